@@ -275,8 +275,7 @@ cdj_new_discovery_packet(uint8_t* packet, uint16_t len)
 cdj_beat_packet_t*
 cdj_new_beat_packet(uint8_t* packet, uint16_t len)
 {
-    struct timespec timestamp;
-    clock_gettime(CDJ_CLOCK, &timestamp);
+    cdj_nanos_t timestamp = cdj_now();
     if (cdj_validate_header(packet, len) != CDJ_OK) {
         return NULL;
     }
@@ -388,6 +387,73 @@ cdj_calculated_next(uint32_t next_beat, uint32_t pitch)
 
 //SNIP_bpm_madness
 
+// clock domain
+
+static clockid_t cdj_clock = CDJ_CLOCK;
+
+int
+cdj_clock_use(clockid_t clock)
+{
+    if (clock != CLOCK_MONOTONIC && clock != CLOCK_MONOTONIC_RAW) return CDJ_ERROR;
+    cdj_clock = clock;
+    return CDJ_OK;
+}
+
+clockid_t
+cdj_clock_id()
+{
+    return cdj_clock;
+}
+
+cdj_nanos_t
+cdj_timespec_to_nanos(const struct timespec* ts)
+{
+    return (cdj_nanos_t) ts->tv_sec * CDJ_NANOS_PER_SEC + ts->tv_nsec;
+}
+
+struct timespec
+cdj_nanos_to_timespec(cdj_nanos_t nanos)
+{
+    struct timespec ts;
+    ts.tv_sec = nanos / CDJ_NANOS_PER_SEC;
+    ts.tv_nsec = nanos % CDJ_NANOS_PER_SEC;
+    if (ts.tv_nsec < 0) {
+        ts.tv_sec--;
+        ts.tv_nsec += CDJ_NANOS_PER_SEC;
+    }
+    return ts;
+}
+
+cdj_nanos_t
+cdj_now()
+{
+    struct timespec ts;
+    clock_gettime(cdj_clock, &ts);
+    return cdj_timespec_to_nanos(&ts);
+}
+
+// offset between wall time and our clock right now, changes when NTP steps the wall clock
+static cdj_nanos_t
+cdj_realtime_offset()
+{
+    struct timespec rt;
+    cdj_nanos_t now = cdj_now();
+    clock_gettime(CLOCK_REALTIME, &rt);
+    return cdj_timespec_to_nanos(&rt) - now;
+}
+
+cdj_nanos_t
+cdj_realtime_to_nanos(const struct timespec* realtime)
+{
+    return cdj_timespec_to_nanos(realtime) - cdj_realtime_offset();
+}
+
+struct timespec
+cdj_nanos_to_realtime(cdj_nanos_t nanos)
+{
+    return cdj_nanos_to_timespec(nanos + cdj_realtime_offset());
+}
+
 static uint32_t
 cdj_read_uint32(uint8_t* data, uint16_t pos)
 {
@@ -836,6 +902,14 @@ cdj_beat_master_ok(cdj_beat_packet_t* b_pkt)
     if (b_pkt->len < 0x2a) return 0;
     return cdj_read_uint32(b_pkt->data, 0x28);
 }
+// used for fader start
+uint8_t
+cdj_fader_start_action(cdj_beat_packet_t* b_pkt, uint8_t player_id)
+{
+    if (player_id < 1 || player_id > CDJ_FADER_CHANNELS) return CDJ_FADER_NO_CHANGE;
+    if (b_pkt->len < 0x24 + CDJ_FADER_CHANNELS) return CDJ_FADER_NO_CHANGE;
+    return b_pkt->data[0x23 + player_id];
+}
 // Message creation functions, based on CDJ_Protocol_Analysis.pdf
 // hence magic numbers we dont know what mean.
 
@@ -1078,6 +1152,25 @@ cdj_create_beat_packet(uint16_t* length, unsigned char model, uint8_t player_id,
     return packet;
 }
 
+/**
+ * Overwrite the next beat and next bar offsets of a beat packet, for when tempo is not constant, e.g. during a ramp.
+ *
+ * @param next_beats - millis from this beat to each of the next 8 beats
+ * @param bar_index - 0 - 3, where in the bar this beat is
+ */
+void
+cdj_set_beat_timings(uint8_t* packet, uint16_t length, uint32_t* next_beats, uint8_t bar_index)
+{
+    if (length < 0x3c) return;
+
+    cdj_set_uint32(packet + 0x24, next_beats[0]);
+    cdj_set_uint32(packet + 0x28, next_beats[1]);
+    cdj_set_uint32(packet + 0x2c, next_beats[3 - bar_index]);
+    cdj_set_uint32(packet + 0x30, next_beats[3]);
+    cdj_set_uint32(packet + 0x34, next_beats[7 - bar_index]);
+    cdj_set_uint32(packet + 0x38, next_beats[7]);
+}
+
 
 uint8_t*
 cdj_create_status_packet(uint16_t* length, unsigned char model, uint8_t player_id,
@@ -1202,8 +1295,30 @@ cdj_create_master_response_packet(uint16_t* length, unsigned char model, uint8_t
     return packet;
 }
 
+/**
+ * Start or stop players 1 - 4, sent to port 50001, by a mixer when a channel fader opens
+ */
+uint8_t*
+cdj_create_fader_start_packet(uint16_t* length, unsigned char model, uint8_t player_id, uint8_t* actions)
+{
+    *length = 0x28;
+    uint8_t* packet = (uint8_t*) calloc(1, *length);
+    if (packet) {
+        cdj_set_header(packet, CDJ_FADER_START_COMMAND);
+        cdj_set_model_name(packet + cdj_header_len(CDJ_BEAT_PORT, 0), model);
+        cdj_set_uint16(packet + 0x1f, CDJ_BEAT_VERSION);
+        packet[0x21] = player_id;
+        cdj_set_uint16(packet + 0x22, CDJ_FADER_CHANNELS); // bytes that follow
+        memcpy(packet + 0x24, actions, CDJ_FADER_CHANNELS);
+    }
+    return packet;
+}
+
+/**
+ * Turn sync on or off on another player, or tell it to become master
+ */
 uint8_t*
-cdj_create_sync_control_packet(uint16_t* length, unsigned char model, uint8_t player_id, int on_off)
+cdj_create_sync_control_packet(uint16_t* length, unsigned char model, uint8_t player_id, uint8_t command)
 {
     *length = 0x2c;
     uint8_t* packet = (uint8_t*) calloc(1, *length);
@@ -1214,7 +1329,32 @@ cdj_create_sync_control_packet(uint16_t* length, unsigned char model, uint8_t pl
         packet[0x21] = player_id;
         cdj_set_uint16(packet + 0x22, *length);
         cdj_set_uint32(packet + 0x24, player_id);
-        packet[0x2b] = on_off ? 0x10 : 0x20;
+        packet[0x2b] = command;
+    }
+    return packet;
+}
+
+/**
+ * Ask another player to load a track, it replies with a CDJ_LOAD_TRACK_ACK to our port 50002
+ */
+uint8_t*
+cdj_create_load_track_packet(uint16_t* length, unsigned char model, uint8_t player_id,
+    uint8_t source_player, uint8_t slot, uint8_t track_type, uint32_t track_id)
+{
+    *length = 0x58;
+    uint8_t* packet = (uint8_t*) calloc(1, *length);
+    if (packet) {
+        cdj_set_header(packet, CDJ_LOAD_TRACK_COMMAND);
+        cdj_set_model_name(packet + cdj_header_len(CDJ_UPDATE_PORT, 0), model);
+        cdj_set_uint16(packet + 0x1f, CDJ_BEAT_VERSION);
+        packet[0x21] = player_id;
+        cdj_set_uint16(packet + 0x22, *length - 0x24); // bytes that follow
+        packet[0x24] = player_id;
+        packet[0x28] = source_player;
+        packet[0x29] = slot;
+        packet[0x2a] = track_type;
+        cdj_set_uint32(packet + 0x2c, track_id);
+        packet[0x39] = 0x32;  // magic
     }
     return packet;
 }
@@ -1230,23 +1370,39 @@ cdj_print_packet(uint8_t* packet, uint16_t length, uint16_t port)
 void
 cdj_fprint_packet(FILE* f, uint8_t* packet, uint16_t length, uint16_t port)
 {
+    static const char hex[] = "0123456789abcdef";
+    char line[16 * 3 + 2];  // one line of 16 bytes, streamed so nothing is allocated per packet
+    char* s;
     int i;
-    char* str = (char*) calloc(1, (length * 4) + 5 + length / 32);
-    if (str == NULL) return;
 
-    uint8_t type = packet[CDJ_PACKET_TYPE_OFFSET];
+    uint8_t type = length > CDJ_PACKET_TYPE_OFFSET ? packet[CDJ_PACKET_TYPE_OFFSET] : 0;
+    uint8_t sub_type = length > CDJ_PACKET_TYPE_OFFSET + 1 ? packet[CDJ_PACKET_TYPE_OFFSET + 1] : 0;
     uint16_t hdr_len = cdj_header_len(port, type);
+    int model_len = 0;
+
+    // model is not always null terminated inside the packet
+    while (hdr_len + model_len < length && model_len < CDJ_DEVICE_MODEL_LENGTH && packet[hdr_len + model_len]) model_len++;
 
-    char* s = str;
+    flockfile(f);
+    fprintf(f, "packet::%03x %i\n'%.*s' type=%02x:%s\n", length, length, model_len, packet + hdr_len, type, cdj_type_to_string(port, type, sub_type));
 
+    s = line;
     for (i = 0; i < length; i++) {
-        if (i > 0 && (i % 16 == 0)) *s++ = '\n';
+        if (i > 0 && (i % 16 == 0)) {
+            *s++ = '\n';
+            fwrite(line, 1, s - line, f);
+            s = line;
+        }
         if (i < 10 || (i >= hdr_len && i < hdr_len + CDJ_DEVICE_MODEL_LENGTH) ) {
-            s += snprintf(s, 4, "%c_ ", packet[i] ? packet[i] : '_');
+            *s++ = packet[i] ? packet[i] : '_';
+            *s++ = '_';
+        } else {
+            *s++ = hex[packet[i] >> 4];
+            *s++ = hex[packet[i] & 0x0f];
         }
-        else s += snprintf(s, 4, "%02x ", packet[i]);
+        *s++ = ' ';
     }
-
-    fprintf(f, "packet::%03x %i\n'%s' type=%02x:%s\n%s\n", length, length, packet + hdr_len, packet[10], cdj_type_to_string(port, packet[10], packet[11]), str);
-    free(str);
+    *s++ = '\n';
+    fwrite(line, 1, s - line, f);
+    funlockfile(f);
 }
\ No newline at end of file
@@ -72,6 +72,20 @@
 #define CDJ_MIXER_STATUS         0x29
 #define CDJ_SYNC_CONTROL         0x2a
 
+// per channel actions in a CDJ_FADER_START_COMMAND, one byte each for players 1 - 4
+#define CDJ_FADER_CHANNELS       4
+#define CDJ_FADER_START          0x00
+#define CDJ_FADER_STOP           0x01
+#define CDJ_FADER_NO_CHANGE      0x02
+
+// command byte of a CDJ_SYNC_CONTROL
+#define CDJ_SYNC_CONTROL_MASTER  0x01 // become tempo master
+#define CDJ_SYNC_CONTROL_ON      0x10
+#define CDJ_SYNC_CONTROL_OFF     0x20
+
+// track types in CDJ_LOAD_TRACK_COMMAND, same as cdj_status_track_type()
+#define CDJ_TRACK_TYPE_REKORDBOX 0x01
+
 // supported models
 #define CDJ_CDJ                 'C'
 #define CDJ_XDJ                 'X'
@@ -112,7 +126,12 @@
 
 #define CDJ_MAX_DJM_CHANNELS           4      // max players supported by on air  packets
 
-#define CDJ_CLOCK CLOCK_REALTIME  // @see https://linux.die.net/man/2/clock_gettime
+// Time, all library timestamps are cdj_nanos_t on a monotonic clock so an NTP step during a gig changes nothing
+#define CDJ_CLOCK CLOCK_MONOTONIC  // default, see cdj_clock_use() @see https://linux.die.net/man/2/clock_gettime
+#define CDJ_NANOS_PER_SEC    1000000000LL
+#define CDJ_NANOS_PER_MILLI  1000000LL
+
+typedef int64_t cdj_nanos_t;
 
 // Data Structures
 
@@ -144,7 +163,7 @@ typedef struct {
     uint16_t        len;
     uint8_t         type;
     uint8_t         player_id;
-    struct timespec timestamp;
+    cdj_nanos_t     timestamp;
     uint8_t         bar_pos;
     float           bpm;
 } cdj_beat_packet_t;
@@ -208,6 +227,19 @@ double cdj_pitch_to_percentage(uint32_t pitch);
 double cdj_pitch_to_multiplier(uint32_t pitch);
 float cdj_calculated_bpm(uint16_t track_bpm, uint32_t pitch);
 uint32_t cdj_beat_millis(float bpm);
+
+// Clock functions
+
+// CLOCK_MONOTONIC (default) or CLOCK_MONOTONIC_RAW which is not slewed by NTP either, set before starting any threads
+int cdj_clock_use(clockid_t clock);
+clockid_t cdj_clock_id();
+cdj_nanos_t cdj_now();
+cdj_nanos_t cdj_timespec_to_nanos(const struct timespec* ts);
+struct timespec cdj_nanos_to_timespec(cdj_nanos_t nanos);
+// kernel packet timestamps (SO_TIMESTAMPNS, PACKET_MMAP, SO_TIMESTAMPING) are CLOCK_REALTIME
+cdj_nanos_t cdj_realtime_to_nanos(const struct timespec* realtime);
+// wall clock time, for display only
+struct timespec cdj_nanos_to_realtime(cdj_nanos_t nanos);
 uint16_t cdj_bpm_to_int(float bpm);
 
 int cdj_ip_format(const char* ip_address, unsigned char* ip);
@@ -306,6 +338,10 @@ uint8_t cdj_beat_master(cdj_beat_packet_t* b_pkt);
  * Seems to return a 1 or 0 in a CDJ_MASTER_RESP
  */
 uint32_t cdj_beat_master_ok(cdj_beat_packet_t* b_pkt);
+/**
+ * CDJ_FADER_START, CDJ_FADER_STOP or CDJ_FADER_NO_CHANGE for player_id in a CDJ_FADER_START_COMMAND
+ */
+uint8_t cdj_fader_start_action(cdj_beat_packet_t* b_pkt, uint8_t player_id);
 
 // handshake
 uint8_t* cdj_create_initial_discovery_packet(uint16_t* length, unsigned char model);
@@ -323,6 +359,7 @@ void     cdj_mod_id_use_req_packet_player_id(uint8_t* packet, uint8_t player_id)
 uint8_t  cdj_inc_id_set_req_packet(uint8_t* packet);
 
 uint8_t* cdj_create_beat_packet(uint16_t* length, unsigned char model, uint8_t player_id, float bpm, uint8_t bar_index);
+void     cdj_set_beat_timings(uint8_t* packet, uint16_t length, uint32_t* next_beats, uint8_t bar_index);
 
 uint8_t* cdj_create_status_packet(uint16_t* length, unsigned char model, uint8_t player_id,
     float bpm, uint8_t bar_index, uint8_t active, uint8_t master, int8_t new_master, uint32_t sync_counter,
@@ -330,6 +367,13 @@ uint8_t* cdj_create_status_packet(uint16_t* length, unsigned char model, uint8_t
 
 uint8_t* cdj_create_master_request_packet(uint16_t* length, unsigned char model, uint8_t player_id);
 uint8_t* cdj_create_master_response_packet(uint16_t* length, unsigned char model, uint8_t player_id);
+// actions has CDJ_FADER_CHANNELS entries, for players 1 - 4
+uint8_t* cdj_create_fader_start_packet(uint16_t* length, unsigned char model, uint8_t player_id, uint8_t* actions);
+// command is CDJ_SYNC_CONTROL_*, sent to the target player's port 50001
+uint8_t* cdj_create_sync_control_packet(uint16_t* length, unsigned char model, uint8_t player_id, uint8_t command);
+// load track_id from source_player's slot, sent to the target player's port 50002
+uint8_t* cdj_create_load_track_packet(uint16_t* length, unsigned char model, uint8_t player_id,
+    uint8_t source_player, uint8_t slot, uint8_t track_type, uint32_t track_id);
 
 
 
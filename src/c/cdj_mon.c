@@ -4,9 +4,14 @@
 #include <errno.h>
 #include <unistd.h>
 #include <sys/socket.h>
+#include <net/if.h>
+#include <netinet/in.h>
 
 #include "cdj.h"
 #include "vdj.h"
+#include "vdj_net.h"
+#include "vdj_sniff.h"
+#include "vdj_stream.h"
 
 // N.B. including .c
 #include "cdj_mon_tui.c"
@@ -18,22 +23,37 @@
  *
  * This is an example of using only libvdj's socket and directly handling Pro Link messages.
  * i.e. this is the lower level api.  We have recv() methods in this application.
+ *
+ * With -m the sockets are not opened at all, packets are read from a raw capture ring (vdj_sniff.h) which sees
+ * unicast status too if the NIC is on a mirrored switch port.
+ *
+ * With -j or -r there is no ui, every decoded event is streamed to stdout or a unix socket (vdj_stream.h).
  */
 
 static void handle_discovery_datagram(uint8_t* packet, uint16_t len);
-static void handle_beat_datagram(uint8_t* packet, uint16_t len);
+static void handle_beat_datagram(uint8_t* packet, uint16_t len, cdj_nanos_t timestamp);
+static void handle_update_datagram(uint8_t* packet, uint16_t len);
 static void* cdj_monitor_discoverys(void* arg);
 static void* cdj_monitor_beats(void* arg);
+static int cdj_monitor_sniff(char* iface);
+static void cdj_monitor_sniff_ph(vdj_sniff_t* s, vdj_sniff_packet_t* pkt);
+
+// headless when set
+static vdj_stream_t* stream = NULL;
 
 static void signal_exit(int sig)
 {
-    tui_exit();
+    if ( ! stream ) tui_exit();
     exit(0);
 }
 static void usage()
 {
     printf("options:\n");
     printf("    -i - network interface to use, required if pc has more than one\n");
+    printf("    -m - sniff all ProLink traffic from a raw capture, e.g. on a mirrored switch port (needs CAP_NET_RAW)\n");
+    printf("    -j - no ui, stream events as newline delimited json\n");
+    printf("    -r - no ui, stream events as binary records (vdj_stream.h)\n");
+    printf("    -u - stream to this unix socket instead of stdout\n");
     printf("    -h - display this text\n");
     exit(0);
 }
@@ -56,6 +76,12 @@ update_ui(uint8_t player_id, uint8_t beat, float bpm)
     tui_cdj_update(id_map[player_id], data);
 }
 
+static void
+update_status_ui(uint8_t player_id, char* flags)
+{
+    tui_text_at(flags, 62, id_map[player_id]);
+}
+
 /**
  * CDJ monitor tools
  */
@@ -64,10 +90,14 @@ int main (int argc, char* argv[])
     char title[128];
     char* iface = NULL;
     unsigned int flags = 0;
+    int sniff = 0;
+    int headless = 0;
+    vdj_stream_format format = VDJ_STREAM_NDJSON;
+    char* socket_path = NULL;
     memset(id_map, 0, 127);
 
     int c;
-    while ( ( c = getopt(argc, argv, "i:h") ) != EOF) {
+    while ( ( c = getopt(argc, argv, "i:mjru:h") ) != EOF) {
         switch (c) {
             case 'h':
                 usage();
@@ -75,9 +105,35 @@ int main (int argc, char* argv[])
             case 'i':
                 iface = optarg;
                 break;
+            case 'm':
+                sniff = 1;
+                break;
+            case 'j':
+                headless = 1;
+                format = VDJ_STREAM_NDJSON;
+                break;
+            case 'r':
+                headless = 1;
+                format = VDJ_STREAM_BINARY;
+                break;
+            case 'u':
+                socket_path = optarg;
+                break;
+        }
+    }
+
+    if (headless) {
+        stream = socket_path ? vdj_stream_connect(socket_path, format) : vdj_stream_new(STDOUT_FILENO, format);
+        if (stream == NULL) {
+            fprintf(stderr, "error: opening event stream\n");
+            return 1;
         }
     }
 
+    if (sniff) {
+        return cdj_monitor_sniff(iface);
+    }
+
     /*
      * init a vcdj
      */
@@ -97,9 +153,11 @@ int main (int argc, char* argv[])
     }
 
     signal(SIGINT, signal_exit);
-    tui_init(8);
-    snprintf(title, 127, "CDJ monitor: %i", v->player_id);
-    tui_set_window_title(title);
+    if ( ! stream ) {
+        snprintf(title, 127, "CDJ monitor: %i", v->player_id);
+        tui_set_window_title(title);
+        tui_init(8);
+    }
 
     // N.B. no handshake, CDJs and rekordbox do not know we are snooping the broadcast packets
 
@@ -112,6 +170,62 @@ int main (int argc, char* argv[])
     return 0;
 }
 
+/**
+ * Read all ProLink traffic from the capture ring on this thread, no sockets are opened.
+ */
+static int
+cdj_monitor_sniff(char* iface)
+{
+    char title[128];
+    char found_iface[IFNAMSIZ + 1];
+    struct sockaddr_in addr;
+    struct sockaddr_in netmask;
+    vdj_sniff_t* s;
+
+    if (iface == NULL) {
+        memset(found_iface, 0, sizeof(found_iface));
+        if (vdj_has_single_ip() != CDJ_OK || vdj_get_single_ip(found_iface, &addr, &netmask) != CDJ_OK) {
+            fprintf(stderr, "error: could not determine interface (provide nic)\n");
+            vdj_print_iface();
+            return 1;
+        }
+        iface = found_iface;
+    }
+
+    if ( ! (s = vdj_sniff_open(iface)) ) {
+        fprintf(stderr, "error: failed to open capture on %s\n", iface);
+        return 1;
+    }
+
+    signal(SIGINT, signal_exit);
+    if ( ! stream ) {
+        snprintf(title, 127, "CDJ monitor: %s", iface);
+        tui_set_window_title(title);
+        tui_init(8);
+    }
+
+    vdj_sniff_loop(s, cdj_monitor_sniff_ph);
+
+    vdj_sniff_close(s);
+    return 0;
+}
+
+static void
+cdj_monitor_sniff_ph(vdj_sniff_t* s, vdj_sniff_packet_t* pkt)
+{
+    switch (pkt->dst_port) {
+        case CDJ_DISCOVERY_PORT:
+            handle_discovery_datagram(pkt->data, pkt->len);
+            break;
+        case CDJ_BEAT_PORT:
+            handle_beat_datagram(pkt->data, pkt->len, pkt->timestamp);
+            break;
+        case CDJ_UPDATE_PORT:
+            handle_update_datagram(pkt->data, pkt->len);
+            break;
+    }
+}
+
 static void*
 cdj_monitor_discoverys(void* arg)
 {
@@ -119,19 +233,24 @@ cdj_monitor_discoverys(void* arg)
     int socket;
     ssize_t len;
     uint8_t packet[1500];
+    char error[TUI_FIELD_LEN];
 
     socket = v->discovery_socket_fd;
 
     while (1) {
         len = recv(socket, packet, 1500, 0);
         if (len == -1) {
-            tui_set_cursor_pos(0, 0);
-            printf("socket read error: %s", strerror(errno));
+            if (stream) {
+                fprintf(stderr, "socket read error: %s\n", strerror(errno));
+                sleep(1);
+                continue;
+            }
+            snprintf(error, sizeof(error), "socket read error: %s", strerror(errno));
+            tui_text_at(error, 0, 0);
             sleep(1);
         } else {
             //tui_set_cursor_pos(0, 0);
             //printf("  pkt: %li type=%02i %02i, pid=%i", len, packet[CDJ_PACKET_TYPE_OFFSET], packet[CDJ_PACKET_TYPE_OFFSET + 1], packet[0x24]);
-            fflush(stdout);
             handle_discovery_datagram(packet, (uint16_t) len);
         }
     }
@@ -144,6 +263,11 @@ handle_discovery_datagram(uint8_t* packet, uint16_t len)
 {
     cdj_discovery_packet_t* d_pkt;
 
+    if (stream) {
+        vdj_stream_discovery(stream, packet, len, 0);
+        return;
+    }
+
     if ( cdj_packet_type(packet, len) == CDJ_KEEP_ALIVE ) {
 
         if ( (d_pkt = cdj_new_discovery_packet(packet, len)) ) {
@@ -178,7 +302,7 @@ cdj_monitor_beats(void* arg)
             fprintf(stderr, "socket read error: %s", strerror(errno));
             return NULL;
         } else {
-            handle_beat_datagram(packet, len);
+            handle_beat_datagram(packet, len, 0);
         }
     }
 
@@ -186,12 +310,20 @@ cdj_monitor_beats(void* arg)
 }
 
 static void
-handle_beat_datagram(uint8_t* packet, uint16_t len)
+handle_beat_datagram(uint8_t* packet, uint16_t len, cdj_nanos_t timestamp)
 {
     cdj_beat_packet_t* b_pkt;
+
+    if (stream) {
+        vdj_stream_beat(stream, packet, len, timestamp);
+        return;
+    }
+
     if ( cdj_packet_type(packet, len) == CDJ_BEAT ) {
 
         if ( (b_pkt = cdj_new_beat_packet(packet, len)) ) {
+            // kernel arrival time is better than our time of decoding
+            if (timestamp) b_pkt->timestamp = timestamp;
             //tui_set_cursor_pos(0, 0);
             //printf("  beat: %i pid=%i pid=%i", id_map[b_pkt->player_id], b_pkt->player_id, packet[0x21]);
             if (id_map[b_pkt->player_id]) {
@@ -202,3 +334,27 @@ handle_beat_datagram(uint8_t* packet, uint16_t len)
     }
 }
 
+// only seen when sniffing, status is unicast
+static void
+handle_update_datagram(uint8_t* packet, uint16_t len)
+{
+    cdj_cdj_status_packet_t* cs_pkt;
+    char* flags_s;
+
+    if (stream) {
+        vdj_stream_update(stream, packet, len, 0);
+        return;
+    }
+
+    if ( cdj_packet_type(packet, len) == CDJ_STATUS ) {
+        if ( (cs_pkt = cdj_new_cdj_status_packet(packet, len)) ) {
+            if (id_map[cs_pkt->player_id]) {
+                if ( (flags_s = cdj_flags_to_chars(cs_pkt->flags)) ) {
+                    update_status_ui(cs_pkt->player_id, flags_s);
+                    free(flags_s);
+                }
+            }
+            free(cs_pkt);
+        }
+    }
+}
@@ -1,7 +1,7 @@
 /*
- * 
+ *
  * A small text ui library to write this
- * 
+ *
 
   CDJ monitor
 
@@ -9,7 +9,14 @@
   [XDJ-1000            ] id=03 type=1 playing=true bpm=120.00
   [VDJ-1000            ] id=05 type=1 playing=true bpm=120.00
   [rekordbox           ] id=17 type=1 playing=false
- * 
+ *
+ * The screen is a set of text fields, each at an x,y position.  Network threads write fields into a back buffer and
+ * never touch the terminal, each field has a sequence lock so the render thread never blocks them.  The render
+ * thread wakes TUI_FPS times a second, compares each field with what it last drew and writes only what changed,
+ * the whole frame goes to the terminal in one write().
+ *
+ * Fields rather than single character cells are the unit of the diff because emoji are more than one byte and
+ * often two columns wide, only the ascii prefix of a field is skipped when it is unchanged.
  */
 
 
@@ -17,6 +24,10 @@
 #include <string.h>
 
 #include <stdio.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
 #include <termios.h>
 #include <sys/ioctl.h>
 
@@ -24,6 +35,12 @@
 #define TUI_NORMAL     "\033[0m"
 #define TUI_BOLD       "\033[1m"
 
+#define TUI_FPS        20
+#define TUI_MAX_ROWS   32       // rows counted up from the bottom of the screen
+#define TUI_ROW_FIELDS 8        // a cdj row uses 5: [ model addr bpm flags
+#define TUI_FIELD_LEN  64       // bytes including the \0, longer text is cropped
+#define TUI_OUT_LEN    (TUI_MAX_ROWS * TUI_ROW_FIELDS * TUI_FIELD_LEN * 3)
+
 /**
  * termios uses columns (x) and rows (height - y)
  */
@@ -32,15 +49,33 @@ typedef struct  {
     int col;
 } dim;
 
+/**
+ * A field in the back buffer, written by any thread.
+ */
+typedef struct {
+    atomic_uint seq;                    // odd while a writer is copying in text
+    atomic_int  x;                      // -1 until the field is used
+    int         bold;
+    char        text[TUI_FIELD_LEN];
+} tui_field;
+
+/**
+ * What the render thread last drew for a field.
+ */
+typedef struct {
+    unsigned int seq;
+    int          bold;
+    char         text[TUI_FIELD_LEN];
+} tui_shown;
+
 static void tui_term_store();
 static void tui_term_reset();
 static void tui_write_bytes(const char* bytes, int len);
 static dim tui_translate(int x, int y);
-static char* crop(char* string, int max_len);
-static char* fixed_length(char* string, int len);
 static void tui_init(int y);
 static void tui_exit();
 static void tui_text_at(char* string, int x, int y);
+static void tui_bold_at(char* string, int x, int y);
 static void tui_cdj_init(int slot, uint8_t player_id, char* model_name, uint32_t ip);
 static void tui_cdj_update(int pos, char* data);
 static int tui_get_width();
@@ -54,33 +89,24 @@ static void tui_cursor_on();
 
 static void tui_cdj_init(int slot, uint8_t player_id, char* model_name, uint32_t ip)
 {
-    if (slot > tui_get_height()) return;
-    char* model;
+    char model[21];
+    char addr[48];
 
-    tui_set_cursor_pos(2, slot);
-    tui_delete_line();
-    putc('[', stdout);
-    fputs(TUI_BOLD, stdout);
-    if ( (model = fixed_length(model_name, 20)) ) {
-        fputs(model, stdout);
-        free(model);
-    }
-    fputs(TUI_NORMAL, stdout);
-    putc(']', stdout);
-    printf(" [%i.%i.%i.%i] [%02i]", 
+    snprintf(model, sizeof(model), "%-20.20s", model_name);
+    snprintf(addr, sizeof(addr), "] [%i.%i.%i.%i] [%02i]",
         ip >> 24 & 0xff,
         ip >> 16 & 0xff,
         ip >> 8 & 0xff,
         ip & 0xff, player_id);
-    fflush(stdout);
+
+    tui_text_at("[", 2, slot);
+    tui_bold_at(model, 3, slot);
+    tui_text_at(addr, 23, slot);
 }
 
 static void tui_cdj_update(int slot, char* data)
 {
-    if (slot > tui_get_height()) return;
-
     tui_text_at(data, 46, slot);
-    fflush(stdout);
 }
 
 
@@ -119,40 +145,250 @@ static dim tui_translate(int x, int y)
     return rv;
 }
 
-//mallocs
-static char* crop(char* string, int max_len)
+
+/*
+ * back buffer
+ */
+
+static tui_field tui_back[TUI_MAX_ROWS][TUI_ROW_FIELDS];
+static atomic_flag tui_full_warned = ATOMIC_FLAG_INIT;
+
+/**
+ * The field at x on row y, claims a free one the first time x is used.
+ */
+static tui_field* tui_field_get(int x, int y)
 {
-    char* new_string = malloc(max_len + 1);
-    strncpy(new_string, string, max_len);
-    new_string[max_len - 1] = '\0';
-    return new_string;
+    tui_field* f;
+    int i, seen;
+
+    for (i = 0; i < TUI_ROW_FIELDS; i++) {
+        f = &tui_back[y][i];
+        seen = -1;
+        if ( atomic_compare_exchange_strong(&f->x, &seen, x) || seen == x ) return f;
+    }
+    return NULL;
+}
+
+static void tui_field_set(char* string, int x, int y, int bold)
+{
+    tui_field* f;
+    unsigned int seq;
+
+    if (y < 0 || y >= TUI_MAX_ROWS || x < 0) return;
+    if ( (f = tui_field_get(x, y)) == NULL ) {
+        if ( ! atomic_flag_test_and_set(&tui_full_warned) ) {
+            fprintf(stderr, "error: tui row %i has no free field for x=%i, raise TUI_ROW_FIELDS\n", y, x);
+        }
+        return;
+    }
+
+    // writers to the same field take turns, the render thread never waits for them
+    do {
+        seq = atomic_load_explicit(&f->seq, memory_order_relaxed) & ~1u;
+    } while ( ! atomic_compare_exchange_weak_explicit(&f->seq, &seq, seq + 1,
+                                                      memory_order_relaxed, memory_order_relaxed) );
+    atomic_thread_fence(memory_order_release);
+
+    f->bold = bold;
+    strncpy(f->text, string, TUI_FIELD_LEN - 1);
+    f->text[TUI_FIELD_LEN - 1] = '\0';
+
+    atomic_store_explicit(&f->seq, seq + 2, memory_order_release);
+}
+
+static void tui_text_at(char* string, int x, int y)
+{
+    tui_field_set(string, x, y, 0);
+}
+
+static void tui_bold_at(char* string, int x, int y)
+{
+    tui_field_set(string, x, y, 1);
+}
+
+
+/*
+ * render thread
+ */
+
+static tui_shown tui_front[TUI_MAX_ROWS][TUI_ROW_FIELDS];
+static char tui_out[TUI_OUT_LEN];
+static int tui_out_len = 0;
+static int tui_width = 0;
+static int tui_height = 0;
+static pthread_t tui_render_thread;
+static unsigned _Atomic tui_running = ATOMIC_VAR_INIT(0);
+
+static void tui_out_append(const char* bytes, int len)
+{
+    if (tui_out_len + len > TUI_OUT_LEN) return;
+    memcpy(tui_out + tui_out_len, bytes, len);
+    tui_out_len += len;
+}
+
+static void tui_out_flush()
+{
+    ssize_t sent;
+    int off = 0;
+
+    while (off < tui_out_len) {
+        if ( (sent = write(1, tui_out + off, tui_out_len - off)) <= 0 ) break;
+        off += sent;
+    }
+    tui_out_len = 0;
 }
 
 /**
- * forces a string to a given length, cropping or padding with whitespace
+ * Code points, near enough to columns to know how many spaces rub out a field.
  */
-static char* fixed_length(char* string, int len)
+static int tui_columns(const char* text)
+{
+    int cols = 0;
+    for ( ; *text; text++) {
+        if ((*text & 0xc0) != 0x80) cols++;
+    }
+    return cols;
+}
+
+static int tui_ascii(const char* text)
+{
+    for ( ; *text; text++) {
+        if (*text & 0x80) return 0;
+    }
+    return 1;
+}
+
+// crop text to max_cols code points
+static void tui_crop(char* text, int max_cols)
+{
+    int cols = 0;
+    char* p;
+    for (p = text; *p; p++) {
+        if ((*p & 0xc0) != 0x80 && cols++ == max_cols) {
+            *p = '\0';
+            return;
+        }
+    }
+}
+
+static void tui_render_field(tui_field* f, tui_shown* s, int y)
+{
+    char text[TUI_FIELD_LEN];
+    char pos[32];
+    unsigned int seq;
+    int x, bold, from, to, pad, len;
+
+    seq = atomic_load_explicit(&f->seq, memory_order_acquire);
+    // unchanged, or a writer is in there now and the next frame will get it
+    if (seq == s->seq || (seq & 1)) return;
+
+    x = atomic_load_explicit(&f->x, memory_order_relaxed);
+    bold = f->bold;
+    memcpy(text, f->text, TUI_FIELD_LEN);
+    atomic_thread_fence(memory_order_acquire);
+    if (atomic_load_explicit(&f->seq, memory_order_relaxed) != seq) return;
+    s->seq = seq;
+
+    if (y >= tui_height || x >= tui_width) return;
+    text[TUI_FIELD_LEN - 1] = '\0';
+    tui_crop(text, tui_width - x - 1);
+
+    if (bold == s->bold && strcmp(text, s->text) == 0) return;
+
+    // skip the unchanged ascii prefix, after a multibyte char the column is not known
+    from = 0;
+    to = strlen(text);
+    if (bold == s->bold) {
+        while (text[from] && text[from] == s->text[from] && ! (text[from] & 0x80)) from++;
+        // and the unchanged suffix when the lengths match, e.g. the bpm after a new bar position,
+        // only in ascii where the same byte is the same column and no char is cut in half
+        if ( to == strlen(s->text) && tui_ascii(text) && tui_ascii(s->text) ) {
+            while (to > from && text[to - 1] == s->text[to - 1]) to--;
+        }
+    }
+
+    len = snprintf(pos, sizeof(pos), "\033[%i;%if", tui_height - y, x + from + 1);
+    tui_out_append(pos, len);
+    if (bold) tui_out_append(TUI_BOLD, strlen(TUI_BOLD));
+    tui_out_append(text + from, to - from);
+    if (bold) tui_out_append(TUI_NORMAL, strlen(TUI_NORMAL));
+    for (pad = tui_columns(s->text) - tui_columns(text); pad > 0; pad--) tui_out_append(" ", 1);
+
+    s->bold = bold;
+    memcpy(s->text, text, TUI_FIELD_LEN);
+}
+
+static void tui_render()
 {
-    int min = strlen(string) < len ? strlen(string) : len;
-    int i;
-    char* new_string = malloc(len + 1);
-    for (i = min; i < len; i++) new_string[i] = ' ';
-    strncpy(new_string, string, min);
-    new_string[len - 1] = '\0';
-    return new_string;
+    int width = tui_get_width();
+    int height = tui_get_height();
+    int x, y;
+
+    if (width != tui_width || height != tui_height) {
+        // rows hang from the bottom of the screen so a resize moves everything, start again
+        if (tui_height) tui_out_append("\033[2J", 4);
+        memset(tui_front, 0, sizeof(tui_front));
+        tui_width = width;
+        tui_height = height;
+    }
+
+    for (y = 0; y < TUI_MAX_ROWS; y++) {
+        for (x = 0; x < TUI_ROW_FIELDS; x++) {
+            tui_render_field(&tui_back[y][x], &tui_front[y][x], y);
+        }
+    }
+
+    if (tui_out_len) tui_out_flush();
+}
+
+static void* tui_render_loop(void* arg)
+{
+    struct timespec next;
+
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    while (tui_running) {
+        tui_render();
+        next.tv_nsec += 1000000000 / TUI_FPS;
+        if (next.tv_nsec >= 1000000000) {
+            next.tv_nsec -= 1000000000;
+            next.tv_sec++;
+        }
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+    }
+    // last changes before exit
+    tui_render();
+
+    return NULL;
 }
 
 
 static void tui_init(int y)
 {
-    int i;
+    int i, j;
+
+    for (i = 0; i < TUI_MAX_ROWS; i++) {
+        for (j = 0; j < TUI_ROW_FIELDS; j++) atomic_init(&tui_back[i][j].x, -1);
+    }
+
     tui_cursor_off();
     tui_term_store();
     for (i = 0 ; i < y - 1 ; i++) puts("");
+    // the render thread writes to fd 1 directly
+    fflush(stdout);
+
+    tui_running = 1;
+    if ( pthread_create(&tui_render_thread, NULL, tui_render_loop, NULL) ) {
+        fprintf(stderr, "error: starting render thread\n");
+        tui_running = 0;
+    }
 }
 
 static void tui_exit()
 {
+    if (tui_running) {
+        tui_running = 0;
+        pthread_join(tui_render_thread, NULL);
+    }
     tui_set_cursor_pos(0, 0);
     printf("\n");
     tui_delete_line();
@@ -160,27 +396,17 @@ static void tui_exit()
     tui_cursor_on();
 }
 
-static void tui_text_at(char* string, int x, int y)
-{
-    if (y > tui_get_height()) return;
-
-    tui_set_cursor_pos(x, y);
-    char* new_string = crop(string, tui_get_width() - x);
-    fputs(new_string, stdout);
-    free(new_string);
-}
-
 static int tui_get_width()
 {
     struct winsize w;
-    ioctl(0, TIOCGWINSZ, &w);
+    if ( ioctl(0, TIOCGWINSZ, &w) || w.ws_col == 0 ) return 80;
     return w.ws_col;
 }
 
 static int tui_get_height()
 {
     struct winsize w;
-    ioctl(0, TIOCGWINSZ, &w);
+    if ( ioctl(0, TIOCGWINSZ, &w) || w.ws_row == 0 ) return 24;
     return w.ws_row;
 }
 
@@ -202,7 +428,7 @@ static void tui_set_window_title(const char* title)
 static void tui_set_cursor_pos(int x, int y)
 {
     dim p = tui_translate(x, y);
-    
+
     const char set_cursor_pos[] = { 27, 91 }; // ESC[
     tui_write_bytes(set_cursor_pos, 2);
     printf("%i", p.row);
@@ -1,9 +1,12 @@
 #include <stdio.h>
-#include <pthread.h>
 #include <signal.h>
 #include <errno.h>
 #include <unistd.h>
+#include <getopt.h>
+#include <poll.h>
 #include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -11,29 +14,190 @@
 #include "vdj.h"
 
 /**
- * Monitor app that just scans the network for players and then exits
+ * Monitor app that just scans the network for players and then exits.
+ *
+ * Players broadcast a keepalive every couple of seconds, rather than wait for one cdj-scan asks, it broadcasts the
+ * CDJ_ID_USE_REQ a joining player sends for each player id it might take, and the owner of an id answers at once
+ * with CDJ_ID_USE_RESP.  With --expect or --expect-ids it exits as soon as everything expected has answered, so a
+ * startup script waits as long as the players take to reply, not a fixed time.
  */
 
-static void handle_discovery_datagram(uint8_t* packet, uint16_t len);
-static void* cdj_monitor_discoverys(void* arg);
+#define SCAN_PROBE_ROUNDS   3       // as vdj_exec_discovery(), any of them may be lost
 
-static void signal_exit(int sig)
-{
-    exit(0);
-}
 static void usage()
 {
     printf("options:\n");
-    printf("    -i - network interface to use, required if pc has more than one\n");
-    printf("    -w - how long scan for, default 3 seconds\n");
-    printf("    -h - display this text\n");
-    printf("cdj-scan exits 0 if at least 1 player is found, 1 for system errors, 2 for user errors and 3 if no players are found\n");
+    printf("    -i, --iface      - network interface to use, required if pc has more than one\n");
+    printf("    -w, --wait       - longest to scan for, default 3 seconds\n");
+    printf("    -n, --expect     - exit as soon as this many players are found\n");
+    printf("    -e, --expect-ids - exit as soon as these players are found, e.g. 1,2,3\n");
+    printf("    -l, --latency    - print how long each player took to be found, and how\n");
+    printf("    -P, --passive    - only listen for keepalives, do not probe\n");
+    printf("    -h, --help       - display this text\n");
+    printf("cdj-scan exits 0 if the expected players, or without -n or -e at least 1 player, are found, "
+           "1 for system errors, 2 for user errors and 3 if they are not found\n");
     exit(2);
 }
 
+static struct option long_options[] = {
+    {"iface",       required_argument, NULL, 'i'},
+    {"wait",        required_argument, NULL, 'w'},
+    {"expect",      required_argument, NULL, 'n'},
+    {"expect-ids",  required_argument, NULL, 'e'},
+    {"latency",     no_argument,       NULL, 'l'},
+    {"passive",     no_argument,       NULL, 'P'},
+    {"help",        no_argument,       NULL, 'h'},
+    {NULL, 0, NULL, 0}
+};
+
+static int latency = 0;
+static cdj_nanos_t start;
+
+//SNIP_scan
 // players we have already found
-static uint8_t id_map[127];
-static int found  = 0;
+static uint8_t id_map[256];
+static int found = 0;
+
+static uint8_t expect_ids[256];
+static int expect_id_count = 0;
+static int expect = 0;
+
+static void
+parse_ids(char* arg)
+{
+    char* end;
+    long id;
+
+    while (*arg) {
+        id = strtol(arg, &end, 10);
+        if (end == arg || id < 1 || id > 255 || (*end && *end != ',')) {
+            fprintf(stderr, "error: bad player list '%s'\n", arg);
+            exit(2);
+        }
+        if ( ! expect_ids[id] ) expect_id_count++;
+        expect_ids[id] = 1;
+        arg = *end ? end + 1 : end;
+    }
+}
+
+/**
+ * @return 1 if we were told what to expect and have found it all
+ */
+static int
+scan_complete()
+{
+    int i, missing = 0;
+
+    if ( ! expect && ! expect_id_count ) return 0;
+    if (found < expect) return 0;
+    for (i = 1; i < 256; i++) {
+        if (expect_ids[i] && ! id_map[i]) missing++;
+    }
+    return missing == 0;
+}
+
+/**
+ * @return 1 if id should be probed, -e may name ids beyond the backline, -n and no option probe the backline
+ */
+static int
+scan_probe_id(int id)
+{
+    if (id_map[id]) return 0;
+    if (expect_id_count) return expect_ids[id];
+    return id <= VDJ_MAX_BACKLINE;
+}
+
+/**
+ * @return the exit code documented in usage()
+ */
+static int
+scan_result()
+{
+    if (expect || expect_id_count) return scan_complete() ? 0 : 3;
+    return found ? 0 : 3;
+}
+//SNIP_scan
+
+static void signal_exit(int sig)
+{
+    exit(scan_result());
+}
+
+static void
+found_player(cdj_discovery_packet_t* d_pkt, uint32_t ip, const char* how)
+{
+    if ( d_pkt->player_id == 0 || id_map[d_pkt->player_id] ) return;
+
+    printf("%.*s %i %d.%d.%d.%d",
+        CDJ_DEVICE_MODEL_LENGTH,
+        cdj_discovery_model(d_pkt),
+        d_pkt->player_id,
+        (unsigned char) (ip >> 24),
+        (unsigned char) (ip >> 16),
+        (unsigned char) (ip >> 8),
+        (unsigned char) (ip >> 0)
+        );
+    if (latency) printf(" %.3fms %s", (double) (cdj_now() - start) / CDJ_NANOS_PER_MILLI, how);
+    printf("\n");
+    fflush(stdout);
+
+    id_map[d_pkt->player_id] = 1;
+    found++;
+}
+
+static void
+handle_discovery_datagram(uint8_t* packet, uint16_t len, struct sockaddr_in* from)
+{
+    cdj_discovery_packet_t* d_pkt;
+    uint8_t type = cdj_packet_type(packet, len);
+    uint32_t ip;
+
+    // our own probes come back on the broadcast socket
+    if ( type != CDJ_KEEP_ALIVE && type != CDJ_ID_USE_RESP ) return;
+    if ( cdj_validate_header(packet, len) != CDJ_OK ) return;
+
+    if ( (d_pkt = cdj_new_discovery_packet(packet, len)) ) {
+        // an id_use_resp says whose id it is but the ip is only in the udp header
+        ip = d_pkt->ip ? d_pkt->ip : ntohl(from->sin_addr.s_addr);
+        found_player(d_pkt, ip, type == CDJ_KEEP_ALIVE ? "keepalive" : "probe");
+        free(d_pkt);
+    }
+}
+
+static void
+recv_all(int fd)
+{
+    uint8_t packet[1500];
+    struct sockaddr_in from;
+    socklen_t from_len;
+    ssize_t len;
+
+    for (;;) {
+        from_len = sizeof(from);
+        len = recvfrom(fd, packet, sizeof(packet), MSG_DONTWAIT, (struct sockaddr*) &from, &from_len);
+        if (len == -1) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) fprintf(stderr, "socket read error: %s\n", strerror(errno));
+            return;
+        }
+        handle_discovery_datagram(packet, (uint16_t) len, &from);
+    }
+}
+
+/**
+ * ask the owner of each id we are still looking for to speak up, reqid counts the rounds as a joining player's does
+ */
+static void
+send_probes(vdj_t* v, uint8_t* packet, uint16_t length, int round)
+{
+    int id;
+
+    packet[0x2f] = round + 1;
+    for (id = 1; id < 256; id++) {
+        if ( ! scan_probe_id(id) ) continue;
+        cdj_mod_id_use_req_packet_player_id(packet, id);
+        vdj_sendto_discovery(v, packet, length);
+    }
+}
 
 /**
  * CDJ scan for players
@@ -42,21 +206,44 @@ int main(int argc, char* argv[])
 {
     char* iface = NULL;
     unsigned int flags = 0;
-    memset(id_map, 0, 127);
-    int wait_time = 3;
+    double wait_time = 3.0;
+    int probe = 1;
+    struct pollfd pfd[3];
+    int nfds = 0;
+    int rounds = 0;
+    uint8_t* packet = NULL;
+    uint16_t length = 0;
+    cdj_nanos_t now, deadline, next_probe, timeout;
+    int i;
+
+    memset(id_map, 0, sizeof(id_map));
+    memset(expect_ids, 0, sizeof(expect_ids));
 
     int c;
-    while ( ( c = getopt(argc, argv, "i:w:h") ) != EOF) {
+    while ( ( c = getopt_long(argc, argv, "i:w:n:e:lPh", long_options, NULL) ) != EOF) {
         switch (c) {
-            case 'h':
-                usage();
-                break;
             case 'w':
-                wait_time = atoi(optarg);
+                wait_time = strtod(optarg, NULL);
                 break;
             case 'i':
                 iface = optarg;
                 break;
+            case 'n':
+                expect = atoi(optarg);
+                break;
+            case 'e':
+                parse_ids(optarg);
+                break;
+            case 'l':
+                latency = 1;
+                break;
+            case 'P':
+                probe = 0;
+                break;
+            case 'h':
+            default:
+                usage();
+                break;
         }
     }
 
@@ -70,9 +257,13 @@ int main(int argc, char* argv[])
     }
 
     /*
-     * open the networks sockets
+     * open the networks sockets, the unicast ones are taken if a vdj is running on this host
      */
-    if (vdj_open_broadcast_sockets(v) != CDJ_OK) {
+    if (probe && vdj_open_probe_sockets(v) != CDJ_OK) {
+        fprintf(stderr, "warning: cannot receive replies to probes, listening for keepalives only\n");
+        probe = 0;
+    }
+    if ( ! v->discovery_socket_fd && vdj_open_broadcast_sockets(v) != CDJ_OK) {
         fprintf(stderr, "error: failed to open sockets\n");
         vdj_destroy(v);
         return 1;
@@ -80,64 +271,42 @@ int main(int argc, char* argv[])
 
     signal(SIGINT, signal_exit);
 
-    // N.B. no handshake, CDJs and rekordbox do not know we are snooping the broadcast packets
-
-    pthread_t thread_id;
-    pthread_create(&thread_id, NULL, *cdj_monitor_discoverys, v);
-
-    sleep(wait_time);
-
-    if ( found ) return 0;
-    return 3;
-}
+    // replies first, a vdj answers in the same instant it sends a keepalive
+    if (probe) {
+        pfd[nfds].fd = v->discovery_unicast_socket_fd;
+        pfd[nfds++].events = POLLIN;
+        // vdj replies to the update port
+        pfd[nfds].fd = v->update_socket_fd;
+        pfd[nfds++].events = POLLIN;
+        // player id is set per probe
+        if ( ! (packet = cdj_create_id_use_req_packet(&length, v->model, v->ip, v->mac, 0, 0)) ) probe = 0;
+    }
+    pfd[nfds].fd = v->discovery_socket_fd;
+    pfd[nfds++].events = POLLIN;
 
-static void*
-cdj_monitor_discoverys(void* arg)
-{
-    vdj_t* v = arg;
-    int socket;
-    ssize_t len;
-    uint8_t packet[1500];
+    start = next_probe = cdj_now();
+    deadline = start + (cdj_nanos_t) (wait_time * CDJ_NANOS_PER_SEC);
 
-    socket = v->discovery_socket_fd;
+    while ( ! scan_complete() ) {
+        now = cdj_now();
+        if (now >= deadline) break;
 
-    while (1) {
-        len = recv(socket, packet, 1500, 0);
-        if (len == -1) {
-            printf("socket read error: %s\n", strerror(errno));
-            sleep(1);
-        } else {
-            handle_discovery_datagram(packet, (uint16_t) len);
+        if (probe && rounds < SCAN_PROBE_ROUNDS && now >= next_probe) {
+            send_probes(v, packet, length, rounds);
+            rounds++;
+            next_probe += CDJ_REPLY_WAIT * CDJ_NANOS_PER_MILLI;
         }
-    }
-
-    return NULL;
-}
 
-static void
-handle_discovery_datagram(uint8_t* packet, uint16_t len)
-{
-    cdj_discovery_packet_t* d_pkt;
-
-    if ( cdj_packet_type(packet, len) == CDJ_KEEP_ALIVE ) {
-        if ( (d_pkt = cdj_new_discovery_packet(packet, len)) ) {
-            if ( id_map[d_pkt->player_id] ) {
-                free(d_pkt);
-                return;
+        timeout = deadline - now;
+        if (probe && rounds < SCAN_PROBE_ROUNDS && next_probe - now < timeout) timeout = next_probe - now;
+        if ( poll(pfd, nfds, timeout / CDJ_NANOS_PER_MILLI + 1) > 0 ) {
+            for (i = 0; i < nfds; i++) {
+                if (pfd[i].revents & POLLIN) recv_all(pfd[i].fd);
             }
-            printf("%s %i %d.%d.%d.%d\n",
-                cdj_discovery_model(d_pkt),
-                d_pkt->player_id,
-                (unsigned char) (d_pkt->ip >> 24),
-                (unsigned char) (d_pkt->ip >> 16),
-                (unsigned char) (d_pkt->ip >> 8),
-                (unsigned char) (d_pkt->ip >> 0)
-                );
-            id_map[d_pkt->player_id] = 1;
-            found = 1;
-            free(d_pkt);
         }
     }
-}
 
+    free(packet);
 
+    return scan_result();
+}
@@ -42,6 +42,17 @@
 #include "vdj_beatout.h"
 #include "vdj_master.h"
 #include "vdj_discovery.h"
+#include "vdj_bpf.h"
+#include "vdj_thread.h"
+#include "vdj_busypoll.h"
+#include "vdj_txtime.h"
+#include "vdj_phase.h"
+#include "vdj_sched.h"
+#include "vdj_deck.h"
+#include "vdj_rtt.h"
+#include "vdj_metrics.h"
+#include "vdj_flight.h"
+#include "vdj_series.h"
 
 #define BROADCAST 1
 #define UNICAST   0
@@ -113,6 +124,7 @@ vdj_t*
 vdj_init_net(unsigned char* mac, char* ip_address, struct sockaddr_in* ip_addr, struct sockaddr_in* netmask, struct sockaddr_in *broadcast_addr, uint32_t flags)
 {
     char mac_s[18];
+    int i;
     vdj_t* v = (vdj_t*) calloc(1, sizeof(vdj_t));
     if (v != NULL) {
         // Setup the vdj_t struct
@@ -147,6 +159,10 @@ vdj_init_net(unsigned char* mac, char* ip_address, struct sockaddr_in* ip_addr,
             v->player_id = 1;
         }
 
+        if (flags & VDJ_FLAG_FILTER_TYPES) {
+            v->filter_types = 1;
+        }
+
         if (flags & VDJ_FLAG_PRINT_IP) {
             vdj_mac_addr_to_string(mac, mac_s);
             printf("vdj: %s/%s\n", ip_address, mac_s);
@@ -157,6 +173,10 @@ vdj_init_net(unsigned char* mac, char* ip_address, struct sockaddr_in* ip_addr,
 
         v->backline = (vdj_backline_t*) calloc(1, sizeof(vdj_backline_t));
 
+        for (i = 0; i < VDJ_THREAD_ROLES; i++) {
+            v->thread_conf[i].cpu = -1;
+        }
+
     }
     return v;
 }
@@ -192,6 +212,19 @@ vdj_open_broadcast_sockets(vdj_t* v)
         vdj_open_beat_socket(v) == CDJ_OK ) ? CDJ_OK : CDJ_ERROR;
 }
 
+/**
+ * Broadcast discovery, and the unicast sockets that CDJ_ID_USE_RESP replies to our probes arrive on,
+ * for tools that probe the link without joining it.
+ */
+int
+vdj_open_probe_sockets(vdj_t* v)
+{
+    return (
+        vdj_open_discovery_socket(v) == CDJ_OK &&
+        vdj_open_discovery_unicast_socket(v) == CDJ_OK &&
+        vdj_open_update_socket(v) == CDJ_OK ) ? CDJ_OK : CDJ_ERROR;
+}
+
 /**
  * Calls free() make sure threads that have this pointer have terminated first
  */
@@ -293,8 +326,7 @@ vdj_status_loop(void* arg)
 int
 vdj_init_status_thread(vdj_t* v)
 {
-    pthread_t thread_id;
-    int s = pthread_create(&thread_id, NULL, vdj_status_loop, v);
+    int s = vdj_thread_create(v, VDJ_THREAD_STATUS, vdj_status_loop, v);
     if (s != 0) {
         return CDJ_ERROR;
     }
@@ -319,13 +351,15 @@ vdj_stop_threads(vdj_t* v)
 
 // Send out a beat from this VCD, this should run as close as possible in time to the beat
 // played by midi instruments.
-void
-vdj_broadcast_beat(vdj_t* v, float bpm, unsigned char bar_pos)
+static void
+vdj_broadcast_beat_packet(vdj_t* v, float bpm, unsigned char bar_pos, uint64_t launch, uint32_t* next_beats)
 {
     uint16_t length;
     unsigned char* pkt;
-    
-    clock_gettime(CDJ_CLOCK, &v->last_beat);
+    cdj_nanos_t now = cdj_now();
+
+    // last_beat is when the beat hits the wire, the txtime clock may not be ours
+    v->last_beat = launch ? now + (int64_t) (launch - vdj_txtime_now(v)) : now;
     v->bpm = bpm;
 
     if (bar_pos) {
@@ -335,20 +369,41 @@ vdj_broadcast_beat(vdj_t* v, float bpm, unsigned char bar_pos)
             v->bar_index = 0;
         }
     }
+    vdj_phase_track(&v->grid, v->last_beat, v->bpm, v->bar_index + 1);
+    vdj_series_beat(v->player_id, v->last_beat, v->bpm, v->pitch, v->bar_index + 1,
+        CDJ_STAT_FLAG_PLAY | (v->master ? CDJ_STAT_FLAG_MASTER : 0));
+    vdj_sched_signal(v);
 
     if ( (pkt = cdj_create_beat_packet(&length, v->model, v->player_id, v->bpm, v->bar_index)) ) {
-        vdj_sendto_beat(v, pkt, length);
+        if (next_beats) cdj_set_beat_timings(pkt, length, next_beats, v->bar_index);
+        // OPT_ID only counts packets the kernel accepted, so only they take a tx_id
+        if ( (launch ? vdj_sendto_beat_at(v, pkt, length, launch) : vdj_sendto_beat(v, pkt, length)) == CDJ_OK ) {
+            if (v->tx_timestamps) v->tx_sent[v->tx_id++ % VDJ_TX_SENT_RING] = v->last_beat;
+        }
         free(pkt);
         v->active = 1;
     }
+    // the timestamp for this beat is not ready yet, collect the previous one
+    if (v->tx_timestamps) vdj_txtime_errors(v);
+}
+
+void
+vdj_broadcast_beat(vdj_t* v, float bpm, unsigned char bar_pos)
+{
+    vdj_broadcast_beat_packet(v, bpm, bar_pos, 0, NULL);
+}
+
+// Send a beat ahead of time, the qdisc holds it until launch (see vdj_txtime.h)
+void
+vdj_broadcast_beat_at(vdj_t* v, float bpm, unsigned char bar_pos, uint64_t launch, uint32_t* next_beats)
+{
+    vdj_broadcast_beat_packet(v, bpm, bar_pos, v->txtime ? launch : 0, next_beats);
 }
 
 void
 vdj_expire_play_state(vdj_t* v)
 {
-    struct timespec now;
-    clock_gettime(CDJ_CLOCK, &now);
-    if (v->active && (v->last_beat.tv_sec < now.tv_sec - 1)) {
+    if (v->active && (cdj_now() - v->last_beat > CDJ_NANOS_PER_SEC)) {
         vdj_set_playing(v, 0);
     }
 }
@@ -487,6 +542,12 @@ vdj_open_socket(vdj_t* v, int port, int broadcast, int *socket_fd_out)
         src_addr.sin_port = htons(port);
     }
 
+    // drop anything without the magic header in the kernel, before we bind so nothing gets queued unfiltered
+    if ( vdj_bpf_attach_magic(socket_fd) ) {
+        close(socket_fd);
+        return CDJ_ERROR;
+    }
+
     // bind socket to local port
     if ( bind(socket_fd, (struct sockaddr *) &src_addr, sizeof(src_addr)) < 0) {
         fprintf(stderr, "error: bind %s:%d\n", v->ip_address, port);
@@ -660,6 +721,8 @@ vdj_sendto_discovery(vdj_t* v, unsigned char* packet, uint16_t packet_length)
     dest.sin_port = (in_port_t)htons(CDJ_DISCOVERY_PORT);
 
     int res = sendto(v->discovery_socket_fd, packet, packet_length, flags, (struct sockaddr*) &dest, sizeof(struct sockaddr_in));
+    vdj_metrics_tx(CDJ_DISCOVERY_PORT, packet, packet_length, res == -1);
+    vdj_flight_tx(CDJ_DISCOVERY_PORT, packet, packet_length, res == -1);
     if (res == -1) {
         fprintf(stderr, "error: broadcast:50000 %s\n", strerror(errno));
         return CDJ_ERROR;
@@ -686,6 +749,8 @@ vdj_sendto_beat(vdj_t* v, unsigned char* packet, uint16_t packet_length)
     dest.sin_port = (in_port_t)htons(CDJ_BEAT_PORT);
 
     int res = sendto(v->beat_socket_fd, packet, packet_length, flags, (struct sockaddr*) &dest, sizeof(struct sockaddr_in));
+    vdj_metrics_tx(CDJ_BEAT_PORT, packet, packet_length, res == -1);
+    vdj_flight_tx(CDJ_BEAT_PORT, packet, packet_length, res == -1);
     if (res == -1) {
         fprintf(stderr, "error: broadcast:50001 'error: '%s'\n", strerror(errno));
         return CDJ_ERROR;
@@ -706,6 +771,8 @@ vdj_sendto_update(vdj_t* v, struct sockaddr_in* dest, unsigned char* packet, uin
     }
 
     int res = sendto(v->send_socket_fd, packet, packet_length, flags, (struct sockaddr*) dest, sizeof(struct sockaddr_in));
+    vdj_metrics_tx(ntohs(dest->sin_port), packet, packet_length, res == -1);
+    vdj_flight_tx(ntohs(dest->sin_port), packet, packet_length, res == -1);
     if (res == -1) {
         char ip_s[INET_ADDRSTRLEN];
         inet_ntop(AF_INET, &dest->sin_addr.s_addr, ip_s, INET_ADDRSTRLEN);
@@ -726,6 +793,7 @@ vdj_discovery_loop(void* arg)
 
     ssize_t len;
     unsigned char packet[1500];
+    cdj_nanos_t start;
 
     while (vdj_discovery_running) {
         len = recv(tinfo->v->discovery_socket_fd, packet, 1500, 0);
@@ -733,7 +801,13 @@ vdj_discovery_loop(void* arg)
             fprintf(stderr, "error: socket read '%s'", strerror(errno));
             return NULL;
         } else {
-            if ( ! cdj_validate_header(packet, len)) discovery_handler(tinfo->v, packet, len);
+            vdj_metrics_rx(CDJ_DISCOVERY_PORT, packet, len);
+            vdj_flight_rx(CDJ_DISCOVERY_PORT, packet, len);
+            if ( ! cdj_validate_header(packet, len)) {
+                start = cdj_now();
+                discovery_handler(tinfo->v, packet, len);
+                vdj_metrics_handler_time(VDJ_THREAD_DISCOVERY, cdj_now() - start);
+            }
         }
     }
 
@@ -746,11 +820,10 @@ vdj_init_discovery_thread(vdj_t* v, vdj_discovery_handler discovery_handler)
     if (vdj_discovery_running) return CDJ_ERROR;
     vdj_discovery_running = 1;
 
-    pthread_t thread_id;
     vdj_thread_info* tinfo = (vdj_thread_info*) calloc(1, sizeof(vdj_thread_info));
     tinfo->v = v;
     tinfo->handler = discovery_handler;
-    return pthread_create(&thread_id, NULL, &vdj_discovery_loop, tinfo);
+    return vdj_thread_create(v, VDJ_THREAD_DISCOVERY, &vdj_discovery_loop, tinfo);
 }
 
 void
@@ -769,6 +842,7 @@ vdj_beat_loop(void* arg)
 
     ssize_t len;
     unsigned char packet[1500];
+    cdj_nanos_t start;
 
     vdj_beat_running = 1;
     while (vdj_beat_running) {
@@ -777,7 +851,13 @@ vdj_beat_loop(void* arg)
             fprintf(stderr, "error: socket read '%s'", strerror(errno));
             return NULL;
         } else {
-            if ( ! cdj_validate_header(packet, len) ) beat_handler(tinfo->v, packet, len);
+            vdj_metrics_rx(CDJ_BEAT_PORT, packet, len);
+            vdj_flight_rx(CDJ_BEAT_PORT, packet, len);
+            if ( ! cdj_validate_header(packet, len) ) {
+                start = cdj_now();
+                beat_handler(tinfo->v, packet, len);
+                vdj_metrics_handler_time(VDJ_THREAD_BEAT, cdj_now() - start);
+            }
         }
     }
     return NULL;
@@ -786,11 +866,10 @@ vdj_beat_loop(void* arg)
 int
 vdj_init_beat_thread(vdj_t* v, vdj_beat_handler beat_handler)
 {
-    pthread_t thread_id;
     vdj_thread_info* tinfo = (vdj_thread_info*) calloc(1, sizeof(vdj_thread_info));
     tinfo->v = v;
     tinfo->handler = beat_handler;
-    return pthread_create(&thread_id, NULL, &vdj_beat_loop, tinfo);
+    return vdj_thread_create(v, VDJ_THREAD_BEAT, &vdj_beat_loop, tinfo);
 }
 
 void
@@ -809,16 +888,21 @@ vdj_managed_beat_loop(void* arg)
 
     ssize_t len;
     unsigned char packet[1500];
+    cdj_nanos_t start;
 
     vdj_beat_running = 1;
     while (vdj_beat_running) {
-        len = recv(tinfo->v->beat_socket_fd, packet, 1500, 0);
+        len = vdj_beat_recv(v, v->beat_socket_fd, packet, 1500);
         if (len == -1) {
             fprintf(stderr, "error: socket read '%s'", strerror(errno));
             return NULL;
         } else {
+            vdj_metrics_rx(CDJ_BEAT_PORT, packet, len);
+            vdj_flight_rx(CDJ_BEAT_PORT, packet, len);
             if ( ! cdj_validate_header(packet, len) ) {
+                start = cdj_now();
                 vdj_handle_managed_beat_datagram(v, beat_ph, packet, len);
+                vdj_metrics_handler_time(VDJ_THREAD_BEAT, cdj_now() - start);
             }
         }
     }
@@ -828,11 +912,12 @@ vdj_managed_beat_loop(void* arg)
 int
 vdj_init_managed_beat_thread(vdj_t* v, vdj_beat_ph beat_ph)
 {
-    pthread_t thread_id;
+    vdj_bpf_filter_managed_beat(v);
+
     vdj_thread_info* tinfo = (vdj_thread_info*) calloc(1, sizeof(vdj_thread_info));
     tinfo->v = v;
     tinfo->handler = beat_ph;
-    return pthread_create(&thread_id, NULL, &vdj_managed_beat_loop, tinfo);
+    return vdj_thread_create(v, VDJ_THREAD_BEAT, &vdj_managed_beat_loop, tinfo);
 }
 void
 vdj_stop_managed_beat_thread(vdj_t* v)
@@ -847,13 +932,25 @@ vdj_handle_managed_beat_datagram(vdj_t* v, vdj_beat_ph beat_ph, unsigned char* p
     unsigned char type = cdj_packet_type(packet, len);
     cdj_beat_packet_t* b_pkt;
     vdj_link_member_t* m;
+    int64_t expected, interval;
 
     switch (type) {
         case CDJ_BEAT : {
             if ( (b_pkt = cdj_new_beat_packet(packet, len)) ) {
                 if ( (m = vdj_get_link_member(v, b_pkt->player_id)) ) {
+                    // jitter is how far off the previous beat and tempo this one is, skip a gap of missed beats
+                    if (m->last_beat && m->bpm > 0 && b_pkt->bpm > 0) {
+                        expected = (int64_t) (60.0 * CDJ_NANOS_PER_SEC / m->bpm);
+                        interval = b_pkt->timestamp - vdj_rtt_one_way(m) - m->last_beat;
+                        if (interval < expected * 3 / 2) vdj_metrics_beat_jitter(m->player_id, interval - expected);
+                    }
                     m->bpm = b_pkt->bpm;
-                    m->last_beat = b_pkt->timestamp;
+                    // when the deck sent it, not when it got here
+                    m->last_beat = b_pkt->timestamp - vdj_rtt_one_way(m);
+                    m->bar_pos = b_pkt->bar_pos;
+                    vdj_phase_track(&m->grid, m->last_beat, m->bpm, m->bar_pos);
+                    vdj_series_beat(m->player_id, m->last_beat, m->bpm, m->pitch, m->bar_pos, m->play_state);
+                    vdj_sched_signal(v);
                 }
                 // optionally chain the handler so that client code can also react to client updates
                 if (beat_ph) beat_ph(v, b_pkt);
@@ -917,6 +1014,14 @@ vdj_handle_managed_beat_unicast_datagram(vdj_t* v, vdj_beat_unicast_ph beat_unic
             }
             break;
         }
+        case CDJ_FADER_START_COMMAND : {
+            if ( (b_pkt = cdj_new_beat_packet(packet, len)) ) {
+                // starting the deck is up to the client, see cdj_fader_start_action()
+                if (beat_unicast_ph) beat_unicast_ph(v, b_pkt);
+                free(b_pkt);
+            }
+            break;
+        }
     }
 }
 
@@ -931,6 +1036,7 @@ vdj_update_loop(void* arg)
 
     ssize_t len;
     unsigned char packet[1500];
+    cdj_nanos_t start;
 
     vdj_update_running = 1;
     while (vdj_update_running) {
@@ -939,7 +1045,13 @@ vdj_update_loop(void* arg)
             fprintf(stderr, "error: socket read '%s'", strerror(errno));
             return NULL;
         } else {
-            if ( ! cdj_validate_header(packet, len) ) update_handler(tinfo->v, packet, len);
+            vdj_metrics_rx(CDJ_UPDATE_PORT, packet, len);
+            vdj_flight_rx(CDJ_UPDATE_PORT, packet, len);
+            if ( ! cdj_validate_header(packet, len) ) {
+                start = cdj_now();
+                update_handler(tinfo->v, packet, len);
+                vdj_metrics_handler_time(VDJ_THREAD_UPDATE, cdj_now() - start);
+            }
         }
     }
 
@@ -949,11 +1061,10 @@ vdj_update_loop(void* arg)
 int
 vdj_init_update_thread(vdj_t* v, vdj_update_handler update_handler)
 {
-    pthread_t thread_id;
     vdj_thread_info* tinfo = (vdj_thread_info*) calloc(1, sizeof(vdj_thread_info));
     tinfo->v = v;
     tinfo->handler = update_handler;
-    return pthread_create(&thread_id, NULL, &vdj_update_loop, tinfo);
+    return vdj_thread_create(v, VDJ_THREAD_UPDATE, &vdj_update_loop, tinfo);
 }
 
 void
@@ -974,6 +1085,7 @@ vdj_managed_update_loop(void* arg)
 
     ssize_t len;
     unsigned char packet[1500];
+    cdj_nanos_t start;
 
     vdj_update_running = 1;
     while (vdj_update_running) {
@@ -982,7 +1094,13 @@ vdj_managed_update_loop(void* arg)
             fprintf(stderr, "socket read error: %s", strerror(errno));
             return NULL;
         } else {
-            if ( ! cdj_validate_header(packet, len) ) vdj_handle_managed_update_datagram(v, update_ph, packet, len);
+            vdj_metrics_rx(CDJ_UPDATE_PORT, packet, len);
+            vdj_flight_rx(CDJ_UPDATE_PORT, packet, len);
+            if ( ! cdj_validate_header(packet, len) ) {
+                start = cdj_now();
+                vdj_handle_managed_update_datagram(v, update_ph, packet, len);
+                vdj_metrics_handler_time(VDJ_THREAD_UPDATE, cdj_now() - start);
+            }
         }
     }
     return NULL;
@@ -998,11 +1116,12 @@ vdj_init_managed_update_thread(vdj_t* v, vdj_update_ph update_ph)
         return CDJ_ERROR;
     }
 
-    pthread_t thread_id;
+    vdj_bpf_filter_managed_update(v);
+
     vdj_thread_info* tinfo = (vdj_thread_info*) calloc(1, sizeof(vdj_thread_info));
     tinfo->v = v;
     tinfo->handler = update_ph;
-    int s = pthread_create(&thread_id, NULL, vdj_managed_update_loop, tinfo);
+    int s = vdj_thread_create(v, VDJ_THREAD_UPDATE, vdj_managed_update_loop, tinfo);
     if (s != 0) {
         return CDJ_ERROR;
     }
@@ -1030,14 +1149,21 @@ vdj_handle_managed_update_datagram(vdj_t* v, vdj_update_ph update_ph, unsigned c
                     // update link master
                     vdj_update_new_master(v, cdj_status_new_master(cs_pkt));
                     m->bpm = cs_pkt->bpm;
-                    m->last_keepalive = time(NULL);
+                    m->last_keepalive = cdj_now();
                     m->known = 1;
                     m->active = cdj_status_active(cs_pkt);
                     m->master_state = cdj_status_master_state(cs_pkt);
                     m->pitch = cdj_status_pitch(cs_pkt);
+                    m->play_state = cs_pkt->flags;
                     if (m->master_state == CDJ_MASTER_STATE_ON) {
+                        if (v->backline->master_id && v->backline->master_id != cs_pkt->player_id) {
+                            vdj_metrics_inc(VDJ_METRIC_MASTER_HANDOFFS);
+                        }
+                        if (v->backline->master_id != cs_pkt->player_id) vdj_series_master(cs_pkt->player_id);
                         v->backline->master_id = cs_pkt->player_id;
                     }
+                    vdj_deck_status(v, cs_pkt);
+                    vdj_series_status(m->player_id, m->bpm, m->pitch, cs_pkt->flags);
                     // if I am master, and now v->master_req matches his status
                     // we let him take over
                     if (v->master) {
@@ -1055,6 +1181,11 @@ vdj_handle_managed_update_datagram(vdj_t* v, vdj_update_ph update_ph, unsigned c
             break;
         }
 
+        case CDJ_LOAD_TRACK_ACK : {
+            if (len > 0x21) vdj_deck_load_ack(v, packet[0x21]);
+            break;
+        }
+
     }
 }
 
@@ -1099,6 +1230,7 @@ vdj_new_link_member(vdj_t* v, cdj_discovery_packet_t* d_pkt)
         m->update_addr = vdj_alloc_dest_addr(m, CDJ_UPDATE_PORT);
         v->backline->link_members[d_pkt->player_id] = m;
         m->active = 1;
+        vdj_metrics_inc(VDJ_METRIC_MEMBER_JOINS);
     }
 
     return m;
@@ -1143,20 +1275,28 @@ vdj_link_member_count(vdj_t* v)
 
 //SNIP_time_diff
 /**
- * return time diff between our last beat and theirs as recorded on this machine.
+ * return time diff between our beat grid and theirs as recorded on this machine.
  * only returns a useful number at all if we have beats coming from both and managed threads.
  * max value is +250ms and min value is -250ms, which is ~one a beat at 240bpm
  * and 1/2 of a beat at 120, any further out and DJ is probably mixing on the half beats.
+ * Until both grids have a tempo this falls back to the raw last beat times.
  * @return  a positive value if we are ahead, negative if we are behind.
  */
 int64_t
 vdj_time_diff(vdj_t* v, vdj_link_member_t* m)
 {
-    struct timespec me = v->last_beat;
-    struct timespec you = m->last_beat;
-
-    // +ve if you > me
-    int64_t diff =  (you.tv_sec * 1000 + you.tv_nsec / 1000000) - (me.tv_sec * 1000 + me.tv_nsec / 1000000);
+    vdj_phase_grid_t a, b;
+    vdj_phase_t phase;
+    int64_t diff;
+
+    vdj_phase_snapshot(&v->grid, &a);
+    vdj_phase_snapshot(&m->grid, &b);
+    if ( vdj_phase_offset(&a, &b, &phase) == CDJ_OK ) {
+        diff = phase.nanos / CDJ_NANOS_PER_MILLI;
+    } else {
+        // +ve if you > me, in millis
+        diff = (m->last_beat - v->last_beat) / CDJ_NANOS_PER_MILLI;
+    }
     return (diff >= -250 && diff <= 250) ? diff : 0;
 }
 //SNIP_time_diff
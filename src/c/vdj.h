@@ -2,6 +2,9 @@
 #ifndef _VDJ_H_INCLUDED_
 #define _VDJ_H_INCLUDED_
 
+#include <pthread.h>
+#include <stdatomic.h>
+
 #include "cdj.h"
 
 #define VDJ_OK          0
@@ -10,6 +13,7 @@
 #define VDJ_MAX_BACKLINE         32   // max devices on the link we can handle, also highest player_id
 #define VDJ_DEVICE_TYPE          CDJ_DEV_TYPE_CDJ  // 1
 #define VDJ_MAX_PLAYERS          4    // max players on the backline, protocol seems to imply 4 is max
+#define VDJ_TX_SENT_RING         4    // beats in flight we can match tx timestamps to
 
 // Initialization flags
 // First 3 bits are player_id 0 - 15 is player ID  (when zero user player _id 5)
@@ -19,14 +23,49 @@
 #define VDJ_FLAG_DEV_CDJ          0x20  // pretend to be an XDJ
 #define VDJ_FLAG_AUTO_ID          0x40  // automatically assign an id
 #define VDJ_FLAG_PRINT_IP         0x80  // print resolved ip address to stdout
+#define VDJ_FLAG_FILTER_TYPES     0x100 // managed threads attach socket filters for only the packet types they handle
 
 
 // data structures
 
+// Library threads, each can be given a realtime priority and cpu, see vdj_thread.h
+typedef enum {
+    VDJ_THREAD_DISCOVERY = 0,  // discovery rx, managed or unmanaged
+    VDJ_THREAD_KEEPALIVE,      // unmanaged keepalive tx
+    VDJ_THREAD_BEAT,           // beat rx, recv() or AF_XDP
+    VDJ_THREAD_UPDATE,         // status rx
+    VDJ_THREAD_STATUS,         // status tx
+    VDJ_THREAD_BEATOUT,        // beat tx
+    VDJ_THREAD_PSELECT,        // single thread doing all rx
+    VDJ_THREAD_SCHED,          // look ahead beat events
+    VDJ_THREAD_MIDI,           // midi clock tx
+    VDJ_THREAD_RTT,            // round trip probes
+    VDJ_THREAD_METRICS,        // metrics exporter
+    VDJ_THREAD_SHM,            // shared memory publisher
+    VDJ_THREAD_DAEMON,         // local client fan out
+    VDJ_THREAD_ROLES
+} vdj_thread_role;
+
+typedef struct {
+    int                 priority;      // SCHED_FIFO priority 1 - 99, 0 leaves the thread on the default scheduler
+    int                 cpu;           // pin the thread to this cpu, -1 for any
+    size_t              prefault;      // bytes of stack to touch when the thread starts, use with vdj_lock_memory()
+} vdj_thread_conf_t;
+
+// beat grid smoothed from a source's beats, see vdj_phase.h
+typedef struct {
+    cdj_nanos_t         anchor;        // smoothed time of the last beat
+    int64_t             period;        // smoothed nanos per beat
+    float               bpm;           // reported bpm the period was last set from
+    uint8_t             bar_pos;       // 1 - 4 position of the anchor beat in the bar
+    uint32_t            beats;         // beats tracked since the grid was seeded, 0 if empty
+    _Atomic uint32_t    seq;           // odd while vdj_phase_track() writes, read with vdj_phase_snapshot()
+} vdj_phase_grid_t;
+
 // Remote (real) CDJ
 typedef struct {
-    struct timespec     last_beat;     // nanosecond time of last beat
-    time_t              last_keepalive;// last time we heard from this player, (resolution in secs) rekordbox disconnects after 7 seconds
+    cdj_nanos_t         last_beat;     // time of last beat
+    cdj_nanos_t         last_keepalive;// last time we heard from this player, rekordbox disconnects after 7 seconds
     float               bpm;           // calculated bpm, based on bpm reported in a beat message (2 decimal places)
     int32_t             pitch;         // slider amount (tempo not necessarily pitch)
     struct sockaddr_in* ip_addr;       // ip address of the device
@@ -39,6 +78,12 @@ typedef struct {
     unsigned int        known:1;       // this device knows us, we are getting stuff on 50002
     unsigned int        onair:1;       // DJMs can send out this info
     unsigned int        gone:1;        // CDJ has gone from the network, no keep alive in 7 seconds
+    vdj_phase_grid_t    grid;          // tracked from beats
+    _Atomic int64_t     srtt;          // smoothed round trip to the device, 0 until measured, see vdj_rtt.h
+    _Atomic int64_t     rttvar;        // smoothed round trip variation, i.e. jitter
+    _Atomic int64_t     rtt_min;
+    _Atomic uint32_t    rtt_samples;   // 0 until a probe has been answered
+    cdj_nanos_t         rtt_probe;     // when the outstanding probe was sent, 0 if none
 } vdj_link_member_t;
 
 // State of the whole Network, as far as we know
@@ -52,6 +97,18 @@ typedef struct {
     uint8_t             master_new;        // new master being negotiated
 } vdj_backline_t;
 
+// beat receive measurements, see vdj_busypoll.h
+typedef struct {
+    uint64_t            packets;
+    uint64_t            spin_hits;     // packets picked up while spinning
+    uint64_t            blocks;        // times the spin budget ran out and we blocked in recv()
+    int64_t             latency_min;   // nanos from the kernel rx timestamp to recv() returning
+    int64_t             latency_max;
+    int64_t             latency_sum;
+    cdj_nanos_t         start;         // when the stats were reset
+    struct timespec     cpu_start;     // beat thread cpu time when the stats were reset
+} vdj_rx_stats_t;
+
 // Local VCDJ
 typedef struct {
     char*               ip_address;      // string format
@@ -83,13 +140,40 @@ typedef struct {
     uint8_t             master;         // 0x01 I think i am master
     int8_t              master_req;     // some other player wants to be master or -1
     float               bpm;            // my virtual device's bpm
-    struct timespec     last_beat;      // nanosecond time of my last beat (may use MONOTONIC clock)
+    cdj_nanos_t         last_beat;      // time of my last beat, when it left the nic if it was scheduled
     uint8_t             active;         // we chose this to mean playing, but there are other states for CDJs
     uint8_t             bar_index;      // 0 - 3 index position in the bar
+    vdj_phase_grid_t    grid;           // tracked from our own beats
+    _Atomic float       follow_slew;    // max change in beat interval per beat when following master, see vdj_beatout.h
+    _Atomic uint8_t     follow_master;  // vdj should track master, beatout locks to the master's grid
+    struct vdj_sched_s* _Atomic sched;  // beat synchronous events, see vdj_sched.h
+    _Atomic unsigned    sched_signals;  // vdj_sched_signal() calls in progress
+    struct vdj_deck_batch_s* decks;     // remote deck commands waiting for confirmation, see vdj_deck.h
     void*               client;         // if anyone wants to hook to our callbacks (e.g. adj_seq_info_t* adj)
     unsigned int        auto_id:1;      // automatically assign id
     unsigned int        have_id:1;      // got an id assigned
-    unsigned int        follow_master:1; // vdj should track master (in adj)
+    unsigned int        filter_types:1; // socket filters drop packet types managed threads ignore
+    unsigned int        rtt:1;          // the rtt thread reads the unicast discovery socket, see vdj_rtt.h
+
+    // threads
+    vdj_thread_conf_t   thread_conf[VDJ_THREAD_ROLES]; // set before the vdj_init_*_thread() call
+    pthread_t           threads[VDJ_THREAD_ROLES];     // last thread started for each role
+    uint32_t            threads_joinable;              // bit per role, set if threads[role] has not been joined
+
+    // low latency receive
+    uint32_t            busy_poll_us;   // managed beat thread spins this long before blocking, 0 for plain recv()
+    unsigned int        measure_rx:1;   // record beat_stats
+    vdj_rx_stats_t      beat_stats;
+
+    // scheduled beat transmission, see vdj_txtime.h
+    unsigned int        txtime:1;       // beat socket has SO_TXTIME set
+    clockid_t           txtime_clock;   // CLOCK_MONOTONIC for the fq qdisc, CLOCK_TAI for etf
+    uint32_t            txtime_errors;  // beats the qdisc dropped for missing their launch time
+    unsigned int        tx_timestamps:1;// kernel reports when each beat was sent
+    uint32_t            tx_id;          // beats sent since tx timestamps were enabled
+    cdj_nanos_t         tx_sent[VDJ_TX_SENT_RING]; // last_beat of recent beats, indexed by tx_id
+    cdj_nanos_t         beat_tx;        // kernel tx timestamp of the last reported beat
+    int64_t             tx_latency;     // beat_tx minus that beat's send or launch time
 } vdj_t;
 
 typedef struct  {
@@ -130,6 +214,7 @@ void vdj_save_player_id(vdj_t* v);
 
 int vdj_open_sockets(vdj_t* v);
 int vdj_open_broadcast_sockets(vdj_t* v);
+int vdj_open_probe_sockets(vdj_t* v);
 int vdj_exec_discovery(vdj_t* v);
 int vdj_close_sockets(vdj_t* v);
 void vdj_print_sockaddr(char* context, struct sockaddr_in* ip);
@@ -142,6 +227,9 @@ int vdj_send_status(vdj_t* v);
 // bpm does not have to be correct but its rendered on the CDJ so if bpm is not what is reported
 // the DJ will not know
 void vdj_broadcast_beat(vdj_t* v, float bpm, uint8_t bar_pos);
+// as above but the beat leaves the nic at launch, nanos in v->txtime_clock, needs vdj_txtime_enable(),
+// next_beats if not NULL are the millis to each of the next 8 beats, when tempo is changing
+void vdj_broadcast_beat_at(vdj_t* v, float bpm, uint8_t bar_pos, uint64_t launch, uint32_t* next_beats);
 // set not active if last beat was more than a second ago
 void vdj_expire_play_state(vdj_t* v);
 void vdj_set_playing(vdj_t* v, int playing);
@@ -191,6 +279,7 @@ vdj_link_member_t* vdj_new_link_member(vdj_t* v, cdj_discovery_packet_t* d_pkt);
 
 void vdj_update_link_member(vdj_link_member_t* m, uint32_t ip);
 uint8_t vdj_link_member_count(vdj_t* v);
+// millis we are ahead of m, see vdj_phase_member() for the full precision offset
 int64_t vdj_time_diff(vdj_t* v, vdj_link_member_t* m);
 struct sockaddr_in* vdj_alloc_dest_addr(vdj_link_member_t* m, uint16_t port);
 
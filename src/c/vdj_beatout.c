@@ -2,19 +2,35 @@
 #include <pthread.h>
 #include <stdatomic.h>
 #include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
 
 #include "cdj.h"
 #include "vdj.h"
+#include "vdj_thread.h"
+#include "vdj_txtime.h"
+#include "vdj_phase.h"
+#include "vdj_beatout.h"
 
 /**
  * Code to send out Beats according to the VDJ's current bpm.
  * Use for testing until integrated with midi or a different time source.
- * This code just ticks at a constant BPM, amaking no attempt to prevent drift.
+ * This code just ticks at a constant BPM on an absolute grid, optionally scheduled with SO_TXTIME.
+ * With v->follow_master the grid is steered onto the master's beat grid instead.
  */
 
 static unsigned _Atomic vdj_beatout_running = ATOMIC_VAR_INIT(0);
 static unsigned _Atomic vdj_beatout_paused = ATOMIC_VAR_INIT(1);
 
+// commands for the beatout thread, applied on beat boundaries
+static pthread_mutex_t vdj_beatout_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t vdj_beatout_cond = PTHREAD_COND_INITIALIZER;
+static vdj_beatout_change_t vdj_beatout_change;
+static uint8_t vdj_beatout_start_at;
+static uint8_t vdj_beatout_stop_at;
+
+//SNIP_beatout
 static long int 
 vdj_one_beat_nanos(float bpm)
 {
@@ -22,39 +38,231 @@ vdj_one_beat_nanos(float bpm)
 }
 
 static struct timespec
-vdj_one_beat_time(float bpm)
+vdj_beatout_timespec(uint64_t nanos)
 {
-    long int nanos = vdj_one_beat_nanos(bpm);
     struct timespec ts = {0};
     ts.tv_sec = nanos / 1000000000L;
     ts.tv_nsec = nanos % 1000000000L;
     return ts;
 }
 
+static double
+vdj_beatout_wrap(double beats, double range)
+{
+    int64_t i = (int64_t) (beats / range);
+    if (beats < i * range) i--;
+    beats -= i * range;
+    return beats >= range / 2 ? beats - range : beats;
+}
+
+static double
+vdj_beatout_clamp(double x, double min, double max)
+{
+    return x < min ? min : x > max ? max : x;
+}
+
+/**
+ * Tempo of the beat at bar_pos, starting change if this beat is its boundary.
+ * Ramps are linear in bpm, the first beat of the ramp is already 1/ramp of the way there.
+ */
+static double
+vdj_beatout_step(vdj_beatout_tempo_t* t, vdj_beatout_change_t* c, uint8_t bar_pos)
+{
+    if ( c->quantize && (c->quantize != VDJ_BEATOUT_BAR || bar_pos == 1) ) {
+        t->from = t->bpm;
+        t->to = c->bpm;
+        t->ramp = c->ramp;
+        t->step = 0;
+        c->quantize = 0;
+        if (t->ramp == 0) t->bpm = t->to;
+    }
+    if (t->step < t->ramp) {
+        t->step++;
+        t->bpm = t->from + (t->to - t->from) * t->step / t->ramp;
+    }
+    return t->bpm;
+}
+
+/**
+ * Millis to each of the next 8 beats, played forward from copies of the tempo and the pending change,
+ * so the offsets in the beat packet match when the beats will really be sent.
+ */
+static void
+vdj_beatout_timings(vdj_beatout_tempo_t* tempo, vdj_beatout_change_t* change, uint8_t bar_pos, uint32_t* next_beats)
+{
+    vdj_beatout_tempo_t t = *tempo;
+    vdj_beatout_change_t c = *change;
+    double bpm = t.bpm;
+    double millis = 0.0;
+    int i;
+
+    for (i = 0; i < 8; i++) {
+        millis += 60000.0 / bpm;
+        next_beats[i] = (uint32_t) (millis + 0.5);
+        bar_pos = bar_pos == 4 ? 1 : bar_pos + 1;
+        bpm = vdj_beatout_step(&t, &c, bar_pos);
+    }
+}
+
+/**
+ * First beat when starting to follow, on the master's next beat, or next bar, and at its bar position.
+ */
+static void
+vdj_beatout_follow_start(vdj_t* v, vdj_phase_grid_t* g, uint8_t quantize, uint64_t* next, uint8_t* bar_pos, double* period)
+{
+    int64_t skew = (int64_t) (vdj_txtime_now(v) - cdj_now());
+    double pos = vdj_phase_position(g, cdj_now() + VDJ_TXTIME_LEAD_NANOS);
+    int64_t k = (int64_t) pos + 1;
+
+    if (quantize == VDJ_BEATOUT_BAR) {
+        while (k % 4) k++;
+    }
+
+    *next = g->anchor + (int64_t) ((k - (g->bar_pos - 1)) * g->period) + skew;
+    *bar_pos = (k % 4) + 1;
+    *period = g->period;
+}
+
+/**
+ * Interval to the next beat, steered towards the master, bar_pos is the position of the beat just sent.
+ * The error is measured over a whole bar so a beat early or late in the bar is realigned at once, only the
+ * fraction of a beat is slewed.
+ * period is the tempo we report, it follows the master's without the phase correction.
+ */
+static uint64_t
+vdj_beatout_follow(vdj_t* v, vdj_phase_grid_t* g, uint64_t sent, uint8_t* bar_pos, double* period)
+{
+    int64_t skew = (int64_t) (vdj_txtime_now(v) - cdj_now());
+    double slew = v->follow_slew;
+    double err, beats, interval;
+
+    if (slew <= 0.0) slew = VDJ_FOLLOW_SLEW;
+    // +ve if the master is ahead of us, in beats
+    err = vdj_beatout_wrap(vdj_phase_position(g, (cdj_nanos_t) (sent - skew)) - (*bar_pos - 1), 4.0);
+    beats = (double) (int64_t) (err < 0 ? err - 0.5 : err + 0.5);
+    if (beats != 0.0) {
+        *bar_pos = (uint8_t) (((*bar_pos - 1 + (int) beats) % 4 + 4) % 4) + 1;
+        err -= beats;
+    }
+
+    *period = vdj_beatout_clamp(g->period, *period * (1.0 - slew), *period * (1.0 + slew));
+    interval = *period * (1.0 - err * VDJ_FOLLOW_GAIN);
+    interval = vdj_beatout_clamp(interval, *period * (1.0 - slew), *period * (1.0 + slew));
+    interval = vdj_beatout_clamp(interval, g->period * (1.0 - VDJ_FOLLOW_MAX_NUDGE), g->period * (1.0 + VDJ_FOLLOW_MAX_NUDGE));
+
+    v->bpm = (float) (60.0 * CDJ_NANOS_PER_SEC / *period);
+    return (uint64_t) interval;
+}
+//SNIP_beatout
+
+/**
+ * Beats are on an absolute grid, each one is one beat after the last one on the grid, not one beat after we
+ * woke up, so sleep overshoot does not accumulate.
+ * With SO_TXTIME we wake VDJ_TXTIME_LEAD_NANOS early and the kernel sends the packet exactly on the grid.
+ * Tempo changes and stops are taken on the beat they are quantized to, commands do not wake the thread
+ * while it plays, starting does.
+ */
 static void*
 vdj_beatout_loop(void* arg)
 {
     vdj_t* v = arg;
 
-    struct timespec sl;
+    clockid_t clock = v->txtime ? v->txtime_clock : CLOCK_MONOTONIC;
+    uint64_t lead = v->txtime ? VDJ_TXTIME_LEAD_NANOS : 0;
+    uint64_t next = vdj_txtime_now(v);
+    struct timespec wake;
+    uint8_t bar_pos = 1;
+    uint8_t start_at = 0;
+    vdj_phase_grid_t* g;
+    vdj_phase_grid_t grid;
+    vdj_beatout_tempo_t tempo;
+    vdj_beatout_change_t change;
+    uint32_t next_beats[8];
+    double period = 0.0;
+    double bpm;
+    int following = 0;
+    int playing = 0;
+    int stop;
     vdj_beatout_running = 1;
-    int was_paused = 0;
+
     while (vdj_beatout_running) {
 
+        if ( ! playing ) {
+            pthread_mutex_lock(&vdj_beatout_lock);
+            while (vdj_beatout_paused && vdj_beatout_running) {
+                pthread_cond_wait(&vdj_beatout_cond, &vdj_beatout_lock);
+            }
+            start_at = vdj_beatout_start_at;
+            pthread_mutex_unlock(&vdj_beatout_lock);
+            if ( ! vdj_beatout_running ) break;
+
+            // restart the grid, first beat goes out now
+            bar_pos = 1;
+            next = vdj_txtime_now(v) + lead;
+            following = 0;
+            memset(&tempo, 0, sizeof(vdj_beatout_tempo_t));
+            tempo.bpm = v->bpm;
+            playing = 1;
+        }
+        if (v->follow_master && ! following && ! v->master &&
+            (g = vdj_phase_grid(v, VDJ_PHASE_MASTER, cdj_now(), &grid)) && g != &v->grid) {
+            vdj_beatout_follow_start(v, &grid, start_at, &next, &bar_pos, &period);
+            following = 1;
+        }
+
+        wake = vdj_beatout_timespec(next - lead);
+        while ( clock_nanosleep(clock, TIMER_ABSTIME, &wake, NULL) == EINTR );
+
+        // paused while we slept
         if (vdj_beatout_paused) {
-            was_paused = 1;
-            usleep(50000); // todo wake up immediatly
+            playing = 0;
+            continue;
+        }
+
+        pthread_mutex_lock(&vdj_beatout_lock);
+        stop = vdj_beatout_stop_at && (vdj_beatout_stop_at != VDJ_BEATOUT_BAR || bar_pos == 1);
+        if (stop) {
+            vdj_beatout_stop_at = 0;
+            vdj_beatout_paused = 1;
+            v->active = 0;
+            playing = 0;
         }
-        if (was_paused) {
-            was_paused = 0;
-            v->bar_index = 0;
+        if ( ! stop && ! following ) {
+            // vdj_set_bpm() while no change is in progress applies from this beat
+            if (tempo.step == tempo.ramp && ! vdj_beatout_change.quantize && v->bpm != (float) tempo.bpm) {
+                tempo.bpm = v->bpm;
+            }
+            bpm = vdj_beatout_step(&tempo, &vdj_beatout_change, bar_pos);
         }
+        change = vdj_beatout_change;
+        pthread_mutex_unlock(&vdj_beatout_lock);
+        if (stop) continue;
 
-        vdj_broadcast_beat(v, v->bpm, v->bar_index++);
-        if (v->bar_index == 4) v->bar_index = 0;
+        if (following) {
+            vdj_broadcast_beat_at(v, v->bpm, bar_pos, next, NULL);
+        } else {
+            vdj_beatout_timings(&tempo, &change, bar_pos, next_beats);
+            vdj_broadcast_beat_at(v, (float) bpm, bar_pos, next, next_beats);
+        }
+        if (v->txtime) vdj_txtime_errors(v);
 
-        sl = vdj_one_beat_time(v->bpm);
-        nanosleep(&sl, NULL);
+        g = NULL;
+        if (following && v->follow_master && ! v->master) {
+            g = vdj_phase_grid(v, VDJ_PHASE_MASTER, cdj_now(), &grid);
+            if (g == &v->grid) g = NULL;
+        }
+        if (g) {
+            next += vdj_beatout_follow(v, &grid, next, &bar_pos, &period);
+        } else if (following) {
+            // the master went away, free run at its last tempo until one appears
+            following = 0;
+            memset(&tempo, 0, sizeof(vdj_beatout_tempo_t));
+            tempo.bpm = v->bpm;
+            next += vdj_one_beat_nanos(v->bpm);
+        } else {
+            next += (uint64_t) (60.0 * CDJ_NANOS_PER_SEC / bpm);
+        }
+        bar_pos = bar_pos == 4 ? 1 : bar_pos + 1;
 
     }
     return NULL;
@@ -63,28 +271,35 @@ vdj_beatout_loop(void* arg)
 int
 vdj_init_beatout_thread(vdj_t* v)
 {
-    pthread_t thread_id;
-    int s = pthread_create(&thread_id, NULL, vdj_beatout_loop, v);
+    int s = vdj_thread_create(v, VDJ_THREAD_BEATOUT, vdj_beatout_loop, v);
     if (s != 0) {
         return CDJ_ERROR;
     }
     return CDJ_OK;
 }
 
+static void
+vdj_beatout_signal()
+{
+    pthread_mutex_lock(&vdj_beatout_lock);
+    pthread_cond_signal(&vdj_beatout_cond);
+    pthread_mutex_unlock(&vdj_beatout_lock);
+}
+
 // kill
 void
 vdj_stop_beatout_thread(vdj_t* v)
 {
     v->active = 0;
     vdj_beatout_running = 0;
+    vdj_beatout_signal();
 }
 
 
 void
 vdj_start_beatout_thread(vdj_t* v)
 {
-    v->active = 1;
-    vdj_beatout_paused = 0;
+    vdj_beatout_start(v, VDJ_BEATOUT_NOW);
 }
 
 void
@@ -92,4 +307,61 @@ vdj_pause_beatout_thread(vdj_t* v)
 {
     v->active = 0;
     vdj_beatout_paused = 1;
-}
\ No newline at end of file
+}
+
+void
+vdj_beatout_start(vdj_t* v, vdj_beatout_quantize quantize)
+{
+    pthread_mutex_lock(&vdj_beatout_lock);
+    vdj_beatout_start_at = quantize;
+    vdj_beatout_stop_at = 0;
+    v->active = 1;
+    vdj_beatout_paused = 0;
+    pthread_cond_signal(&vdj_beatout_cond);
+    pthread_mutex_unlock(&vdj_beatout_lock);
+}
+
+void
+vdj_beatout_stop(vdj_t* v, vdj_beatout_quantize quantize)
+{
+    if (quantize == VDJ_BEATOUT_NOW) {
+        vdj_pause_beatout_thread(v);
+        return;
+    }
+    pthread_mutex_lock(&vdj_beatout_lock);
+    vdj_beatout_stop_at = quantize;
+    pthread_mutex_unlock(&vdj_beatout_lock);
+}
+
+int
+vdj_beatout_ramp_tempo(vdj_t* v, float bpm, uint32_t beats, vdj_beatout_quantize quantize)
+{
+    if (bpm <= 0.0) return CDJ_ERROR;
+
+    pthread_mutex_lock(&vdj_beatout_lock);
+    if (vdj_beatout_paused) {
+        // takes effect when we start
+        vdj_beatout_change.quantize = 0;
+        v->bpm = bpm;
+    } else {
+        vdj_beatout_change.bpm = bpm;
+        vdj_beatout_change.ramp = beats;
+        vdj_beatout_change.quantize = quantize == VDJ_BEATOUT_BAR ? VDJ_BEATOUT_BAR : VDJ_BEATOUT_BEAT;
+    }
+    pthread_mutex_unlock(&vdj_beatout_lock);
+    return CDJ_OK;
+}
+
+int
+vdj_beatout_set_tempo(vdj_t* v, float bpm, vdj_beatout_quantize quantize)
+{
+    return vdj_beatout_ramp_tempo(v, bpm, 0, quantize);
+}
+
+void
+vdj_beatout_follow_master(vdj_t* v, int follow, float slew)
+{
+    // atomic, the beatout thread reads them without the lock
+    v->follow_slew = slew;
+    v->follow_master = follow ? 1 : 0;
+}
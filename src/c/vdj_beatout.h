@@ -2,12 +2,53 @@
 #include "cdj.h"
 #include "vdj.h"
 
+#define VDJ_FOLLOW_SLEW         0.005  // default max change in the beat interval per beat
+#define VDJ_FOLLOW_GAIN         0.25   // share of the phase error to the master corrected each beat
+#define VDJ_FOLLOW_MAX_NUDGE    0.04   // the beat interval stays within this of the master's
+
+// when a command takes effect
+typedef enum {
+    VDJ_BEATOUT_NOW  = 0,
+    VDJ_BEATOUT_BEAT = 1,   // on the next beat
+    VDJ_BEATOUT_BAR  = 4    // on the next downbeat
+} vdj_beatout_quantize;
+
+// a tempo change waiting for its beat
+typedef struct {
+    float               bpm;
+    uint32_t            ramp;       // beats to get there, 0 to step
+    uint8_t             quantize;   // 0 if nothing is pending
+} vdj_beatout_change_t;
+
+// tempo as the beatout thread plays it
+typedef struct {
+    double              bpm;        // tempo of the current beat
+    double              from;       // ramp start and end
+    double              to;
+    uint32_t            ramp;
+    uint32_t            step;       // beats of the ramp played
+} vdj_beatout_tempo_t;
+
 
 int vdj_init_beatout_thread(vdj_t* v);
 // kill
 void vdj_stop_beatout_thread(vdj_t* v);
 
-// unpause
+// unpause, first beat goes out now
 void vdj_start_beatout_thread(vdj_t* v);
-// thread stays alive but we become v->inactive
+// thread stays alive but we become v->inactive, the next beat is not sent
 void vdj_pause_beatout_thread(vdj_t* v);
+
+// start now, or on the master's next beat or bar when following, wakes the thread immediately
+void vdj_beatout_start(vdj_t* v, vdj_beatout_quantize quantize);
+// the beat at the next beat or bar boundary is not sent
+void vdj_beatout_stop(vdj_t* v, vdj_beatout_quantize quantize);
+
+// change tempo from the next beat or bar, NOW is the next beat, while stopped the tempo is set at once
+int vdj_beatout_set_tempo(vdj_t* v, float bpm, vdj_beatout_quantize quantize);
+// as above but linearly over beats, the packets' next beat and bar offsets follow the ramp
+int vdj_beatout_ramp_tempo(vdj_t* v, float bpm, uint32_t beats, vdj_beatout_quantize quantize);
+
+// beatout tracks the sync master's tempo, phase and bar position instead of free running at v->bpm,
+// slew is the max fractional change in the beat interval per beat, 0 for VDJ_FOLLOW_SLEW
+void vdj_beatout_follow_master(vdj_t* v, int follow, float slew);
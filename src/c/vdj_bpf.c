@@ -0,0 +1,139 @@
+/**
+ * Classic BPF socket filters for ProLink sockets.
+ *
+ * On a UDP socket the filter sees the 8 byte UDP header followed by the payload, so the magic header
+ * starts at offset 8 and the packet type is at offset 8 + CDJ_PACKET_TYPE_OFFSET.
+ * Loads past the end of a short datagram abort the program with 0, i.e. drop, so we need no explicit length check.
+ *
+ * @author teknopaul
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <linux/filter.h>
+
+#include "cdj.h"
+#include "vdj.h"
+#include "vdj_bpf.h"
+
+#define VDJ_BPF_UDP_HDR_LEN  8
+
+// Qspt1WmJOL as two words and a half word
+#define VDJ_BPF_MAGIC_0      0x51737074  // Qspt
+#define VDJ_BPF_MAGIC_1      0x31576d4a  // 1WmJ
+#define VDJ_BPF_MAGIC_2      0x4f4c      // OL
+
+/**
+ * Build the filter program.
+ *
+ *   ld  [8]  ; jne Qspt drop
+ *   ld  [12] ; jne 1WmJ drop
+ *   ldh [16] ; jne OL   drop
+ *   ldb [18] ; jeq type[0] accept ; jeq type[1] accept ... ; ja drop  (only if types are given)
+ *   accept: ret #0xffff
+ *   drop:   ret #0
+ *
+ * @return number of instructions written to prog
+ */
+static int
+vdj_bpf_build(struct sock_filter* prog, const uint8_t* types, int type_count)
+{
+    int i = 0, t;
+    // instructions after the 3 magic checks is 1 ldb + type_count jeqs + 1 ja, when types are used
+    int tail = type_count ? type_count + 2 : 0;
+
+    prog[i++] = (struct sock_filter) BPF_STMT(BPF_LD  | BPF_W | BPF_ABS, VDJ_BPF_UDP_HDR_LEN);
+    prog[i++] = (struct sock_filter) BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, VDJ_BPF_MAGIC_0, 0, 4 + tail + 1);
+    prog[i++] = (struct sock_filter) BPF_STMT(BPF_LD  | BPF_W | BPF_ABS, VDJ_BPF_UDP_HDR_LEN + 4);
+    prog[i++] = (struct sock_filter) BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, VDJ_BPF_MAGIC_1, 0, 2 + tail + 1);
+    prog[i++] = (struct sock_filter) BPF_STMT(BPF_LD  | BPF_H | BPF_ABS, VDJ_BPF_UDP_HDR_LEN + 8);
+    prog[i++] = (struct sock_filter) BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, VDJ_BPF_MAGIC_2, 0, tail + 1);
+
+    if (type_count) {
+        prog[i++] = (struct sock_filter) BPF_STMT(BPF_LD | BPF_B | BPF_ABS, VDJ_BPF_UDP_HDR_LEN + CDJ_PACKET_TYPE_OFFSET);
+        for (t = 0; t < type_count; t++) {
+            // jump forward to accept, skipping the remaining jeqs and the ja
+            prog[i++] = (struct sock_filter) BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, types[t], type_count - t, 0);
+        }
+        prog[i++] = (struct sock_filter) BPF_JUMP(BPF_JMP | BPF_JA, 1, 0, 0);
+    }
+
+    prog[i++] = (struct sock_filter) BPF_STMT(BPF_RET | BPF_K, 0xffff);
+    prog[i++] = (struct sock_filter) BPF_STMT(BPF_RET | BPF_K, 0);
+
+    return i;
+}
+
+int
+vdj_bpf_attach(int socket_fd, const uint8_t* types, int type_count)
+{
+    struct sock_filter prog[VDJ_BPF_MAX_TYPES + 10];
+    struct sock_fprog fprog;
+
+    if (type_count > VDJ_BPF_MAX_TYPES) return CDJ_ERROR;
+
+    fprog.len = vdj_bpf_build(prog, types, type_count);
+    fprog.filter = prog;
+
+    // replaces any previously attached filter
+    if ( setsockopt(socket_fd, SOL_SOCKET, SO_ATTACH_FILTER, &fprog, sizeof(fprog)) ) {
+        fprintf(stderr, "error: attach socket filter '%s'\n", strerror(errno));
+        return CDJ_ERROR;
+    }
+    return CDJ_OK;
+}
+
+int
+vdj_bpf_detach(int socket_fd)
+{
+    int value = 0;
+    if ( setsockopt(socket_fd, SOL_SOCKET, SO_DETACH_FILTER, &value, sizeof(value)) ) {
+        return CDJ_ERROR;
+    }
+    return CDJ_OK;
+}
+
+int
+vdj_bpf_attach_magic(int socket_fd)
+{
+    return vdj_bpf_attach(socket_fd, NULL, 0);
+}
+
+int
+vdj_bpf_filter_types(vdj_t* v, int socket_fd, const uint8_t* types, int type_count)
+{
+    if ( ! v->filter_types || socket_fd <= 0 ) return CDJ_OK;
+    return vdj_bpf_attach(socket_fd, types, type_count);
+}
+
+int
+vdj_bpf_filter_managed_beat(vdj_t* v)
+{
+    static const uint8_t types[] = { CDJ_BEAT };
+    return vdj_bpf_filter_types(v, v->beat_socket_fd, types, sizeof(types));
+}
+
+int
+vdj_bpf_filter_managed_beat_unicast(vdj_t* v)
+{
+    static const uint8_t types[] = { CDJ_MASTER_REQ, CDJ_MASTER_RESP, CDJ_FADER_START_COMMAND };
+    return vdj_bpf_filter_types(v, v->beat_unicast_socket_fd, types, sizeof(types));
+}
+
+int
+vdj_bpf_filter_managed_update(vdj_t* v)
+{
+    static const uint8_t types[] = { CDJ_STATUS, CDJ_LOAD_TRACK_ACK };
+    return vdj_bpf_filter_types(v, v->update_socket_fd, types, sizeof(types));
+}
+
+int
+vdj_bpf_filter_managed_discovery(vdj_t* v)
+{
+    static const uint8_t types[] = { CDJ_ID_USE_REQ, CDJ_COLLISION, CDJ_KEEP_ALIVE };
+    static const uint8_t unicast_types[] = { CDJ_ID_USE_RESP };
+    return vdj_bpf_filter_types(v, v->discovery_socket_fd, types, sizeof(types)) |
+        vdj_bpf_filter_types(v, v->discovery_unicast_socket_fd, unicast_types, sizeof(unicast_types));
+}
@@ -0,0 +1,32 @@
+#ifndef _VDJ_BPF_H_INCLUDED_
+#define _VDJ_BPF_H_INCLUDED_
+
+#include "vdj.h"
+
+/**
+ * In kernel socket filters (classic BPF, SO_ATTACH_FILTER) for the ProLink UDP sockets.
+ *
+ * Every socket gets a filter that drops datagrams without the Qspt1WmJOL magic header, so junk on the port
+ * never wakes a thread blocked in recv().  If the vdj was created with VDJ_FLAG_FILTER_TYPES the managed threads
+ * also restrict each socket to the packet types they handle, e.g. only CDJ_BEAT on 50001.
+ */
+
+#define VDJ_BPF_MAX_TYPES    16
+
+// accept only valid ProLink packets, optionally only those with a type in types[]
+int vdj_bpf_attach(int socket_fd, const uint8_t* types, int type_count);
+int vdj_bpf_detach(int socket_fd);
+
+// magic header only filter, applied to every socket when it is opened
+int vdj_bpf_attach_magic(int socket_fd);
+
+// restrict a socket to packet types, noop unless v was initialised with VDJ_FLAG_FILTER_TYPES
+int vdj_bpf_filter_types(vdj_t* v, int socket_fd, const uint8_t* types, int type_count);
+
+// filters matching the types vdj_handle_managed_*_datagram() act on
+int vdj_bpf_filter_managed_beat(vdj_t* v);
+int vdj_bpf_filter_managed_beat_unicast(vdj_t* v);
+int vdj_bpf_filter_managed_update(vdj_t* v);
+int vdj_bpf_filter_managed_discovery(vdj_t* v);
+
+#endif // _VDJ_BPF_H_INCLUDED_
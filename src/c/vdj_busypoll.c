@@ -0,0 +1,196 @@
+/**
+ * Spin-then-block receive and rx latency measurement for the beat thread.
+ *
+ * Busy polling trades a core for wakeup latency, the nic interrupt, softirq and scheduler wakeup of a
+ * thread blocked in recv() typically cost tens of micros, more on a Pi.  While spinning the thread never sleeps
+ * so the packet is picked up as soon as the kernel queues it to the socket, and with SO_BUSY_POLL the spinning
+ * recv() drives the nic's napi poll itself.
+ *
+ * @author teknopaul
+ */
+
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "cdj.h"
+#include "vdj.h"
+#include "vdj_busypoll.h"
+
+#ifndef SO_PREFER_BUSY_POLL
+#define SO_PREFER_BUSY_POLL 69
+#endif
+#ifndef SO_BUSY_POLL_BUDGET
+#define SO_BUSY_POLL_BUDGET 70
+#endif
+
+static void
+vdj_busy_poll_sockopts(int socket_fd, uint32_t spin_us)
+{
+    int value;
+
+    if (socket_fd <= 0) return;
+
+    // raising SO_BUSY_POLL above net.core.busy_read needs CAP_NET_ADMIN, we still spin in userspace without it
+    value = spin_us;
+    if ( setsockopt(socket_fd, SOL_SOCKET, SO_BUSY_POLL, &value, sizeof(value)) ) {
+        fprintf(stderr, "warn: SO_BUSY_POLL '%s'\n", strerror(errno));
+        return;
+    }
+    // since 5.11, keeps the nic's interrupts masked while we are polling
+    value = spin_us ? 1 : 0;
+    setsockopt(socket_fd, SOL_SOCKET, SO_PREFER_BUSY_POLL, &value, sizeof(value));
+    value = VDJ_BUSY_POLL_NAPI_BUDGET;
+    if (spin_us) setsockopt(socket_fd, SOL_SOCKET, SO_BUSY_POLL_BUDGET, &value, sizeof(value));
+}
+
+int
+vdj_busy_poll_enable(vdj_t* v, uint32_t spin_us)
+{
+    v->busy_poll_us = spin_us;
+    vdj_busy_poll_sockopts(v->beat_socket_fd, spin_us);
+    vdj_busy_poll_sockopts(v->beat_unicast_socket_fd, spin_us);
+    return CDJ_OK;
+}
+
+int
+vdj_rx_stats_enable(vdj_t* v)
+{
+    int value = 1;
+
+    if ( setsockopt(v->beat_socket_fd, SOL_SOCKET, SO_TIMESTAMPNS, &value, sizeof(value)) ) {
+        fprintf(stderr, "error: SO_TIMESTAMPNS '%s'\n", strerror(errno));
+        return CDJ_ERROR;
+    }
+    vdj_rx_stats_reset(v);
+    v->measure_rx = 1;
+    return CDJ_OK;
+}
+
+void
+vdj_rx_stats_reset(vdj_t* v)
+{
+    vdj_rx_stats_t* stats = &v->beat_stats;
+    clockid_t cpu_clock;
+
+    memset(stats, 0, sizeof(vdj_rx_stats_t));
+    stats->latency_min = INT64_MAX;
+    stats->start = cdj_now();
+    // a thread that has not started yet has used no cpu
+    if ( (v->threads_joinable & (1 << VDJ_THREAD_BEAT)) &&
+         pthread_getcpuclockid(v->threads[VDJ_THREAD_BEAT], &cpu_clock) == 0 ) {
+        clock_gettime(cpu_clock, &stats->cpu_start);
+    }
+}
+
+float
+vdj_rx_stats_cpu(vdj_t* v)
+{
+    vdj_rx_stats_t* stats = &v->beat_stats;
+    struct timespec cpu;
+    clockid_t cpu_clock;
+    int64_t wall;
+
+    if ( ! (v->threads_joinable & (1 << VDJ_THREAD_BEAT)) ||
+         pthread_getcpuclockid(v->threads[VDJ_THREAD_BEAT], &cpu_clock) ||
+         clock_gettime(cpu_clock, &cpu) ) {
+        return 0.0;
+    }
+    wall = cdj_now() - stats->start;
+    if (wall <= 0) return 0.0;
+    return 100.0 * (cdj_timespec_to_nanos(&cpu) - cdj_timespec_to_nanos(&stats->cpu_start)) / wall;
+}
+
+void
+vdj_rx_stats_fprint(FILE* f, vdj_t* v)
+{
+    vdj_rx_stats_t* stats = &v->beat_stats;
+
+    if (stats->packets == 0) {
+        fprintf(f, "beat rx: no packets\n");
+        return;
+    }
+    fprintf(f, "beat rx: %s packets=%llu spin_hits=%llu blocks=%llu latency min=%.1fus avg=%.1fus max=%.1fus cpu=%.1f%%\n",
+        v->busy_poll_us ? "busy poll" : "recv",
+        (unsigned long long) stats->packets,
+        (unsigned long long) stats->spin_hits,
+        (unsigned long long) stats->blocks,
+        stats->latency_min / 1000.0,
+        (stats->latency_sum / (int64_t) stats->packets) / 1000.0,
+        stats->latency_max / 1000.0,
+        vdj_rx_stats_cpu(v));
+}
+
+/**
+ * recvmsg() so we can get at the kernel timestamp, only when measuring.
+ */
+static ssize_t
+vdj_beat_recv_measured(vdj_t* v, int socket_fd, uint8_t* packet, size_t len, int flags)
+{
+    vdj_rx_stats_t* stats = &v->beat_stats;
+    char control[CMSG_SPACE(sizeof(struct timespec))];
+    struct iovec iov = { packet, len };
+    struct msghdr msg;
+    struct cmsghdr* cmsg;
+    struct timespec kernel;
+    cdj_nanos_t now;
+    int64_t latency;
+    ssize_t rlen;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    rlen = recvmsg(socket_fd, &msg, flags);
+    if (rlen < 0) return rlen;
+
+    now = cdj_now();
+    for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_TIMESTAMPNS) {
+            memcpy(&kernel, CMSG_DATA(cmsg), sizeof(kernel));
+            latency = now - cdj_realtime_to_nanos(&kernel);
+            stats->packets++;
+            stats->latency_sum += latency;
+            if (latency < stats->latency_min) stats->latency_min = latency;
+            if (latency > stats->latency_max) stats->latency_max = latency;
+        }
+    }
+    return rlen;
+}
+
+static ssize_t
+vdj_beat_recv_once(vdj_t* v, int socket_fd, uint8_t* packet, size_t len, int flags)
+{
+    if (v->measure_rx) return vdj_beat_recv_measured(v, socket_fd, packet, len, flags);
+    return recv(socket_fd, packet, len, flags);
+}
+
+ssize_t
+vdj_beat_recv(vdj_t* v, int socket_fd, uint8_t* packet, size_t len)
+{
+    ssize_t rlen;
+    int64_t deadline;
+
+    if (v->busy_poll_us) {
+        deadline = cdj_now() + (int64_t) v->busy_poll_us * 1000;
+        do {
+            rlen = vdj_beat_recv_once(v, socket_fd, packet, len, MSG_DONTWAIT);
+            if (rlen >= 0) {
+                v->beat_stats.spin_hits++;
+                return rlen;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) return rlen;
+        } while (cdj_now() < deadline);
+        v->beat_stats.blocks++;
+    }
+
+    return vdj_beat_recv_once(v, socket_fd, packet, len, 0);
+}
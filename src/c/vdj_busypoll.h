@@ -0,0 +1,34 @@
+#ifndef _VDJ_BUSYPOLL_H_INCLUDED_
+#define _VDJ_BUSYPOLL_H_INCLUDED_
+
+#include <stdio.h>
+#include <sys/types.h>
+
+#include "vdj.h"
+
+/**
+ * Busy polling receive for the beat sockets, for dedicated sync boxes that can give up a core.
+ *
+ * The managed beat thread spins on non blocking recv() for up to spin_us and only then blocks, with
+ * SO_BUSY_POLL/SO_PREFER_BUSY_POLL set the kernel also polls the NIC queue instead of waiting for an interrupt.
+ * Measurement hooks record kernel rx timestamp to recv() return latency and the thread's CPU time,
+ * so interrupt driven recv() and busy polling can be compared on the same box.
+ */
+
+#define VDJ_BUSY_POLL_DEFAULT_US  1000000  // longer than a beat at any sane bpm, so the thread never sleeps while music plays
+#define VDJ_BUSY_POLL_NAPI_BUDGET 8        // packets per napi poll, beats never come in big bursts
+
+// set before vdj_init_managed_beat_thread(), spin_us 0 turns busy polling off
+int vdj_busy_poll_enable(vdj_t* v, uint32_t spin_us);
+
+// start recording vdj_rx_stats_t for the beat thread, enables SO_TIMESTAMPNS on the beat socket
+int vdj_rx_stats_enable(vdj_t* v);
+void vdj_rx_stats_reset(vdj_t* v);
+// CPU used by the beat thread as a percentage of wall time since the stats were reset
+float vdj_rx_stats_cpu(vdj_t* v);
+void vdj_rx_stats_fprint(FILE* f, vdj_t* v);
+
+// recv() used by the managed beat loop, spins if busy polling is enabled and records stats if they are enabled
+ssize_t vdj_beat_recv(vdj_t* v, int socket_fd, uint8_t* packet, size_t len);
+
+#endif // _VDJ_BUSYPOLL_H_INCLUDED_
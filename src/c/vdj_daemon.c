@@ -0,0 +1,498 @@
+/**
+ * Fan out of link events to local clients, see vdj_daemon.h
+ *
+ * Receive threads format each record once, through a vdj_stream sink, and send it to every client with
+ * MSG_DONTWAIT while holding the client lock.  Only when a send would block is the record queued, the daemon
+ * thread then waits for POLLOUT and flushes the queue in order.  The daemon thread also accepts clients, reads
+ * their commands and closes clients that were marked for dropping.
+ *
+ * @author teknopaul
+ */
+
+#define _GNU_SOURCE
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "cdj.h"
+#include "vdj.h"
+#include "vdj_thread.h"
+#include "vdj_master.h"
+#include "vdj_beatout.h"
+#include "vdj_stream.h"
+#include "vdj_daemon.h"
+
+typedef struct {
+    int                 fd;             // -1 if the slot is free
+    uint32_t            head;           // queued records are head to tail
+    uint32_t            tail;
+    uint16_t            len[VDJ_DAEMON_QUEUE];
+    uint8_t             records[VDJ_DAEMON_QUEUE][VDJ_DAEMON_RECORD_MAX];
+    unsigned int        drop:1;         // fell behind or went away, closed by the daemon thread
+} vdj_daemon_client_t;
+
+typedef struct {
+    vdj_t*              v;
+    char*               path;
+    int                 listen_fd;
+    int                 wake[2];        // pipe, written when a queue needs POLLOUT or a client a close
+    vdj_stream_t*       stream;
+    pthread_mutex_t     lock;
+    vdj_daemon_client_t clients[VDJ_DAEMON_CLIENTS];
+    uint64_t            gone;           // bit per player_id reported gone
+    // each player's last keepalive and status record, what a new client is sent first
+    uint16_t            last_len[VDJ_MAX_BACKLINE + 1][2];
+    uint8_t             last[VDJ_MAX_BACKLINE + 1][2][VDJ_DAEMON_RECORD_MAX];
+} vdj_daemon_t;
+
+static unsigned _Atomic vdj_daemon_running = ATOMIC_VAR_INIT(0);
+static int _Atomic vdj_daemon_connected = ATOMIC_VAR_INIT(0);
+static uint64_t _Atomic vdj_daemon_drops = ATOMIC_VAR_INIT(0);
+static vdj_daemon_t* vdj_daemon = NULL;
+
+/**
+ * Send or queue one record for one client, call with the lock held, returns 1 if the daemon thread has work
+ */
+static int
+vdj_daemon_send(vdj_daemon_client_t* c, const void* record, int len)
+{
+    ssize_t rv;
+
+    if (c->fd < 0 || c->drop) return 0;
+
+    if (c->head == c->tail) {
+        rv = send(c->fd, record, len, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (rv == len) return 0;
+        if (rv < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+            c->drop = 1;
+            return 1;
+        }
+    }
+    if (c->tail - c->head == VDJ_DAEMON_QUEUE) {
+        c->drop = 1;
+        vdj_daemon_drops++;
+        return 1;
+    }
+    memcpy(c->records[c->tail % VDJ_DAEMON_QUEUE], record, len);
+    c->len[c->tail % VDJ_DAEMON_QUEUE] = len;
+    c->tail++;
+    return 1;
+}
+
+static void
+vdj_daemon_wake(vdj_daemon_t* d)
+{
+    char b = 0;
+    if ( write(d->wake[1], &b, 1) < 0 ) {
+        // pipe full, the daemon thread is already due to wake
+    }
+}
+
+/**
+ * Keep the record if it is part of a player's state, call with the lock held
+ */
+static void
+vdj_daemon_keep(vdj_daemon_t* d, const void* record, int len)
+{
+    const vdj_stream_header_t* hdr = record;
+    int i;
+
+    if (hdr->player_id > VDJ_MAX_BACKLINE) return;
+
+    switch (hdr->event) {
+        case VDJ_STREAM_KEEPALIVE:
+        case VDJ_STREAM_STATUS:
+            i = hdr->event == VDJ_STREAM_STATUS;
+            memcpy(d->last[hdr->player_id][i], record, len);
+            d->last_len[hdr->player_id][i] = len;
+            break;
+        case VDJ_STREAM_GONE:
+            d->last_len[hdr->player_id][0] = 0;
+            d->last_len[hdr->player_id][1] = 0;
+            break;
+    }
+}
+
+static void
+vdj_daemon_sink(void* arg, const void* record, int len)
+{
+    vdj_daemon_t* d = arg;
+    int i, wake = 0;
+
+    if (len > VDJ_DAEMON_RECORD_MAX) return;
+
+    pthread_mutex_lock(&d->lock);
+    vdj_daemon_keep(d, record, len);
+    for (i = 0; i < VDJ_DAEMON_CLIENTS; i++) {
+        wake |= vdj_daemon_send(&d->clients[i], record, len);
+    }
+    pthread_mutex_unlock(&d->lock);
+    if (wake) vdj_daemon_wake(d);
+}
+
+void
+vdj_daemon_discovery_ph(vdj_t* v, cdj_discovery_packet_t* d_pkt)
+{
+    if (vdj_daemon) vdj_stream_discovery(vdj_daemon->stream, d_pkt->data, d_pkt->len, 0);
+}
+
+void
+vdj_daemon_update_ph(vdj_t* v, cdj_cdj_status_packet_t* cs_pkt)
+{
+    if (vdj_daemon) vdj_stream_update(vdj_daemon->stream, cs_pkt->data, cs_pkt->len, 0);
+}
+
+void
+vdj_daemon_beat_ph(vdj_t* v, cdj_beat_packet_t* b_pkt)
+{
+    if (vdj_daemon) vdj_stream_beat(vdj_daemon->stream, b_pkt->data, b_pkt->len, b_pkt->timestamp);
+}
+
+int
+vdj_daemon_clients()
+{
+    return vdj_daemon_connected;
+}
+
+uint64_t
+vdj_daemon_dropped()
+{
+    return vdj_daemon_drops;
+}
+
+static vdj_beatout_quantize
+vdj_daemon_quantize(const char* word)
+{
+    if (strcmp(word, "bar") == 0) return VDJ_BEATOUT_BAR;
+    if (strcmp(word, "beat") == 0) return VDJ_BEATOUT_BEAT;
+    return VDJ_BEATOUT_NOW;
+}
+
+/**
+ * Run one command, text is \0 terminated, reply->text says what happened
+ */
+static void
+vdj_daemon_command(vdj_daemon_t* d, char* text, vdj_daemon_reply_t* reply)
+{
+    char cmd[16], arg[16] = "", when[16] = "";
+    float bpm;
+
+    if ( sscanf(text, "%15s %15s %15s", cmd, arg, when) < 1 ) {
+        snprintf(reply->text, sizeof(reply->text), "empty command");
+        return;
+    }
+
+    if (strcmp(cmd, "bpm") == 0) {
+        bpm = atof(arg);
+        if (bpm <= 0.0 || bpm > 999.0) {
+            snprintf(reply->text, sizeof(reply->text), "usage: bpm 124.5 [now|beat|bar]");
+            return;
+        }
+        if ( vdj_beatout_set_tempo(d->v, bpm, vdj_daemon_quantize(when)) ) {
+            snprintf(reply->text, sizeof(reply->text), "tempo not set");
+            return;
+        }
+        reply->ok = 1;
+        snprintf(reply->text, sizeof(reply->text), "bpm %.2f", bpm);
+    }
+    else if (strcmp(cmd, "play") == 0) {
+        vdj_beatout_start(d->v, vdj_daemon_quantize(arg));
+        reply->ok = 1;
+        snprintf(reply->text, sizeof(reply->text), "playing");
+    }
+    else if (strcmp(cmd, "stop") == 0) {
+        vdj_beatout_stop(d->v, vdj_daemon_quantize(arg));
+        reply->ok = 1;
+        snprintf(reply->text, sizeof(reply->text), "stopping");
+    }
+    else if (strcmp(cmd, "master") == 0) {
+        if (d->v->backline == NULL) {
+            snprintf(reply->text, sizeof(reply->text), "no backline");
+            return;
+        }
+        vdj_request_master(d->v);
+        reply->ok = 1;
+        snprintf(reply->text, sizeof(reply->text), "master requested");
+    }
+    else {
+        snprintf(reply->text, sizeof(reply->text), "unknown command '%s'", cmd);
+    }
+}
+
+static void
+vdj_daemon_read(vdj_daemon_t* d, vdj_daemon_client_t* c)
+{
+    char text[128];
+    vdj_daemon_reply_t reply;
+    ssize_t len;
+    struct timespec ts;
+
+    if ( (len = recv(c->fd, text, sizeof(text) - 1, MSG_DONTWAIT)) <= 0 ) {
+        if (len == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+            pthread_mutex_lock(&d->lock);
+            c->drop = 1;
+            pthread_mutex_unlock(&d->lock);
+        }
+        return;
+    }
+    text[len] = '\0';
+
+    memset(&reply, 0, sizeof(reply));
+    vdj_daemon_command(d, text, &reply);
+    ts = cdj_nanos_to_realtime(cdj_now());
+    reply.hdr.len = sizeof(reply);
+    reply.hdr.event = VDJ_DAEMON_REPLY;
+    reply.hdr.player_id = d->v->player_id;
+    reply.hdr.ts = (int64_t) ts.tv_sec * CDJ_NANOS_PER_SEC + ts.tv_nsec;
+
+    pthread_mutex_lock(&d->lock);
+    vdj_daemon_send(c, &reply, sizeof(reply));
+    pthread_mutex_unlock(&d->lock);
+}
+
+static void
+vdj_daemon_flush(vdj_daemon_t* d, vdj_daemon_client_t* c)
+{
+    uint32_t i;
+    ssize_t rv;
+
+    pthread_mutex_lock(&d->lock);
+    while (c->head != c->tail && ! c->drop) {
+        i = c->head % VDJ_DAEMON_QUEUE;
+        rv = send(c->fd, c->records[i], c->len[i], MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (rv < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) c->drop = 1;
+            break;
+        }
+        c->head++;
+    }
+    pthread_mutex_unlock(&d->lock);
+}
+
+/**
+ * Send a new client every player's current state, only to that client, call with the lock held
+ */
+static int
+vdj_daemon_snapshot(vdj_daemon_t* d, vdj_daemon_client_t* c)
+{
+    vdj_stream_status_t status;
+    int id, wake = 0;
+
+    for (id = 1; id <= VDJ_MAX_BACKLINE; id++) {
+        if (d->last_len[id][0]) wake |= vdj_daemon_send(c, d->last[id][0], d->last_len[id][0]);
+        if (d->last_len[id][1] == sizeof(status)) {
+            // all of it is news to this client
+            memcpy(&status, d->last[id][1], sizeof(status));
+            status.changed = VDJ_STREAM_CHANGED_FLAGS | VDJ_STREAM_CHANGED_BPM | VDJ_STREAM_CHANGED_TRACK;
+            wake |= vdj_daemon_send(c, &status, sizeof(status));
+        }
+    }
+    return wake;
+}
+
+static void
+vdj_daemon_accept(vdj_daemon_t* d)
+{
+    int fd, i, wake = 0;
+
+    if ( (fd = accept4(d->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) < 0 ) return;
+
+    pthread_mutex_lock(&d->lock);
+    for (i = 0; i < VDJ_DAEMON_CLIENTS; i++) {
+        if (d->clients[i].fd < 0) {
+            memset(&d->clients[i], 0, sizeof(vdj_daemon_client_t));
+            d->clients[i].fd = fd;
+            vdj_daemon_connected++;
+            // so the new client learns every player's state, not only what changes from now
+            wake = vdj_daemon_snapshot(d, &d->clients[i]);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&d->lock);
+
+    if (i == VDJ_DAEMON_CLIENTS) {
+        fprintf(stderr, "warn: vdjd has %d clients already\n", VDJ_DAEMON_CLIENTS);
+        close(fd);
+        return;
+    }
+    if (wake) vdj_daemon_wake(d);
+}
+
+/**
+ * Tell clients about members whose keepalives stopped, the managed discovery thread only marks them
+ */
+static void
+vdj_daemon_scan_gone(vdj_daemon_t* d)
+{
+    vdj_link_member_t* m;
+    int i;
+
+    for (i = 1; i <= VDJ_MAX_BACKLINE; i++) {
+        if ( (m = vdj_get_link_member(d->v, i)) == NULL ) continue;
+        if (m->gone && ! (d->gone & (1ULL << i))) {
+            d->gone |= 1ULL << i;
+            vdj_stream_gone(d->stream, i, 0);
+        } else if ( ! m->gone ) {
+            d->gone &= ~(1ULL << i);
+        }
+    }
+}
+
+static void*
+vdj_daemon_loop(void* arg)
+{
+    vdj_daemon_t* d = arg;
+    struct pollfd pfds[VDJ_DAEMON_CLIENTS + 2];
+    vdj_daemon_client_t* polled[VDJ_DAEMON_CLIENTS];
+    cdj_nanos_t next_scan = cdj_now();
+    char drain[64];
+    int i, n;
+
+    while (vdj_daemon_running) {
+        pfds[0].fd = d->listen_fd;
+        pfds[0].events = POLLIN;
+        pfds[1].fd = d->wake[0];
+        pfds[1].events = POLLIN;
+        n = 0;
+
+        pthread_mutex_lock(&d->lock);
+        for (i = 0; i < VDJ_DAEMON_CLIENTS; i++) {
+            vdj_daemon_client_t* c = &d->clients[i];
+            if (c->fd < 0) continue;
+            if (c->drop) {
+                close(c->fd);
+                c->fd = -1;
+                vdj_daemon_connected--;
+                continue;
+            }
+            pfds[n + 2].fd = c->fd;
+            pfds[n + 2].events = POLLIN | (c->head != c->tail ? POLLOUT : 0);
+            polled[n++] = c;
+        }
+        pthread_mutex_unlock(&d->lock);
+
+        if ( poll(pfds, n + 2, VDJ_DAEMON_SCAN_MILLIS) < 0 ) continue;
+
+        if (pfds[1].revents & POLLIN) {
+            while ( read(d->wake[0], drain, sizeof(drain)) > 0 );
+        }
+        for (i = 0; i < n; i++) {
+            if (pfds[i + 2].revents & POLLOUT) vdj_daemon_flush(d, polled[i]);
+            if (pfds[i + 2].revents & (POLLIN | POLLHUP | POLLERR)) vdj_daemon_read(d, polled[i]);
+        }
+        if (pfds[0].revents & POLLIN) vdj_daemon_accept(d);
+
+        if (cdj_now() >= next_scan) {
+            vdj_daemon_scan_gone(d);
+            next_scan = cdj_now() + VDJ_DAEMON_SCAN_MILLIS * CDJ_NANOS_PER_MILLI;
+        }
+    }
+
+    // handlers may still be running, the daemon struct is left for them, only the sockets go
+    pthread_mutex_lock(&d->lock);
+    for (i = 0; i < VDJ_DAEMON_CLIENTS; i++) {
+        if (d->clients[i].fd >= 0) close(d->clients[i].fd);
+        d->clients[i].fd = -1;
+    }
+    vdj_daemon_connected = 0;
+    pthread_mutex_unlock(&d->lock);
+    close(d->listen_fd);
+    unlink(d->path);
+    return NULL;
+}
+
+static int
+vdj_daemon_listen(const char* path)
+{
+    struct sockaddr_un addr;
+    int fd;
+
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "error: socket path too long '%s'\n", path);
+        return -1;
+    }
+    if ( (fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0)) < 0 ) {
+        fprintf(stderr, "error: unix socket '%s'\n", strerror(errno));
+        return -1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    unlink(path);
+    if ( bind(fd, (struct sockaddr*) &addr, sizeof(addr)) || listen(fd, VDJ_DAEMON_CLIENTS) ) {
+        fprintf(stderr, "error: listen '%s' '%s'\n", path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static void
+vdj_daemon_free(vdj_daemon_t* d)
+{
+    if (d->stream) vdj_stream_destroy(d->stream);
+    pthread_mutex_destroy(&d->lock);
+    free(d->path);
+    free(d);
+}
+
+int
+vdj_init_daemon_thread(vdj_t* v, const char* path)
+{
+    vdj_daemon_t* d;
+    int i;
+
+    if (vdj_daemon_running || vdj_daemon) return CDJ_ERROR;
+
+    if ( (d = calloc(1, sizeof(vdj_daemon_t))) == NULL ) return CDJ_ERROR;
+    d->v = v;
+    for (i = 0; i < VDJ_DAEMON_CLIENTS; i++) d->clients[i].fd = -1;
+    pthread_mutex_init(&d->lock, NULL);
+
+    if ( (d->path = strdup(path)) == NULL ||
+         (d->stream = vdj_stream_sink_new(VDJ_STREAM_BINARY, vdj_daemon_sink, d)) == NULL ) {
+        vdj_daemon_free(d);
+        return CDJ_ERROR;
+    }
+    if ( pipe2(d->wake, O_NONBLOCK | O_CLOEXEC) ) {
+        fprintf(stderr, "error: pipe '%s'\n", strerror(errno));
+        vdj_daemon_free(d);
+        return CDJ_ERROR;
+    }
+    if ( (d->listen_fd = vdj_daemon_listen(path)) < 0 ) {
+        close(d->wake[0]);
+        close(d->wake[1]);
+        vdj_daemon_free(d);
+        return CDJ_ERROR;
+    }
+
+    vdj_daemon = d;
+    vdj_daemon_running = 1;
+    if ( vdj_thread_create(v, VDJ_THREAD_DAEMON, vdj_daemon_loop, d) ) {
+        vdj_daemon_running = 0;
+        vdj_daemon = NULL;
+        close(d->listen_fd);
+        unlink(path);
+        close(d->wake[0]);
+        close(d->wake[1]);
+        vdj_daemon_free(d);
+        return CDJ_ERROR;
+    }
+    return CDJ_OK;
+}
+
+void
+vdj_stop_daemon_thread(vdj_t* v)
+{
+    vdj_daemon_running = 0;
+    if (vdj_daemon) vdj_daemon_wake(vdj_daemon);
+}
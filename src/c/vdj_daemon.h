@@ -0,0 +1,49 @@
+#ifndef _VDJ_DAEMON_H_INCLUDED_
+#define _VDJ_DAEMON_H_INCLUDED_
+
+#include "cdj.h"
+#include "vdj.h"
+#include "vdj_stream.h"
+
+/**
+ * One link member shared by many local processes.
+ *
+ * The daemon listens on a SOCK_SEQPACKET unix socket, each message to a client is one binary vdj_stream.h
+ * record: keepalives, beats, status changes and members gone.  The receive threads send to every client
+ * without blocking, a client that is not keeping up has its records queued, and a client that falls
+ * VDJ_DAEMON_QUEUE records behind is disconnected, so one stalled reader never delays the link or the others.
+ *
+ * Clients may send commands, one per message, each answered by a vdj_daemon_reply_t:
+ *
+ *    bpm 124.5 [now|beat|bar]    change our tempo
+ *    play [now|beat|bar]         start sending beats
+ *    stop [now|beat|bar]         stop sending beats
+ *    master                      ask to become tempo master
+ */
+
+#define VDJ_DAEMON_PATH         "/run/vdjd.sock"
+#define VDJ_DAEMON_CLIENTS      16
+#define VDJ_DAEMON_QUEUE        64      // records a client may fall behind before it is dropped
+#define VDJ_DAEMON_RECORD_MAX   64
+#define VDJ_DAEMON_SCAN_MILLIS  500     // how often members are checked for having gone
+#define VDJ_DAEMON_REPLY        0x40    // vdj_stream_header_t.event of a reply
+
+typedef struct __attribute__((packed)) {
+    vdj_stream_header_t hdr;        // player_id is ours
+    uint8_t         ok;             // 1 if the command was done
+    char            text[VDJ_DAEMON_RECORD_MAX - sizeof(vdj_stream_header_t) - 1];  // \0 terminated
+} vdj_daemon_reply_t;
+
+int vdj_init_daemon_thread(vdj_t* v, const char* path);
+void vdj_stop_daemon_thread(vdj_t* v);
+
+// managed packet handlers that fan packets out to clients, pass to vdj_init_managed_*_thread() or chain them
+void vdj_daemon_discovery_ph(vdj_t* v, cdj_discovery_packet_t* d_pkt);
+void vdj_daemon_update_ph(vdj_t* v, cdj_cdj_status_packet_t* cs_pkt);
+void vdj_daemon_beat_ph(vdj_t* v, cdj_beat_packet_t* b_pkt);
+
+// clients connected and dropped for falling behind
+int vdj_daemon_clients();
+uint64_t vdj_daemon_dropped();
+
+#endif // _VDJ_DAEMON_H_INCLUDED_
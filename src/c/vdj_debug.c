@@ -14,12 +14,16 @@
 #include "vdj.h"
 #include "vdj_net.h"
 #include "vdj_discovery.h"
+#include "vdj_filter.h"
 
 /**
  * Debug tool, carefull this code does not behave like a well mannered CDJ, it does not necessarily maintain the 
  * member count for example so XDJs will always complain about its prescence on the network in the form of id_use packets.
  */
 
+// compiled once, run on the raw packet before anything is parsed or printed
+static vdj_filter_t* filter = NULL;
+
 static void handle_discovery_datagram(vdj_t* v, uint8_t* packet, uint16_t len);
 static void handle_update_datagram(uint8_t* packet, uint16_t len);
 static void handle_beat_datagram(uint8_t* packet, uint16_t len);
@@ -34,6 +38,9 @@ static void usage()
     printf("    -d - debug discovery frames on port 50000\n");
     printf("    -u - debug update frames on port 50002\n");
     printf("    -b - debug beat frames on port 50001\n");
+    printf("    -f - only packets matching this filter, e.g. 'type==CDJ_STATUS && player==2 && flags&master'\n");
+    printf("         fields port type subtype len player bpm pitch flags bar, raw byte[N] u16[N] u32[N]\n");
+    printf("         debugs all three ports unless one of -d -u -b is given\n");
     printf("    -k - just send keepalives\n");
     printf("    -c - mimic CDJ\n");
     printf("    -x - mimic XDJ\n");
@@ -67,7 +74,7 @@ int main (int argc, char* argv[])
     // likely to have wifi and LAN for CDJs at home
     // TODO likely not to have DHCPd in a club
     int c;
-    while ( ( c = getopt(argc, argv, "p:i:dubkKShmascx") ) != EOF) {
+    while ( ( c = getopt(argc, argv, "p:i:f:dubkKShmascx") ) != EOF) {
         switch (c) {
             case 'h':
                 usage();
@@ -109,9 +116,16 @@ int main (int argc, char* argv[])
             case 'i':
                 iface = optarg;
                 break;
+            case 'f':
+                if ( ! (filter = vdj_filter_compile(optarg)) ) return 1;
+                break;
         }
     }
 
+    if (filter && ! (debug_discovery | debug_update | debug_beat)) {
+        debug_discovery = debug_update = debug_beat = 1;
+    }
+
     /*
      * init the vcdj
      */
@@ -195,7 +209,7 @@ vdj_debug_discoverys(void* arg)
         if (len == -1) {
             fprintf(stderr, "socket read error: %s", strerror(errno));
             return NULL;
-        } else {
+        } else if ( ! filter || vdj_filter_match(filter, CDJ_DISCOVERY_PORT, packet, len) ) {
             handle_discovery_datagram(v, packet, len);
         }
     }
@@ -275,7 +289,7 @@ vdj_debug_beats(void* arg)
         if (len == -1) {
             fprintf(stderr, "socket read error: %s", strerror(errno));
             return NULL;
-        } else {
+        } else if ( ! filter || vdj_filter_match(filter, CDJ_BEAT_PORT, packet, len) ) {
             handle_beat_datagram(packet, len);
         }
     }
@@ -322,7 +336,7 @@ vdj_debug_updates(void* arg)
         if (len == -1) {
             fprintf(stderr, "socket read error: %s", strerror(errno));
             return NULL;
-        } else {
+        } else if ( ! filter || vdj_filter_match(filter, CDJ_UPDATE_PORT, packet, len) ) {
             handle_update_datagram(packet, len);
         }
     }
@@ -0,0 +1,359 @@
+/**
+ * Batched remote deck control.
+ *
+ * The batch in flight hangs off v->decks so the update thread can find it, a module lock guards that pointer
+ * and every batch's state.  Waiters sleep on the batch's condition, signalled whenever a command completes.
+ *
+ * @author teknopaul
+ */
+
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+
+#include "cdj.h"
+#include "vdj.h"
+#include "vdj_metrics.h"
+#include "vdj_flight.h"
+#include "vdj_deck.h"
+
+struct vdj_deck_batch_s {
+    vdj_t*              v;
+    pthread_cond_t      cond;
+    int                 count;
+    int                 pending;        // sent and not yet done
+    vdj_deck_cmd_t      cmds[VDJ_DECK_MAX];
+    uint8_t*            packets[VDJ_DECK_MAX];
+    uint16_t            lengths[VDJ_DECK_MAX];
+    uint16_t            ports[VDJ_DECK_MAX];
+};
+
+static pthread_mutex_t vdj_deck_lock = PTHREAD_MUTEX_INITIALIZER;
+
+vdj_deck_batch_t*
+vdj_deck_batch_new(vdj_t* v)
+{
+    pthread_condattr_t attr;
+
+    vdj_deck_batch_t* b = (vdj_deck_batch_t*) calloc(1, sizeof(vdj_deck_batch_t));
+    if (b == NULL) return NULL;
+    b->v = v;
+
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&b->cond, &attr);
+    pthread_condattr_destroy(&attr);
+    return b;
+}
+
+void
+vdj_deck_batch_destroy(vdj_deck_batch_t* b)
+{
+    int i;
+
+    pthread_mutex_lock(&vdj_deck_lock);
+    if (b->v->decks == b) b->v->decks = NULL;
+    pthread_mutex_unlock(&vdj_deck_lock);
+
+    for (i = 0; i < b->count; i++) free(b->packets[i]);
+    pthread_cond_destroy(&b->cond);
+    free(b);
+}
+
+static vdj_deck_cmd_t*
+vdj_deck_add(vdj_deck_batch_t* b, uint8_t player_id, vdj_deck_op op, uint8_t* packet, uint16_t length, uint16_t port)
+{
+    vdj_deck_cmd_t* cmd;
+
+    if (packet == NULL) return NULL;
+    pthread_mutex_lock(&vdj_deck_lock);
+    if (b->count == VDJ_DECK_MAX || b->v->decks == b) {
+        pthread_mutex_unlock(&vdj_deck_lock);
+        fprintf(stderr, "error: deck batch full or already sent\n");
+        free(packet);
+        return NULL;
+    }
+    cmd = &b->cmds[b->count];
+    memset(cmd, 0, sizeof(vdj_deck_cmd_t));
+    cmd->player_id = player_id;
+    cmd->op = op;
+    b->packets[b->count] = packet;
+    b->lengths[b->count] = length;
+    b->ports[b->count] = port;
+    b->count++;
+    pthread_mutex_unlock(&vdj_deck_lock);
+    return cmd;
+}
+
+int
+vdj_deck_sync(vdj_deck_batch_t* b, uint8_t player_id, int on)
+{
+    uint16_t length;
+    uint8_t* pkt = cdj_create_sync_control_packet(&length, b->v->model, b->v->player_id,
+        on ? CDJ_SYNC_CONTROL_ON : CDJ_SYNC_CONTROL_OFF);
+
+    if ( ! vdj_deck_add(b, player_id, on ? VDJ_DECK_SYNC_ON : VDJ_DECK_SYNC_OFF, pkt, length, CDJ_BEAT_PORT) ) {
+        return CDJ_ERROR;
+    }
+    return CDJ_OK;
+}
+
+int
+vdj_deck_master(vdj_deck_batch_t* b, uint8_t player_id)
+{
+    uint16_t length;
+    uint8_t* pkt = cdj_create_sync_control_packet(&length, b->v->model, b->v->player_id, CDJ_SYNC_CONTROL_MASTER);
+
+    if ( ! vdj_deck_add(b, player_id, VDJ_DECK_MASTER, pkt, length, CDJ_BEAT_PORT) ) return CDJ_ERROR;
+    return CDJ_OK;
+}
+
+int
+vdj_deck_load(vdj_deck_batch_t* b, uint8_t player_id, uint8_t source_player, uint8_t slot, uint8_t track_type,
+              uint32_t track_id)
+{
+    uint16_t length;
+    vdj_deck_cmd_t* cmd;
+    uint8_t* pkt = cdj_create_load_track_packet(&length, b->v->model, b->v->player_id,
+        source_player, slot, track_type, track_id);
+
+    if ( ! (cmd = vdj_deck_add(b, player_id, VDJ_DECK_LOAD, pkt, length, CDJ_UPDATE_PORT)) ) return CDJ_ERROR;
+    // the batch is not sent yet, but a batch sent from another thread could be matching status packets
+    pthread_mutex_lock(&vdj_deck_lock);
+    cmd->source_player = source_player;
+    cmd->slot = slot;
+    cmd->track_type = track_type;
+    cmd->track_id = track_id;
+    pthread_mutex_unlock(&vdj_deck_lock);
+    return CDJ_OK;
+}
+
+int
+vdj_deck_send(vdj_deck_batch_t* b)
+{
+    struct sockaddr_in dests[VDJ_DECK_MAX];
+    struct iovec iov[VDJ_DECK_MAX];
+    struct mmsghdr msgs[VDJ_DECK_MAX];
+    int index[VDJ_DECK_MAX];
+    vdj_link_member_t* m;
+    cdj_nanos_t now;
+    int i, n = 0, sent;
+
+    if (b->v->send_socket_fd == 0) {
+        fprintf(stderr, "error: socket not open\n");
+        return CDJ_ERROR;
+    }
+
+    pthread_mutex_lock(&vdj_deck_lock);
+    if (b->v->decks && b->v->decks != b) {
+        pthread_mutex_unlock(&vdj_deck_lock);
+        fprintf(stderr, "error: another deck batch is in flight\n");
+        return CDJ_ERROR;
+    }
+
+    memset(msgs, 0, sizeof(msgs));
+    for (i = 0; i < b->count; i++) {
+        if (b->cmds[i].state != VDJ_DECK_QUEUED) continue;
+        m = vdj_get_link_member(b->v, b->cmds[i].player_id);
+        if (m == NULL || m->ip_addr == NULL) {
+            fprintf(stderr, "error: player %d unknown\n", b->cmds[i].player_id);
+            b->cmds[i].state = VDJ_DECK_FAILED;
+            continue;
+        }
+        memset(&dests[n], 0, sizeof(struct sockaddr_in));
+        dests[n].sin_family = AF_INET;
+        dests[n].sin_addr.s_addr = m->ip_addr->sin_addr.s_addr;
+        dests[n].sin_port = (in_port_t)htons(b->ports[i]);
+        iov[n].iov_base = b->packets[i];
+        iov[n].iov_len = b->lengths[i];
+        msgs[n].msg_hdr.msg_name = &dests[n];
+        msgs[n].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+        msgs[n].msg_hdr.msg_iov = &iov[n];
+        msgs[n].msg_hdr.msg_iovlen = 1;
+        index[n++] = i;
+    }
+
+    // status packets for this batch may arrive before sendmmsg() returns
+    b->v->decks = b;
+    now = cdj_now();
+    for (i = 0; i < n; i++) {
+        b->cmds[index[i]].state = VDJ_DECK_SENT;
+        b->cmds[index[i]].sent = now;
+    }
+    b->pending += n;
+
+    sent = n ? sendmmsg(b->v->send_socket_fd, msgs, n, 0) : 0;
+    if (sent == -1) {
+        fprintf(stderr, "error: deck control sendmmsg '%s'\n", strerror(errno));
+        sent = 0;
+    }
+    for (i = 0; i < n; i++) {
+        vdj_metrics_tx(b->ports[index[i]], b->packets[index[i]], b->lengths[index[i]], i >= sent);
+        vdj_flight_tx(b->ports[index[i]], b->packets[index[i]], b->lengths[index[i]], i >= sent);
+    }
+    for (i = sent; i < n; i++) {
+        b->cmds[index[i]].state = VDJ_DECK_FAILED;
+        b->pending--;
+    }
+    pthread_mutex_unlock(&vdj_deck_lock);
+
+    return sent == n ? CDJ_OK : CDJ_ERROR;
+}
+
+int
+vdj_deck_wait(vdj_deck_batch_t* b, int64_t timeout)
+{
+    struct timespec ts;
+    int i, ok = 1;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    ts = cdj_nanos_to_timespec(cdj_timespec_to_nanos(&ts) + timeout);
+
+    pthread_mutex_lock(&vdj_deck_lock);
+    while (b->pending) {
+        if ( pthread_cond_timedwait(&b->cond, &vdj_deck_lock, &ts) == ETIMEDOUT ) break;
+    }
+    for (i = 0; i < b->count; i++) {
+        if (b->cmds[i].state == VDJ_DECK_SENT || b->cmds[i].state == VDJ_DECK_ACKED) {
+            b->cmds[i].state = VDJ_DECK_TIMEOUT;
+        }
+        if (b->cmds[i].state != VDJ_DECK_DONE) ok = 0;
+    }
+    b->pending = 0;
+    if (b->v->decks == b) b->v->decks = NULL;
+    pthread_mutex_unlock(&vdj_deck_lock);
+
+    return ok ? CDJ_OK : CDJ_ERROR;
+}
+
+int
+vdj_deck_count(vdj_deck_batch_t* b)
+{
+    int count;
+
+    pthread_mutex_lock(&vdj_deck_lock);
+    count = b->count;
+    pthread_mutex_unlock(&vdj_deck_lock);
+    return count;
+}
+
+int
+vdj_deck_get(vdj_deck_batch_t* b, int i, vdj_deck_cmd_t* cmd)
+{
+    if (i < 0 || i >= b->count) return CDJ_ERROR;
+    pthread_mutex_lock(&vdj_deck_lock);
+    memcpy(cmd, &b->cmds[i], sizeof(vdj_deck_cmd_t));
+    pthread_mutex_unlock(&vdj_deck_lock);
+    return CDJ_OK;
+}
+
+static const char*
+vdj_deck_op_name(vdj_deck_op op)
+{
+    switch (op) {
+        case VDJ_DECK_SYNC_ON  : return "sync on";
+        case VDJ_DECK_SYNC_OFF : return "sync off";
+        case VDJ_DECK_MASTER   : return "master";
+        case VDJ_DECK_LOAD     : return "load";
+    }
+    return "?";
+}
+
+static const char*
+vdj_deck_state_name(vdj_deck_state state)
+{
+    switch (state) {
+        case VDJ_DECK_QUEUED  : return "queued";
+        case VDJ_DECK_SENT    : return "sent";
+        case VDJ_DECK_ACKED   : return "acked";
+        case VDJ_DECK_DONE    : return "done";
+        case VDJ_DECK_TIMEOUT : return "timeout";
+        case VDJ_DECK_FAILED  : return "failed";
+    }
+    return "?";
+}
+
+void
+vdj_deck_fprint(FILE* f, vdj_deck_batch_t* b)
+{
+    vdj_deck_cmd_t cmd;
+    int i;
+
+    for (i = 0; i < b->count; i++) {
+        vdj_deck_get(b, i, &cmd);
+        fprintf(f, "player %02d %-8s %-7s", cmd.player_id, vdj_deck_op_name(cmd.op), vdj_deck_state_name(cmd.state));
+        if (cmd.acked) fprintf(f, " ack=%.1fms", (cmd.acked - cmd.sent) / 1000000.0);
+        if (cmd.done) fprintf(f, " done=%.1fms", (cmd.done - cmd.sent) / 1000000.0);
+        fprintf(f, "\n");
+    }
+}
+
+//SNIP_deck_confirmed
+static int
+vdj_deck_confirmed(vdj_deck_cmd_t* cmd, cdj_cdj_status_packet_t* cs_pkt)
+{
+    uint8_t flags = cdj_status_flags(cs_pkt);
+
+    switch (cmd->op) {
+        case VDJ_DECK_SYNC_ON  : return flags & CDJ_STAT_FLAG_SYNC;
+        case VDJ_DECK_SYNC_OFF : return ! (flags & CDJ_STAT_FLAG_SYNC);
+        case VDJ_DECK_MASTER   : return flags & CDJ_STAT_FLAG_MASTER;
+        case VDJ_DECK_LOAD     : return cdj_status_track_id(cs_pkt) == cmd->track_id &&
+                                        cdj_status_playing_from(cs_pkt) == cmd->source_player &&
+                                        cdj_status_playing_from_slot(cs_pkt) == cmd->slot;
+    }
+    return 0;
+}
+//SNIP_deck_confirmed
+
+void
+vdj_deck_status(vdj_t* v, cdj_cdj_status_packet_t* cs_pkt)
+{
+    vdj_deck_batch_t* b;
+    vdj_deck_cmd_t* cmd;
+    int i;
+
+    pthread_mutex_lock(&vdj_deck_lock);
+    if ( (b = v->decks) ) {
+        for (i = 0; i < b->count; i++) {
+            cmd = &b->cmds[i];
+            if (cmd->player_id != cs_pkt->player_id) continue;
+            if (cmd->state != VDJ_DECK_SENT && cmd->state != VDJ_DECK_ACKED) continue;
+            if ( vdj_deck_confirmed(cmd, cs_pkt) ) {
+                cmd->state = VDJ_DECK_DONE;
+                cmd->done = cdj_now();
+                b->pending--;
+                pthread_cond_broadcast(&b->cond);
+            }
+        }
+    }
+    pthread_mutex_unlock(&vdj_deck_lock);
+}
+
+void
+vdj_deck_load_ack(vdj_t* v, uint8_t player_id)
+{
+    vdj_deck_batch_t* b;
+    vdj_deck_cmd_t* cmd;
+    int i;
+
+    pthread_mutex_lock(&vdj_deck_lock);
+    if ( (b = v->decks) ) {
+        for (i = 0; i < b->count; i++) {
+            cmd = &b->cmds[i];
+            if (cmd->player_id == player_id && cmd->op == VDJ_DECK_LOAD && cmd->state == VDJ_DECK_SENT) {
+                cmd->state = VDJ_DECK_ACKED;
+                cmd->acked = cdj_now();
+            }
+        }
+    }
+    pthread_mutex_unlock(&vdj_deck_lock);
+}
@@ -0,0 +1,74 @@
+#ifndef _VDJ_DECK_H_INCLUDED_
+#define _VDJ_DECK_H_INCLUDED_
+
+#include <stdio.h>
+
+#include "cdj.h"
+#include "vdj.h"
+
+/**
+ * Remote deck control, sync on/off, tempo master and load track for many decks at once.
+ *
+ * Commands are added to a batch, the packets are built as they are added and the whole batch goes out in one
+ * sendmmsg().  Completion is tracked from what the decks report back: a load is acked with a
+ * CDJ_LOAD_TRACK_ACK and done when the deck's status packets show the track, sync and master are done when
+ * the status flags change.  Needs the managed update thread, it feeds status packets to the active batch.
+ */
+
+#define VDJ_DECK_MAX            16          // commands in a batch
+#define VDJ_DECK_TIMEOUT_NANOS  2000000000  // status packets come every 200ms, give a deck ten of them
+
+typedef enum {
+    VDJ_DECK_SYNC_ON = 1,
+    VDJ_DECK_SYNC_OFF,
+    VDJ_DECK_MASTER,
+    VDJ_DECK_LOAD
+} vdj_deck_op;
+
+typedef enum {
+    VDJ_DECK_QUEUED = 0,
+    VDJ_DECK_SENT,
+    VDJ_DECK_ACKED,     // load acked, track not showing in status yet
+    VDJ_DECK_DONE,
+    VDJ_DECK_TIMEOUT,
+    VDJ_DECK_FAILED     // deck unknown or the send failed
+} vdj_deck_state;
+
+typedef struct {
+    uint8_t             player_id;
+    vdj_deck_op         op;
+    uint8_t             source_player;  // for VDJ_DECK_LOAD
+    uint8_t             slot;
+    uint8_t             track_type;
+    uint32_t            track_id;
+    vdj_deck_state      state;
+    cdj_nanos_t         sent;
+    cdj_nanos_t         acked;
+    cdj_nanos_t         done;           // when the status confirmed it, done - sent is the completion latency
+} vdj_deck_cmd_t;
+
+typedef struct vdj_deck_batch_s vdj_deck_batch_t;
+
+vdj_deck_batch_t* vdj_deck_batch_new(vdj_t* v);
+void vdj_deck_batch_destroy(vdj_deck_batch_t* b);
+
+int vdj_deck_sync(vdj_deck_batch_t* b, uint8_t player_id, int on);
+int vdj_deck_master(vdj_deck_batch_t* b, uint8_t player_id);
+int vdj_deck_load(vdj_deck_batch_t* b, uint8_t player_id, uint8_t source_player, uint8_t slot, uint8_t track_type,
+                  uint32_t track_id);
+
+// send every queued command in one go, only one batch per vdj can be in flight
+int vdj_deck_send(vdj_deck_batch_t* b);
+// CDJ_OK when all commands are done, otherwise unfinished ones are marked VDJ_DECK_TIMEOUT
+int vdj_deck_wait(vdj_deck_batch_t* b, int64_t timeout);
+
+int vdj_deck_count(vdj_deck_batch_t* b);
+// copy of the i'th command and its state
+int vdj_deck_get(vdj_deck_batch_t* b, int i, vdj_deck_cmd_t* cmd);
+void vdj_deck_fprint(FILE* f, vdj_deck_batch_t* b);
+
+// called by the managed update thread
+void vdj_deck_status(vdj_t* v, cdj_cdj_status_packet_t* cs_pkt);
+void vdj_deck_load_ack(vdj_t* v, uint8_t player_id);
+
+#endif // _VDJ_DECK_H_INCLUDED_
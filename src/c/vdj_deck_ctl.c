@@ -0,0 +1,144 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "cdj.h"
+#include "vdj.h"
+#include "vdj_net.h"
+#include "vdj_discovery.h"
+#include "vdj_deck.h"
+
+/**
+ * Joins the ProLink network and sends sync, master and load track commands to many decks in one go,
+ * then waits for each deck to confirm and prints how long each one took.
+ *
+ * @author teknopaul
+ */
+
+static void
+usage()
+{
+    printf("Control several decks at once and report when each has done it\n");
+    printf("options:\n");
+    printf("    -i - network interface to use, required if pc has more than one\n");
+    printf("    -p - player id for our virtual cdj, default is auto assign\n");
+    printf("    -s - players to turn sync on, e.g. 1,2\n");
+    printf("    -o - players to turn sync off\n");
+    printf("    -m - player to make tempo master\n");
+    printf("    -l - load a track, player:source_player:slot:rekordbox_id, may be repeated\n");
+    printf("    -t - timeout in millis, default %lld\n", VDJ_DECK_TIMEOUT_NANOS / CDJ_NANOS_PER_MILLI);
+    printf("    -h - display this text\n");
+    exit(0);
+}
+
+static int
+add_sync(vdj_deck_batch_t* b, char* list, int on)
+{
+    char* tok;
+    for (tok = strtok(list, ","); tok; tok = strtok(NULL, ",")) {
+        if ( vdj_deck_sync(b, atoi(tok), on) ) return CDJ_ERROR;
+    }
+    return CDJ_OK;
+}
+
+static int
+add_load(vdj_deck_batch_t* b, char* arg)
+{
+    unsigned int player, source, slot, track_id;
+
+    if (sscanf(arg, "%u:%u:%u:%u", &player, &source, &slot, &track_id) != 4) {
+        fprintf(stderr, "error: load '%s' should be player:source_player:slot:rekordbox_id\n", arg);
+        return CDJ_ERROR;
+    }
+    return vdj_deck_load(b, player, source, slot, CDJ_TRACK_TYPE_REKORDBOX, track_id);
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned int flags = 0;
+    uint8_t player_id = 0;
+    char* iface = NULL;
+    char* sync_on = NULL;
+    char* sync_off = NULL;
+    char* loads[VDJ_DECK_MAX];
+    int load_count = 0;
+    int master = 0;
+    int64_t timeout = VDJ_DECK_TIMEOUT_NANOS;
+    int i, ok;
+    vdj_t* v;
+    vdj_deck_batch_t* b;
+
+    int c;
+    while ( ( c = getopt(argc, argv, "i:p:s:o:m:l:t:h") ) != EOF) {
+        switch (c) {
+            case 'h':
+                usage();
+                break;
+            case 'i':
+                iface = optarg;
+                break;
+            case 'p':
+                player_id = atoi(optarg);
+                if (player_id < 0xf) flags |= player_id;
+                break;
+            case 's':
+                sync_on = optarg;
+                break;
+            case 'o':
+                sync_off = optarg;
+                break;
+            case 'm':
+                master = atoi(optarg);
+                break;
+            case 'l':
+                if (load_count < VDJ_DECK_MAX) loads[load_count++] = optarg;
+                break;
+            case 't':
+                timeout = atoll(optarg) * CDJ_NANOS_PER_MILLI;
+                break;
+        }
+    }
+
+    if (sync_on == NULL && sync_off == NULL && master == 0 && load_count == 0) usage();
+    if (player_id == 0) flags |= VDJ_FLAG_AUTO_ID;
+
+    if ( ! (v = vdj_init_iface(iface, flags)) ) {
+        fprintf(stderr, "error: creating virtual cdj\n");
+        return 1;
+    }
+    if ( vdj_open_sockets(v) != CDJ_OK ) {
+        fprintf(stderr, "error: failed to open sockets\n");
+        vdj_destroy(v);
+        return 1;
+    }
+    if ( vdj_exec_discovery(v) != CDJ_OK ) {
+        fprintf(stderr, "error: cdj initialization\n");
+        vdj_destroy(v);
+        return 1;
+    }
+    if ( vdj_init_managed_discovery_thread(v, NULL) != CDJ_OK ||
+         vdj_init_managed_update_thread(v, NULL) != CDJ_OK ||
+         vdj_init_status_thread(v) != CDJ_OK ) {
+        fprintf(stderr, "error: init managed threads\n");
+        vdj_destroy(v);
+        return 1;
+    }
+
+    if ( (b = vdj_deck_batch_new(v)) == NULL ) return 1;
+    if ( (sync_on && add_sync(b, sync_on, 1)) || (sync_off && add_sync(b, sync_off, 0)) ||
+         (master && vdj_deck_master(b, master)) ) {
+        return 1;
+    }
+    for (i = 0; i < load_count; i++) {
+        if ( add_load(b, loads[i]) ) return 1;
+    }
+
+    // wait for the decks' addresses
+    sleep(3);
+    vdj_deck_send(b);
+    ok = vdj_deck_wait(b, timeout) == CDJ_OK;
+    vdj_deck_fprint(stdout, b);
+    vdj_deck_batch_destroy(b);
+    return ok ? 0 : 1;
+}
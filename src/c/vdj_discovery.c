@@ -25,6 +25,10 @@
 #include "cdj.h"
 #include "vdj.h"
 #include "vdj_discovery.h"
+#include "vdj_bpf.h"
+#include "vdj_thread.h"
+#include "vdj_metrics.h"
+#include "vdj_flight.h"
 
 
 static unsigned _Atomic vdj_keepalive_running = ATOMIC_VAR_INIT(0);
@@ -79,17 +83,18 @@ vdj_set_discovery_socket_timeouts(vdj_t* v)
 void
 vdj_expire_players(vdj_t* v, vdj_expired_h expired_h)
 {
-    time_t now;
+    cdj_nanos_t now;
     int i;
     vdj_link_member_t* m;
 
     // expire gone players
     if (v->backline) {
-        now = time(0);
+        now = cdj_now();
         for (i = 0; i < VDJ_MAX_BACKLINE; i++) {
             if ( (m = v->backline->link_members[i]) ) {
-                if ( m->last_keepalive < now - 7 ) { // observed timeout from XDJs
+                if ( m->last_keepalive < now - 7 * CDJ_NANOS_PER_SEC ) { // observed timeout from XDJs
                     // dont free() thread issues, just mark it as gone
+                    if ( ! m->gone ) vdj_metrics_inc(VDJ_METRIC_MEMBER_EXPIRIES);
                     m->gone = 1;
                     m->active = 0;
                     if (expired_h) expired_h(v, m);
@@ -201,6 +206,7 @@ vdj_managed_discovery_loop(void* arg)
 
     ssize_t len;
     uint8_t packet[1500];
+    cdj_nanos_t start;
 
     vdj_keepalive_running = 1;
     while (vdj_keepalive_running) {
@@ -214,8 +220,12 @@ vdj_managed_discovery_loop(void* arg)
                 fprintf(stderr, "error: socket read '%s'", strerror(errno));
                 return NULL;
             } else if (len > 0) {
+                vdj_metrics_rx(CDJ_DISCOVERY_PORT, packet, len);
+                vdj_flight_rx(CDJ_DISCOVERY_PORT, packet, len);
                 if ( ! cdj_validate_header(packet, len) )  {
+                    start = cdj_now();
                     vdj_handle_managed_discovery_datagram(v, discovery_ph, packet, len);
+                    vdj_metrics_handler_time(VDJ_THREAD_DISCOVERY, cdj_now() - start);
                 }
             }
         } while (len > 0);
@@ -224,8 +234,10 @@ vdj_managed_discovery_loop(void* arg)
 
         vdj_send_keepalive(v);
 
-        // drain_unicast
-        while ( recv(tinfo->v->discovery_unicast_socket_fd, packet, 1500, MSG_DONTWAIT) > 0 );
+        // drain_unicast, unless the rtt thread is waiting for replies on it
+        if ( ! v->rtt ) {
+            while ( recv(tinfo->v->discovery_unicast_socket_fd, packet, 1500, MSG_DONTWAIT) > 0 );
+        }
     }
 
     return NULL;
@@ -247,14 +259,15 @@ vdj_init_managed_discovery_thread(vdj_t* v, vdj_discovery_ph discovery_ph)
     vdj_keepalive_running = 1;
 
 
+    vdj_bpf_filter_managed_discovery(v);
+
     // drain_multicast
     while ( recv(v->discovery_socket_fd, packet, 1500, MSG_DONTWAIT) > 0 );
 
-    pthread_t thread_id;
     vdj_thread_info* tinfo = (vdj_thread_info*) calloc(1, sizeof(vdj_thread_info));
     tinfo->v = v;
     tinfo->handler = discovery_ph;
-    return pthread_create(&thread_id, NULL, &vdj_managed_discovery_loop, tinfo);
+    return vdj_thread_create(v, VDJ_THREAD_DISCOVERY, &vdj_managed_discovery_loop, tinfo);
 }
 
 
@@ -288,8 +301,7 @@ vdj_init_keepalive_thread(vdj_t* v)
     if (vdj_keepalive_running) return CDJ_ERROR;
     vdj_keepalive_running = 1;
 
-    pthread_t thread_id;
-    return pthread_create(&thread_id, NULL, &vdj_keepalive_loop, v);
+    return vdj_thread_create(v, VDJ_THREAD_KEEPALIVE, &vdj_keepalive_loop, v);
 }
 
 // handle discovery of other link members,
@@ -408,9 +420,10 @@ vdj_handle_managed_discovery_datagram(vdj_t* v, vdj_discovery_ph discovery_ph, u
                     }
                 }
                 if (m) {
+                    if (m->gone) vdj_metrics_inc(VDJ_METRIC_MEMBER_JOINS);
                     m->gone = 0;
                     m->active = 1;
-                    m->last_keepalive = time(NULL);
+                    m->last_keepalive = cdj_now();
                 }
 
                 if (discovery_ph) discovery_ph(v, d_pkt);
@@ -0,0 +1,290 @@
+/**
+ * Fader start batches.
+ *
+ * Packets, iovecs and mmsghdrs are all built ahead of time so the send is a single syscall with nothing to
+ * allocate or format on the way.  The batch has its own socket with SO_TIMESTAMPING, the OPT_ID counter
+ * tells us which packet of the batch each timestamp belongs to.
+ *
+ * @author teknopaul
+ */
+
+#define _GNU_SOURCE
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <linux/errqueue.h>
+#include <linux/net_tstamp.h>
+
+#include "cdj.h"
+#include "vdj.h"
+#include "vdj_sched.h"
+#include "vdj_metrics.h"
+#include "vdj_flight.h"
+#include "vdj_fader.h"
+
+struct vdj_fader_s {
+    vdj_t*              v;
+    int                 socket_fd;
+    uint8_t             actions[CDJ_FADER_CHANNELS];
+    unsigned int        dirty:1;        // actions changed since the batch was built
+    int                 count;          // packets in the batch
+    uint8_t*            packets[VDJ_FADER_BATCH];
+    struct sockaddr_in  dests[VDJ_FADER_BATCH];
+    struct iovec        iov[VDJ_FADER_BATCH];
+    struct mmsghdr      msgs[VDJ_FADER_BATCH];
+    uint32_t            tx_id;          // OPT_ID of the next packet sent
+    vdj_fader_report_t  report;
+    unsigned int _Atomic done;
+};
+
+vdj_fader_t*
+vdj_fader_new(vdj_t* v)
+{
+    int flags = SOF_TIMESTAMPING_TX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE |
+                SOF_TIMESTAMPING_OPT_ID | SOF_TIMESTAMPING_OPT_TSONLY;
+    int broadcast = 1;
+    int i;
+
+    vdj_fader_t* f = (vdj_fader_t*) calloc(1, sizeof(vdj_fader_t));
+    if (f == NULL) return NULL;
+    f->v = v;
+    for (i = 0; i < CDJ_FADER_CHANNELS; i++) f->actions[i] = CDJ_FADER_NO_CHANGE;
+
+    if ( (f->socket_fd = socket(AF_INET, SOCK_DGRAM, 0)) == -1 ) {
+        fprintf(stderr, "error: fader start socket '%s'\n", strerror(errno));
+        free(f);
+        return NULL;
+    }
+    if ( setsockopt(f->socket_fd, SOL_SOCKET, SO_BROADCAST, &broadcast, sizeof(broadcast)) ) {
+        fprintf(stderr, "error: fader start SO_BROADCAST '%s'\n", strerror(errno));
+        close(f->socket_fd);
+        free(f);
+        return NULL;
+    }
+    // without timestamps we still send, the report just has no skew
+    if ( setsockopt(f->socket_fd, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags)) ) {
+        fprintf(stderr, "warn: fader start SO_TIMESTAMPING '%s'\n", strerror(errno));
+    }
+    return f;
+}
+
+static void
+vdj_fader_free_packets(vdj_fader_t* f)
+{
+    int i;
+    for (i = 0; i < f->count; i++) {
+        free(f->packets[i]);
+        f->packets[i] = NULL;
+    }
+    f->count = 0;
+}
+
+void
+vdj_fader_destroy(vdj_fader_t* f)
+{
+    vdj_fader_free_packets(f);
+    close(f->socket_fd);
+    free(f);
+}
+
+int
+vdj_fader_set(vdj_fader_t* f, uint8_t player_id, uint8_t action)
+{
+    if (player_id < 1 || player_id > CDJ_FADER_CHANNELS) return CDJ_ERROR;
+    if (action > CDJ_FADER_NO_CHANGE) return CDJ_ERROR;
+    f->actions[player_id - 1] = action;
+    f->dirty = 1;
+    return CDJ_OK;
+}
+
+static int
+vdj_fader_add(vdj_fader_t* f, uint8_t* actions, struct sockaddr_in* dest)
+{
+    uint16_t length;
+    int n = f->count;
+
+    if ( (f->packets[n] = cdj_create_fader_start_packet(&length, f->v->model, f->v->player_id, actions)) == NULL ) {
+        return CDJ_ERROR;
+    }
+    memcpy(&f->dests[n], dest, sizeof(struct sockaddr_in));
+    f->dests[n].sin_port = (in_port_t)htons(CDJ_BEAT_PORT);
+    f->iov[n].iov_base = f->packets[n];
+    f->iov[n].iov_len = length;
+    memset(&f->msgs[n], 0, sizeof(struct mmsghdr));
+    f->msgs[n].msg_hdr.msg_name = &f->dests[n];
+    f->msgs[n].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+    f->msgs[n].msg_hdr.msg_iov = &f->iov[n];
+    f->msgs[n].msg_hdr.msg_iovlen = 1;
+    f->count++;
+    return CDJ_OK;
+}
+
+int
+vdj_fader_prepare(vdj_fader_t* f)
+{
+    uint8_t actions[CDJ_FADER_CHANNELS];
+    uint8_t broadcast[CDJ_FADER_CHANNELS];
+    vdj_link_member_t* m;
+    int i, unknown = 0;
+
+    vdj_fader_free_packets(f);
+    memset(broadcast, CDJ_FADER_NO_CHANGE, CDJ_FADER_CHANNELS);
+
+    for (i = 0; i < CDJ_FADER_CHANNELS; i++) {
+        if (f->actions[i] == CDJ_FADER_NO_CHANGE) continue;
+
+        m = vdj_get_link_member(f->v, i + 1);
+        if (m && m->ip_addr) {
+            memset(actions, CDJ_FADER_NO_CHANGE, CDJ_FADER_CHANNELS);
+            actions[i] = f->actions[i];
+            if ( vdj_fader_add(f, actions, m->ip_addr) ) return CDJ_ERROR;
+        } else {
+            broadcast[i] = f->actions[i];
+            unknown = 1;
+        }
+    }
+    if (unknown && vdj_fader_add(f, broadcast, f->v->broadcast_addr) ) return CDJ_ERROR;
+
+    f->dirty = 0;
+    if (f->count == 0) {
+        fprintf(stderr, "error: fader start has no decks\n");
+        return CDJ_ERROR;
+    }
+    return CDJ_OK;
+}
+
+/**
+ * Read back the batch's tx timestamps, packets first to first + count - 1 by OPT_ID.
+ */
+static void
+vdj_fader_tx_stamps(vdj_fader_t* f, uint32_t first, int count)
+{
+    vdj_fader_report_t* r = &f->report;
+    char control[256];
+    uint8_t data[64];
+    struct iovec iov = { data, sizeof(data) };
+    struct msghdr msg;
+    struct cmsghdr* cmsg;
+    struct sock_extended_err* err;
+    struct scm_timestamping* stamps;
+    struct pollfd pfd = { f->socket_fd, 0, 0 };
+    cdj_nanos_t tx = 0, min = 0, max = 0;
+
+    while (r->stamps < count) {
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        if ( recvmsg(f->socket_fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) == -1 ) {
+            // the error queue raises POLLERR
+            if ( poll(&pfd, 1, VDJ_FADER_TX_WAIT_MS) <= 0 ) break;
+            continue;
+        }
+        for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPING) {
+                stamps = (struct scm_timestamping*) CMSG_DATA(cmsg);
+                tx = cdj_realtime_to_nanos(&stamps->ts[0]);
+                continue;
+            }
+            err = (struct sock_extended_err*) CMSG_DATA(cmsg);
+            if (err->ee_origin == SO_EE_ORIGIN_TIMESTAMPING && tx && err->ee_data - first < (uint32_t) count) {
+                if (r->stamps == 0 || tx < min) min = tx;
+                if (r->stamps == 0 || tx > max) max = tx;
+                r->stamps++;
+                tx = 0;
+            }
+        }
+    }
+    if (r->stamps) r->late = min - r->due;
+    if (r->stamps == count) r->skew = max - min;
+}
+
+static int
+vdj_fader_sendmmsg(vdj_fader_t* f, cdj_nanos_t due)
+{
+    vdj_fader_report_t* r = &f->report;
+    uint32_t first = f->tx_id;
+    int i, n;
+
+    f->done = 0;
+    memset(r, 0, sizeof(vdj_fader_report_t));
+    r->due = due;
+
+    r->sent = cdj_now();
+    n = sendmmsg(f->socket_fd, f->msgs, f->count, 0);
+    for (i = 0; i < f->count; i++) {
+        vdj_metrics_tx(CDJ_BEAT_PORT, f->iov[i].iov_base, f->iov[i].iov_len, i >= n);
+        vdj_flight_tx(CDJ_BEAT_PORT, f->iov[i].iov_base, f->iov[i].iov_len, i >= n);
+    }
+    if (n == -1) {
+        fprintf(stderr, "error: fader start sendmmsg '%s'\n", strerror(errno));
+        return CDJ_ERROR;
+    }
+    f->tx_id += n;
+    r->packets = n;
+    r->late = r->sent - due;
+    vdj_fader_tx_stamps(f, first, n);
+    f->done = 1;
+
+    if (n < f->count) {
+        fprintf(stderr, "error: fader start sent %i of %i\n", n, f->count);
+        return CDJ_ERROR;
+    }
+    return CDJ_OK;
+}
+
+int
+vdj_fader_send(vdj_fader_t* f)
+{
+    if (f->dirty && vdj_fader_prepare(f)) return CDJ_ERROR;
+    return vdj_fader_sendmmsg(f, cdj_now());
+}
+
+int
+vdj_fader_send_at(vdj_fader_t* f, cdj_nanos_t when)
+{
+    struct timespec ts;
+
+    if (f->dirty && vdj_fader_prepare(f)) return CDJ_ERROR;
+
+    if (when - cdj_now() > VDJ_FADER_SPIN_NANOS) {
+        ts = cdj_nanos_to_timespec(when - VDJ_FADER_SPIN_NANOS);
+        while ( clock_nanosleep(cdj_clock_id(), TIMER_ABSTIME, &ts, NULL) == EINTR );
+    }
+    while (cdj_now() < when);
+
+    return vdj_fader_sendmmsg(f, when);
+}
+
+static void
+vdj_fader_sched_h(vdj_t* v, vdj_sched_event_t* e)
+{
+    vdj_fader_send_at((vdj_fader_t*) e->arg, e->when);
+}
+
+int
+vdj_fader_send_on(vdj_fader_t* f, uint8_t player_id, vdj_sched_unit unit, uint32_t count)
+{
+    // build now, not on the scheduler thread
+    if (f->dirty && vdj_fader_prepare(f)) return 0;
+    f->done = 0;
+    return vdj_sched_add(f->v, player_id, unit, count, VDJ_FADER_LEAD_NANOS, 0, vdj_fader_sched_h, f);
+}
+
+int
+vdj_fader_report(vdj_fader_t* f, vdj_fader_report_t* r)
+{
+    if ( ! f->done ) return CDJ_ERROR;
+    memcpy(r, &f->report, sizeof(vdj_fader_report_t));
+    return CDJ_OK;
+}
@@ -0,0 +1,50 @@
+#ifndef _VDJ_FADER_H_INCLUDED_
+#define _VDJ_FADER_H_INCLUDED_
+
+#include "cdj.h"
+#include "vdj.h"
+#include "vdj_sched.h"
+
+/**
+ * Synchronised fader start, start or stop several decks at one instant, e.g. on the master's next bar.
+ *
+ * The CDJ_FADER_START_COMMAND packets are built when the decks are set, one per deck unicast to its port 50001,
+ * and handed to the kernel in one sendmmsg() at the planned time so every deck's packet leaves within micros
+ * of the others.  A deck whose address is not known yet gets its command by broadcast in the same batch.
+ * TX timestamps on the batch measure how late the first packet left and the skew to the last one.
+ */
+
+#define VDJ_FADER_BATCH         (CDJ_FADER_CHANNELS + 1)  // a packet per deck plus one broadcast
+#define VDJ_FADER_SPIN_NANOS    200000   // the last stretch before the send is spun, not slept
+#define VDJ_FADER_LEAD_NANOS    1000000  // scheduler events fire this early, the rest is slept and spun
+#define VDJ_FADER_TX_WAIT_MS    10       // longest wait for the batch's tx timestamps
+
+typedef struct {
+    cdj_nanos_t         due;        // when the batch was planned to go
+    cdj_nanos_t         sent;       // when sendmmsg() was called
+    int64_t             late;       // first packet out - due, sent - due without tx timestamps
+    int64_t             skew;       // last packet out - first packet out, 0 unless every packet was stamped
+    int                 packets;    // accepted by the kernel
+    int                 stamps;     // tx timestamps read back
+} vdj_fader_report_t;
+
+typedef struct vdj_fader_s vdj_fader_t;
+
+vdj_fader_t* vdj_fader_new(vdj_t* v);
+void vdj_fader_destroy(vdj_fader_t* f);
+
+// CDJ_FADER_START or CDJ_FADER_STOP player 1 - 4 with the next batch, CDJ_FADER_NO_CHANGE leaves it out
+int vdj_fader_set(vdj_fader_t* f, uint8_t player_id, uint8_t action);
+// build the batch now rather than at send time, e.g. after the decks' addresses have been discovered
+int vdj_fader_prepare(vdj_fader_t* f);
+
+int vdj_fader_send(vdj_fader_t* f);
+// blocks the caller until when, on the cdj_now() clock, then sends
+int vdj_fader_send_at(vdj_fader_t* f, cdj_nanos_t when);
+// send on the count'th next beat or bar of player_id, needs vdj_init_sched_thread(), returns the event id or 0
+int vdj_fader_send_on(vdj_fader_t* f, uint8_t player_id, vdj_sched_unit unit, uint32_t count);
+
+// CDJ_OK and a copy of the report once the last batch has gone
+int vdj_fader_report(vdj_fader_t* f, vdj_fader_report_t* r);
+
+#endif // _VDJ_FADER_H_INCLUDED_
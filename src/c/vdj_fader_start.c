@@ -0,0 +1,149 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "cdj.h"
+#include "vdj.h"
+#include "vdj_net.h"
+#include "vdj_discovery.h"
+#include "vdj_phase.h"
+#include "vdj_sched.h"
+#include "vdj_fader.h"
+
+/**
+ * Joins the ProLink network and starts or stops several decks at once, now or on the master's next beat or bar.
+ *
+ * Prints how late the batch went out and the skew between the decks' packets.
+ *
+ * @author teknopaul
+ */
+
+static void
+usage()
+{
+    printf("Start or stop decks together with fader start commands\n");
+    printf("options:\n");
+    printf("    -i - network interface to use, required if pc has more than one\n");
+    printf("    -p - player id for our virtual cdj, default is auto assign\n");
+    printf("    -s - players to start, e.g. 1,2\n");
+    printf("    -x - players to stop\n");
+    printf("    -b - send on the master's next beat\n");
+    printf("    -B - send on the master's next bar\n");
+    printf("    -f - time to the beat or bar from this player instead of the master\n");
+    printf("    -h - display this text\n");
+    exit(0);
+}
+
+static int
+set_players(vdj_fader_t* f, char* list, uint8_t action)
+{
+    char* tok;
+    for (tok = strtok(list, ","); tok; tok = strtok(NULL, ",")) {
+        if ( vdj_fader_set(f, atoi(tok), action) ) {
+            fprintf(stderr, "error: player '%s' must be 1 - %d\n", tok, CDJ_FADER_CHANNELS);
+            return CDJ_ERROR;
+        }
+    }
+    return CDJ_OK;
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned int flags = 0;
+    uint8_t player_id = 0;
+    uint8_t follow = VDJ_PHASE_MASTER;
+    char* iface = NULL;
+    char* start = NULL;
+    char* stop = NULL;
+    int unit = 0;
+    int i;
+    vdj_t* v;
+    vdj_fader_t* f;
+    vdj_fader_report_t r;
+
+    int c;
+    while ( ( c = getopt(argc, argv, "i:p:s:x:bBf:h") ) != EOF) {
+        switch (c) {
+            case 'h':
+                usage();
+                break;
+            case 'i':
+                iface = optarg;
+                break;
+            case 'p':
+                player_id = atoi(optarg);
+                if (player_id < 0xf) flags |= player_id;
+                break;
+            case 's':
+                start = optarg;
+                break;
+            case 'x':
+                stop = optarg;
+                break;
+            case 'b':
+                unit = VDJ_SCHED_BEAT;
+                break;
+            case 'B':
+                unit = VDJ_SCHED_BAR;
+                break;
+            case 'f':
+                follow = atoi(optarg);
+                break;
+        }
+    }
+
+    if (start == NULL && stop == NULL) usage();
+    if (player_id == 0) flags |= VDJ_FLAG_AUTO_ID;
+
+    if ( ! (v = vdj_init_iface(iface, flags)) ) {
+        fprintf(stderr, "error: creating virtual cdj\n");
+        return 1;
+    }
+    if ( vdj_open_sockets(v) != CDJ_OK ) {
+        fprintf(stderr, "error: failed to open sockets\n");
+        vdj_destroy(v);
+        return 1;
+    }
+    if ( vdj_exec_discovery(v) != CDJ_OK ) {
+        fprintf(stderr, "error: cdj initialization\n");
+        vdj_destroy(v);
+        return 1;
+    }
+    if ( vdj_init_managed_discovery_thread(v, NULL) != CDJ_OK ||
+         vdj_init_managed_beat_thread(v, NULL) != CDJ_OK ||
+         vdj_init_managed_update_thread(v, NULL) != CDJ_OK ||
+         vdj_init_status_thread(v) != CDJ_OK ||
+         vdj_init_sched_thread(v) != CDJ_OK ) {
+        fprintf(stderr, "error: init managed threads\n");
+        vdj_destroy(v);
+        return 1;
+    }
+
+    if ( (f = vdj_fader_new(v)) == NULL ) return 1;
+    if ( (start && set_players(f, start, CDJ_FADER_START)) || (stop && set_players(f, stop, CDJ_FADER_STOP)) ) {
+        return 1;
+    }
+
+    // give the decks a chance to announce themselves, unknown decks get a broadcast
+    sleep(3);
+    if ( vdj_fader_prepare(f) ) return 1;
+
+    if (unit) {
+        if ( vdj_fader_send_on(f, follow, unit, 1) == 0 ) {
+            fprintf(stderr, "error: scheduling fader start\n");
+            return 1;
+        }
+        for (i = 0; i < 1000 && vdj_fader_report(f, &r); i++) usleep(10000);
+    } else {
+        vdj_fader_send(f);
+    }
+
+    if ( vdj_fader_report(f, &r) ) {
+        fprintf(stderr, "error: no beat from player %d\n", follow);
+        return 1;
+    }
+    printf("fader start packets=%d late=%.1fus skew=%.1fus%s\n", r.packets, r.late / 1000.0, r.skew / 1000.0,
+        r.stamps == r.packets ? "" : " (no tx timestamps)");
+    return 0;
+}
@@ -0,0 +1,527 @@
+/**
+ * Packet filter compiler and interpreter, see vdj_filter.h for the language.
+ *
+ * A recursive descent parser emits stack code directly, && and || compile to jumps so the right hand side is
+ * only evaluated when it matters, and type==NAME compiles to a single instruction that checks port and type.
+ * Matching is a loop over a fixed array of instructions, fields are read from the raw packet with bounds
+ * checks, nothing is allocated.
+ *
+ * @author teknopaul
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "cdj.h"
+#include "vdj_filter.h"
+
+//SNIP_filter
+enum {
+    OP_END = 0,
+    OP_PUSH,
+    OP_FIELD,
+    OP_BYTE,
+    OP_U16,
+    OP_U32,
+    OP_TYPE_IS,     // arg is CDJ_DISCOVERY_PORT for discovery types, else 0
+    OP_EQ,
+    OP_NE,
+    OP_LT,
+    OP_LE,
+    OP_GT,
+    OP_GE,
+    OP_BAND,
+    OP_BOR,
+    OP_NOT,
+    OP_BOOL,
+    OP_JFALSE,      // leaves 0 and jumps if false, else pops
+    OP_JTRUE        // leaves 1 and jumps if true, else pops
+};
+
+enum {
+    F_PORT = 0,
+    F_TYPE,
+    F_SUBTYPE,
+    F_LEN,
+    F_PLAYER,
+    F_BPM,
+    F_PITCH,
+    F_FLAGS,
+    F_BAR
+};
+
+typedef struct {
+    const char*         name;
+    uint8_t             value;
+} filter_name_t;
+
+static const filter_name_t fields[] = {
+    {"port", F_PORT}, {"type", F_TYPE}, {"subtype", F_SUBTYPE}, {"len", F_LEN}, {"player", F_PLAYER},
+    {"bpm", F_BPM}, {"pitch", F_PITCH}, {"flags", F_FLAGS}, {"bar", F_BAR},
+    {NULL, 0}
+};
+
+static const filter_name_t flag_names[] = {
+    {"master", CDJ_STAT_FLAG_MASTER}, {"play", CDJ_STAT_FLAG_PLAY}, {"sync", CDJ_STAT_FLAG_SYNC},
+    {"onair", CDJ_STAT_FLAG_ONAIR},
+    {NULL, 0}
+};
+
+// names as in cdj.h and as printed by cdj_type_to_string(), without the CDJ_ prefix
+static const filter_name_t discovery_types[] = {
+    {"stage1_discovery", CDJ_STAGE1_DISCOVERY}, {"id_use_req", CDJ_ID_USE_REQ}, {"id_use_resp", CDJ_ID_USE_RESP},
+    {"id_set_req", CDJ_ID_SET_REQ}, {"id_set_resp", CDJ_ID_SET_RESP}, {"keep_alive", CDJ_KEEP_ALIVE},
+    {"device_keep_alive", CDJ_KEEP_ALIVE}, {"collision", CDJ_COLLISION}, {"discovery", CDJ_DISCOVERY},
+    {NULL, 0}
+};
+
+static const filter_name_t types[] = {
+    {"fader_start_command", CDJ_FADER_START_COMMAND}, {"channels_on_air", CDJ_CHANNELS_ON_AIR},
+    {"goodbye", CDJ_GOODBYE}, {"media_qry", CDJ_MEDIA_QRY}, {"media_resp", CDJ_MEDIA_RESP},
+    {"status", CDJ_STATUS}, {"load_track_command", CDJ_LOAD_TRACK_COMMAND}, {"load_track_ack", CDJ_LOAD_TRACK_ACK},
+    {"master_req", CDJ_MASTER_REQ}, {"master_handoff_req", CDJ_MASTER_REQ}, {"master_resp", CDJ_MASTER_RESP},
+    {"master_handoff_resp", CDJ_MASTER_RESP}, {"beat", CDJ_BEAT}, {"mixer_status", CDJ_MIXER_STATUS},
+    {"sync_control", CDJ_SYNC_CONTROL},
+    {NULL, 0}
+};
+
+typedef struct {
+    const char*         expr;
+    const char*         p;
+    vdj_filter_t*       f;
+    int                 depth;
+    int                 error;
+} filter_compiler_t;
+
+static void filter_or(filter_compiler_t* c);
+
+static const filter_name_t*
+filter_lookup(const filter_name_t* names, const char* name)
+{
+    for ( ; names->name; names++) {
+        if (strcmp(names->name, name) == 0) return names;
+    }
+    return NULL;
+}
+
+static void
+filter_error(filter_compiler_t* c, const char* msg)
+{
+    if (c->error) return;
+    c->error = 1;
+    fprintf(stderr, "error: filter '%s' at %i: %s\n", c->expr, (int) (c->p - c->expr), msg);
+}
+
+static void
+filter_skip(filter_compiler_t* c)
+{
+    while (isspace((unsigned char) *c->p)) c->p++;
+}
+
+/**
+ * consume tok if it is next, and not the start of a longer operator, e.g. & is not &&
+ */
+static int
+filter_accept(filter_compiler_t* c, const char* tok)
+{
+    size_t n = strlen(tok);
+
+    filter_skip(c);
+    if (strncmp(c->p, tok, n) != 0) return 0;
+    if (n == 1 && (tok[0] == '&' || tok[0] == '|') && c->p[1] == tok[0]) return 0;
+    if (n == 1 && (tok[0] == '<' || tok[0] == '>' || tok[0] == '!') && c->p[1] == '=') return 0;
+    c->p += n;
+    return 1;
+}
+
+/**
+ * @return index of the emitted instruction
+ */
+static int
+filter_emit(filter_compiler_t* c, uint8_t op, uint8_t field, uint16_t arg, double value)
+{
+    vdj_filter_insn_t* i;
+
+    if (c->error) return 0;
+    if (c->f->len >= VDJ_FILTER_MAX_CODE - 1) {
+        filter_error(c, "expression too long");
+        return 0;
+    }
+
+    switch (op) {
+        case OP_PUSH: case OP_FIELD: case OP_BYTE: case OP_U16: case OP_U32: case OP_TYPE_IS:
+            c->depth++;
+            break;
+        case OP_NOT: case OP_BOOL:
+            break;
+        default:
+            // binary operators, and jumps on the path that falls through
+            c->depth--;
+    }
+    if (c->depth > VDJ_FILTER_MAX_STACK) {
+        filter_error(c, "expression nested too deep");
+        return 0;
+    }
+
+    i = &c->f->code[c->f->len];
+    i->op = op;
+    i->field = field;
+    i->arg = arg;
+    i->value = value;
+    return c->f->len++;
+}
+
+/**
+ * lower case identifier into name, CDJ_ prefix removed, 0 if there is no identifier next
+ */
+static int
+filter_ident(filter_compiler_t* c, char* name, size_t size)
+{
+    size_t n = 0;
+
+    filter_skip(c);
+    if ( ! isalpha((unsigned char) *c->p) && *c->p != '_' ) return 0;
+    while (isalnum((unsigned char) *c->p) || *c->p == '_') {
+        if (n < size - 1) name[n++] = tolower((unsigned char) *c->p);
+        c->p++;
+    }
+    name[n] = 0;
+    if (strncmp(name, "cdj_", 4) == 0) memmove(name, name + 4, n - 3);
+    return 1;
+}
+
+static double
+filter_number(filter_compiler_t* c)
+{
+    char* end;
+    double value;
+
+    filter_skip(c);
+    if (c->p[0] == '0' && (c->p[1] == 'x' || c->p[1] == 'X')) value = (double) strtoul(c->p, &end, 16);
+    else value = strtod(c->p, &end);
+    if (end == c->p) {
+        filter_error(c, "number expected");
+        return 0.0;
+    }
+    c->p = end;
+    return value;
+}
+
+static void
+filter_primary(filter_compiler_t* c)
+{
+    char name[32];
+    const filter_name_t* n;
+    double offset;
+    uint8_t op;
+
+    filter_skip(c);
+    if (filter_accept(c, "(")) {
+        filter_or(c);
+        if ( ! filter_accept(c, ")") ) filter_error(c, "')' expected");
+        return;
+    }
+    if (isdigit((unsigned char) *c->p) || *c->p == '.') {
+        filter_emit(c, OP_PUSH, 0, 0, filter_number(c));
+        return;
+    }
+    if (*c->p == '-' && (isdigit((unsigned char) c->p[1]) || c->p[1] == '.')) {
+        c->p++;
+        filter_emit(c, OP_PUSH, 0, 0, -filter_number(c));
+        return;
+    }
+    if ( ! filter_ident(c, name, sizeof(name)) ) {
+        filter_error(c, *c->p ? "unexpected character" : "unexpected end of expression");
+        return;
+    }
+
+    if ( (n = filter_lookup(fields, name)) ) {
+        filter_emit(c, OP_FIELD, n->value, 0, 0.0);
+    } else if (strcmp(name, "byte") == 0 || strcmp(name, "u16") == 0 || strcmp(name, "u32") == 0) {
+        op = name[0] == 'b' ? OP_BYTE : name[1] == '1' ? OP_U16 : OP_U32;
+        if ( ! filter_accept(c, "[") ) {
+            filter_error(c, "'[' expected");
+            return;
+        }
+        offset = filter_number(c);
+        if ( ! filter_accept(c, "]") ) filter_error(c, "']' expected");
+        else if (offset < 0 || offset > 1500) filter_error(c, "offset out of range");
+        filter_emit(c, op, 0, (uint16_t) offset, 0.0);
+    } else if ( (n = filter_lookup(flag_names, name)) ||
+                (n = filter_lookup(types, name)) ||
+                (n = filter_lookup(discovery_types, name)) ) {
+        filter_emit(c, OP_PUSH, 0, 0, n->value);
+    } else {
+        filter_error(c, "unknown name");
+    }
+}
+
+static void
+filter_unary(filter_compiler_t* c)
+{
+    if (filter_accept(c, "!")) {
+        filter_unary(c);
+        filter_emit(c, OP_NOT, 0, 0, 0.0);
+        return;
+    }
+    filter_primary(c);
+}
+
+static void
+filter_bits(filter_compiler_t* c)
+{
+    filter_unary(c);
+    while ( ! c->error ) {
+        if (filter_accept(c, "&")) {
+            filter_unary(c);
+            filter_emit(c, OP_BAND, 0, 0, 0.0);
+        } else if (filter_accept(c, "|")) {
+            filter_unary(c);
+            filter_emit(c, OP_BOR, 0, 0, 0.0);
+        } else {
+            break;
+        }
+    }
+}
+
+/**
+ * type==NAME and type!=NAME become OP_TYPE_IS, type is ambiguous without the port
+ */
+static int
+filter_type_is(filter_compiler_t* c, int start, uint8_t op)
+{
+    const char* p = c->p;
+    vdj_filter_insn_t* i = &c->f->code[start];
+    const filter_name_t* n;
+    uint16_t port = 0;
+    char name[32];
+
+    if (c->f->len != start + 1 || i->op != OP_FIELD || i->field != F_TYPE) return 0;
+    if ( ! filter_ident(c, name, sizeof(name)) ) return 0;
+    if ( (n = filter_lookup(discovery_types, name)) ) {
+        port = CDJ_DISCOVERY_PORT;
+    } else if ( ! (n = filter_lookup(types, name)) ) {
+        c->p = p;
+        return 0;
+    }
+
+    i->op = OP_TYPE_IS;
+    i->arg = port;
+    i->value = n->value;
+    if (op == OP_NE) filter_emit(c, OP_NOT, 0, 0, 0.0);
+    return 1;
+}
+
+static void
+filter_compare(filter_compiler_t* c)
+{
+    int start = c->f->len;
+    uint8_t op;
+
+    filter_bits(c);
+    if (filter_accept(c, "==")) op = OP_EQ;
+    else if (filter_accept(c, "!=")) op = OP_NE;
+    else if (filter_accept(c, "<=")) op = OP_LE;
+    else if (filter_accept(c, ">=")) op = OP_GE;
+    else if (filter_accept(c, "<")) op = OP_LT;
+    else if (filter_accept(c, ">")) op = OP_GT;
+    else return;
+
+    if ( (op == OP_EQ || op == OP_NE) && filter_type_is(c, start, op) ) return;
+    filter_bits(c);
+    filter_emit(c, op, 0, 0, 0.0);
+}
+
+static void
+filter_and(filter_compiler_t* c)
+{
+    int jump;
+
+    filter_compare(c);
+    while ( ! c->error && filter_accept(c, "&&") ) {
+        jump = filter_emit(c, OP_JFALSE, 0, 0, 0.0);
+        filter_compare(c);
+        filter_emit(c, OP_BOOL, 0, 0, 0.0);
+        c->f->code[jump].arg = c->f->len;
+    }
+}
+
+static void
+filter_or(filter_compiler_t* c)
+{
+    int jump;
+
+    filter_and(c);
+    while ( ! c->error && filter_accept(c, "||") ) {
+        jump = filter_emit(c, OP_JTRUE, 0, 0, 0.0);
+        filter_and(c);
+        filter_emit(c, OP_BOOL, 0, 0, 0.0);
+        c->f->code[jump].arg = c->f->len;
+    }
+}
+
+vdj_filter_t*
+vdj_filter_compile(const char* expr)
+{
+    filter_compiler_t c;
+
+    memset(&c, 0, sizeof(c));
+    c.expr = c.p = expr;
+    if ( ! (c.f = calloc(1, sizeof(vdj_filter_t))) ) return NULL;
+
+    filter_or(&c);
+    filter_skip(&c);
+    if (*c.p) filter_error(&c, "unexpected trailing characters");
+    if (c.error) {
+        free(c.f);
+        return NULL;
+    }
+    // room for OP_END is always left
+    c.f->code[c.f->len].op = OP_END;
+    return c.f;
+}
+
+void
+vdj_filter_free(vdj_filter_t* f)
+{
+    free(f);
+}
+
+static double
+filter_read(uint8_t* packet, uint16_t len, uint16_t offset, uint16_t size)
+{
+    uint32_t v = 0;
+    uint16_t i;
+
+    if (offset + size > len) return -1.0;
+    for (i = 0; i < size; i++) v = (v << 8) | packet[offset + i];
+    return v;
+}
+
+static double
+filter_field(uint8_t field, uint16_t port, uint8_t* packet, uint16_t len)
+{
+    int type = len > CDJ_PACKET_TYPE_OFFSET ? packet[CDJ_PACKET_TYPE_OFFSET] : -1;
+    int sub_type = len > CDJ_PACKET_TYPE_OFFSET + 1 ? packet[CDJ_PACKET_TYPE_OFFSET + 1] : -1;
+    int beat = port == CDJ_BEAT_PORT && type == CDJ_BEAT;
+    int status = port == CDJ_UPDATE_PORT && type == CDJ_STATUS;
+    double bpm;
+
+    switch (field) {
+        case F_PORT: return port;
+        case F_TYPE: return type;
+        case F_SUBTYPE: return port == CDJ_DISCOVERY_PORT ? sub_type : -1;
+        case F_LEN: return len;
+        case F_PLAYER: {
+            // as cdj_discovery_player_id(), discovery packets carry it at different offsets
+            if (port != CDJ_DISCOVERY_PORT) return filter_read(packet, len, 0x21, 1);
+            if (sub_type != 0) return filter_read(packet, len, 0x21, 1);
+            switch (type) {
+                case CDJ_DISCOVERY:
+                case CDJ_STAGE1_DISCOVERY: return -1.0;
+                case CDJ_ID_USE_REQ: return filter_read(packet, len, 0x2e, 1);
+                case CDJ_ID_SET_REQ:
+                case CDJ_ID_USE_RESP:
+                case CDJ_KEEP_ALIVE: return filter_read(packet, len, 0x24, 1);
+            }
+            return filter_read(packet, len, 0x21, 1);
+        }
+        case F_BPM: {
+            if (beat && len >= 0x5c) {
+                return cdj_calculated_bpm(filter_read(packet, len, 0x5a, 2), filter_read(packet, len, 0x54, 4));
+            }
+            if (status && len >= 0x94) {
+                bpm = filter_read(packet, len, 0x92, 2);
+                if (bpm == 0xffff) return 0.0;
+                return cdj_calculated_bpm(bpm, filter_read(packet, len, 0x8c, 4));
+            }
+            return -1.0;
+        }
+        case F_PITCH: {
+            if (beat && len >= 0x58) return cdj_pitch_to_percentage(filter_read(packet, len, 0x54, 4));
+            if (status && len >= 0x90) return cdj_pitch_to_percentage(filter_read(packet, len, 0x8c, 4));
+            return -1.0;
+        }
+        case F_FLAGS: return status ? filter_read(packet, len, 0x89, 1) : -1.0;
+        case F_BAR: return beat ? filter_read(packet, len, 0x5c, 1) : -1.0;
+    }
+    return -1.0;
+}
+
+int
+vdj_filter_match(vdj_filter_t* f, uint16_t port, uint8_t* packet, uint16_t len)
+{
+    double stack[VDJ_FILTER_MAX_STACK];
+    vdj_filter_insn_t* i;
+    uint16_t pc = 0;
+    int sp = 0;         // next free slot, the compiler made sure it stays in range
+    int64_t a, b;
+
+    while (1) {
+        i = &f->code[pc++];
+        switch (i->op) {
+            case OP_END:
+                return sp > 0 && stack[sp - 1] != 0.0;
+            case OP_PUSH:
+                stack[sp++] = i->value;
+                break;
+            case OP_FIELD:
+                stack[sp++] = filter_field(i->field, port, packet, len);
+                break;
+            case OP_BYTE:
+                stack[sp++] = filter_read(packet, len, i->arg, 1);
+                break;
+            case OP_U16:
+                stack[sp++] = filter_read(packet, len, i->arg, 2);
+                break;
+            case OP_U32:
+                stack[sp++] = filter_read(packet, len, i->arg, 4);
+                break;
+            case OP_TYPE_IS:
+                if (i->arg == CDJ_DISCOVERY_PORT) {
+                    stack[sp++] = port == CDJ_DISCOVERY_PORT && len > CDJ_PACKET_TYPE_OFFSET + 1 &&
+                        packet[CDJ_PACKET_TYPE_OFFSET] == i->value && packet[CDJ_PACKET_TYPE_OFFSET + 1] == 0;
+                } else {
+                    stack[sp++] = port != CDJ_DISCOVERY_PORT && len > CDJ_PACKET_TYPE_OFFSET &&
+                        packet[CDJ_PACKET_TYPE_OFFSET] == i->value;
+                }
+                break;
+            case OP_EQ: sp--; stack[sp - 1] = stack[sp - 1] == stack[sp]; break;
+            case OP_NE: sp--; stack[sp - 1] = stack[sp - 1] != stack[sp]; break;
+            case OP_LT: sp--; stack[sp - 1] = stack[sp - 1] < stack[sp]; break;
+            case OP_LE: sp--; stack[sp - 1] = stack[sp - 1] <= stack[sp]; break;
+            case OP_GT: sp--; stack[sp - 1] = stack[sp - 1] > stack[sp]; break;
+            case OP_GE: sp--; stack[sp - 1] = stack[sp - 1] >= stack[sp]; break;
+            case OP_BAND:
+            case OP_BOR:
+                // a missing field is -1, flags&master of a beat packet must not be all ones
+                sp--;
+                a = (int64_t) stack[sp - 1];
+                b = (int64_t) stack[sp];
+                if (a < 0 || b < 0) stack[sp - 1] = 0.0;
+                else stack[sp - 1] = i->op == OP_BAND ? a & b : a | b;
+                break;
+            case OP_NOT:
+                stack[sp - 1] = stack[sp - 1] == 0.0;
+                break;
+            case OP_BOOL:
+                stack[sp - 1] = stack[sp - 1] != 0.0;
+                break;
+            case OP_JFALSE:
+                if (stack[sp - 1] == 0.0) pc = i->arg;
+                else sp--;
+                break;
+            case OP_JTRUE:
+                if (stack[sp - 1] != 0.0) {
+                    stack[sp - 1] = 1.0;
+                    pc = i->arg;
+                } else {
+                    sp--;
+                }
+                break;
+        }
+    }
+}
+//SNIP_filter
@@ -0,0 +1,49 @@
+#ifndef _VDJ_FILTER_H_INCLUDED_
+#define _VDJ_FILTER_H_INCLUDED_
+
+#include <stdint.h>
+
+/**
+ * Packet filter expressions, compiled once to a small stack bytecode and run against raw packets as they arrive,
+ * before anything is parsed, allocated or printed.
+ *
+ *    type==CDJ_STATUS && player==2 && flags&master
+ *    port==50001 && (bpm<120 || bpm>130)
+ *    !(type==keep_alive) && byte[0x21]!=5
+ *
+ * fields     port type subtype len, and decoded from the raw packet player bpm pitch flags bar,
+ *            a field a packet does not have is -1, e.g. flags of a beat packet.  bpm is the pitched bpm,
+ *            pitch is in percent.
+ * raw        byte[N] u16[N] u32[N], big endian at offset N, -1 past the end of the packet
+ * names      CDJ packet types with or without the CDJ_ prefix, and the status flags master play sync onair,
+ *            case does not matter.  type==NAME also checks the port, since types are reused across ports,
+ *            so type==CDJ_STATUS does not match CDJ_DISCOVERY packets.
+ * operators  || && ! == != < <= > >= & | ( ) and numbers in decimal or 0x hex.
+ *            Unlike C, & and | bind tighter than comparisons, so flags&master==0 is (flags&master)==0.
+ *            & and | with a missing field give 0.
+ *
+ * @author teknopaul
+ */
+
+#define VDJ_FILTER_MAX_CODE     128
+#define VDJ_FILTER_MAX_STACK    32
+
+typedef struct {
+    uint8_t             op;
+    uint8_t             field;
+    uint16_t            arg;            // offset, jump target or port
+    double              value;
+} vdj_filter_insn_t;
+
+typedef struct {
+    uint16_t            len;
+    vdj_filter_insn_t   code[VDJ_FILTER_MAX_CODE];
+} vdj_filter_t;
+
+// NULL and an error message on stderr if the expression does not compile
+vdj_filter_t* vdj_filter_compile(const char* expr);
+void vdj_filter_free(vdj_filter_t* f);
+// 1 if the packet received on port matches
+int vdj_filter_match(vdj_filter_t* f, uint16_t port, uint8_t* packet, uint16_t len);
+
+#endif // _VDJ_FILTER_H_INCLUDED_
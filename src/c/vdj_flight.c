@@ -0,0 +1,188 @@
+/**
+ * Packet flight recorder, see vdj_flight.h
+ *
+ * @author teknopaul
+ */
+
+#define _GNU_SOURCE
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "cdj.h"
+#include "vdj_flight.h"
+
+//SNIP_flight
+static vdj_flight_header_t* _Atomic vdj_flight = NULL;
+
+static vdj_flight_slot_t*
+vdj_flight_slot(vdj_flight_header_t* hdr, uint64_t index)
+{
+    return (vdj_flight_slot_t*) ((uint8_t*) hdr + sizeof(vdj_flight_header_t)) + index % hdr->slots;
+}
+
+static void
+vdj_flight_record(vdj_flight_dir dir, uint16_t port, uint8_t* packet, ssize_t len, int failed)
+{
+    vdj_flight_header_t* hdr = vdj_flight;
+    vdj_flight_slot_t* slot;
+    struct timespec ts;
+    uint64_t index;
+
+    if (hdr == NULL || len < 0) return;
+
+    ts = cdj_nanos_to_realtime(cdj_now());
+    index = atomic_fetch_add_explicit(&hdr->head, 1, memory_order_relaxed);
+    slot = vdj_flight_slot(hdr, index);
+
+    atomic_store_explicit(&slot->seq, 0, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    slot->ts = (int64_t) ts.tv_sec * CDJ_NANOS_PER_SEC + ts.tv_nsec;
+    slot->port = port;
+    slot->len = len;
+    slot->caplen = len > VDJ_FLIGHT_SNAP ? VDJ_FLIGHT_SNAP : len;
+    slot->dir = dir;
+    slot->failed = failed ? 1 : 0;
+    memcpy(slot->data, packet, slot->caplen);
+
+    atomic_store_explicit(&slot->seq, index + 1, memory_order_release);
+}
+
+void
+vdj_flight_rx(uint16_t port, uint8_t* packet, ssize_t len)
+{
+    vdj_flight_record(VDJ_FLIGHT_RX, port, packet, len, 0);
+}
+
+void
+vdj_flight_tx(uint16_t port, uint8_t* packet, uint16_t len, int failed)
+{
+    vdj_flight_record(VDJ_FLIGHT_TX, port, packet, len, failed);
+}
+//SNIP_flight
+
+static size_t vdj_flight_size = 0;
+
+int
+vdj_flight_open(const char* path, size_t size)
+{
+    vdj_flight_header_t* hdr;
+    uint32_t slots;
+    struct stat st;
+    int fd, err = 0;
+
+    if (vdj_flight) return CDJ_ERROR;
+    if (size == 0) size = VDJ_FLIGHT_SIZE;
+    slots = (size - sizeof(vdj_flight_header_t)) / sizeof(vdj_flight_slot_t);
+    if (size <= sizeof(vdj_flight_header_t) || slots < 2) {
+        fprintf(stderr, "error: flight recorder size %zu too small\n", size);
+        return CDJ_ERROR;
+    }
+    size = sizeof(vdj_flight_header_t) + (size_t) slots * sizeof(vdj_flight_slot_t);
+
+    if ( (fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644)) < 0 ) {
+        fprintf(stderr, "error: open '%s' '%s'\n", path, strerror(errno));
+        return CDJ_ERROR;
+    }
+    // disk blocks now, so recording never waits on the filesystem for space
+    if ( fstat(fd, &st) || (st.st_size != size && ftruncate(fd, size)) ) {
+        err = errno;
+    } else if (st.st_size != size) {
+        // returns the error, errno is not set
+        err = posix_fallocate(fd, 0, size);
+    }
+    if (err) {
+        fprintf(stderr, "error: sizing '%s' '%s'\n", path, strerror(err));
+        close(fd);
+        return CDJ_ERROR;
+    }
+    hdr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, 0);
+    close(fd);
+    if (hdr == MAP_FAILED) {
+        fprintf(stderr, "error: mmap '%s' '%s'\n", path, strerror(errno));
+        return CDJ_ERROR;
+    }
+
+    // carry on after the last run's packets so they can still be dumped
+    if (hdr->magic != VDJ_FLIGHT_MAGIC || hdr->version != VDJ_FLIGHT_VERSION ||
+        hdr->slots != slots || hdr->slot_size != sizeof(vdj_flight_slot_t)) {
+        memset(hdr, 0, sizeof(vdj_flight_header_t));
+        hdr->magic = VDJ_FLIGHT_MAGIC;
+        hdr->version = VDJ_FLIGHT_VERSION;
+        hdr->slots = slots;
+        hdr->slot_size = sizeof(vdj_flight_slot_t);
+    }
+    hdr->pid = getpid();
+
+    vdj_flight_size = size;
+    vdj_flight = hdr;
+    return CDJ_OK;
+}
+
+/**
+ * Call once the threads that record have stopped
+ */
+void
+vdj_flight_close()
+{
+    vdj_flight_header_t* hdr = atomic_exchange(&vdj_flight, NULL);
+    if (hdr) {
+        msync(hdr, vdj_flight_size, MS_ASYNC);
+        munmap(hdr, vdj_flight_size);
+    }
+}
+
+vdj_flight_header_t*
+vdj_flight_map(const char* path)
+{
+    vdj_flight_header_t* hdr;
+    struct stat st;
+    int fd;
+
+    if ( (fd = open(path, O_RDONLY | O_CLOEXEC)) < 0 ) return NULL;
+    if ( fstat(fd, &st) || st.st_size < sizeof(vdj_flight_header_t) ) {
+        close(fd);
+        return NULL;
+    }
+    hdr = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (hdr == MAP_FAILED) return NULL;
+
+    if (hdr->magic != VDJ_FLIGHT_MAGIC || hdr->version != VDJ_FLIGHT_VERSION ||
+        hdr->slot_size != sizeof(vdj_flight_slot_t) ||
+        sizeof(vdj_flight_header_t) + (size_t) hdr->slots * sizeof(vdj_flight_slot_t) > st.st_size) {
+        munmap(hdr, st.st_size);
+        return NULL;
+    }
+    return hdr;
+}
+
+void
+vdj_flight_unmap(vdj_flight_header_t* hdr)
+{
+    if (hdr) munmap(hdr, sizeof(vdj_flight_header_t) + (size_t) hdr->slots * sizeof(vdj_flight_slot_t));
+}
+
+//SNIP_flight_read
+int
+vdj_flight_read(vdj_flight_header_t* hdr, uint64_t index, vdj_flight_slot_t* slot)
+{
+    vdj_flight_slot_t* src = vdj_flight_slot(hdr, index);
+
+    if (atomic_load_explicit(&src->seq, memory_order_acquire) != index + 1) return CDJ_ERROR;
+    memcpy(slot, src, sizeof(vdj_flight_slot_t));
+    atomic_thread_fence(memory_order_acquire);
+    if (atomic_load_explicit(&src->seq, memory_order_relaxed) != index + 1) return CDJ_ERROR;
+    if (slot->caplen > VDJ_FLIGHT_SNAP) return CDJ_ERROR;
+    return CDJ_OK;
+}
+//SNIP_flight_read
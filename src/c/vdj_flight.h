@@ -0,0 +1,67 @@
+#ifndef _VDJ_FLIGHT_H_INCLUDED_
+#define _VDJ_FLIGHT_H_INCLUDED_
+
+#include <stdatomic.h>
+#include <sys/types.h>
+
+#include "cdj.h"
+
+/**
+ * Flight recorder, every datagram received and sent is kept in a fixed size ring in a memory mapped file, so
+ * after sync went wrong mid-set the last minutes of traffic can be dumped with vdj-flight-dump, even if vdj
+ * crashed.
+ *
+ * Recording is a fetch_add to claim a slot, a memcpy into the page cache and a release store, no allocation,
+ * no locks and no syscalls, the kernel writes the pages back in its own time.  Each slot carries the index
+ * it was written for, set last, so a reader skips slots that are half written or were overwritten under it.
+ * Packets longer than VDJ_FLIGHT_SNAP are cut, len keeps their real length.
+ *
+ *    vdj_flight_open(VDJ_FLIGHT_PATH, 0);
+ */
+
+#define VDJ_FLIGHT_PATH         "/var/tmp/vdj.flight"
+#define VDJ_FLIGHT_MAGIC        0x544c4656  // "VFLT"
+#define VDJ_FLIGHT_VERSION      1
+#define VDJ_FLIGHT_SIZE         (16 * 1024 * 1024)  // default file size, ~30k packets, many minutes of a busy link
+#define VDJ_FLIGHT_SNAP         512
+
+typedef enum {
+    VDJ_FLIGHT_RX = 0,
+    VDJ_FLIGHT_TX
+} vdj_flight_dir;
+
+typedef struct {
+    uint32_t            magic;
+    uint32_t            version;
+    uint32_t            slots;
+    uint32_t            slot_size;
+    _Atomic uint64_t    head;           // packets ever recorded, the next slot is head % slots
+    int32_t             pid;            // last process to record
+    uint8_t             pad[36];
+} vdj_flight_header_t;
+
+typedef struct {
+    _Atomic uint64_t    seq;            // index + 1 of the packet in this slot, 0 while it is written
+    int64_t             ts;             // CLOCK_REALTIME nanos
+    uint16_t            port;
+    uint16_t            len;            // as received or sent
+    uint16_t            caplen;         // bytes kept
+    uint8_t             dir;            // vdj_flight_dir
+    uint8_t             failed;         // sendto() failed
+    uint8_t             pad[8];
+    uint8_t             data[VDJ_FLIGHT_SNAP];
+} vdj_flight_slot_t;
+
+// recording, process wide, size 0 for VDJ_FLIGHT_SIZE, an existing ring of the same size is appended to
+int vdj_flight_open(const char* path, size_t size);
+void vdj_flight_close();
+void vdj_flight_rx(uint16_t port, uint8_t* packet, ssize_t len);
+void vdj_flight_tx(uint16_t port, uint8_t* packet, uint16_t len, int failed);
+
+// reading, while it is recorded or after the fact
+vdj_flight_header_t* vdj_flight_map(const char* path);
+void vdj_flight_unmap(vdj_flight_header_t* hdr);
+// copy of the packet at index, CDJ_ERROR if it is being written or has been overwritten
+int vdj_flight_read(vdj_flight_header_t* hdr, uint64_t index, vdj_flight_slot_t* slot);
+
+#endif // _VDJ_FLIGHT_H_INCLUDED_
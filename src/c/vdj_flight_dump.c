@@ -0,0 +1,114 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cdj.h"
+#include "vdj_flight.h"
+
+/**
+ * Prints the packets a flight recorder kept, the last seconds before the most recent packet by default, so it
+ * can be run after the fact, e.g. after vdj was restarted.
+ *
+ * @author teknopaul
+ */
+
+static void
+usage()
+{
+    printf("Dump the last seconds of a vdj flight recorder\n");
+    printf("options:\n");
+    printf("    -f - flight recorder file, default %s\n", VDJ_FLIGHT_PATH);
+    printf("    -s - seconds before the last packet to dump, default 10, 0 for all that is kept\n");
+    printf("    -p - only this port, e.g. 50001\n");
+    printf("    -q - one line per packet, no hex\n");
+    printf("    -h - display this text\n");
+    exit(0);
+}
+
+static void
+print_slot(vdj_flight_slot_t* slot, int quiet)
+{
+    uint8_t packet[1500];
+    char when[32];
+    struct tm tm;
+    time_t secs = slot->ts / CDJ_NANOS_PER_SEC;
+
+    localtime_r(&secs, &tm);
+    strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", &tm);
+    printf("%s.%06lld %s %i %i %s%s\n", when, (long long) (slot->ts % CDJ_NANOS_PER_SEC) / 1000,
+        slot->dir == VDJ_FLIGHT_TX ? "tx" : "rx", slot->port, slot->len,
+        slot->caplen > CDJ_PACKET_TYPE_OFFSET + 1 && cdj_validate_header(slot->data, slot->caplen) == CDJ_OK ?
+            cdj_type_to_string(slot->port, slot->data[CDJ_PACKET_TYPE_OFFSET], slot->data[CDJ_PACKET_TYPE_OFFSET + 1]) :
+            "not prolink",
+        slot->failed ? " FAILED" : "");
+    if (quiet || slot->caplen <= CDJ_PACKET_TYPE_OFFSET + 1) return;
+
+    // cdj_fprint_packet() reads the header and model name, zeros past the end keep it inside the buffer
+    memset(packet, 0, sizeof(packet));
+    memcpy(packet, slot->data, slot->caplen);
+    cdj_fprint_packet(stdout, packet, slot->caplen, slot->port);
+}
+
+int main(int argc, char *argv[])
+{
+    char* path = VDJ_FLIGHT_PATH;
+    double seconds = 10.0;
+    int port = 0;
+    int quiet = 0;
+    vdj_flight_header_t* hdr;
+    vdj_flight_slot_t slot;
+    uint64_t head, oldest, first, i;
+    int64_t last = 0;
+    int n = 0;
+
+    int c;
+    while ( ( c = getopt(argc, argv, "f:s:p:qh") ) != EOF) {
+        switch (c) {
+            case 'h':
+                usage();
+                break;
+            case 'f':
+                path = optarg;
+                break;
+            case 's':
+                seconds = strtod(optarg, NULL);
+                break;
+            case 'p':
+                port = atoi(optarg);
+                break;
+            case 'q':
+                quiet = 1;
+                break;
+        }
+    }
+
+    if ( (hdr = vdj_flight_map(path)) == NULL ) {
+        fprintf(stderr, "error: no flight recorder at '%s'\n", path);
+        return 1;
+    }
+
+    head = atomic_load(&hdr->head);
+    oldest = head > hdr->slots ? head - hdr->slots : 0;
+
+    // walk back from the newest packet to the first one in the window
+    first = head;
+    for (i = head; i > oldest; i--) {
+        if ( vdj_flight_read(hdr, i - 1, &slot) ) continue;
+        if (last == 0) last = slot.ts;
+        if (seconds > 0.0 && slot.ts < last - (int64_t) (seconds * CDJ_NANOS_PER_SEC)) break;
+        first = i - 1;
+    }
+
+    for (i = first; i < head; i++) {
+        if ( vdj_flight_read(hdr, i, &slot) ) continue;
+        if (port && slot.port != port) continue;
+        print_slot(&slot, quiet);
+        n++;
+    }
+    fprintf(stderr, "%d packets, %llu recorded by pid %d, %u kept\n", n, (unsigned long long) head, hdr->pid, hdr->slots);
+
+    vdj_flight_unmap(hdr);
+    return 0;
+}
@@ -8,7 +8,14 @@
 #include "vdj.h"
 #include "vdj_net.h"
 #include "vdj_beatout.h"
+#include "vdj_rtt.h"
+#include "vdj_metrics.h"
+#include "vdj_shm.h"
+#include "vdj_flight.h"
+#include "vdj_series.h"
 #include "vdj_discovery.h"
+#include "vdj_thread.h"
+#include "vdj_txtime.h"
 
 /**
  * This app does nothing other than join the ProLink networks as a player and tries to be
@@ -26,6 +33,19 @@ vdj_usage()
     printf("    -x - mimic XDJ-1000\n");
     printf("    -b - bpm, if set vdj broadcasts beat info\n");
     printf("    -M - start as master\n");
+    printf("    -R - SCHED_FIFO priority for the beatout thread (1-99), also locks memory\n");
+    printf("    -C - cpu to pin the beatout thread to\n");
+    printf("    -T - schedule beats with SO_TXTIME, needs the fq qdisc on the interface\n");
+    printf("    -t - timestamp beats as the kernel sends them and print how late they left\n");
+    printf("    -F - follow the master's tempo and phase, -b sets the tempo until a master is found\n");
+    printf("    -S - max change in beat interval per beat when following, default %.3f\n", VDJ_FOLLOW_SLEW);
+    printf("    -r - ramp to this bpm, starting on the bar after the first 4 bars\n");
+    printf("    -n - beats to ramp over, default 16\n");
+    printf("    -L - measure round trip latency to each deck and date their beats half of it earlier\n");
+    printf("    -E - serve Prometheus metrics on this tcp port on loopback, address:port, or unix:/path\n");
+    printf("    -P - publish the backline in shared memory, default name %s, read it with vdj-shm-dump\n", VDJ_SHM_NAME);
+    printf("    -f - record every packet sent and received, default file %s, read it with vdj-flight-dump\n", VDJ_FLIGHT_PATH);
+    printf("    -w - record beats, tempo and master changes to this time series file, query it with vdj-series\n");
     printf("    -h - display this text\n");
     exit(0);
 }
@@ -65,12 +85,26 @@ int main(int argc, char *argv[])
     char* iface = NULL;
     float bpm = 0.0;
     char master = 0;
+    int rt_priority = 0;
+    int rt_cpu = -1;
+    char txtime = 0;
+    char tx_timestamps = 0;
+    char follow = 0;
+    float slew = 0.0;
+    float ramp_bpm = 0.0;
+    uint32_t ramp_beats = 16;
+    char rtt = 0;
+    char* metrics = NULL;
+    char* shm = NULL;
+    char* flight = NULL;
+    char* series = NULL;
+    int seconds = 0;
 
     // we need to know which interface to use
     // likely to have wifi and LAN for CDJs at home
     // TODO likely not to have DHCPd in a club
     int c;
-    while ( ( c = getopt(argc, argv, "p:i:b:hamxcM") ) != EOF) {
+    while ( ( c = getopt(argc, argv, "p:i:b:R:C:S:r:n:E:P::f::w:hamxcMTtFL") ) != EOF) {
         switch (c) {
             case 'h':
                 vdj_usage();
@@ -97,10 +131,60 @@ int main(int argc, char *argv[])
             case 'i':
                 iface = optarg;
                 break;
+            case 'R':
+                rt_priority = atoi(optarg);
+                break;
+            case 'C':
+                rt_cpu = atoi(optarg);
+                break;
+            case 'T':
+                txtime = 1;
+                break;
+            case 't':
+                tx_timestamps = 1;
+                break;
+            case 'F':
+                follow = 1;
+                break;
+            case 'S':
+                slew = strtof(optarg, NULL);
+                break;
+            case 'L':
+                rtt = 1;
+                break;
+            case 'r':
+                ramp_bpm = strtof(optarg, NULL);
+                break;
+            case 'n':
+                ramp_beats = atoi(optarg);
+                break;
+            case 'E':
+                metrics = optarg;
+                break;
+            case 'P':
+                shm = optarg ? optarg : VDJ_SHM_NAME;
+                break;
+            case 'f':
+                flight = optarg ? optarg : VDJ_FLIGHT_PATH;
+                break;
+            case 'w':
+                series = optarg;
+                break;
         }
     }
 
     if (player_id == 0) flags |= VDJ_FLAG_AUTO_ID;
+
+    // before any socket is opened so discovery is recorded too
+    if ( flight && vdj_flight_open(flight, 0) != CDJ_OK ) {
+        fprintf(stderr, "error: opening flight recorder\n");
+        return 1;
+    }
+    if ( series && vdj_series_open(series) != CDJ_OK ) {
+        fprintf(stderr, "error: opening time series\n");
+        return 1;
+    }
+
     /**
      * init the vdj
      */
@@ -111,6 +195,19 @@ int main(int argc, char *argv[])
     }
     if (bpm) v->bpm = bpm;
     if (master) v->master = 1;
+    if (follow) vdj_beatout_follow_master(v, 1, slew);
+
+    // beats must go out on time even when the box is busy playing audio
+    if (rt_priority) {
+        vdj_lock_memory();
+        if ( vdj_thread_set_priority(v, VDJ_THREAD_BEATOUT, rt_priority) ) {
+            fprintf(stderr, "error: priority must be 1 - %d\n", VDJ_THREAD_PRIORITY_MAX);
+            vdj_destroy(v);
+            return 1;
+        }
+        vdj_thread_set_prefault(v, VDJ_THREAD_BEATOUT, 64 * 1024);
+    }
+    if (rt_cpu >= 0) vdj_thread_set_cpu(v, VDJ_THREAD_BEATOUT, rt_cpu);
 
     if ( vdj_open_sockets(v) != CDJ_OK ) {
         fprintf(stderr, "error: failed to open sockets\n");
@@ -142,6 +239,34 @@ int main(int argc, char *argv[])
         return 1;
     }
 
+    if ( rtt && vdj_init_rtt_thread(v) != CDJ_OK ) {
+        fprintf(stderr, "error: init rtt thread\n");
+        sleep(1);
+        vdj_destroy(v);
+        return 1;
+    }
+
+    if ( metrics && vdj_init_metrics_thread(v, metrics) != CDJ_OK ) {
+        fprintf(stderr, "error: init metrics thread\n");
+        vdj_destroy(v);
+        return 1;
+    }
+
+    if ( shm && vdj_init_shm_thread(v, shm) != CDJ_OK ) {
+        fprintf(stderr, "error: init shm thread\n");
+        vdj_destroy(v);
+        return 1;
+    }
+
+    // following needs the master's beats, metrics need them for the jitter histograms, shm readers and the
+    // time series their times
+    if ( (follow || metrics || shm || series) && vdj_init_managed_beat_thread(v, NULL) != CDJ_OK ) {
+        fprintf(stderr, "error: init managed beat thread\n");
+        sleep(1);
+        vdj_destroy(v);
+        return 1;
+    }
+
     if ( vdj_init_status_thread(v) != CDJ_OK ) {
         fprintf(stderr, "error: init status thread\n");
         sleep(1);
@@ -150,6 +275,8 @@ int main(int argc, char *argv[])
     }
 
     if ( bpm > 0.0 ) {
+        if (txtime) vdj_txtime_enable(v, CLOCK_MONOTONIC);
+        if (tx_timestamps) vdj_tx_timestamps_enable(v);
         if ( vdj_init_beatout_thread(v) != CDJ_OK )  {
             fprintf(stderr, "error: init beatout thread\n");
             sleep(1);
@@ -157,10 +284,25 @@ int main(int argc, char *argv[])
             return 1;
        }
        vdj_start_beatout_thread(v);
+       if (ramp_bpm > 0.0) {
+           sleep((unsigned int) (16 * 60 / bpm));
+           vdj_beatout_ramp_tempo(v, ramp_bpm, ramp_beats, VDJ_BEATOUT_BAR);
+       }
     }
 
 
-    while (1) sleep(1);
+    while (1) {
+        sleep(1);
+        seconds++;
+        if (rtt && seconds % 10 == 0) {
+            vdj_rtt_fprint(stdout, v);
+            fflush(stdout);
+        }
+        if (tx_timestamps && bpm > 0.0 && seconds % 10 == 0) {
+            printf("beat tx latency: %.3fms\n", (double) v->tx_latency / CDJ_NANOS_PER_MILLI);
+            fflush(stdout);
+        }
+    }
 
     vdj_destroy(v);
 
@@ -4,6 +4,8 @@
 
 #include "cdj.h"
 #include "vdj.h"
+#include "vdj_metrics.h"
+#include "vdj_series.h"
 
 /* 
 
@@ -47,6 +49,7 @@ vdj_request_master(vdj_t* v)
         master_id = v->player_id;
         v->backline->master_id = v->player_id;
         v->backline->master_bpm = v->bpm;
+        vdj_series_master(v->player_id);
         v->master = 1;
         v->master_state |= CDJ_STAT_FLAG_MASTER;
         return;
@@ -77,6 +80,7 @@ vdj_update_new_master(vdj_t* v, int8_t new_master_id)
     if (new_master_id > 0) {
         if (v->player_id == new_master_id) { // thats me!
             //fprintf(stderr, "master handoff confirmed\n");
+            if ( ! v->master ) vdj_metrics_inc(VDJ_METRIC_MASTER_HANDOFFS);
             v->master = 1;
             v->master_req = -1;
             v->backline->sync_counter++;
@@ -0,0 +1,427 @@
+/**
+ * Metrics registry and exporter, see vdj_metrics.h
+ *
+ * @author teknopaul
+ */
+
+#define _GNU_SOURCE
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "cdj.h"
+#include "vdj.h"
+#include "vdj_thread.h"
+#include "vdj_metrics.h"
+
+//SNIP_metrics
+#define VDJ_METRICS_PORTS       3       // 50000, 50001, 50002
+
+typedef struct {
+    uint64_t _Atomic    rx[VDJ_METRICS_PORTS][VDJ_METRICS_TYPES];
+    uint64_t _Atomic    rx_invalid[VDJ_METRICS_PORTS];
+    uint64_t _Atomic    tx[VDJ_METRICS_PORTS][VDJ_METRICS_TYPES];
+    uint64_t _Atomic    tx_errors[VDJ_METRICS_PORTS][VDJ_METRICS_TYPES];
+    uint64_t _Atomic    counters[VDJ_METRICS_COUNTERS];
+    uint64_t _Atomic    handler[VDJ_THREAD_ROLES][VDJ_METRICS_BUCKETS + 1];
+    uint64_t _Atomic    handler_nanos[VDJ_THREAD_ROLES];
+    uint64_t _Atomic    jitter[VDJ_MAX_BACKLINE + 1][VDJ_METRICS_BUCKETS + 1];
+    uint64_t _Atomic    jitter_nanos[VDJ_MAX_BACKLINE + 1];
+} __attribute__((aligned(64))) vdj_metrics_shard_t;
+
+// upper bounds in nanos
+static const int64_t vdj_metrics_handler_le[VDJ_METRICS_BUCKETS] = {
+    1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 1000000
+};
+static const int64_t vdj_metrics_jitter_le[VDJ_METRICS_BUCKETS] = {
+    100000, 250000, 500000, 1000000, 2000000, 5000000, 10000000, 25000000, 50000000
+};
+
+static vdj_metrics_shard_t vdj_metrics_shards[VDJ_METRICS_SHARDS];
+static unsigned _Atomic vdj_metrics_next_shard = ATOMIC_VAR_INIT(0);
+static _Thread_local vdj_metrics_shard_t* vdj_metrics_local = NULL;
+
+static vdj_metrics_shard_t*
+vdj_metrics_shard()
+{
+    if (vdj_metrics_local == NULL) {
+        vdj_metrics_local = &vdj_metrics_shards[atomic_fetch_add(&vdj_metrics_next_shard, 1) % VDJ_METRICS_SHARDS];
+    }
+    return vdj_metrics_local;
+}
+
+static inline void
+vdj_metrics_add(uint64_t _Atomic* counter, uint64_t n)
+{
+    atomic_fetch_add_explicit(counter, n, memory_order_relaxed);
+}
+
+static int
+vdj_metrics_port(uint16_t port)
+{
+    switch (port) {
+        case CDJ_DISCOVERY_PORT: return 0;
+        case CDJ_BEAT_PORT: return 1;
+        case CDJ_UPDATE_PORT: return 2;
+    }
+    return -1;
+}
+
+static int
+vdj_metrics_bucket(const int64_t* le, int64_t nanos)
+{
+    int b;
+    for (b = 0; b < VDJ_METRICS_BUCKETS; b++) {
+        if (nanos <= le[b]) return b;
+    }
+    return VDJ_METRICS_BUCKETS;
+}
+
+void
+vdj_metrics_rx(uint16_t port, uint8_t* packet, ssize_t len)
+{
+    vdj_metrics_shard_t* s;
+    int p;
+    uint8_t type;
+
+    if (len <= 0 || (p = vdj_metrics_port(port)) < 0) return;
+    s = vdj_metrics_shard();
+    if ( cdj_validate_header(packet, len) || len < CDJ_PACKET_TYPE_OFFSET + 1 ) {
+        vdj_metrics_add(&s->rx_invalid[p], 1);
+        return;
+    }
+    type = cdj_packet_type(packet, len);
+    vdj_metrics_add(&s->rx[p][type < VDJ_METRICS_TYPES ? type : VDJ_METRICS_TYPES - 1], 1);
+}
+
+void
+vdj_metrics_tx(uint16_t port, uint8_t* packet, uint16_t len, int failed)
+{
+    vdj_metrics_shard_t* s;
+    int p;
+    uint8_t type;
+
+    if ( (p = vdj_metrics_port(port)) < 0 || len < CDJ_PACKET_TYPE_OFFSET + 1 ) return;
+    s = vdj_metrics_shard();
+    type = packet[CDJ_PACKET_TYPE_OFFSET];
+    if (type >= VDJ_METRICS_TYPES) type = VDJ_METRICS_TYPES - 1;
+    vdj_metrics_add(failed ? &s->tx_errors[p][type] : &s->tx[p][type], 1);
+}
+
+void
+vdj_metrics_inc(vdj_metric metric)
+{
+    vdj_metrics_add(&vdj_metrics_shard()->counters[metric], 1);
+}
+
+void
+vdj_metrics_handler_time(vdj_thread_role role, int64_t nanos)
+{
+    vdj_metrics_shard_t* s = vdj_metrics_shard();
+
+    if (nanos < 0) nanos = 0;
+    vdj_metrics_add(&s->handler[role][vdj_metrics_bucket(vdj_metrics_handler_le, nanos)], 1);
+    vdj_metrics_add(&s->handler_nanos[role], nanos);
+}
+
+void
+vdj_metrics_beat_jitter(uint8_t player_id, int64_t nanos)
+{
+    vdj_metrics_shard_t* s;
+
+    if (player_id > VDJ_MAX_BACKLINE) return;
+    s = vdj_metrics_shard();
+    if (nanos < 0) nanos = -nanos;
+    vdj_metrics_add(&s->jitter[player_id][vdj_metrics_bucket(vdj_metrics_jitter_le, nanos)], 1);
+    vdj_metrics_add(&s->jitter_nanos[player_id], nanos);
+}
+
+
+// exporter
+
+/**
+ * Sum of one counter across all shards, offset is the counter's position in a shard.
+ */
+static uint64_t
+vdj_metrics_sum(size_t offset)
+{
+    uint64_t sum = 0;
+    int i;
+    for (i = 0; i < VDJ_METRICS_SHARDS; i++) {
+        sum += atomic_load_explicit((uint64_t _Atomic*) ((uint8_t*) &vdj_metrics_shards[i] + offset),
+                                    memory_order_relaxed);
+    }
+    return sum;
+}
+
+#define VDJ_METRICS_SUM(field) vdj_metrics_sum(offsetof(vdj_metrics_shard_t, field))
+
+static void
+vdj_metrics_fprint_packets(FILE* f, const char* name, const char* help, size_t offset)
+{
+    static const uint16_t ports[VDJ_METRICS_PORTS] = { CDJ_DISCOVERY_PORT, CDJ_BEAT_PORT, CDJ_UPDATE_PORT };
+    uint64_t n;
+    int p, t;
+
+    fprintf(f, "# HELP %s %s\n# TYPE %s counter\n", name, help, name);
+    for (p = 0; p < VDJ_METRICS_PORTS; p++) {
+        for (t = 0; t < VDJ_METRICS_TYPES; t++) {
+            n = vdj_metrics_sum(offset + (p * VDJ_METRICS_TYPES + t) * sizeof(uint64_t));
+            if (n) fprintf(f, "%s{port=\"%u\",type=\"%s\"} %llu\n", name, ports[p],
+                           cdj_type_to_string(ports[p], t, 0), (unsigned long long) n);
+        }
+    }
+}
+
+static void
+vdj_metrics_fprint_histogram(FILE* f, const char* name, const char* label, const char* value,
+                             const int64_t* le, size_t offset, size_t sum_offset)
+{
+    uint64_t count = 0;
+    int b;
+
+    for (b = 0; b <= VDJ_METRICS_BUCKETS; b++) {
+        count += vdj_metrics_sum(offset + b * sizeof(uint64_t));
+        if (b < VDJ_METRICS_BUCKETS) {
+            fprintf(f, "%s_bucket{%s=\"%s\",le=\"%g\"} %llu\n", name, label, value, le[b] / 1e9,
+                    (unsigned long long) count);
+        } else {
+            fprintf(f, "%s_bucket{%s=\"%s\",le=\"+Inf\"} %llu\n", name, label, value, (unsigned long long) count);
+        }
+    }
+    fprintf(f, "%s_sum{%s=\"%s\"} %.9f\n", name, label, value, vdj_metrics_sum(sum_offset) / 1e9);
+    fprintf(f, "%s_count{%s=\"%s\"} %llu\n", name, label, value, (unsigned long long) count);
+}
+
+/**
+ * A bare port listens on loopback only, the metrics say a lot about the box, address:port to listen elsewhere
+ */
+static int
+vdj_metrics_addr(const char* listen_on, struct sockaddr_in* in)
+{
+    char host[INET_ADDRSTRLEN];
+    const char* colon = strrchr(listen_on, ':');
+    char* end;
+    long port;
+
+    memset(in, 0, sizeof(struct sockaddr_in));
+    in->sin_family = AF_INET;
+    in->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (colon) {
+        if (colon - listen_on >= sizeof(host)) return CDJ_ERROR;
+        memcpy(host, listen_on, colon - listen_on);
+        host[colon - listen_on] = '\0';
+        if ( inet_pton(AF_INET, host, &in->sin_addr) != 1 ) return CDJ_ERROR;
+        listen_on = colon + 1;
+    }
+    port = strtol(listen_on, &end, 10);
+    if (end == listen_on || *end || port <= 0 || port > 0xffff) return CDJ_ERROR;
+    in->sin_port = htons((uint16_t) port);
+    return CDJ_OK;
+}
+//SNIP_metrics
+
+static const char* vdj_metrics_counter_names[VDJ_METRICS_COUNTERS] = {
+    "vdj_member_joins_total",
+    "vdj_member_expiries_total",
+    "vdj_master_handoffs_total"
+};
+
+static unsigned _Atomic vdj_metrics_running = ATOMIC_VAR_INIT(0);
+
+typedef struct {
+    vdj_t*      v;
+    int         fd;
+} vdj_metrics_server_t;
+
+void
+vdj_metrics_fprint(FILE* f, vdj_t* v)
+{
+    static const uint16_t ports[VDJ_METRICS_PORTS] = { CDJ_DISCOVERY_PORT, CDJ_BEAT_PORT, CDJ_UPDATE_PORT };
+    vdj_link_member_t* m;
+    cdj_nanos_t now = cdj_now();
+    char player[8];
+    int i, b;
+    uint64_t n;
+
+    vdj_metrics_fprint_packets(f, "vdj_rx_packets_total", "ProLink packets received",
+                               offsetof(vdj_metrics_shard_t, rx));
+    fprintf(f, "# HELP vdj_rx_invalid_total Packets received without a ProLink header\n"
+               "# TYPE vdj_rx_invalid_total counter\n");
+    for (i = 0; i < VDJ_METRICS_PORTS; i++) {
+        fprintf(f, "vdj_rx_invalid_total{port=\"%u\"} %llu\n", ports[i],
+                (unsigned long long) VDJ_METRICS_SUM(rx_invalid[i]));
+    }
+    vdj_metrics_fprint_packets(f, "vdj_tx_packets_total", "ProLink packets sent",
+                               offsetof(vdj_metrics_shard_t, tx));
+    vdj_metrics_fprint_packets(f, "vdj_tx_errors_total", "ProLink packets that sendto() failed on",
+                               offsetof(vdj_metrics_shard_t, tx_errors));
+
+    for (i = 0; i < VDJ_METRICS_COUNTERS; i++) {
+        fprintf(f, "# TYPE %s counter\n%s %llu\n", vdj_metrics_counter_names[i], vdj_metrics_counter_names[i],
+                (unsigned long long) VDJ_METRICS_SUM(counters[i]));
+    }
+
+    fprintf(f, "# HELP vdj_handler_seconds Time to handle one received packet\n"
+               "# TYPE vdj_handler_seconds histogram\n");
+    for (i = 0; i < VDJ_THREAD_ROLES; i++) {
+        for (n = 0, b = 0; b <= VDJ_METRICS_BUCKETS; b++) n += VDJ_METRICS_SUM(handler[i][b]);
+        if (n == 0) continue;
+        vdj_metrics_fprint_histogram(f, "vdj_handler_seconds", "thread", vdj_thread_name(i), vdj_metrics_handler_le,
+                                     offsetof(vdj_metrics_shard_t, handler[i]),
+                                     offsetof(vdj_metrics_shard_t, handler_nanos[i]));
+    }
+
+    fprintf(f, "# HELP vdj_beat_jitter_seconds Beat arrival against the previous beat and tempo\n"
+               "# TYPE vdj_beat_jitter_seconds histogram\n");
+    for (i = 1; i <= VDJ_MAX_BACKLINE; i++) {
+        for (n = 0, b = 0; b <= VDJ_METRICS_BUCKETS; b++) n += VDJ_METRICS_SUM(jitter[i][b]);
+        if (n == 0) continue;
+        snprintf(player, sizeof(player), "%i", i);
+        vdj_metrics_fprint_histogram(f, "vdj_beat_jitter_seconds", "player", player, vdj_metrics_jitter_le,
+                                     offsetof(vdj_metrics_shard_t, jitter[i]),
+                                     offsetof(vdj_metrics_shard_t, jitter_nanos[i]));
+    }
+
+    if (v == NULL) return;
+
+    fprintf(f, "# TYPE vdj_bpm gauge\nvdj_bpm %.2f\n", v->bpm);
+    fprintf(f, "# TYPE vdj_master gauge\nvdj_master %u\n", v->master);
+    if (v->backline == NULL) return;
+
+    fprintf(f, "# TYPE vdj_link_members gauge\nvdj_link_members %u\n", vdj_link_member_count(v));
+    fprintf(f, "# TYPE vdj_master_player gauge\nvdj_master_player %u\n", v->backline->master_id);
+    fprintf(f, "# TYPE vdj_member_bpm gauge\n# TYPE vdj_member_last_beat_age_seconds gauge\n"
+               "# TYPE vdj_member_rtt_seconds gauge\n");
+    for (i = 1; i <= VDJ_MAX_BACKLINE; i++) {
+        if ( (m = vdj_get_link_member(v, i)) == NULL || m->gone ) continue;
+        fprintf(f, "vdj_member_bpm{player=\"%i\"} %.2f\n", i, m->bpm);
+        if (m->last_beat) {
+            fprintf(f, "vdj_member_last_beat_age_seconds{player=\"%i\"} %.3f\n", i, (now - m->last_beat) / 1e9);
+        }
+        if (m->rtt_samples) fprintf(f, "vdj_member_rtt_seconds{player=\"%i\"} %.6f\n", i, m->srtt / 1e9);
+    }
+}
+
+static void
+vdj_metrics_serve(vdj_metrics_server_t* srv, int fd)
+{
+    struct timeval tv = { 1, 0 };
+    char request[2048];
+    char header[128];
+    char* body = NULL;
+    size_t body_len = 0;
+    FILE* f;
+    int len;
+
+    // the request is not looked at, every path gets the metrics
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    if ( recv(fd, request, sizeof(request), 0) <= 0 ) return;
+
+    if ( (f = open_memstream(&body, &body_len)) == NULL ) return;
+    vdj_metrics_fprint(f, srv->v);
+    fclose(f);
+
+    len = snprintf(header, sizeof(header), "HTTP/1.0 200 OK\r\n"
+        "Content-Type: text/plain; version=0.0.4\r\nContent-Length: %zu\r\n\r\n", body_len);
+    send(fd, header, len, MSG_NOSIGNAL);
+    send(fd, body, body_len, MSG_NOSIGNAL);
+    free(body);
+}
+
+static void*
+vdj_metrics_loop(void* arg)
+{
+    vdj_metrics_server_t* srv = arg;
+    struct pollfd pfd = { srv->fd, POLLIN, 0 };
+    int fd;
+
+    while (vdj_metrics_running) {
+        // wake now and then to see if we were stopped
+        if ( poll(&pfd, 1, 500) <= 0 ) continue;
+        if ( (fd = accept(srv->fd, NULL, NULL)) < 0 ) continue;
+        vdj_metrics_serve(srv, fd);
+        close(fd);
+    }
+
+    close(srv->fd);
+    free(srv);
+    return NULL;
+}
+
+static int
+vdj_metrics_listen(const char* listen_on)
+{
+    struct sockaddr_un un;
+    struct sockaddr_in in;
+    int fd, value = 1;
+
+    if ( strncmp(listen_on, "unix:", 5) == 0 ) {
+        listen_on += 5;
+        if (strlen(listen_on) >= sizeof(un.sun_path)) {
+            fprintf(stderr, "error: socket path too long '%s'\n", listen_on);
+            return -1;
+        }
+        memset(&un, 0, sizeof(un));
+        un.sun_family = AF_UNIX;
+        strcpy(un.sun_path, listen_on);
+        unlink(listen_on);
+        if ( (fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0 ) return -1;
+        if ( bind(fd, (struct sockaddr*) &un, sizeof(un)) ) goto fail;
+    } else {
+        if ( vdj_metrics_addr(listen_on, &in) ) {
+            fprintf(stderr, "error: metrics listen '%s' is not port, address:port or unix:/path\n", listen_on);
+            return -1;
+        }
+        if ( (fd = socket(AF_INET, SOCK_STREAM, 0)) < 0 ) return -1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &value, sizeof(value));
+        if ( bind(fd, (struct sockaddr*) &in, sizeof(in)) ) goto fail;
+    }
+    if ( listen(fd, 4) ) goto fail;
+    return fd;
+
+    fail:
+    fprintf(stderr, "error: metrics listen '%s' '%s'\n", listen_on, strerror(errno));
+    close(fd);
+    return -1;
+}
+
+int
+vdj_init_metrics_thread(vdj_t* v, const char* listen_on)
+{
+    vdj_metrics_server_t* srv;
+
+    if (vdj_metrics_running) return CDJ_ERROR;
+
+    if ( (srv = calloc(1, sizeof(vdj_metrics_server_t))) == NULL ) return CDJ_ERROR;
+    srv->v = v;
+    if ( (srv->fd = vdj_metrics_listen(listen_on)) < 0 ) {
+        free(srv);
+        return CDJ_ERROR;
+    }
+
+    vdj_metrics_running = 1;
+    if ( vdj_thread_create(v, VDJ_THREAD_METRICS, vdj_metrics_loop, srv) ) {
+        vdj_metrics_running = 0;
+        close(srv->fd);
+        free(srv);
+        return CDJ_ERROR;
+    }
+    return CDJ_OK;
+}
+
+void
+vdj_stop_metrics_thread(vdj_t* v)
+{
+    vdj_metrics_running = 0;
+}
@@ -0,0 +1,53 @@
+#ifndef _VDJ_METRICS_H_INCLUDED_
+#define _VDJ_METRICS_H_INCLUDED_
+
+#include <stdio.h>
+#include <sys/types.h>
+
+#include "cdj.h"
+#include "vdj.h"
+
+/**
+ * Counters and histograms for unattended boxes, exported in the Prometheus text format.
+ *
+ * The registry is process wide.  Each thread that counts something claims its own shard on first use and only
+ * ever adds to that one, so counting is an uncontended relaxed atomic add on a cache line no other thread
+ * writes.  The exporter sums the shards when scraped, gauges such as link members, bpm and round trip are read
+ * from the vdj_t at that time.
+ *
+ * The exporter thread serves plain HTTP on a TCP port or a unix socket, e.g.
+ *
+ *    vdj_init_metrics_thread(v, "9310");                       // 127.0.0.1 only
+ *    vdj_init_metrics_thread(v, "0.0.0.0:9310");               // for a scraper on another host
+ *    vdj_init_metrics_thread(v, "unix:/run/vdj.metrics");     // curl --unix-socket /run/vdj.metrics http://x/
+ */
+
+#define VDJ_METRICS_SHARDS      16      // threads beyond this share shards, still correct, just contended
+#define VDJ_METRICS_TYPES       0x40    // packet types counted, higher types are counted as 0x3f
+#define VDJ_METRICS_BUCKETS     9       // histogram buckets, plus +Inf
+
+typedef enum {
+    VDJ_METRIC_MEMBER_JOINS = 0,
+    VDJ_METRIC_MEMBER_EXPIRIES,
+    VDJ_METRIC_MASTER_HANDOFFS,
+    VDJ_METRICS_COUNTERS
+} vdj_metric;
+
+// count a received packet, whether or not it has a valid header
+void vdj_metrics_rx(uint16_t port, uint8_t* packet, ssize_t len);
+// count a sent packet, failed if sendto() did
+void vdj_metrics_tx(uint16_t port, uint8_t* packet, uint16_t len, int failed);
+void vdj_metrics_inc(vdj_metric metric);
+// time a thread spent handling one packet
+void vdj_metrics_handler_time(vdj_thread_role role, int64_t nanos);
+// a beat from player_id came this far from where its previous beat and tempo said it would
+void vdj_metrics_beat_jitter(uint8_t player_id, int64_t nanos);
+
+// text exposition format
+void vdj_metrics_fprint(FILE* f, vdj_t* v);
+
+// listen is a TCP port on loopback, address:port, or unix:/path
+int vdj_init_metrics_thread(vdj_t* v, const char* listen);
+void vdj_stop_metrics_thread(vdj_t* v);
+
+#endif // _VDJ_METRICS_H_INCLUDED_
@@ -0,0 +1,241 @@
+/**
+ * MIDI clock locked to a beat grid.
+ *
+ * The timer thread keeps its own position, ticks into the bar, and its own tick interval.  After each tick
+ * it reads where the followed grid says that tick was, the difference is the phase error.  The next interval
+ * is the grid's tick interval shortened or lengthened by VDJ_MIDI_GAIN of the error, and the interval may only
+ * change by VDJ_MIDI_SLEW per tick, a first order loop so the clock converges without overshoot.
+ *
+ * @author teknopaul
+ */
+
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cdj.h"
+#include "vdj.h"
+#include "vdj_thread.h"
+#include "vdj_phase.h"
+#include "vdj_midi.h"
+
+#define VDJ_MIDI_SEND_START     0x01
+#define VDJ_MIDI_SEND_STOP      0x02
+#define VDJ_MIDI_SEND_CONTINUE  0x04
+#define VDJ_MIDI_SEND_POSITION  0x08
+
+struct vdj_midi_s {
+    vdj_t*              v;
+    int                 fd;
+    uint8_t             player_id;
+    double              interval;       // nanos to the next tick
+    uint32_t            tick;           // 0 - 95 position in the bar of the last tick
+    unsigned int        locked:1;       // following a grid, not free running
+    unsigned _Atomic    pending;        // VDJ_MIDI_SEND_* flags for the next tick
+    uint16_t _Atomic    position;       // song position to send
+    unsigned _Atomic    running;
+    uint32_t _Atomic    write_errors;
+};
+
+vdj_midi_t*
+vdj_midi_new(vdj_t* v, int fd, uint8_t player_id)
+{
+    vdj_midi_t* m = (vdj_midi_t*) calloc(1, sizeof(vdj_midi_t));
+    if (m == NULL) return NULL;
+
+    m->v = v;
+    m->fd = fd;
+    m->player_id = player_id;
+    m->interval = 60.0 * CDJ_NANOS_PER_SEC / (VDJ_MIDI_DEFAULT_BPM * VDJ_MIDI_PPQN);
+    return m;
+}
+
+void
+vdj_midi_destroy(vdj_midi_t* m)
+{
+    free(m);
+}
+
+static double
+vdj_midi_wrap(double ticks, double range)
+{
+    int64_t i = (int64_t) (ticks / range);
+    if (ticks < i * range) i--;
+    ticks -= i * range;
+    return ticks >= range / 2 ? ticks - range : ticks;
+}
+
+/**
+ * Adjust the interval to the next tick, and realign the tick count after jumps.
+ */
+static void
+vdj_midi_lock(vdj_midi_t* m, cdj_nanos_t t)
+{
+    vdj_phase_grid_t grid;
+    vdj_phase_grid_t* g = vdj_phase_grid(m->v, m->player_id, t, &grid) ? &grid : NULL;
+    double target, err, max;
+
+    m->locked = g ? 1 : 0;
+    if (g == NULL) return;
+
+    // +ve if the grid is ahead of our clock
+    err = vdj_midi_wrap(vdj_phase_position(g, t) * VDJ_MIDI_PPQN - m->tick, VDJ_MIDI_BAR_TICKS);
+    if (err > VDJ_MIDI_RESYNC_TICKS || -err > VDJ_MIDI_RESYNC_TICKS) {
+        m->tick = (m->tick + (int32_t) (err < 0 ? err - 0.5 : err + 0.5) + VDJ_MIDI_BAR_TICKS) % VDJ_MIDI_BAR_TICKS;
+        err = vdj_midi_wrap(vdj_phase_position(g, t) * VDJ_MIDI_PPQN - m->tick, VDJ_MIDI_BAR_TICKS);
+    }
+
+    target = ((double) g->period / VDJ_MIDI_PPQN) * (1.0 - err * VDJ_MIDI_GAIN);
+    max = m->interval * VDJ_MIDI_SLEW;
+    if (target > m->interval + max) target = m->interval + max;
+    if (target < m->interval - max) target = m->interval - max;
+    m->interval = target;
+}
+
+static void
+vdj_midi_write(vdj_midi_t* m, uint8_t* data, size_t len)
+{
+    if ( write(m->fd, data, len) != (ssize_t) len ) m->write_errors++;
+}
+
+static void
+vdj_midi_tick(vdj_midi_t* m)
+{
+    uint8_t data[8];
+    size_t len = 0;
+    unsigned pending = m->pending;
+    uint16_t position;
+
+    // start waits for the followed player's downbeat
+    if ( (pending & VDJ_MIDI_SEND_START) && ( ! m->locked || m->tick != 0 ) ) pending &= ~VDJ_MIDI_SEND_START;
+    if (pending) atomic_fetch_and(&m->pending, ~pending);
+
+    if (pending & VDJ_MIDI_SEND_STOP) {
+        data[len++] = VDJ_MIDI_STOP;
+    }
+    if (pending & VDJ_MIDI_SEND_POSITION) {
+        position = m->position;
+        data[len++] = VDJ_MIDI_SONG_POSITION;
+        data[len++] = position & 0x7f;
+        data[len++] = (position >> 7) & 0x7f;
+    }
+    if (pending & VDJ_MIDI_SEND_START) {
+        data[len++] = VDJ_MIDI_START;
+    }
+    else if (pending & VDJ_MIDI_SEND_CONTINUE) {
+        data[len++] = VDJ_MIDI_CONTINUE;
+    }
+    data[len++] = VDJ_MIDI_CLOCK;
+
+    vdj_midi_write(m, data, len);
+}
+
+static void*
+vdj_midi_loop(void* arg)
+{
+    vdj_midi_t* m = arg;
+    cdj_nanos_t next = cdj_now();
+    struct timespec wake;
+
+    // start on a tick of the grid if there is one
+    vdj_midi_lock(m, next);
+
+    while (m->running) {
+        wake = cdj_nanos_to_timespec(next);
+        while ( clock_nanosleep(cdj_clock_id(), TIMER_ABSTIME, &wake, NULL) == EINTR );
+
+        vdj_midi_tick(m);
+        vdj_midi_lock(m, next);
+
+        next += (int64_t) m->interval;
+        if (++m->tick == VDJ_MIDI_BAR_TICKS) m->tick = 0;
+    }
+    return NULL;
+}
+
+int
+vdj_init_midi_thread(vdj_midi_t* m)
+{
+    m->running = 1;
+    if ( vdj_thread_create(m->v, VDJ_THREAD_MIDI, vdj_midi_loop, m) ) {
+        m->running = 0;
+        return CDJ_ERROR;
+    }
+    return CDJ_OK;
+}
+
+void
+vdj_stop_midi_thread(vdj_midi_t* m)
+{
+    m->running = 0;
+}
+
+void
+vdj_midi_start(vdj_midi_t* m)
+{
+    atomic_fetch_or(&m->pending, VDJ_MIDI_SEND_START);
+}
+
+void
+vdj_midi_stop(vdj_midi_t* m)
+{
+    atomic_fetch_and(&m->pending, ~(VDJ_MIDI_SEND_START | VDJ_MIDI_SEND_CONTINUE));
+    atomic_fetch_or(&m->pending, VDJ_MIDI_SEND_STOP);
+}
+
+void
+vdj_midi_continue(vdj_midi_t* m)
+{
+    atomic_fetch_or(&m->pending, VDJ_MIDI_SEND_CONTINUE);
+}
+
+void
+vdj_midi_song_position(vdj_midi_t* m, uint16_t sixteenths)
+{
+    m->position = sixteenths & 0x3fff;
+    atomic_fetch_or(&m->pending, VDJ_MIDI_SEND_POSITION);
+}
+
+float
+vdj_midi_bpm(vdj_midi_t* m)
+{
+    return 60.0 * CDJ_NANOS_PER_SEC / (m->interval * VDJ_MIDI_PPQN);
+}
+
+uint32_t
+vdj_midi_write_errors(vdj_midi_t* m)
+{
+    return m->write_errors;
+}
+
+int
+vdj_midi_open_pty(char* name, size_t len)
+{
+    struct termios tio;
+    int fd;
+
+    if ( (fd = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK)) == -1 ) {
+        fprintf(stderr, "error: posix_openpt '%s'\n", strerror(errno));
+        return -1;
+    }
+    if ( grantpt(fd) || unlockpt(fd) || ptsname_r(fd, name, len) ) {
+        fprintf(stderr, "error: pty '%s'\n", strerror(errno));
+        close(fd);
+        return -1;
+    }
+    // midi is binary, no line discipline
+    if ( tcgetattr(fd, &tio) == 0 ) {
+        cfmakeraw(&tio);
+        tcsetattr(fd, TCSANOW, &tio);
+    }
+    return fd;
+}
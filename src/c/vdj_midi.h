@@ -0,0 +1,55 @@
+#ifndef _VDJ_MIDI_H_INCLUDED_
+#define _VDJ_MIDI_H_INCLUDED_
+
+#include <stddef.h>
+
+#include "cdj.h"
+#include "vdj.h"
+
+/**
+ * MIDI clock generator phase locked to a ProLink player, by default the tempo master.
+ *
+ * Writes 24 PPQN timing clock, start, stop, continue and song position to any file descriptor, a raw midi
+ * device (/dev/snd/midiC1D0), a pty or a pipe.  Ticks are scheduled on absolute times, the interval follows
+ * the player's beat grid and a small share of the phase error is corrected each tick, with the change in
+ * interval per tick limited so tempo changes ramp rather than jump.
+ * Without a grid to follow, e.g. before the first beat or when the master stops, the clock free runs.
+ */
+
+#define VDJ_MIDI_PPQN           24
+#define VDJ_MIDI_BAR_TICKS      (4 * VDJ_MIDI_PPQN)
+#define VDJ_MIDI_CLOCK          0xf8
+#define VDJ_MIDI_START          0xfa
+#define VDJ_MIDI_CONTINUE       0xfb
+#define VDJ_MIDI_STOP           0xfc
+#define VDJ_MIDI_SONG_POSITION  0xf2
+
+#define VDJ_MIDI_DEFAULT_BPM    120.0
+#define VDJ_MIDI_GAIN           0.1   // share of the phase error corrected each tick
+#define VDJ_MIDI_SLEW           0.02  // max change in tick interval per tick
+#define VDJ_MIDI_RESYNC_TICKS   2.0   // phase errors bigger than this are a jump, realign the tick count instead
+
+typedef struct vdj_midi_s vdj_midi_t;
+
+// follow player_id, or VDJ_PHASE_MASTER, writing to fd
+vdj_midi_t* vdj_midi_new(vdj_t* v, int fd, uint8_t player_id);
+void vdj_midi_destroy(vdj_midi_t* m);
+
+int vdj_init_midi_thread(vdj_midi_t* m);
+void vdj_stop_midi_thread(vdj_midi_t* m);
+
+// send Start on the next downbeat of the followed player, waits until it is playing
+void vdj_midi_start(vdj_midi_t* m);
+void vdj_midi_stop(vdj_midi_t* m);
+void vdj_midi_continue(vdj_midi_t* m);
+// song position in 16th notes, sent with the next tick, takes effect on the next continue
+void vdj_midi_song_position(vdj_midi_t* m, uint16_t sixteenths);
+
+float vdj_midi_bpm(vdj_midi_t* m);
+uint32_t vdj_midi_write_errors(vdj_midi_t* m);
+
+// open a pty in raw non-blocking mode for testing without hardware, returns the master fd and the slave's
+// name in name, or -1
+int vdj_midi_open_pty(char* name, size_t len);
+
+#endif // _VDJ_MIDI_H_INCLUDED_
@@ -0,0 +1,164 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdatomic.h>
+
+#include "cdj.h"
+#include "vdj.h"
+#include "vdj_net.h"
+#include "vdj_discovery.h"
+#include "vdj_thread.h"
+#include "vdj_phase.h"
+#include "vdj_midi.h"
+
+/**
+ * Joins the ProLink network and sends MIDI clock locked to the tempo master, or to a chosen player.
+ *
+ * Write to a raw midi device with -d, or use -t to create a pty and read it to test without hardware.
+ *
+ * @author teknopaul
+ */
+
+static unsigned _Atomic running = ATOMIC_VAR_INIT(1);
+
+static void
+usage()
+{
+    printf("Send MIDI clock locked to the ProLink master\n");
+    printf("options:\n");
+    printf("    -i - network interface to use, required if pc has more than one\n");
+    printf("    -p - player id for our virtual cdj, default is auto assign\n");
+    printf("    -f - follow this player instead of the master\n");
+    printf("    -d - midi device to write to, e.g. /dev/snd/midiC1D0\n");
+    printf("    -t - create a pty and write to it, its name is printed\n");
+    printf("    -s - send Start on the first downbeat\n");
+    printf("    -R - SCHED_FIFO priority for the midi thread (1-99), also locks memory\n");
+    printf("    -h - display this text\n");
+    exit(0);
+}
+
+static void
+signal_exit(int sig)
+{
+    running = 0;
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned int flags = 0;
+    uint8_t player_id = 0;
+    uint8_t follow = VDJ_PHASE_MASTER;
+    char* iface = NULL;
+    char* device = NULL;
+    char pty_name[128];
+    int pty = 0, start = 0, rt_priority = 0;
+    int fd;
+    vdj_t* v;
+    vdj_midi_t* midi;
+
+    int c;
+    while ( ( c = getopt(argc, argv, "i:p:f:d:tsR:h") ) != EOF) {
+        switch (c) {
+            case 'h':
+                usage();
+                break;
+            case 'i':
+                iface = optarg;
+                break;
+            case 'p':
+                player_id = atoi(optarg);
+                if (player_id < 0xf) flags |= player_id;
+                break;
+            case 'f':
+                follow = atoi(optarg);
+                break;
+            case 'd':
+                device = optarg;
+                break;
+            case 't':
+                pty = 1;
+                break;
+            case 's':
+                start = 1;
+                break;
+            case 'R':
+                rt_priority = atoi(optarg);
+                break;
+        }
+    }
+
+    if ( (device == NULL) == (pty == 0) ) usage();
+    if (player_id == 0) flags |= VDJ_FLAG_AUTO_ID;
+
+    if (pty) {
+        if ( (fd = vdj_midi_open_pty(pty_name, sizeof(pty_name))) == -1 ) return 1;
+        printf("midi clock on %s\n", pty_name);
+        fflush(stdout);
+    } else {
+        if ( (fd = open(device, O_WRONLY | O_NONBLOCK)) == -1 ) {
+            fprintf(stderr, "error: open '%s' '%s'\n", device, strerror(errno));
+            return 1;
+        }
+    }
+
+    if ( ! (v = vdj_init_iface(iface, flags)) ) {
+        fprintf(stderr, "error: creating virtual cdj\n");
+        return 1;
+    }
+    if (rt_priority) {
+        vdj_lock_memory();
+        if ( vdj_thread_set_priority(v, VDJ_THREAD_MIDI, rt_priority) ) {
+            fprintf(stderr, "error: priority must be 1 - %d\n", VDJ_THREAD_PRIORITY_MAX);
+            vdj_destroy(v);
+            return 1;
+        }
+        vdj_thread_set_prefault(v, VDJ_THREAD_MIDI, 64 * 1024);
+    }
+
+    if ( vdj_open_sockets(v) != CDJ_OK ) {
+        fprintf(stderr, "error: failed to open sockets\n");
+        vdj_destroy(v);
+        return 1;
+    }
+    if ( vdj_exec_discovery(v) != CDJ_OK ) {
+        fprintf(stderr, "error: cdj initialization\n");
+        vdj_destroy(v);
+        return 1;
+    }
+    if ( vdj_init_managed_discovery_thread(v, NULL) != CDJ_OK ||
+         vdj_init_managed_beat_thread(v, NULL) != CDJ_OK ||
+         vdj_init_managed_update_thread(v, NULL) != CDJ_OK ||
+         vdj_init_status_thread(v) != CDJ_OK ) {
+        fprintf(stderr, "error: init managed threads\n");
+        vdj_destroy(v);
+        return 1;
+    }
+
+    if ( (midi = vdj_midi_new(v, fd, follow)) == NULL || vdj_init_midi_thread(midi) != CDJ_OK ) {
+        fprintf(stderr, "error: init midi thread\n");
+        vdj_destroy(v);
+        return 1;
+    }
+    if (start) vdj_midi_start(midi);
+
+    signal(SIGINT, signal_exit);
+    signal(SIGTERM, signal_exit);
+    while (running) {
+        sleep(1);
+        printf("\r%06.2fbpm write errors=%u ", vdj_midi_bpm(midi), vdj_midi_write_errors(midi));
+        fflush(stdout);
+    }
+    printf("\n");
+
+    vdj_midi_stop(midi);
+    usleep(100000);
+    vdj_stop_midi_thread(midi);
+    vdj_thread_join(v, VDJ_THREAD_MIDI);
+    vdj_midi_destroy(midi);
+    close(fd);
+    return 0;
+}
@@ -9,6 +9,7 @@
 #include "cdj.h"
 #include "vdj.h"
 #include "vdj_discovery.h"
+#include "vdj_stream.h"
 
 // N.B. including .c
 #include "cdj_mon_tui.c"
@@ -18,14 +19,20 @@
  * Monitor app that creates a VDJ an joins the prolink network, this requires an  player_id, n.b. max 4 on the lan.
  *
  * This is an example of using the api where we recieve only interesting packets.
+ *
+ * With -j or -r there is no ui, keepalives, beats and status changes are streamed to stdout or a unix socket.
  */
 
 static void discovery_ph(vdj_t* v, cdj_discovery_packet_t* d_pkt);
 static void update_ph(vdj_t* v, cdj_cdj_status_packet_t* cs_pkt);
+static void beat_ph(vdj_t* v, cdj_beat_packet_t* b_pkt);
+
+// headless when set
+static vdj_stream_t* stream = NULL;
 
 static void signal_exit(int sig)
 {
-    tui_exit();
+    if ( ! stream ) tui_exit();
     exit(0);
 }
 static void usage()
@@ -36,6 +43,9 @@ static void usage()
     printf("    -x - mimic XDJ\n");
     printf("    -p - specific player number (default is 5)\n");
     printf("    -a - auto assign player number\n");
+    printf("    -j - no ui, stream events as newline delimited json\n");
+    printf("    -r - no ui, stream events as binary records (vdj_stream.h)\n");
+    printf("    -u - stream to this unix socket instead of stdout\n");
     printf("    -h - display this text\n");
     exit(0);
 }
@@ -67,10 +77,13 @@ int main (int argc, char* argv[])
     char* iface = NULL;
     uint32_t flags = 0;
     uint8_t player_id;
+    int headless = 0;
+    vdj_stream_format format = VDJ_STREAM_NDJSON;
+    char* socket_path = NULL;
     memset(id_map, 0, 127);
 
     int c;
-    while ( ( c = getopt(argc, argv, "p:i:chax") ) != EOF) {
+    while ( ( c = getopt(argc, argv, "p:i:chaxjru:") ) != EOF) {
         switch (c) {
             case 'x':
                 flags |= VDJ_FLAG_DEV_XDJ;
@@ -91,6 +104,25 @@ int main (int argc, char* argv[])
             case 'i':
                 iface = optarg;
                 break;
+            case 'j':
+                headless = 1;
+                format = VDJ_STREAM_NDJSON;
+                break;
+            case 'r':
+                headless = 1;
+                format = VDJ_STREAM_BINARY;
+                break;
+            case 'u':
+                socket_path = optarg;
+                break;
+        }
+    }
+
+    if (headless) {
+        stream = socket_path ? vdj_stream_connect(socket_path, format) : vdj_stream_new(STDOUT_FILENO, format);
+        if (stream == NULL) {
+            fprintf(stderr, "error: opening event stream\n");
+            return 1;
         }
     }
 
@@ -133,10 +165,19 @@ int main (int argc, char* argv[])
         return 1;
     }
 
+    // the ui has no room for beats
+    if ( stream && vdj_init_managed_beat_thread(v, beat_ph) != CDJ_OK ) {
+        fprintf(stderr, "error: init beat thread\n");
+        vdj_destroy(v);
+        return 1;
+    }
+
     signal(SIGINT, signal_exit);
-    tui_init(8);
-    snprintf(title, 127, "VDJ monitor [%02i]", v->player_id);
-    tui_set_window_title(title);
+    if ( ! stream ) {
+        snprintf(title, 127, "VDJ monitor [%02i]", v->player_id);
+        tui_set_window_title(title);
+        tui_init(8);
+    }
 
     while (1) sleep(1);
 
@@ -147,6 +188,10 @@ int main (int argc, char* argv[])
 static void
 discovery_ph(vdj_t* v, cdj_discovery_packet_t* d_pkt)
 {
+    if (stream) {
+        vdj_stream_discovery(stream, d_pkt->data, d_pkt->len, 0);
+        return;
+    }
     if ( d_pkt->type == CDJ_KEEP_ALIVE ) {
         int slot = id_map[d_pkt->player_id];
         //tui_set_cursor_pos(0, 0);
@@ -164,6 +209,11 @@ update_ph(vdj_t* v, cdj_cdj_status_packet_t* cs_pkt)
 {
     char* emojis;
 
+    if (stream) {
+        vdj_stream_update(stream, cs_pkt->data, cs_pkt->len, 0);
+        return;
+    }
+
     if (id_map[cs_pkt->player_id]) {
         if ( (emojis = cdj_flags_to_emoji(cs_pkt->flags)) ) {
             update_ui(cs_pkt->player_id, cs_pkt->bpm, emojis);
@@ -172,3 +222,9 @@ update_ph(vdj_t* v, cdj_cdj_status_packet_t* cs_pkt)
     }
 }
 
+
+static void
+beat_ph(vdj_t* v, cdj_beat_packet_t* b_pkt)
+{
+    vdj_stream_beat(stream, b_pkt->data, b_pkt->len, b_pkt->timestamp);
+}
@@ -0,0 +1,325 @@
+/**
+ * pcap reading and writing, see vdj_pcap.h
+ *
+ * No libpcap, the file format is a 24 byte header and a 16 byte header per frame.
+ *
+ * @author teknopaul
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "cdj.h"
+#include "vdj_pcap.h"
+
+//SNIP_pcap
+#define VDJ_PCAP_MAGIC_MICROS   0xa1b2c3d4
+#define VDJ_PCAP_MAGIC_NANOS    0xa1b23c4d
+
+#define VDJ_PCAP_LINK_ETHERNET  1
+#define VDJ_PCAP_LINK_RAW       101
+#define VDJ_PCAP_LINK_SLL       113     // tcpdump -i any
+#define VDJ_PCAP_LINK_IPV4      228
+#define VDJ_PCAP_LINK_SLL2      276
+
+#define VDJ_PCAP_IP_HDR_LEN     20
+#define VDJ_PCAP_UDP_HDR_LEN    8
+
+typedef struct {
+    uint32_t            magic;
+    uint16_t            version_major;
+    uint16_t            version_minor;
+    int32_t             thiszone;
+    uint32_t            sigfigs;
+    uint32_t            snaplen;
+    uint32_t            linktype;
+} vdj_pcap_file_header_t;
+
+typedef struct {
+    uint32_t            ts_sec;
+    uint32_t            ts_frac;    // micros or nanos
+    uint32_t            caplen;
+    uint32_t            len;
+} vdj_pcap_record_header_t;
+
+static uint32_t
+vdj_pcap_u32(vdj_pcap_t* p, uint32_t i)
+{
+    return p->swap ? __builtin_bswap32(i) : i;
+}
+
+static void
+vdj_pcap_put16(uint8_t* b, uint16_t i)
+{
+    b[0] = i >> 8;
+    b[1] = i;
+}
+
+static void
+vdj_pcap_put32(uint8_t* b, uint32_t i)
+{
+    b[0] = i >> 24;
+    b[1] = i >> 16;
+    b[2] = i >> 8;
+    b[3] = i;
+}
+
+static uint16_t
+vdj_pcap_get16(uint8_t* b)
+{
+    return (b[0] << 8) | b[1];
+}
+
+static uint32_t
+vdj_pcap_get32(uint8_t* b)
+{
+    return ((uint32_t) b[0] << 24) | (b[1] << 16) | (b[2] << 8) | b[3];
+}
+
+static uint16_t
+vdj_pcap_ip_checksum(uint8_t* ip)
+{
+    uint32_t sum = 0;
+    int i;
+    for (i = 0; i < VDJ_PCAP_IP_HDR_LEN; i += 2) sum += vdj_pcap_get16(ip + i);
+    while (sum >> 16) sum = (sum & 0xffff) + (sum >> 16);
+    return ~sum;
+}
+
+vdj_pcap_t*
+vdj_pcap_create(const char* path)
+{
+    vdj_pcap_file_header_t hdr;
+    vdj_pcap_t* p;
+
+    if ( ! (p = (vdj_pcap_t*) calloc(1, sizeof(vdj_pcap_t))) ) return NULL;
+    if ( ! (p->f = fopen(path, "w")) ) {
+        fprintf(stderr, "error: open '%s' '%s'\n", path, strerror(errno));
+        free(p);
+        return NULL;
+    }
+    p->linktype = VDJ_PCAP_LINK_RAW;
+    p->nanos = 1;
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = VDJ_PCAP_MAGIC_NANOS;
+    hdr.version_major = 2;
+    hdr.version_minor = 4;
+    hdr.snaplen = VDJ_PCAP_SNAPLEN;
+    hdr.linktype = p->linktype;
+    if ( fwrite(&hdr, sizeof(hdr), 1, p->f) != 1 ) {
+        fprintf(stderr, "error: write '%s' '%s'\n", path, strerror(errno));
+        fclose(p->f);
+        free(p);
+        return NULL;
+    }
+    return p;
+}
+
+/**
+ * Frames are an IPv4 header without options and a UDP header without a checksum, enough for wireshark to
+ * decode, and for us to know where it was going when we replay it.
+ */
+int
+vdj_pcap_write(vdj_pcap_t* p, vdj_pcap_packet_t* pkt)
+{
+    vdj_pcap_record_header_t rec;
+    uint8_t* ip = p->frame;
+    uint8_t* udp = ip + VDJ_PCAP_IP_HDR_LEN;
+    uint16_t len = pkt->len;
+
+    if (len > VDJ_PCAP_SNAPLEN - VDJ_PCAP_IP_HDR_LEN - VDJ_PCAP_UDP_HDR_LEN) {
+        len = VDJ_PCAP_SNAPLEN - VDJ_PCAP_IP_HDR_LEN - VDJ_PCAP_UDP_HDR_LEN;
+    }
+
+    memset(ip, 0, VDJ_PCAP_IP_HDR_LEN + VDJ_PCAP_UDP_HDR_LEN);
+    ip[0] = 0x45;
+    vdj_pcap_put16(ip + 2, VDJ_PCAP_IP_HDR_LEN + VDJ_PCAP_UDP_HDR_LEN + pkt->len);
+    ip[6] = 0x40;   // don't fragment
+    ip[8] = 64;
+    ip[9] = 17;     // udp
+    vdj_pcap_put32(ip + 12, pkt->src_ip);
+    vdj_pcap_put32(ip + 16, pkt->dst_ip);
+    vdj_pcap_put16(ip + 10, vdj_pcap_ip_checksum(ip));
+    vdj_pcap_put16(udp, pkt->src_port);
+    vdj_pcap_put16(udp + 2, pkt->dst_port);
+    vdj_pcap_put16(udp + 4, VDJ_PCAP_UDP_HDR_LEN + pkt->len);
+    memcpy(udp + VDJ_PCAP_UDP_HDR_LEN, pkt->data, len);
+
+    rec.ts_sec = pkt->ts / CDJ_NANOS_PER_SEC;
+    rec.ts_frac = pkt->ts % CDJ_NANOS_PER_SEC;
+    rec.caplen = VDJ_PCAP_IP_HDR_LEN + VDJ_PCAP_UDP_HDR_LEN + len;
+    rec.len = VDJ_PCAP_IP_HDR_LEN + VDJ_PCAP_UDP_HDR_LEN + pkt->len;
+
+    if ( fwrite(&rec, sizeof(rec), 1, p->f) != 1 || fwrite(p->frame, rec.caplen, 1, p->f) != 1 ) {
+        fprintf(stderr, "error: pcap write '%s'\n", strerror(errno));
+        return CDJ_ERROR;
+    }
+    p->packets++;
+    return CDJ_OK;
+}
+
+vdj_pcap_t*
+vdj_pcap_open(const char* path)
+{
+    vdj_pcap_file_header_t hdr;
+    vdj_pcap_t* p;
+
+    if ( ! (p = (vdj_pcap_t*) calloc(1, sizeof(vdj_pcap_t))) ) return NULL;
+    if ( ! (p->f = fopen(path, "r")) ) {
+        fprintf(stderr, "error: open '%s' '%s'\n", path, strerror(errno));
+        free(p);
+        return NULL;
+    }
+    if ( fread(&hdr, sizeof(hdr), 1, p->f) != 1 ) {
+        fprintf(stderr, "error: '%s' is not a pcap file\n", path);
+        vdj_pcap_close(p);
+        return NULL;
+    }
+
+    switch (hdr.magic) {
+        case VDJ_PCAP_MAGIC_NANOS:
+            p->nanos = 1;
+            break;
+        case VDJ_PCAP_MAGIC_MICROS:
+            break;
+        case __builtin_bswap32(VDJ_PCAP_MAGIC_NANOS):
+            p->nanos = 1;
+            p->swap = 1;
+            break;
+        case __builtin_bswap32(VDJ_PCAP_MAGIC_MICROS):
+            p->swap = 1;
+            break;
+        default:
+            // pcapng is what wireshark saves by default
+            fprintf(stderr, "error: '%s' is not a pcap file, pcapng must be converted with editcap -F pcap\n", path);
+            vdj_pcap_close(p);
+            return NULL;
+    }
+
+    p->linktype = vdj_pcap_u32(p, hdr.linktype);
+    switch (p->linktype) {
+        case VDJ_PCAP_LINK_ETHERNET:
+        case VDJ_PCAP_LINK_RAW:
+        case VDJ_PCAP_LINK_SLL:
+        case VDJ_PCAP_LINK_IPV4:
+        case VDJ_PCAP_LINK_SLL2:
+            break;
+        default:
+            fprintf(stderr, "error: '%s' link type %u not supported\n", path, p->linktype);
+            vdj_pcap_close(p);
+            return NULL;
+    }
+    return p;
+}
+
+/**
+ * @return the IPv4 header in the frame, or NULL if this frame does not carry IPv4
+ */
+static uint8_t*
+vdj_pcap_ip(vdj_pcap_t* p, uint32_t caplen)
+{
+    uint8_t* frame = p->frame;
+    uint32_t offset;
+    uint16_t ethertype;
+
+    switch (p->linktype) {
+        case VDJ_PCAP_LINK_ETHERNET:
+            if (caplen < 14) return NULL;
+            ethertype = vdj_pcap_get16(frame + 12);
+            offset = 14;
+            if (ethertype == 0x8100 && caplen >= 18) {  // vlan tag
+                ethertype = vdj_pcap_get16(frame + 16);
+                offset = 18;
+            }
+            break;
+        case VDJ_PCAP_LINK_SLL:
+            if (caplen < 16) return NULL;
+            ethertype = vdj_pcap_get16(frame + 14);
+            offset = 16;
+            break;
+        case VDJ_PCAP_LINK_SLL2:
+            if (caplen < 20) return NULL;
+            ethertype = vdj_pcap_get16(frame);
+            offset = 20;
+            break;
+        default:
+            ethertype = 0x0800;
+            offset = 0;
+    }
+    if (ethertype != 0x0800 || caplen < offset + VDJ_PCAP_IP_HDR_LEN) return NULL;
+    return frame + offset;
+}
+
+/**
+ * strip the link, ip and udp headers, and check it's unfragmented UDP to a ProLink port
+ */
+static int
+vdj_pcap_parse(vdj_pcap_t* p, uint32_t caplen, vdj_pcap_packet_t* pkt)
+{
+    uint8_t* ip;
+    uint8_t* udp;
+    uint16_t ihl, udp_len;
+    uint32_t avail;
+
+    if ( ! (ip = vdj_pcap_ip(p, caplen)) ) return CDJ_ERROR;
+    ihl = (ip[0] & 0x0f) * 4;
+    avail = caplen - (ip - p->frame);
+    if ((ip[0] >> 4) != 4 || ip[9] != 17 || (vdj_pcap_get16(ip + 6) & 0x1fff) != 0) return CDJ_ERROR;
+    if (avail < ihl + VDJ_PCAP_UDP_HDR_LEN) return CDJ_ERROR;
+
+    udp = ip + ihl;
+    pkt->dst_port = vdj_pcap_get16(udp + 2);
+    if (pkt->dst_port < CDJ_DISCOVERY_PORT || pkt->dst_port > CDJ_UPDATE_PORT) return CDJ_ERROR;
+    udp_len = vdj_pcap_get16(udp + 4);
+    if (udp_len < VDJ_PCAP_UDP_HDR_LEN) return CDJ_ERROR;
+
+    pkt->src_ip = vdj_pcap_get32(ip + 12);
+    pkt->dst_ip = vdj_pcap_get32(ip + 16);
+    pkt->src_port = vdj_pcap_get16(udp);
+    pkt->data = udp + VDJ_PCAP_UDP_HDR_LEN;
+    pkt->len = udp_len - VDJ_PCAP_UDP_HDR_LEN;
+    if (pkt->len > avail - ihl - VDJ_PCAP_UDP_HDR_LEN) pkt->len = avail - ihl - VDJ_PCAP_UDP_HDR_LEN;
+    return CDJ_OK;
+}
+
+int
+vdj_pcap_next(vdj_pcap_t* p, vdj_pcap_packet_t* pkt)
+{
+    vdj_pcap_record_header_t rec;
+    uint32_t caplen, keep;
+
+    while ( fread(&rec, sizeof(rec), 1, p->f) == 1 ) {
+        caplen = vdj_pcap_u32(p, rec.caplen);
+        keep = caplen > VDJ_PCAP_SNAPLEN ? VDJ_PCAP_SNAPLEN : caplen;
+        if ( fread(p->frame, 1, keep, p->f) != keep ) break;
+        if (caplen > keep && fseek(p->f, caplen - keep, SEEK_CUR)) break;
+
+        if ( vdj_pcap_parse(p, keep, pkt) == CDJ_OK ) {
+            pkt->ts = (int64_t) vdj_pcap_u32(p, rec.ts_sec) * CDJ_NANOS_PER_SEC +
+                (int64_t) vdj_pcap_u32(p, rec.ts_frac) * (p->nanos ? 1 : 1000);
+            p->packets++;
+            return CDJ_OK;
+        }
+        p->skipped++;
+    }
+    return CDJ_ERROR;
+}
+
+int
+vdj_pcap_rewind(vdj_pcap_t* p)
+{
+    return fseek(p->f, sizeof(vdj_pcap_file_header_t), SEEK_SET) ? CDJ_ERROR : CDJ_OK;
+}
+
+void
+vdj_pcap_close(vdj_pcap_t* p)
+{
+    if (p) {
+        if (p->f) fclose(p->f);
+        free(p);
+    }
+}
+//SNIP_pcap
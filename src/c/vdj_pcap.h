@@ -0,0 +1,57 @@
+#ifndef _VDJ_PCAP_H_INCLUDED_
+#define _VDJ_PCAP_H_INCLUDED_
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "cdj.h"
+
+/**
+ * Read and write ProLink sessions as pcap files.
+ *
+ * Files we write are LINKTYPE_RAW, an IPv4 and UDP header in front of each ProLink packet, with nanosecond
+ * timestamps, so wireshark and tcpdump open them.  The reader also takes what tcpdump writes, ethernet,
+ * "-i any" cooked captures, micro or nano timestamps, either byte order, and skips anything that is not
+ * UDP to ports 50000 - 50002.
+ *
+ *    vdj_pcap_t* p = vdj_pcap_open("gig.pcap");
+ *    while (vdj_pcap_next(p, &pkt) == CDJ_OK) ...
+ */
+
+#define VDJ_PCAP_SNAPLEN        2048    // largest ProLink packet is well under the ethernet MTU
+
+typedef struct {
+    int64_t             ts;         // CLOCK_REALTIME nanos
+    uint32_t            src_ip;     // in the format used in CDJ packets, e.g. cdj_discovery_ip()
+    uint32_t            dst_ip;
+    uint16_t            src_port;
+    uint16_t            dst_port;   // CDJ_DISCOVERY_PORT, CDJ_BEAT_PORT or CDJ_UPDATE_PORT
+    uint16_t            len;
+    uint8_t*            data;       // ProLink packet, when reading it points into the reader's buffer
+} vdj_pcap_packet_t;
+
+typedef struct {
+    FILE*               f;
+    uint32_t            linktype;
+    uint8_t             nanos;      // timestamps are nanos, not micros
+    uint8_t             swap;       // file was written on the other endian
+    uint64_t            packets;    // written, or returned by vdj_pcap_next()
+    uint64_t            skipped;    // frames read that were not ProLink
+    uint8_t             frame[VDJ_PCAP_SNAPLEN];
+} vdj_pcap_t;
+
+// allocs, writes the file header
+vdj_pcap_t* vdj_pcap_create(const char* path);
+int vdj_pcap_write(vdj_pcap_t* p, vdj_pcap_packet_t* pkt);
+
+// allocs, reads the file header
+vdj_pcap_t* vdj_pcap_open(const char* path);
+// next ProLink packet, CDJ_ERROR at the end of the file
+int vdj_pcap_next(vdj_pcap_t* p, vdj_pcap_packet_t* pkt);
+// back to the first packet, to loop a session
+int vdj_pcap_rewind(vdj_pcap_t* p);
+
+// flushes and frees
+void vdj_pcap_close(vdj_pcap_t* p);
+
+#endif // _VDJ_PCAP_H_INCLUDED_
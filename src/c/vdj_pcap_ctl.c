@@ -0,0 +1,308 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "cdj.h"
+#include "vdj.h"
+#include "vdj_net.h"
+#include "vdj_discovery.h"
+#include "vdj_sniff.h"
+#include "vdj_pcap.h"
+
+/**
+ * Records a whole session to a pcap file, and plays one back, either onto the network or straight into the
+ * vdj_handle_managed_*_datagram() functions of an in process vdj_t, at the original speed, N times faster
+ * or as fast as it will go.  Gig traffic replayed with -H and -x 0 is the handler throughput benchmark.
+ *
+ * @author teknopaul
+ */
+
+static volatile sig_atomic_t running = 1;
+static vdj_sniff_t* sniff = NULL;
+
+static vdj_pcap_t* out = NULL;
+static uint64_t write_errors = 0;
+
+static void
+signal_exit(int sig)
+{
+    running = 0;
+    if (sniff) vdj_sniff_stop(sniff);
+}
+
+static void
+usage()
+{
+    printf("Record ProLink traffic to a pcap file, or replay one\n");
+    printf("options:\n");
+    printf("    -w - record to this file, until ctrl+c, needs CAP_NET_RAW\n");
+    printf("    -r - replay this file, tcpdump and wireshark pcap files are fine too\n");
+    printf("    -i - network interface to record from or replay onto\n");
+    printf("    -H - replay into the packet handlers of an in process virtual cdj, not onto the network\n");
+    printf("    -x - speed, 2 is twice as fast as recorded, 0 is as fast as possible, default 1\n");
+    printf("    -n - times to play the file, default 1\n");
+    printf("    -d - ip to send unicast packets to, without it only broadcasts are replayed onto the network\n");
+    printf("    -p - only packets to this port, e.g. 50001\n");
+    printf("    -h - display this text\n");
+    exit(0);
+}
+
+static void
+record_ph(vdj_sniff_t* s, vdj_sniff_packet_t* sp)
+{
+    vdj_pcap_packet_t pkt;
+    struct timespec ts = cdj_nanos_to_realtime(sp->timestamp);
+
+    pkt.ts = cdj_timespec_to_nanos(&ts);
+    pkt.src_ip = sp->src_ip;
+    pkt.dst_ip = sp->dst_ip;
+    pkt.src_port = sp->src_port;
+    pkt.dst_port = sp->dst_port;
+    pkt.len = sp->len;
+    pkt.data = sp->data;
+    if ( vdj_pcap_write(out, &pkt) != CDJ_OK ) write_errors++;
+}
+
+static int
+record(char* iface, char* path)
+{
+    char found_iface[IFNAMSIZ + 1];
+    struct sockaddr_in addr;
+    struct sockaddr_in netmask;
+
+    if (iface == NULL) {
+        memset(found_iface, 0, sizeof(found_iface));
+        if (vdj_has_single_ip() != CDJ_OK || vdj_get_single_ip(found_iface, &addr, &netmask) != CDJ_OK) {
+            fprintf(stderr, "error: could not determine interface (provide nic)\n");
+            vdj_print_iface();
+            return 1;
+        }
+        iface = found_iface;
+    }
+
+    if ( ! (out = vdj_pcap_create(path)) ) return 1;
+    if ( ! (sniff = vdj_sniff_open(iface)) ) {
+        fprintf(stderr, "error: failed to open capture on %s\n", iface);
+        vdj_pcap_close(out);
+        return 1;
+    }
+
+    signal(SIGINT, signal_exit);
+    signal(SIGTERM, signal_exit);
+    fprintf(stderr, "recording %s to %s\n", iface, path);
+    vdj_sniff_loop(sniff, record_ph);
+
+    vdj_sniff_drops(sniff);
+    fprintf(stderr, "%llu packets recorded, %llu dropped by the kernel, %llu write errors\n",
+        (unsigned long long) out->packets, (unsigned long long) sniff->drops, (unsigned long long) write_errors);
+    vdj_sniff_close(sniff);
+    vdj_pcap_close(out);
+    return write_errors ? 1 : 0;
+}
+
+/**
+ * broadcasts went to x.x.x.255 on a /24 link local or 255.255.255.255, anything else was for one device
+ */
+static int
+is_broadcast(uint32_t ip)
+{
+    return (ip & 0xff) == 0xff;
+}
+
+static void
+dispatch(vdj_t* v, vdj_pcap_packet_t* pkt)
+{
+    switch (pkt->dst_port) {
+        case CDJ_DISCOVERY_PORT:
+            if (is_broadcast(pkt->dst_ip)) vdj_handle_managed_discovery_datagram(v, NULL, pkt->data, pkt->len);
+            else vdj_handle_managed_discovery_unicast_datagram(v, NULL, pkt->data, pkt->len);
+            break;
+        case CDJ_BEAT_PORT:
+            if (is_broadcast(pkt->dst_ip)) vdj_handle_managed_beat_datagram(v, NULL, pkt->data, pkt->len);
+            else vdj_handle_managed_beat_unicast_datagram(v, NULL, pkt->data, pkt->len);
+            break;
+        case CDJ_UPDATE_PORT:
+            vdj_handle_managed_update_datagram(v, NULL, pkt->data, pkt->len);
+            break;
+    }
+}
+
+static int
+open_send_socket(vdj_t* v)
+{
+    struct sockaddr_in src;
+    int fd, value = 1;
+
+    if ( (fd = socket(PF_INET, SOCK_DGRAM, IPPROTO_UDP)) < 0 ) {
+        fprintf(stderr, "error: socket '%s'\n", strerror(errno));
+        return -1;
+    }
+    memcpy(&src, v->ip_addr, sizeof(src));
+    src.sin_port = 0;
+    if ( setsockopt(fd, SOL_SOCKET, SO_BROADCAST, &value, sizeof(value)) ||
+         bind(fd, (struct sockaddr*) &src, sizeof(src)) ) {
+        fprintf(stderr, "error: send socket '%s'\n", strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static void
+wait_until(cdj_nanos_t due)
+{
+    struct timespec ts = cdj_nanos_to_timespec(due);
+    while (running && clock_nanosleep(cdj_clock_id(), TIMER_ABSTIME, &ts, NULL) == EINTR);
+}
+
+static int
+replay(char* iface, char* path, int handlers, double speed, int loops, char* unicast_ip, int port)
+{
+    vdj_pcap_t* in;
+    vdj_pcap_packet_t pkt;
+    vdj_t* v;
+    struct sockaddr_in dest;
+    struct sockaddr_in* broadcast;
+    cdj_nanos_t start, now, due, late, max_late = 0, in_handlers = 0, began;
+    int64_t first;
+    uint64_t sent = 0, skipped = 0, errors = 0;
+    int fd = -1, loop;
+
+    memset(&dest, 0, sizeof(dest));
+    dest.sin_family = AF_INET;
+    if (unicast_ip && inet_pton(AF_INET, unicast_ip, &dest.sin_addr) != 1) {
+        fprintf(stderr, "error: bad ip '%s'\n", unicast_ip);
+        return 1;
+    }
+
+    if ( ! (in = vdj_pcap_open(path)) ) return 1;
+
+    // no sockets are opened for -H, the handlers' few replies fail to send
+    if ( ! (v = vdj_init_iface(iface ? iface : (handlers ? "lo" : NULL), 7)) ) {
+        fprintf(stderr, "error: creating virtual cdj\n");
+        vdj_pcap_close(in);
+        return 1;
+    }
+    broadcast = v->broadcast_addr;
+    broadcast->sin_family = AF_INET;
+    if ( ! handlers && (fd = open_send_socket(v)) < 0 ) {
+        vdj_destroy(v);
+        vdj_pcap_close(in);
+        return 1;
+    }
+
+    signal(SIGINT, signal_exit);
+    signal(SIGTERM, signal_exit);
+
+    began = cdj_now();
+    for (loop = 0; running && loop < loops; loop++) {
+        if ( loop && vdj_pcap_rewind(in) != CDJ_OK ) break;
+        start = cdj_now();
+        first = -1;
+
+        while ( running && vdj_pcap_next(in, &pkt) == CDJ_OK ) {
+            if ( (port && pkt.dst_port != port) || cdj_validate_header(pkt.data, pkt.len) != CDJ_OK ||
+                 ( ! handlers && ! unicast_ip && ! is_broadcast(pkt.dst_ip)) ) {
+                skipped++;
+                continue;
+            }
+
+            // original inter-arrival times, scaled, against an absolute start so sleeps do not drift
+            if (first < 0) first = pkt.ts;
+            if (speed > 0.0 && pkt.ts > first) {
+                due = start + (cdj_nanos_t) ((pkt.ts - first) / speed);
+                wait_until(due);
+                now = cdj_now();
+                late = now - due;
+                if (late > max_late) max_late = late;
+            }
+
+            if (handlers) {
+                now = cdj_now();
+                dispatch(v, &pkt);
+                in_handlers += cdj_now() - now;
+            } else {
+                if (is_broadcast(pkt.dst_ip)) dest.sin_addr = broadcast->sin_addr;
+                else inet_pton(AF_INET, unicast_ip, &dest.sin_addr);
+                dest.sin_port = htons(pkt.dst_port);
+                if ( sendto(fd, pkt.data, pkt.len, 0, (struct sockaddr*) &dest, sizeof(dest)) == -1 ) errors++;
+            }
+            sent++;
+        }
+    }
+    now = cdj_now();
+
+    fprintf(stderr, "%llu packets replayed, %llu skipped, %llu send errors in %.3f s, %.0f packets/s, %.3f ms max late\n",
+        (unsigned long long) sent, (unsigned long long) skipped, (unsigned long long) errors,
+        (double) (now - began) / CDJ_NANOS_PER_SEC,
+        now > began ? (double) sent * CDJ_NANOS_PER_SEC / (now - began) : 0.0,
+        (double) max_late / CDJ_NANOS_PER_MILLI);
+    if (handlers && sent) {
+        fprintf(stderr, "%.0f ns per packet in the handlers, %u link members\n",
+            (double) in_handlers / sent, vdj_link_member_count(v));
+    }
+
+    if (fd >= 0) close(fd);
+    vdj_destroy(v);
+    vdj_pcap_close(in);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    char* iface = NULL;
+    char* write_path = NULL;
+    char* read_path = NULL;
+    char* unicast_ip = NULL;
+    int handlers = 0;
+    double speed = 1.0;
+    int loops = 1;
+    int port = 0;
+
+    int c;
+    while ( ( c = getopt(argc, argv, "w:r:i:Hx:n:d:p:h") ) != EOF) {
+        switch (c) {
+            case 'h':
+                usage();
+                break;
+            case 'w':
+                write_path = optarg;
+                break;
+            case 'r':
+                read_path = optarg;
+                break;
+            case 'i':
+                iface = optarg;
+                break;
+            case 'H':
+                handlers = 1;
+                break;
+            case 'x':
+                speed = strtod(optarg, NULL);
+                break;
+            case 'n':
+                loops = atoi(optarg);
+                break;
+            case 'd':
+                unicast_ip = optarg;
+                break;
+            case 'p':
+                port = atoi(optarg);
+                break;
+        }
+    }
+
+    if (write_path && ! read_path) return record(iface, write_path);
+    if (read_path && ! write_path) return replay(iface, read_path, handlers, speed, loops, unicast_ip, port);
+
+    fprintf(stderr, "error: one of -w or -r is required\n");
+    return 1;
+}
@@ -0,0 +1,199 @@
+/**
+ * Beat grid tracking and phase offsets.
+ *
+ * Received beat times carry tens of micros of network and scheduler jitter and the reported bpm only has two
+ * decimal places, comparing raw last_beat times makes sync logic chase noise.  The grid is an alpha-beta filter,
+ * it predicts the next beat from the smoothed anchor and period and corrects both by a fraction of the error.
+ *
+ * @author teknopaul
+ */
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "cdj.h"
+#include "vdj.h"
+#include "vdj_phase.h"
+
+//SNIP_phase
+static int64_t
+vdj_phase_round(double x)
+{
+    return (int64_t) (x < 0 ? x - 0.5 : x + 0.5);
+}
+
+/**
+ * wrap x into -0.5 to +0.5, i.e. distance to the nearest whole number
+ */
+static double
+vdj_phase_wrap(double x)
+{
+    int64_t i = (int64_t) x;
+    if (x < i) i--;
+    x -= i;
+    return x >= 0.5 ? x - 1.0 : x;
+}
+
+void
+vdj_phase_reset(vdj_phase_grid_t* g)
+{
+    memset(g, 0, sizeof(vdj_phase_grid_t));
+}
+
+void
+vdj_phase_snapshot(vdj_phase_grid_t* g, vdj_phase_grid_t* copy)
+{
+    uint32_t seq;
+
+    do {
+        while ( (seq = atomic_load_explicit(&g->seq, memory_order_acquire)) & 1 ) ;
+        copy->anchor = g->anchor;
+        copy->period = g->period;
+        copy->bpm = g->bpm;
+        copy->bar_pos = g->bar_pos;
+        copy->beats = g->beats;
+        atomic_thread_fence(memory_order_acquire);
+    } while (atomic_load_explicit(&g->seq, memory_order_relaxed) != seq);
+    atomic_store_explicit(&copy->seq, 0, memory_order_relaxed);
+}
+
+static void
+vdj_phase_seed(vdj_phase_grid_t* g, cdj_nanos_t beat, float bpm, uint8_t bar_pos)
+{
+    g->anchor = beat;
+    g->period = (int64_t) (60.0 * CDJ_NANOS_PER_SEC / bpm);
+    g->bpm = bpm;
+    g->bar_pos = bar_pos ? bar_pos : 1;
+    g->beats = 1;
+}
+
+static void
+vdj_phase_update(vdj_phase_grid_t* g, cdj_nanos_t beat, float bpm, uint8_t bar_pos)
+{
+    int64_t n, err;
+    cdj_nanos_t predicted;
+
+    if (bpm <= 0.0) {
+        g->anchor = 0;
+        g->period = 0;
+        g->bpm = 0.0;
+        g->bar_pos = 0;
+        g->beats = 0;
+        return;
+    }
+    if (g->beats == 0) {
+        vdj_phase_seed(g, beat, bpm, bar_pos);
+        return;
+    }
+
+    // the DJ moved the tempo, trust the new bpm but keep the grid's phase
+    if (bpm != g->bpm) {
+        g->period = (int64_t) (60.0 * CDJ_NANOS_PER_SEC / bpm);
+        g->bpm = bpm;
+    }
+
+    n = vdj_phase_round((double) (beat - g->anchor) / g->period);
+    if (n <= 0 || n > VDJ_PHASE_MAX_GAP) {
+        vdj_phase_seed(g, beat, bpm, bar_pos);
+        return;
+    }
+    predicted = g->anchor + n * g->period;
+    err = beat - predicted;
+    if (err > g->period * VDJ_PHASE_JUMP || -err > g->period * VDJ_PHASE_JUMP) {
+        vdj_phase_seed(g, beat, bpm, bar_pos);
+        return;
+    }
+
+    g->anchor = predicted + (int64_t) (err * VDJ_PHASE_ALPHA);
+    g->period += (int64_t) (err * VDJ_PHASE_BETA / n);
+    g->bar_pos = bar_pos ? bar_pos : ((g->bar_pos - 1 + n) % 4) + 1;
+    g->beats++;
+}
+
+void
+vdj_phase_track(vdj_phase_grid_t* g, cdj_nanos_t beat, float bpm, uint8_t bar_pos)
+{
+    uint32_t seq = atomic_load_explicit(&g->seq, memory_order_relaxed);
+
+    atomic_store_explicit(&g->seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    vdj_phase_update(g, beat, bpm, bar_pos);
+
+    atomic_store_explicit(&g->seq, seq + 2, memory_order_release);
+}
+
+double
+vdj_phase_position(vdj_phase_grid_t* g, cdj_nanos_t t)
+{
+    return (g->bar_pos - 1) + (double) (t - g->anchor) / g->period;
+}
+
+int
+vdj_phase_offset(vdj_phase_grid_t* a, vdj_phase_grid_t* b, vdj_phase_t* phase)
+{
+    cdj_nanos_t t;
+    double ratio, r, diff;
+
+    if (a->beats == 0 || b->beats == 0) return CDJ_ERROR;
+
+    // b beats per a beat, snapped to half, same or double time
+    ratio = (double) a->period / b->period;
+    r = ratio > 1.5 ? 2.0 : ratio < 0.75 ? 0.5 : 1.0;
+    if (ratio / r > 1.0 + VDJ_PHASE_TOLERANCE || ratio / r < 1.0 - VDJ_PHASE_TOLERANCE) return CDJ_ERROR;
+
+    // compare at the most recent beat, so neither grid is extrapolated further than needed
+    t = a->anchor > b->anchor ? a->anchor : b->anchor;
+    diff = vdj_phase_position(a, t) - vdj_phase_position(b, t) / r;
+
+    phase->ratio = r;
+    phase->beat = vdj_phase_wrap(diff);
+    phase->bar = vdj_phase_wrap(diff / 4.0);
+    phase->nanos = (int64_t) (phase->beat * a->period);
+    return CDJ_OK;
+}
+//SNIP_phase
+
+vdj_phase_grid_t*
+vdj_phase_grid(vdj_t* v, uint8_t player_id, cdj_nanos_t now, vdj_phase_grid_t* copy)
+{
+    vdj_link_member_t* m;
+    vdj_phase_grid_t* g;
+
+    if (player_id == VDJ_PHASE_MASTER) {
+        if (v->master) player_id = v->player_id;
+        else if (v->backline && v->backline->master_id) player_id = v->backline->master_id;
+        else return NULL;
+    }
+    if (player_id == v->player_id) {
+        g = &v->grid;
+    } else {
+        if ( (m = vdj_get_link_member(v, player_id)) == NULL || m->gone ) return NULL;
+        g = &m->grid;
+    }
+    vdj_phase_snapshot(g, copy);
+    if (copy->beats == 0 || copy->period <= 0 || now - copy->anchor > VDJ_PHASE_MAX_GAP * copy->period) return NULL;
+    return g;
+}
+
+int
+vdj_phase_member(vdj_t* v, vdj_link_member_t* m, vdj_phase_t* phase)
+{
+    vdj_phase_grid_t a, b;
+
+    vdj_phase_snapshot(&v->grid, &a);
+    vdj_phase_snapshot(&m->grid, &b);
+    return vdj_phase_offset(&a, &b, phase);
+}
+
+int
+vdj_phase_master(vdj_t* v, vdj_phase_t* phase)
+{
+    vdj_phase_grid_t a, b;
+    vdj_phase_grid_t* g = vdj_phase_grid(v, VDJ_PHASE_MASTER, cdj_now(), &b);
+
+    if (g == NULL || g == &v->grid) return CDJ_ERROR;
+    vdj_phase_snapshot(&v->grid, &a);
+    return vdj_phase_offset(&a, &b, phase);
+}
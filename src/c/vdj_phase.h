@@ -0,0 +1,54 @@
+#ifndef _VDJ_PHASE_H_INCLUDED_
+#define _VDJ_PHASE_H_INCLUDED_
+
+#include "cdj.h"
+#include "vdj.h"
+
+/**
+ * Phase offsets between beat sources.
+ *
+ * Each source, us, a link member or the master, has a vdj_phase_grid_t that is fed every beat it sends.
+ * The grid smooths beat arrival times against the reported tempo, so receive jitter on one beat does not
+ * move the phase, and the offset between two grids can be read at any time, not only when both just beat.
+ * Offsets are fractions of a beat and of a bar at the first grid's tempo, when one source plays in
+ * double or half time the other's beats are scaled first so every other beat lines up.
+ * Grids are written by the thread that receives or sends the beats and read by any other, with a seqlock,
+ * readers work on a copy from vdj_phase_snapshot() so a beat arriving mid calculation cannot tear it.
+ */
+
+#define VDJ_PHASE_ALPHA       0.25  // share of a beat's timing error that moves the grid
+#define VDJ_PHASE_BETA        0.05  // share of a beat's timing error that changes the period
+#define VDJ_PHASE_JUMP        0.25  // errors bigger than this fraction of a beat mean the DJ jumped, reseed
+#define VDJ_PHASE_MAX_GAP     8     // beats missed before the grid is reseeded
+#define VDJ_PHASE_TOLERANCE   0.10  // tempos further apart than this (after halving or doubling) are unrelated
+#define VDJ_PHASE_MASTER      0     // player_id meaning whoever is sync master, including us
+
+typedef struct {
+    int64_t     nanos;  // signed offset at a's tempo, +ve if a is ahead of b
+    double      beat;   // offset as a fraction of a's beat, -0.5 to +0.5
+    double      bar;    // offset as a fraction of a's bar, -0.5 to +0.5
+    double      ratio;  // b beats per a beat, 1, 2 if b is in double time or 0.5 if b is in half time
+} vdj_phase_t;
+
+// feed a grid a beat, bar_pos 1 - 4 as in the beat packet, 0 if unknown, one writer per grid
+void vdj_phase_track(vdj_phase_grid_t* g, cdj_nanos_t beat, float bpm, uint8_t bar_pos);
+// initialise a grid no other thread can see yet
+void vdj_phase_reset(vdj_phase_grid_t* g);
+// consistent copy of a grid another thread may be tracking
+void vdj_phase_snapshot(vdj_phase_grid_t* g, vdj_phase_grid_t* copy);
+
+// position at time t in beats from the start of the grid's bar, 0.0 - 4.0 for times within the tracked bar
+double vdj_phase_position(vdj_phase_grid_t* g, cdj_nanos_t t);
+
+// offset of grid a from grid b, CDJ_ERROR if either has no beats yet or their tempos are unrelated
+int vdj_phase_offset(vdj_phase_grid_t* a, vdj_phase_grid_t* b, vdj_phase_t* phase);
+
+// copy the grid of a player, us or VDJ_PHASE_MASTER, NULL if unknown or the player stopped sending beats at
+// time now, else the live grid, only to compare with &v->grid, read copy instead
+vdj_phase_grid_t* vdj_phase_grid(vdj_t* v, uint8_t player_id, cdj_nanos_t now, vdj_phase_grid_t* copy);
+
+// our offset from a link member or from the sync master, +ve if we are ahead
+int vdj_phase_member(vdj_t* v, vdj_link_member_t* m, vdj_phase_t* phase);
+int vdj_phase_master(vdj_t* v, vdj_phase_t* phase);
+
+#endif // _VDJ_PHASE_H_INCLUDED_
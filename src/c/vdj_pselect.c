@@ -25,6 +25,10 @@
 
 #include "vdj.h"
 #include "vdj_discovery.h"
+#include "vdj_bpf.h"
+#include "vdj_thread.h"
+#include "vdj_metrics.h"
+#include "vdj_flight.h"
 
 
 #define VDJ_PSELECT_TIMEOUT
@@ -196,6 +200,7 @@ vdj_pselect_handler_socket(vdj_t* v, vdj_handlers* handlers, fd_set *readfds)
     uint8_t sig;
     ssize_t len;
     uint8_t packet[1500];
+    cdj_nanos_t start;
 
     // beats
     if ( FD_ISSET(v->beat_socket_fd, readfds) ) {
@@ -203,8 +208,12 @@ vdj_pselect_handler_socket(vdj_t* v, vdj_handlers* handlers, fd_set *readfds)
         if (len == -1) {
             fprintf(stderr, "error: beat_socket_fd read '%s'\n", strerror(errno));
         } else {
+            vdj_metrics_rx(CDJ_BEAT_PORT, packet, len);
+            vdj_flight_rx(CDJ_BEAT_PORT, packet, len);
             if ( ! cdj_validate_header(packet, len) ) {
+                start = cdj_now();
                 vdj_handle_managed_beat_datagram(v, handlers->beat_ph, packet, len);
+                vdj_metrics_handler_time(VDJ_THREAD_PSELECT, cdj_now() - start);
             }
         }
     }
@@ -214,8 +223,12 @@ vdj_pselect_handler_socket(vdj_t* v, vdj_handlers* handlers, fd_set *readfds)
         if (len == -1) {
             fprintf(stderr, "error: discovery_socket_fd read '%s'\n", strerror(errno));
         } else {
+            vdj_metrics_rx(CDJ_DISCOVERY_PORT, packet, len);
+            vdj_flight_rx(CDJ_DISCOVERY_PORT, packet, len);
             if ( ! cdj_validate_header(packet, len) ) {
+                start = cdj_now();
                 vdj_handle_managed_discovery_datagram(v, handlers->discovery_ph, packet, len);
+                vdj_metrics_handler_time(VDJ_THREAD_PSELECT, cdj_now() - start);
             }
         }
     }
@@ -225,8 +238,12 @@ vdj_pselect_handler_socket(vdj_t* v, vdj_handlers* handlers, fd_set *readfds)
         if (len == -1) {
             fprintf(stderr, "error: discovery_unicast_socket_fd read '%s'\n", strerror(errno));
         } else {
+            vdj_metrics_rx(CDJ_DISCOVERY_PORT, packet, len);
+            vdj_flight_rx(CDJ_DISCOVERY_PORT, packet, len);
             if ( ! cdj_validate_header(packet, len) ) {
+                start = cdj_now();
                 vdj_handle_managed_discovery_unicast_datagram(v, handlers->discovery_unicast_ph, packet, len);
+                vdj_metrics_handler_time(VDJ_THREAD_PSELECT, cdj_now() - start);
             }
         }
 
@@ -238,8 +255,12 @@ vdj_pselect_handler_socket(vdj_t* v, vdj_handlers* handlers, fd_set *readfds)
         if (len == -1) {
             fprintf(stderr, "error: beat_socket_fd read '%s'\n", strerror(errno));
         } else {
+            vdj_metrics_rx(CDJ_BEAT_PORT, packet, len);
+            vdj_flight_rx(CDJ_BEAT_PORT, packet, len);
             if ( ! cdj_validate_header(packet, len) ) {
+                start = cdj_now();
                 vdj_handle_managed_beat_unicast_datagram(v, handlers->beat_unicast_ph, packet, len);
+                vdj_metrics_handler_time(VDJ_THREAD_PSELECT, cdj_now() - start);
             }
         }
     }
@@ -250,8 +271,12 @@ vdj_pselect_handler_socket(vdj_t* v, vdj_handlers* handlers, fd_set *readfds)
         if (len == -1) {
             fprintf(stderr, "error: update_socket_fd read '%s'\n", strerror(errno));
         } else {
+            vdj_metrics_rx(CDJ_UPDATE_PORT, packet, len);
+            vdj_flight_rx(CDJ_UPDATE_PORT, packet, len);
             if ( ! cdj_validate_header(packet, len) ) {
+                start = cdj_now();
                 vdj_handle_managed_update_datagram(v, handlers->update_ph, packet, len);
+                vdj_metrics_handler_time(VDJ_THREAD_PSELECT, cdj_now() - start);
             }
         }
     }
@@ -357,14 +382,19 @@ vdj_pselect_init(vdj_t* v,
     handlers->beat_unicast_ph = beat_unicast_ph;
     handlers->update_ph = update_ph;
 
+    // this thread only ever acts on the packet types the managed handlers understand
+    vdj_bpf_filter_managed_discovery(v);
+    vdj_bpf_filter_managed_beat(v);
+    vdj_bpf_filter_managed_beat_unicast(v);
+    vdj_bpf_filter_managed_update(v);
+
     vdj_pselect_running = 1;
 
-    pthread_t thread_id;
     vdj_thread_info* tinfo = (vdj_thread_info*) calloc(1, sizeof(vdj_thread_info));
     tinfo->v = v;
     tinfo->handler = handlers;
 
-    return pthread_create(&thread_id, NULL, &vdj_pselect_loop, tinfo);
+    return vdj_thread_create(v, VDJ_THREAD_PSELECT, &vdj_pselect_loop, tinfo);
 }
 
 void
@@ -0,0 +1,229 @@
+/**
+ * Round trip probes.
+ *
+ * One thread sends a probe every VDJ_RTT_INTERVAL_NANOS to the next member in turn and polls the unicast discovery
+ * socket in between.  Replies are dated by the kernel with SO_TIMESTAMPNS so the thread waking late does not
+ * inflate the sample.  Only one probe per member is outstanding, a reply that comes after the next probe to the
+ * same member was sent is matched to that one, so lost replies cost at most one wrong sample.
+ *
+ * @author teknopaul
+ */
+
+#define _GNU_SOURCE
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "cdj.h"
+#include "vdj.h"
+#include "vdj_thread.h"
+#include "vdj_flight.h"
+#include "vdj_rtt.h"
+
+static unsigned _Atomic vdj_rtt_running = ATOMIC_VAR_INIT(0);
+
+//SNIP_rtt
+/**
+ * Only the rtt thread writes the estimate, it works on locals and stores each field once since the beat
+ * thread reads srtt as beats arrive.
+ */
+void
+vdj_rtt_sample(vdj_link_member_t* m, int64_t rtt)
+{
+    int64_t srtt, rttvar, err;
+
+    if (rtt <= 0) return;
+    if (m->rtt_samples == 0) {
+        srtt = rtt;
+        rttvar = rtt / 2;
+        m->rtt_min = rtt;
+    } else {
+        srtt = m->srtt;
+        rttvar = m->rttvar;
+        err = rtt - srtt;
+        rttvar += ((err < 0 ? -err : err) - rttvar) / VDJ_RTT_BETA;
+        srtt += err / VDJ_RTT_ALPHA;
+        if (rtt < m->rtt_min) m->rtt_min = rtt;
+    }
+    m->rttvar = rttvar;
+    m->srtt = srtt;
+    m->rtt_samples++;
+}
+
+int64_t
+vdj_rtt_one_way(vdj_link_member_t* m)
+{
+    return m->srtt / 2;
+}
+//SNIP_rtt
+
+/**
+ * Next member after last that we can reach, NULL if there are none
+ */
+static vdj_link_member_t*
+vdj_rtt_next_member(vdj_t* v, int* last)
+{
+    vdj_link_member_t* m;
+    int i, slot;
+
+    // all the way round to last itself
+    for (i = 1; i <= VDJ_MAX_BACKLINE + 1; i++) {
+        slot = (*last + i) % (VDJ_MAX_BACKLINE + 1);
+        m = vdj_get_link_member(v, slot);
+        if (m && m->ip_addr && ! m->gone) {
+            *last = slot;
+            return m;
+        }
+    }
+    return NULL;
+}
+
+static void
+vdj_rtt_probe(vdj_t* v, vdj_link_member_t* m, uint8_t* packet, uint16_t length)
+{
+    struct sockaddr_in* dest;
+
+    if ( (dest = vdj_alloc_dest_addr(m, CDJ_DISCOVERY_PORT)) == NULL ) return;
+    cdj_mod_id_use_req_packet_player_id(packet, m->player_id);
+    m->rtt_probe = cdj_now();
+    if ( vdj_sendto_update(v, dest, packet, length) ) m->rtt_probe = 0;
+    free(dest);
+}
+
+static void
+vdj_rtt_recv(vdj_t* v)
+{
+    uint8_t packet[1500];
+    char control[CMSG_SPACE(sizeof(struct timespec))];
+    struct iovec iov = { packet, sizeof(packet) };
+    struct msghdr msg;
+    struct cmsghdr* cmsg;
+    struct timespec kernel;
+    cdj_discovery_packet_t* d_pkt;
+    vdj_link_member_t* m;
+    cdj_nanos_t rx;
+    ssize_t len;
+
+    for (;;) {
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        if ( (len = recvmsg(v->discovery_unicast_socket_fd, &msg, MSG_DONTWAIT)) <= 0 ) return;
+        vdj_flight_rx(CDJ_DISCOVERY_PORT, packet, len);
+
+        rx = cdj_now();
+        for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_TIMESTAMPNS) {
+                memcpy(&kernel, CMSG_DATA(cmsg), sizeof(kernel));
+                rx = cdj_realtime_to_nanos(&kernel);
+            }
+        }
+
+        if ( (d_pkt = cdj_new_discovery_packet(packet, len)) ) {
+            if (d_pkt->type == CDJ_ID_USE_RESP && (m = vdj_get_link_member(v, d_pkt->player_id)) && m->rtt_probe) {
+                if (rx - m->rtt_probe < VDJ_RTT_TIMEOUT_NANOS) vdj_rtt_sample(m, rx - m->rtt_probe);
+                m->rtt_probe = 0;
+            }
+            free(d_pkt);
+        }
+    }
+}
+
+static void*
+vdj_rtt_loop(void* arg)
+{
+    vdj_t* v = arg;
+    vdj_link_member_t* m;
+    struct pollfd pfd = { v->discovery_unicast_socket_fd, POLLIN, 0 };
+    cdj_nanos_t now, next = cdj_now();
+    uint16_t length;
+    int last = 0;
+
+    // player id is set per probe, reqid stays 1, it counts a joining player's attempts 1 - 3
+    uint8_t* packet = cdj_create_id_use_req_packet(&length, v->model, v->ip, v->mac, 0, 1);
+    if (packet == NULL) return NULL;
+
+    while (vdj_rtt_running) {
+        now = cdj_now();
+        if (now >= next) {
+            if ( (m = vdj_rtt_next_member(v, &last)) ) vdj_rtt_probe(v, m, packet, length);
+            next += VDJ_RTT_INTERVAL_NANOS;
+            if (next < now) next = now + VDJ_RTT_INTERVAL_NANOS;
+        }
+        if ( poll(&pfd, 1, (next - now) / CDJ_NANOS_PER_MILLI + 1) > 0 ) vdj_rtt_recv(v);
+    }
+
+    free(packet);
+    v->rtt = 0;
+    return NULL;
+}
+
+// kernel rx timestamps on the unicast discovery socket, only while the rtt thread reads it
+static int
+vdj_rtt_timestamps(vdj_t* v, int value)
+{
+    if ( setsockopt(v->discovery_unicast_socket_fd, SOL_SOCKET, SO_TIMESTAMPNS, &value, sizeof(value)) ) {
+        fprintf(stderr, "error: SO_TIMESTAMPNS '%s'\n", strerror(errno));
+        return CDJ_ERROR;
+    }
+    return CDJ_OK;
+}
+
+int
+vdj_init_rtt_thread(vdj_t* v)
+{
+    if (vdj_rtt_running) return CDJ_ERROR;
+    if (v->backline == NULL) {
+        fprintf(stderr, "error: init a managed discovery thread first\n");
+        return CDJ_ERROR;
+    }
+    if ( vdj_rtt_timestamps(v, 1) ) return CDJ_ERROR;
+
+    vdj_rtt_running = 1;
+    v->rtt = 1;
+    if ( vdj_thread_create(v, VDJ_THREAD_RTT, vdj_rtt_loop, v) ) {
+        vdj_rtt_running = 0;
+        v->rtt = 0;
+        vdj_rtt_timestamps(v, 0);
+        return CDJ_ERROR;
+    }
+    return CDJ_OK;
+}
+
+/**
+ * Waits for the thread, up to VDJ_RTT_INTERVAL_NANOS, the discovery thread then has the socket back without timestamps
+ */
+void
+vdj_stop_rtt_thread(vdj_t* v)
+{
+    if ( ! vdj_rtt_running ) return;
+    vdj_rtt_running = 0;
+    vdj_thread_join(v, VDJ_THREAD_RTT);
+    vdj_rtt_timestamps(v, 0);
+    v->rtt = 0;
+}
+
+void
+vdj_rtt_fprint(FILE* f, vdj_t* v)
+{
+    vdj_link_member_t* m;
+    int i;
+
+    for (i = 1; i <= VDJ_MAX_BACKLINE; i++) {
+        if ( (m = vdj_get_link_member(v, i)) == NULL ) continue;
+        if (m->rtt_samples == 0) {
+            fprintf(f, "player %02d rtt unknown\n", i);
+            continue;
+        }
+        fprintf(f, "player %02d rtt=%.3fms jitter=%.3fms min=%.3fms samples=%u\n", i,
+            m->srtt / 1000000.0, m->rttvar / 1000000.0, m->rtt_min / 1000000.0, m->rtt_samples);
+    }
+}
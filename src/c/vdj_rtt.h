@@ -0,0 +1,36 @@
+#ifndef _VDJ_RTT_H_INCLUDED_
+#define _VDJ_RTT_H_INCLUDED_
+
+#include <stdio.h>
+
+#include "cdj.h"
+#include "vdj.h"
+
+/**
+ * Round trip latency to each link member, so beat times can be corrected for the network delay.
+ *
+ * A beat packet is timestamped when it arrives, so it is late by the one way delay from the deck, which on a
+ * busy club switch can be milliseconds.  The rtt thread probes each member in turn with a CDJ_ID_USE_REQ for
+ * the member's own player id sent unicast to its port 50000, the owner of an id answers with CDJ_ID_USE_RESP.
+ * The reply's kernel rx timestamp minus the probe's send time is one sample, smoothed as TCP does (RFC 6298)
+ * into srtt and rttvar in vdj_link_member_t.  The managed beat thread then dates each beat half the smoothed
+ * round trip earlier, assuming the path is symmetric.
+ */
+
+#define VDJ_RTT_INTERVAL_NANOS  250000000   // between probes, members take turns
+#define VDJ_RTT_TIMEOUT_NANOS   (CDJ_REPLY_WAIT * CDJ_NANOS_PER_MILLI)  // a reply later than this is not a sample
+#define VDJ_RTT_ALPHA           8           // srtt moves 1/8 of the way to each sample
+#define VDJ_RTT_BETA            4           // rttvar moves 1/4 of the way to each deviation
+
+// needs a managed discovery thread, sets v->rtt
+int vdj_init_rtt_thread(vdj_t* v);
+void vdj_stop_rtt_thread(vdj_t* v);
+
+// fold one round trip sample into the member's estimate
+void vdj_rtt_sample(vdj_link_member_t* m, int64_t rtt);
+// half the smoothed round trip, 0 until the member has answered a probe
+int64_t vdj_rtt_one_way(vdj_link_member_t* m);
+
+void vdj_rtt_fprint(FILE* f, vdj_t* v);
+
+#endif // _VDJ_RTT_H_INCLUDED_
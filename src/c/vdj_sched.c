@@ -0,0 +1,297 @@
+/**
+ * Look ahead scheduler, fires client handlers ahead of predicted beats.
+ *
+ * The timer thread waits on an eventfd so new beats can wake it to re-plan, then sleeps the last
+ * VDJ_SCHED_SPIN_NANOS with clock_nanosleep() on the cdj clock, poll timeouts are less precise.
+ * Beat threads wake it without taking the lock, only the first wake since the timer thread last looked
+ * writes the eventfd.
+ * Handlers run on the timer thread without the lock held, they may add or cancel events.
+ *
+ * @author teknopaul
+ */
+
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include "cdj.h"
+#include "vdj.h"
+#include "vdj_thread.h"
+#include "vdj_phase.h"
+#include "vdj_sched.h"
+
+//SNIP_sched
+struct vdj_sched_s {
+    vdj_t*              v;
+    pthread_mutex_t     lock;
+    int                 wake_fd;        // eventfd, readable when the timer thread should re-plan
+    unsigned _Atomic    wake_pending;   // set by the first wake since the timer thread last looked
+    vdj_sched_event_t   events[VDJ_SCHED_MAX];
+    int                 next_id;
+    unsigned _Atomic    running;
+};
+
+static int64_t
+vdj_sched_floor_div(int64_t a, int64_t b)
+{
+    return a >= 0 ? a / b : -((-a + b - 1) / b);
+}
+
+// bar position 0 - 3 of the k'th beat after the anchor
+static int
+vdj_sched_bar_index(vdj_phase_grid_t* g, int64_t k)
+{
+    int64_t i = (g->bar_pos - 1 + k) % 4;
+    return i < 0 ? i + 4 : i;
+}
+
+/**
+ * A new event goes on the count'th beat or bar that is still far enough away to fire lead before it,
+ * a planned one moves to the beat of the current grid nearest its old prediction.
+ */
+static int
+vdj_sched_plan(vdj_sched_event_t* e, vdj_phase_grid_t* g, cdj_nanos_t now)
+{
+    int64_t k;
+    int i;
+
+    if (g == NULL) {
+        e->when = 0;
+        return CDJ_ERROR;
+    }
+
+    if (e->when == 0) {
+        k = vdj_sched_floor_div(now + e->lead - g->anchor, g->period) + 1;
+        if (e->unit == VDJ_SCHED_BAR) {
+            while (vdj_sched_bar_index(g, k)) k++;
+        }
+        k += (int64_t) (e->count - 1) * e->unit;
+    } else {
+        k = vdj_sched_floor_div(e->when - g->anchor + g->period / 2, g->period);
+        if (e->unit == VDJ_SCHED_BAR) {
+            i = vdj_sched_bar_index(g, k);
+            k += i >= 2 ? 4 - i : -i;
+        }
+    }
+
+    e->when = g->anchor + k * g->period;
+    e->bar_pos = vdj_sched_bar_index(g, k) + 1;
+    e->period = g->period;
+    return CDJ_OK;
+}
+
+static void
+vdj_sched_wake(vdj_sched_t* s)
+{
+    uint64_t one = 1;
+
+    if ( atomic_exchange_explicit(&s->wake_pending, 1, memory_order_acq_rel) ) return;
+    if ( write(s->wake_fd, &one, sizeof(one)) == -1 ) {
+        fprintf(stderr, "error: sched wake '%s'\n", strerror(errno));
+    }
+}
+
+/**
+ * Plan every pending event on its player's grid, call with the lock held.
+ * @return 1 and a copy of the first event that is due in fire, or 0 and the time the next one is due in next
+ */
+static int
+vdj_sched_due(vdj_sched_t* s, cdj_nanos_t now, vdj_sched_event_t* fire, cdj_nanos_t* next)
+{
+    vdj_sched_event_t* e;
+    vdj_phase_grid_t grid;
+    int i;
+
+    *next = now + VDJ_SCHED_IDLE_NANOS;
+    for (i = 0; i < VDJ_SCHED_MAX; i++) {
+        e = &s->events[i];
+        if (e->id == 0) continue;
+        if ( vdj_sched_plan(e, vdj_phase_grid(s->v, e->player_id, now, &grid) ? &grid : NULL, now) ) continue;
+
+        if (e->when - e->lead <= now) {
+            *fire = *e;
+            if (e->repeat) e->when += e->unit * e->period;
+            else e->id = 0;
+            return 1;
+        }
+        if (e->when - e->lead < *next) *next = e->when - e->lead;
+    }
+    return 0;
+}
+//SNIP_sched
+
+static void
+vdj_sched_wait(vdj_sched_t* s, cdj_nanos_t now, cdj_nanos_t until)
+{
+    struct pollfd pfd = { s->wake_fd, POLLIN, 0 };
+    struct timespec ts;
+    uint64_t count;
+
+    if (until - now > VDJ_SCHED_SPIN_NANOS) {
+        ts = cdj_nanos_to_timespec(until - now - VDJ_SCHED_SPIN_NANOS);
+        pthread_mutex_unlock(&s->lock);
+        if ( ppoll(&pfd, 1, &ts, NULL) > 0 ) {
+            // clear the flag first, a wake racing the read leaves the fd readable and costs one extra plan
+            atomic_store_explicit(&s->wake_pending, 0, memory_order_release);
+            if ( read(s->wake_fd, &count, sizeof(count)) == -1 && errno != EAGAIN ) {
+                fprintf(stderr, "error: sched wait '%s'\n", strerror(errno));
+            }
+        }
+        pthread_mutex_lock(&s->lock);
+    } else {
+        ts = cdj_nanos_to_timespec(until);
+        pthread_mutex_unlock(&s->lock);
+        while ( clock_nanosleep(cdj_clock_id(), TIMER_ABSTIME, &ts, NULL) == EINTR );
+        pthread_mutex_lock(&s->lock);
+    }
+}
+
+static void*
+vdj_sched_loop(void* arg)
+{
+    vdj_sched_t* s = arg;
+    vdj_sched_event_t fire;
+    cdj_nanos_t now, next;
+
+    pthread_mutex_lock(&s->lock);
+    while (s->running) {
+        now = cdj_now();
+        if ( vdj_sched_due(s, now, &fire, &next) ) {
+            pthread_mutex_unlock(&s->lock);
+            fire.handler(s->v, &fire);
+            pthread_mutex_lock(&s->lock);
+        } else {
+            vdj_sched_wait(s, now, next);
+        }
+    }
+    pthread_mutex_unlock(&s->lock);
+    return NULL;
+}
+
+int
+vdj_init_sched_thread(vdj_t* v)
+{
+    vdj_sched_t* s;
+
+    if (v->sched) return CDJ_ERROR;
+    if ( (s = (vdj_sched_t*) calloc(1, sizeof(vdj_sched_t))) == NULL ) return CDJ_ERROR;
+
+    if ( (s->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1 ) {
+        fprintf(stderr, "error: sched eventfd '%s'\n", strerror(errno));
+        free(s);
+        return CDJ_ERROR;
+    }
+    pthread_mutex_init(&s->lock, NULL);
+    s->v = v;
+    s->running = 1;
+
+    if ( vdj_thread_create(v, VDJ_THREAD_SCHED, vdj_sched_loop, s) ) {
+        pthread_mutex_destroy(&s->lock);
+        close(s->wake_fd);
+        free(s);
+        return CDJ_ERROR;
+    }
+    v->sched = s;
+    return CDJ_OK;
+}
+
+/**
+ * Beat threads keep running, v->sched is cleared first and the scheduler only freed once no
+ * vdj_sched_signal() that could still have seen it is in progress.
+ */
+void
+vdj_stop_sched_thread(vdj_t* v)
+{
+    vdj_sched_t* s = v->sched;
+
+    if (s == NULL) return;
+    v->sched = NULL;
+
+    pthread_mutex_lock(&s->lock);
+    s->running = 0;
+    pthread_mutex_unlock(&s->lock);
+    vdj_sched_wake(s);
+    vdj_thread_join(v, VDJ_THREAD_SCHED);
+
+    while (v->sched_signals) sched_yield();
+    pthread_mutex_destroy(&s->lock);
+    close(s->wake_fd);
+    free(s);
+}
+
+//SNIP_sched_events
+int
+vdj_sched_add(vdj_t* v, uint8_t player_id, vdj_sched_unit unit, uint32_t count, int64_t lead, int repeat,
+              vdj_sched_h handler, void* arg)
+{
+    vdj_sched_t* s = v->sched;
+    vdj_sched_event_t* e;
+    int i, id = 0;
+
+    if (s == NULL || handler == NULL || count == 0 || lead < 0) return 0;
+
+    pthread_mutex_lock(&s->lock);
+    for (i = 0; s->running && i < VDJ_SCHED_MAX; i++) {
+        e = &s->events[i];
+        if (e->id) continue;
+
+        memset(e, 0, sizeof(vdj_sched_event_t));
+        if (++s->next_id <= 0) s->next_id = 1;
+        id = e->id = s->next_id;
+        e->player_id = player_id;
+        e->unit = unit;
+        e->count = count;
+        e->lead = lead;
+        e->repeat = repeat ? 1 : 0;
+        e->handler = handler;
+        e->arg = arg;
+        break;
+    }
+    pthread_mutex_unlock(&s->lock);
+    if (id) vdj_sched_wake(s);
+
+    if (id == 0) fprintf(stderr, "error: scheduler %s\n", s->running ? "full" : "stopped");
+    return id;
+}
+
+int
+vdj_sched_cancel(vdj_t* v, int id)
+{
+    vdj_sched_t* s = v->sched;
+    int i, rv = CDJ_ERROR;
+
+    if (s == NULL || id == 0) return CDJ_ERROR;
+
+    pthread_mutex_lock(&s->lock);
+    for (i = 0; i < VDJ_SCHED_MAX; i++) {
+        if (s->events[i].id == id) {
+            s->events[i].id = 0;
+            rv = CDJ_OK;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&s->lock);
+    return rv;
+}
+//SNIP_sched_events
+
+void
+vdj_sched_signal(vdj_t* v)
+{
+    vdj_sched_t* s;
+
+    // counted before v->sched is read, see vdj_stop_sched_thread()
+    v->sched_signals++;
+    if ( (s = v->sched) ) vdj_sched_wake(s);
+    v->sched_signals--;
+}
@@ -0,0 +1,62 @@
+#ifndef _VDJ_SCHED_H_INCLUDED_
+#define _VDJ_SCHED_H_INCLUDED_
+
+#include "cdj.h"
+#include "vdj.h"
+#include "vdj_phase.h"
+
+/**
+ * Beat synchronous event scheduler.
+ *
+ * beat_ph callbacks arrive after the beat, too late for quantized loops, jump points or midi that has to sound
+ * on the beat.  Clients register "call me lead nanos before the count'th next beat (or bar) of player p" and
+ * a timer thread fires the handler at the time predicted from that player's vdj_phase_grid_t.
+ * Each beat packet that arrives refines the grid and pending events are re-planned onto it, an event that
+ * was planned for a beat stays on that beat as the prediction moves.
+ * Events for a player that stops sending beats wait until it plays again and are then planned afresh.
+ */
+
+#define VDJ_SCHED_MAX           32       // pending events
+#define VDJ_SCHED_IDLE_NANOS    100000000 // longest the timer thread sleeps without re-planning
+#define VDJ_SCHED_SPIN_NANOS    200000   // the last stretch is slept with clock_nanosleep() not a poll
+
+typedef enum {
+    VDJ_SCHED_BEAT = 1,
+    VDJ_SCHED_BAR  = 4       // beats per unit
+} vdj_sched_unit;
+
+typedef struct vdj_sched_event_s vdj_sched_event_t;
+
+typedef void (*vdj_sched_h)(vdj_t* v, vdj_sched_event_t* e);
+
+struct vdj_sched_event_s {
+    int                 id;         // 0 if the slot is free
+    uint8_t             player_id;  // whose beats, or VDJ_PHASE_MASTER
+    vdj_sched_unit      unit;
+    uint32_t            count;      // fire before the count'th next beat or bar, 1 is the next one
+    int64_t             lead;       // nanos before the beat to fire
+    unsigned int        repeat:1;   // fire before every beat or bar from then on
+    cdj_nanos_t         when;       // predicted time of the beat, 0 until planned
+    uint8_t             bar_pos;    // predicted 1 - 4 bar position of that beat
+    int64_t             period;     // predicted nanos per beat
+    vdj_sched_h         handler;
+    void*               arg;
+};
+
+typedef struct vdj_sched_s vdj_sched_t;
+
+// sets v->sched and starts the timer thread, VDJ_THREAD_SCHED
+int vdj_init_sched_thread(vdj_t* v);
+// joins the timer thread and frees v->sched, pending events are dropped, it can be started again,
+// not to be called from a handler or at the same time as vdj_sched_add() or vdj_sched_cancel()
+void vdj_stop_sched_thread(vdj_t* v);
+
+// returns the event id, or 0 if the scheduler is not running or full
+int vdj_sched_add(vdj_t* v, uint8_t player_id, vdj_sched_unit unit, uint32_t count, int64_t lead, int repeat,
+                  vdj_sched_h handler, void* arg);
+int vdj_sched_cancel(vdj_t* v, int id);
+
+// wake the timer thread to re-plan, called when a beat has been tracked, takes no lock
+void vdj_sched_signal(vdj_t* v);
+
+#endif // _VDJ_SCHED_H_INCLUDED_
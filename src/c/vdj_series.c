@@ -0,0 +1,384 @@
+/**
+ * Decoded time series recorder and queries, see vdj_series.h
+ *
+ * @author teknopaul
+ */
+
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "cdj.h"
+#include "vdj.h"
+#include "vdj_phase.h"
+#include "vdj_series.h"
+
+_Static_assert(sizeof(vdj_series_header_t) == 4096, "series header is one page");
+_Static_assert(sizeof(vdj_series_chunk_t) % 4096 == 0, "series chunks start on a page");
+
+// beats from two threads and status from a third, a new chunk is a syscall so appends take a lock
+static pthread_mutex_t vdj_series_lock = PTHREAD_MUTEX_INITIALIZER;
+static vdj_series_header_t* _Atomic vdj_series_hdr = NULL;
+static vdj_series_chunk_t* vdj_series_current = NULL;
+static int vdj_series_fd = -1;
+
+//SNIP_series_offset
+static off_t
+vdj_series_offset(uint32_t i)
+{
+    return sizeof(vdj_series_header_t) + (off_t) i * sizeof(vdj_series_chunk_t);
+}
+//SNIP_series_offset
+
+static vdj_series_chunk_t*
+vdj_series_map_chunk(uint32_t i)
+{
+    vdj_series_chunk_t* c = mmap(NULL, sizeof(vdj_series_chunk_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+        vdj_series_fd, vdj_series_offset(i));
+    if (c == MAP_FAILED) {
+        fprintf(stderr, "error: series mmap '%s'\n", strerror(errno));
+        return NULL;
+    }
+    return c;
+}
+
+static int64_t
+vdj_series_realtime(cdj_nanos_t t)
+{
+    struct timespec ts = cdj_nanos_to_realtime(t);
+    return cdj_timespec_to_nanos(&ts);
+}
+
+/**
+ * extend the file by a chunk and start writing it, called with the lock held
+ */
+static int
+vdj_series_grow(vdj_series_header_t* hdr)
+{
+    vdj_series_chunk_t* c;
+    uint32_t n = atomic_load(&hdr->chunks);
+    int err;
+
+    // returns the error, errno is not set
+    if ( (err = posix_fallocate(vdj_series_fd, vdj_series_offset(n), sizeof(vdj_series_chunk_t))) ) {
+        fprintf(stderr, "error: series grow '%s'\n", strerror(err));
+        return CDJ_ERROR;
+    }
+    if ( ! (c = vdj_series_map_chunk(n)) ) return CDJ_ERROR;
+
+    if (vdj_series_current) munmap(vdj_series_current, sizeof(vdj_series_chunk_t));
+    vdj_series_current = c;
+    atomic_store_explicit(&hdr->chunks, n + 1, memory_order_release);
+    return CDJ_OK;
+}
+
+int
+vdj_series_open(const char* path)
+{
+    vdj_series_header_t* hdr;
+    struct stat st;
+    uint32_t chunks;
+    int err = 0;
+
+    if (vdj_series_hdr) return CDJ_ERROR;
+    if ( (vdj_series_fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644)) < 0 ) {
+        fprintf(stderr, "error: open '%s' '%s'\n", path, strerror(errno));
+        return CDJ_ERROR;
+    }
+    if ( fstat(vdj_series_fd, &st) ) {
+        err = errno;
+    } else if (st.st_size < sizeof(vdj_series_header_t)) {
+        err = posix_fallocate(vdj_series_fd, 0, sizeof(vdj_series_header_t));
+    }
+    if (err) {
+        fprintf(stderr, "error: sizing '%s' '%s'\n", path, strerror(err));
+        close(vdj_series_fd);
+        vdj_series_fd = -1;
+        return CDJ_ERROR;
+    }
+    hdr = mmap(NULL, sizeof(vdj_series_header_t), PROT_READ | PROT_WRITE, MAP_SHARED, vdj_series_fd, 0);
+    if (hdr == MAP_FAILED) {
+        fprintf(stderr, "error: mmap '%s' '%s'\n", path, strerror(errno));
+        close(vdj_series_fd);
+        vdj_series_fd = -1;
+        return CDJ_ERROR;
+    }
+
+    if (hdr->magic == 0) {
+        hdr->magic = VDJ_SERIES_MAGIC;
+        hdr->version = VDJ_SERIES_VERSION;
+        hdr->chunk_rows = VDJ_SERIES_CHUNK_ROWS;
+        hdr->chunk_size = sizeof(vdj_series_chunk_t);
+        hdr->created = vdj_series_realtime(cdj_now());
+    } else if (hdr->magic != VDJ_SERIES_MAGIC || hdr->version != VDJ_SERIES_VERSION ||
+               hdr->chunk_rows != VDJ_SERIES_CHUNK_ROWS || hdr->chunk_size != sizeof(vdj_series_chunk_t)) {
+        fprintf(stderr, "error: '%s' is not a version %d time series\n", path, VDJ_SERIES_VERSION);
+        munmap(hdr, sizeof(vdj_series_header_t));
+        close(vdj_series_fd);
+        vdj_series_fd = -1;
+        return CDJ_ERROR;
+    }
+    hdr->pid = getpid();
+
+    // carry on in the last chunk of an existing file
+    chunks = atomic_load(&hdr->chunks);
+    if (chunks && vdj_series_offset(chunks) <= st.st_size) {
+        vdj_series_current = vdj_series_map_chunk(chunks - 1);
+    } else {
+        atomic_store(&hdr->chunks, 0);
+        vdj_series_grow(hdr);
+    }
+    if ( ! vdj_series_current ) {
+        munmap(hdr, sizeof(vdj_series_header_t));
+        close(vdj_series_fd);
+        vdj_series_fd = -1;
+        return CDJ_ERROR;
+    }
+
+    vdj_series_hdr = hdr;
+    return CDJ_OK;
+}
+
+/**
+ * Call once the threads that record have stopped
+ */
+void
+vdj_series_close()
+{
+    vdj_series_header_t* hdr = atomic_exchange(&vdj_series_hdr, NULL);
+    if (hdr) {
+        pthread_mutex_lock(&vdj_series_lock);
+        munmap(vdj_series_current, sizeof(vdj_series_chunk_t));
+        vdj_series_current = NULL;
+        munmap(hdr, sizeof(vdj_series_header_t));
+        close(vdj_series_fd);
+        vdj_series_fd = -1;
+        pthread_mutex_unlock(&vdj_series_lock);
+    }
+}
+
+static void
+vdj_series_append(uint8_t kind, uint8_t player_id, int64_t ts, float bpm, uint32_t pitch, uint8_t bar, uint8_t flags)
+{
+    vdj_series_header_t* hdr = vdj_series_hdr;
+    vdj_series_chunk_t* c;
+    uint32_t n;
+
+    if (hdr == NULL) return;
+
+    pthread_mutex_lock(&vdj_series_lock);
+    c = vdj_series_current;
+    if (c && (n = atomic_load_explicit(&c->rows, memory_order_relaxed)) == VDJ_SERIES_CHUNK_ROWS) {
+        c = vdj_series_grow(hdr) == CDJ_OK ? vdj_series_current : NULL;
+    }
+    if (c) {
+        n = atomic_load_explicit(&c->rows, memory_order_relaxed);
+        c->ts[n] = ts;
+        c->bpm[n] = bpm;
+        c->pitch[n] = pitch;
+        c->player[n] = player_id;
+        c->kind[n] = kind;
+        c->bar[n] = bar;
+        c->flags[n] = flags;
+        if (n == 0 || ts < c->first) c->first = ts;
+        if (n == 0 || ts > c->last) c->last = ts;
+        atomic_store_explicit(&c->rows, n + 1, memory_order_release);
+    }
+    pthread_mutex_unlock(&vdj_series_lock);
+}
+
+void
+vdj_series_beat(uint8_t player_id, cdj_nanos_t beat, float bpm, uint32_t pitch, uint8_t bar_pos, uint8_t flags)
+{
+    if (vdj_series_hdr) vdj_series_append(VDJ_SERIES_BEAT, player_id, vdj_series_realtime(beat), bpm, pitch, bar_pos, flags);
+}
+
+void
+vdj_series_status(uint8_t player_id, float bpm, uint32_t pitch, uint8_t flags)
+{
+    if (vdj_series_hdr) vdj_series_append(VDJ_SERIES_STATUS, player_id, vdj_series_realtime(cdj_now()), bpm, pitch, 0, flags);
+}
+
+void
+vdj_series_master(uint8_t player_id)
+{
+    if (vdj_series_hdr) vdj_series_append(VDJ_SERIES_MASTER, player_id, vdj_series_realtime(cdj_now()), 0.0, 0, 0, 0);
+}
+
+// reading
+
+vdj_series_t*
+vdj_series_map(const char* path)
+{
+    vdj_series_t* s;
+    vdj_series_header_t* hdr;
+    struct stat st;
+    uint32_t chunks;
+    int fd;
+
+    if ( (fd = open(path, O_RDONLY | O_CLOEXEC)) < 0 ) return NULL;
+    if ( fstat(fd, &st) || st.st_size < sizeof(vdj_series_header_t) ) {
+        close(fd);
+        return NULL;
+    }
+    hdr = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (hdr == MAP_FAILED) return NULL;
+
+    if (hdr->magic != VDJ_SERIES_MAGIC || hdr->version != VDJ_SERIES_VERSION ||
+        hdr->chunk_rows != VDJ_SERIES_CHUNK_ROWS || hdr->chunk_size != sizeof(vdj_series_chunk_t) ||
+        ! (s = (vdj_series_t*) calloc(1, sizeof(vdj_series_t))) ) {
+        munmap(hdr, st.st_size);
+        return NULL;
+    }
+    // the writer may have grown the file since we looked at its size
+    chunks = atomic_load_explicit(&hdr->chunks, memory_order_acquire);
+    while (chunks && vdj_series_offset(chunks) > st.st_size) chunks--;
+
+    s->hdr = hdr;
+    s->size = st.st_size;
+    s->chunks = chunks;
+    return s;
+}
+
+void
+vdj_series_unmap(vdj_series_t* s)
+{
+    if (s) {
+        munmap(s->hdr, s->size);
+        free(s);
+    }
+}
+
+//SNIP_series
+vdj_series_chunk_t*
+vdj_series_chunk(vdj_series_t* s, uint32_t i)
+{
+    if (i >= s->chunks) return NULL;
+    return (vdj_series_chunk_t*) ((uint8_t*) s->hdr + vdj_series_offset(i));
+}
+
+int
+vdj_series_span(vdj_series_t* s, int64_t* first, int64_t* last)
+{
+    vdj_series_chunk_t* c;
+    uint32_t i;
+    int found = 0;
+
+    for (i = 0; i < s->chunks; i++) {
+        c = vdj_series_chunk(s, i);
+        if (atomic_load_explicit(&c->rows, memory_order_acquire) == 0) continue;
+        if ( ! found || c->first < *first) *first = c->first;
+        if ( ! found || c->last > *last) *last = c->last;
+        found = 1;
+    }
+    return found ? CDJ_OK : CDJ_ERROR;
+}
+
+/**
+ * rows committed in chunk i, 0 if the chunk is all outside from - to
+ */
+static uint32_t
+vdj_series_rows(vdj_series_t* s, uint32_t i, int64_t from, int64_t to, vdj_series_chunk_t** c)
+{
+    uint32_t rows;
+    *c = vdj_series_chunk(s, i);
+    rows = atomic_load_explicit(&(*c)->rows, memory_order_acquire);
+    if (rows > VDJ_SERIES_CHUNK_ROWS) return 0;
+    if (rows == 0 || (*c)->last < from || (*c)->first > to) return 0;
+    return rows;
+}
+
+void
+vdj_series_tempo(vdj_series_t* s, uint8_t player_id, int64_t from, int64_t to, int64_t step,
+    vdj_series_tempo_cb cb, void* arg)
+{
+    vdj_series_chunk_t* c;
+    uint32_t i, r, rows, n = 0;
+    int64_t bucket = from;
+    double sum = 0.0;
+    float min = 0.0, max = 0.0, bpm;
+
+    if (step <= 0) step = to - from + 1;
+
+    for (i = 0; i < s->chunks; i++) {
+        rows = vdj_series_rows(s, i, from, to, &c);
+        for (r = 0; r < rows; r++) {
+            if (c->player[r] != player_id || c->kind[r] == VDJ_SERIES_MASTER) continue;
+            if (c->ts[r] < from || c->ts[r] > to || c->bpm[r] <= 0.0) continue;
+
+            if (c->ts[r] >= bucket + step) {
+                if (n) cb(bucket, sum / n, min, max, n, arg);
+                bucket += (c->ts[r] - bucket) / step * step;
+                n = 0;
+                sum = 0.0;
+            }
+            bpm = c->bpm[r];
+            if (n == 0 || bpm < min) min = bpm;
+            if (n == 0 || bpm > max) max = bpm;
+            sum += bpm;
+            n++;
+        }
+    }
+    if (n) cb(bucket, sum / n, min, max, n, arg);
+}
+//SNIP_series
+
+void
+vdj_series_masters(vdj_series_t* s, int64_t from, int64_t to, vdj_series_master_cb cb, void* arg)
+{
+    vdj_series_chunk_t* c;
+    uint32_t i, r, rows;
+
+    for (i = 0; i < s->chunks; i++) {
+        rows = vdj_series_rows(s, i, from, to, &c);
+        for (r = 0; r < rows; r++) {
+            if (c->kind[r] == VDJ_SERIES_MASTER && c->ts[r] >= from && c->ts[r] <= to) cb(c->ts[r], c->player[r], arg);
+        }
+    }
+}
+
+/**
+ * Replays both players' beats through the same grids vdj uses live, so the error is what sync would have seen.
+ * Beats before from are not reported but still seed the grids, nor are b's beats once a has missed more than
+ * VDJ_PHASE_MAX_GAP beats.
+ */
+void
+vdj_series_phase(vdj_series_t* s, uint8_t a, uint8_t b, int64_t from, int64_t to,
+    vdj_series_phase_cb cb, void* arg)
+{
+    vdj_series_chunk_t* c;
+    vdj_phase_grid_t ga, gb;
+    vdj_phase_t phase;
+    uint32_t i, r, rows;
+    int64_t seed = from - 16 * CDJ_NANOS_PER_SEC;
+
+    vdj_phase_reset(&ga);
+    vdj_phase_reset(&gb);
+
+    for (i = 0; i < s->chunks; i++) {
+        rows = vdj_series_rows(s, i, seed, to, &c);
+        for (r = 0; r < rows; r++) {
+            if (c->kind[r] != VDJ_SERIES_BEAT || c->ts[r] < seed || c->ts[r] > to) continue;
+            if (c->player[r] == a) {
+                vdj_phase_track(&ga, c->ts[r], c->bpm[r], c->bar[r]);
+            } else if (c->player[r] == b) {
+                vdj_phase_track(&gb, c->ts[r], c->bpm[r], c->bar[r]);
+                if (c->ts[r] < from) continue;
+                // a stopped sending beats, its grid is stale as vdj_phase_grid() would see it live
+                if (c->ts[r] - ga.anchor > VDJ_PHASE_MAX_GAP * ga.period) continue;
+                if (vdj_phase_offset(&ga, &gb, &phase) == CDJ_OK) cb(c->ts[r], &phase, arg);
+            }
+        }
+    }
+}
@@ -0,0 +1,102 @@
+#ifndef _VDJ_SERIES_H_INCLUDED_
+#define _VDJ_SERIES_H_INCLUDED_
+
+#include <stdatomic.h>
+
+#include "cdj.h"
+#include "vdj.h"
+#include "vdj_phase.h"
+
+/**
+ * Decoded time series, every beat, status and master change of every link member, us included, appended to
+ * a file that is read with mmap, so a whole night can be queried without decoding packets again.
+ *
+ * The file is a header page followed by fixed size chunks of VDJ_SERIES_CHUNK_ROWS rows.  Each chunk stores
+ * its rows column by column, a query for one player's tempo reads the player, kind and bpm columns and never
+ * touches the rest, and each chunk keeps the first and last time in it so chunks outside a time range are
+ * skipped without reading any rows.  Rows are only ever appended, a chunk's row count is stored after the
+ * row, so a file can be read while it is written, and a file left by a crash is good up to the last row.
+ *
+ * Times are CLOCK_REALTIME nanos so files from different runs line up.
+ *
+ *    vdj_series_open("night.vdjts");        // in the process on the link, see vdj -w
+ *
+ *    vdj_series_t* s = vdj_series_map("night.vdjts");
+ *    vdj_series_tempo(s, 2, from, to, 10 * CDJ_NANOS_PER_SEC, tempo_cb, NULL);
+ */
+
+#define VDJ_SERIES_MAGIC        0x53544a56  // "VJTS"
+#define VDJ_SERIES_VERSION      1
+#define VDJ_SERIES_CHUNK_ROWS   4096        // a chunk is 21 pages, a couple of minutes of a four deck night
+
+typedef enum {
+    VDJ_SERIES_BEAT = 1,       // ts is when the beat was sent, bar is 1 - 4
+    VDJ_SERIES_STATUS,         // flags are CDJ_STAT_FLAG_*
+    VDJ_SERIES_MASTER          // player is the new tempo master, 0 if none
+} vdj_series_kind;
+
+typedef struct {
+    uint32_t            magic;
+    uint32_t            version;
+    uint32_t            chunk_rows;
+    uint32_t            chunk_size;
+    _Atomic uint32_t    chunks;         // chunks in the file, the last one may be part filled
+    int32_t             pid;            // last process to write
+    int64_t             created;
+    uint8_t             pad[4064];
+} vdj_series_header_t;
+
+typedef struct {
+    _Atomic uint32_t    rows;
+    uint32_t            pad0;
+    int64_t             first;          // min and max ts in the chunk
+    int64_t             last;
+    uint8_t             pad1[40];
+    int64_t             ts[VDJ_SERIES_CHUNK_ROWS];
+    float               bpm[VDJ_SERIES_CHUNK_ROWS];
+    uint32_t            pitch[VDJ_SERIES_CHUNK_ROWS];
+    uint8_t             player[VDJ_SERIES_CHUNK_ROWS];
+    uint8_t             kind[VDJ_SERIES_CHUNK_ROWS];
+    uint8_t             bar[VDJ_SERIES_CHUNK_ROWS];
+    uint8_t             flags[VDJ_SERIES_CHUNK_ROWS];
+    uint8_t             pad2[4032];     // chunks start on a page
+} vdj_series_chunk_t;
+
+typedef struct {
+    vdj_series_header_t* hdr;
+    size_t              size;
+    uint32_t            chunks;         // at the time it was mapped
+} vdj_series_t;
+
+// recording, process wide, appends to an existing file
+int vdj_series_open(const char* path);
+void vdj_series_close();
+// hooks, no-ops unless open, beat is cdj_now() time
+void vdj_series_beat(uint8_t player_id, cdj_nanos_t beat, float bpm, uint32_t pitch, uint8_t bar_pos, uint8_t flags);
+void vdj_series_status(uint8_t player_id, float bpm, uint32_t pitch, uint8_t flags);
+void vdj_series_master(uint8_t player_id);
+
+// reading
+vdj_series_t* vdj_series_map(const char* path);
+void vdj_series_unmap(vdj_series_t* s);
+vdj_series_chunk_t* vdj_series_chunk(vdj_series_t* s, uint32_t i);
+// first and last ts in the file, CDJ_ERROR if it has no rows
+int vdj_series_span(vdj_series_t* s, int64_t* first, int64_t* last);
+
+// queries over from - to inclusive, results arrive in time order
+
+// mean, min and max bpm of a player's beats and status in each step of the range
+typedef void (*vdj_series_tempo_cb)(int64_t ts, float mean, float min, float max, uint32_t rows, void* arg);
+void vdj_series_tempo(vdj_series_t* s, uint8_t player_id, int64_t from, int64_t to, int64_t step,
+    vdj_series_tempo_cb cb, void* arg);
+
+// each change of tempo master
+typedef void (*vdj_series_master_cb)(int64_t ts, uint8_t player_id, void* arg);
+void vdj_series_masters(vdj_series_t* s, int64_t from, int64_t to, vdj_series_master_cb cb, void* arg);
+
+// phase of a against b at each of b's beats, see vdj_phase_offset()
+typedef void (*vdj_series_phase_cb)(int64_t ts, vdj_phase_t* phase, void* arg);
+void vdj_series_phase(vdj_series_t* s, uint8_t a, uint8_t b, int64_t from, int64_t to,
+    vdj_series_phase_cb cb, void* arg);
+
+#endif // _VDJ_SERIES_H_INCLUDED_
@@ -0,0 +1,239 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cdj.h"
+#include "vdj.h"
+#include "vdj_phase.h"
+#include "vdj_series.h"
+
+/**
+ * Queries a time series written by vdj -w, tempo curves, master history and phase error between two decks,
+ * over the whole file or part of a night.
+ *
+ * @author teknopaul
+ */
+
+typedef struct {
+    int64_t             step;
+    int64_t             bucket;
+    uint32_t            beats;
+    double              sum;        // of absolute errors
+    int64_t             max;
+} phase_stats_t;
+
+static void
+usage()
+{
+    printf("Query a time series file written by vdj -w\n");
+    printf("options:\n");
+    printf("    -f - time series file\n");
+    printf("    -s - start, seconds from the first row or a local time HH:MM[:SS]\n");
+    printf("    -e - end, as -s\n");
+    printf("    -t - tempo curve of this player\n");
+    printf("    -m - master history\n");
+    printf("    -a - phase error of this player ...\n");
+    printf("    -b - ... against this player\n");
+    printf("    -i - seconds per line of the tempo curve and phase error, default 60, 0 for every beat\n");
+    printf("    -h - display this text\n");
+    printf("with no query prints what the file holds\n");
+    exit(0);
+}
+
+static char*
+format_ts(int64_t ts, char* buf, size_t len)
+{
+    struct tm tm;
+    time_t secs = ts / CDJ_NANOS_PER_SEC;
+    localtime_r(&secs, &tm);
+    strftime(buf, len, "%Y-%m-%d %H:%M:%S", &tm);
+    return buf;
+}
+
+/**
+ * HH:MM[:SS] is that time on the night the file starts, after midnight if it is earlier than the first row
+ */
+static int64_t
+parse_time(char* arg, int64_t first)
+{
+    struct tm tm;
+    time_t secs = first / CDJ_NANOS_PER_SEC;
+    int h = 0, m = 0, s = 0;
+    int64_t t;
+
+    if ( ! strchr(arg, ':') ) return first + (int64_t) (strtod(arg, NULL) * CDJ_NANOS_PER_SEC);
+
+    sscanf(arg, "%d:%d:%d", &h, &m, &s);
+    localtime_r(&secs, &tm);
+    tm.tm_hour = h;
+    tm.tm_min = m;
+    tm.tm_sec = s;
+    tm.tm_isdst = -1;
+    t = (int64_t) mktime(&tm) * CDJ_NANOS_PER_SEC;
+    if (t < first - CDJ_NANOS_PER_SEC) t += 24LL * 3600 * CDJ_NANOS_PER_SEC;
+    return t;
+}
+
+static void
+tempo_cb(int64_t ts, float mean, float min, float max, uint32_t rows, void* arg)
+{
+    char when[32];
+    printf("%s %7.2f bpm  min %7.2f  max %7.2f  %u rows\n", format_ts(ts, when, sizeof(when)), mean, min, max, rows);
+}
+
+static void
+master_cb(int64_t ts, uint8_t player_id, void* arg)
+{
+    char when[32];
+    printf("%s.%03lld master %02i\n", format_ts(ts, when, sizeof(when)), (long long) (ts % CDJ_NANOS_PER_SEC) / CDJ_NANOS_PER_MILLI, player_id);
+}
+
+static void
+phase_print(phase_stats_t* p)
+{
+    char when[32];
+    if (p->beats) {
+        printf("%s %4u beats  mean %7.3f ms  max %7.3f ms\n", format_ts(p->bucket, when, sizeof(when)), p->beats,
+            p->sum / p->beats / CDJ_NANOS_PER_MILLI, (double) p->max / CDJ_NANOS_PER_MILLI);
+    }
+}
+
+static void
+phase_cb(int64_t ts, vdj_phase_t* phase, void* arg)
+{
+    phase_stats_t* p = arg;
+    int64_t err = phase->nanos < 0 ? -phase->nanos : phase->nanos;
+    char when[32];
+
+    if (p->step == 0) {
+        printf("%s.%03lld %+8.3f ms  beat %+6.3f  bar %+6.3f\n", format_ts(ts, when, sizeof(when)),
+            (long long) (ts % CDJ_NANOS_PER_SEC) / CDJ_NANOS_PER_MILLI,
+            (double) phase->nanos / CDJ_NANOS_PER_MILLI, phase->beat, phase->bar);
+        return;
+    }
+    if (p->beats == 0 || ts >= p->bucket + p->step) {
+        phase_print(p);
+        p->bucket = p->beats == 0 ? ts : p->bucket + (ts - p->bucket) / p->step * p->step;
+        p->beats = 0;
+        p->sum = 0.0;
+        p->max = 0;
+    }
+    p->beats++;
+    p->sum += err;
+    if (err > p->max) p->max = err;
+}
+
+static void
+summary(vdj_series_t* s, int64_t from, int64_t to)
+{
+    vdj_series_chunk_t* c;
+    uint64_t rows[VDJ_MAX_BACKLINE + 1][VDJ_SERIES_MASTER + 1];
+    uint64_t total = 0;
+    uint32_t i, r, n;
+    char first_s[32], last_s[32];
+    int p;
+
+    memset(rows, 0, sizeof(rows));
+    for (i = 0; i < s->chunks; i++) {
+        c = vdj_series_chunk(s, i);
+        n = atomic_load(&c->rows);
+        if (n > VDJ_SERIES_CHUNK_ROWS) continue;
+        for (r = 0; r < n; r++) {
+            if (c->player[r] <= VDJ_MAX_BACKLINE && c->kind[r] <= VDJ_SERIES_MASTER) rows[c->player[r]][c->kind[r]]++;
+        }
+        total += n;
+    }
+
+    printf("%s - %s, %.0f minutes, %llu rows in %u chunks, last written by pid %d\n",
+        format_ts(from, first_s, sizeof(first_s)), format_ts(to, last_s, sizeof(last_s)),
+        (double) (to - from) / CDJ_NANOS_PER_SEC / 60, (unsigned long long) total, s->chunks, s->hdr->pid);
+    for (p = 0; p <= VDJ_MAX_BACKLINE; p++) {
+        if (rows[p][VDJ_SERIES_BEAT] || rows[p][VDJ_SERIES_STATUS] || rows[p][VDJ_SERIES_MASTER]) {
+            printf("player %02i %8llu beats %8llu status %4llu times master\n", p,
+                (unsigned long long) rows[p][VDJ_SERIES_BEAT], (unsigned long long) rows[p][VDJ_SERIES_STATUS],
+                (unsigned long long) rows[p][VDJ_SERIES_MASTER]);
+        }
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    char* path = NULL;
+    char* start = NULL;
+    char* end = NULL;
+    int tempo = -1;
+    int masters = 0;
+    int a = -1, b = -1;
+    double step = 60.0;
+    int64_t first, last, from, to;
+    phase_stats_t phase;
+    vdj_series_t* s;
+
+    int c;
+    while ( ( c = getopt(argc, argv, "f:s:e:t:ma:b:i:h") ) != EOF) {
+        switch (c) {
+            case 'h':
+                usage();
+                break;
+            case 'f':
+                path = optarg;
+                break;
+            case 's':
+                start = optarg;
+                break;
+            case 'e':
+                end = optarg;
+                break;
+            case 't':
+                tempo = atoi(optarg);
+                break;
+            case 'm':
+                masters = 1;
+                break;
+            case 'a':
+                a = atoi(optarg);
+                break;
+            case 'b':
+                b = atoi(optarg);
+                break;
+            case 'i':
+                step = strtod(optarg, NULL);
+                break;
+        }
+    }
+
+    if ( ! path ) {
+        fprintf(stderr, "error: -f is required\n");
+        return 1;
+    }
+    if ( ! (s = vdj_series_map(path)) ) {
+        fprintf(stderr, "error: '%s' is not a time series\n", path);
+        return 1;
+    }
+    if ( vdj_series_span(s, &first, &last) ) {
+        fprintf(stderr, "error: '%s' has no rows yet\n", path);
+        vdj_series_unmap(s);
+        return 1;
+    }
+    from = start ? parse_time(start, first) : first;
+    to = end ? parse_time(end, first) : last;
+
+    if (tempo >= 0) {
+        // a 1ns step is a line per row
+        vdj_series_tempo(s, tempo, from, to, step > 0.0 ? (int64_t) (step * CDJ_NANOS_PER_SEC) : 1, tempo_cb, NULL);
+    } else if (masters) {
+        vdj_series_masters(s, from, to, master_cb, NULL);
+    } else if (a >= 0 && b >= 0) {
+        memset(&phase, 0, sizeof(phase));
+        phase.step = (int64_t) (step * CDJ_NANOS_PER_SEC);
+        vdj_series_phase(s, a, b, from, to, phase_cb, &phase);
+        phase_print(&phase);
+    } else {
+        summary(s, from, to);
+    }
+
+    vdj_series_unmap(s);
+    return 0;
+}
@@ -0,0 +1,289 @@
+/**
+ * Backline state in shared memory, see vdj_shm.h
+ *
+ * @author teknopaul
+ */
+
+#define _GNU_SOURCE
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <netinet/in.h>
+
+#include "cdj.h"
+#include "vdj.h"
+#include "vdj_thread.h"
+#include "vdj_phase.h"
+#include "vdj_shm.h"
+
+static unsigned _Atomic vdj_shm_running = ATOMIC_VAR_INIT(0);
+
+typedef struct {
+    vdj_t*      v;
+    vdj_shm_t*  shm;
+    char*       name;
+} vdj_shm_publisher_t;
+
+static void
+vdj_shm_copy_grid(vdj_shm_player_t* p, vdj_phase_grid_t* live)
+{
+    vdj_phase_grid_t g;
+
+    vdj_phase_snapshot(live, &g);
+    p->grid_anchor = g.anchor;
+    p->grid_period = g.period;
+    p->grid_beats = g.beats;
+    p->grid_bar_pos = g.bar_pos;
+}
+
+static void
+vdj_shm_copy_member(vdj_shm_player_t* p, vdj_link_member_t* m)
+{
+    p->last_beat = m->last_beat;
+    p->last_keepalive = m->last_keepalive;
+    p->srtt = m->rtt_samples ? m->srtt : 0;
+    p->bpm = m->bpm;
+    p->pitch = m->pitch;
+    p->ip = m->ip_addr ? m->ip_addr->sin_addr.s_addr : 0;
+    p->player_id = m->player_id;
+    p->bar_pos = m->bar_pos;
+    p->active = m->active;
+    p->master_state = m->master_state;
+    p->play_state = m->play_state;
+    p->gone = m->gone;
+    vdj_shm_copy_grid(p, &m->grid);
+}
+
+/**
+ * Snapshot the vdj_t into stage, outside the seqlock so readers retry as little as possible
+ */
+static void
+vdj_shm_stage(vdj_t* v, vdj_shm_t* stage)
+{
+    vdj_shm_player_t* self = &stage->self;
+    vdj_link_member_t* m;
+    int i;
+
+    memset(&stage->sync_counter, 0, sizeof(vdj_shm_t) - offsetof(vdj_shm_t, sync_counter));
+
+    self->last_beat = v->last_beat;
+    self->bpm = v->bpm;
+    self->pitch = v->pitch;
+    self->player_id = v->player_id;
+    self->bar_pos = v->bar_index + 1;
+    self->active = v->active;
+    self->master_state = v->master_state;
+    vdj_shm_copy_grid(self, &v->grid);
+
+    if (v->backline) {
+        stage->sync_counter = v->backline->sync_counter;
+        stage->master_bpm = v->backline->master_bpm;
+        stage->master_id = v->backline->master_id;
+        for (i = 1; i <= VDJ_MAX_BACKLINE; i++) {
+            if ( (m = vdj_get_link_member(v, i)) == NULL ) continue;
+            vdj_shm_copy_member(&stage->players[i], m);
+            if ( ! m->gone ) stage->members++;
+        }
+    }
+    // backline master_bpm is only kept while we are master
+    if (v->master) {
+        stage->master_id = v->player_id;
+        stage->master_bpm = v->bpm;
+    } else if (stage->master_id <= VDJ_MAX_BACKLINE && stage->players[stage->master_id].player_id) {
+        stage->master_bpm = stage->players[stage->master_id].bpm;
+    }
+}
+
+static void
+vdj_shm_publish(vdj_shm_t* shm, vdj_shm_t* stage)
+{
+    uint32_t seq = atomic_load_explicit(&shm->seq, memory_order_relaxed);
+
+    atomic_store_explicit(&shm->seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    shm->published = cdj_now();
+    memcpy(&shm->sync_counter, &stage->sync_counter, sizeof(vdj_shm_t) - offsetof(vdj_shm_t, sync_counter));
+
+    atomic_store_explicit(&shm->seq, seq + 2, memory_order_release);
+}
+
+static void*
+vdj_shm_loop(void* arg)
+{
+    vdj_shm_publisher_t* pub = arg;
+    vdj_shm_t* stage;
+    struct timespec wake;
+    cdj_nanos_t next = cdj_now();
+
+    if ( (stage = calloc(1, sizeof(vdj_shm_t))) ) {
+        while (vdj_shm_running) {
+            vdj_shm_stage(pub->v, stage);
+            vdj_shm_publish(pub->shm, stage);
+
+            next += VDJ_SHM_PERIOD_NANOS;
+            if (next < cdj_now()) next = cdj_now() + VDJ_SHM_PERIOD_NANOS;
+            wake = cdj_nanos_to_timespec(next);
+            while ( clock_nanosleep(cdj_clock_id(), TIMER_ABSTIME, &wake, NULL) == EINTR );
+        }
+        free(stage);
+    }
+
+    // readers still mapping it see the publisher has gone, new readers do not find it
+    pub->shm->pid = 0;
+    munmap(pub->shm, sizeof(vdj_shm_t));
+    shm_unlink(pub->name);
+    free(pub->name);
+    free(pub);
+    return NULL;
+}
+
+int
+vdj_init_shm_thread(vdj_t* v, const char* name)
+{
+    vdj_shm_publisher_t* pub;
+    vdj_shm_t* shm;
+    int fd;
+
+    if (vdj_shm_running) return CDJ_ERROR;
+
+    if ( (fd = shm_open(name, O_CREAT | O_RDWR, 0644)) < 0 ) {
+        fprintf(stderr, "error: shm_open '%s' '%s'\n", name, strerror(errno));
+        return CDJ_ERROR;
+    }
+    if ( ftruncate(fd, sizeof(vdj_shm_t)) ) {
+        fprintf(stderr, "error: ftruncate '%s' '%s'\n", name, strerror(errno));
+        close(fd);
+        shm_unlink(name);
+        return CDJ_ERROR;
+    }
+    shm = mmap(NULL, sizeof(vdj_shm_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (shm == MAP_FAILED) {
+        fprintf(stderr, "error: mmap '%s' '%s'\n", name, strerror(errno));
+        shm_unlink(name);
+        return CDJ_ERROR;
+    }
+
+    // a segment left by a publisher that died is reused, seq carries on so its readers stay consistent
+    if (atomic_load(&shm->seq) & 1) atomic_fetch_add(&shm->seq, 1);
+    shm->magic = VDJ_SHM_MAGIC;
+    shm->version = VDJ_SHM_VERSION;
+    shm->size = sizeof(vdj_shm_t);
+    shm->clock = cdj_clock_id();
+    shm->pid = getpid();
+
+    if ( (pub = calloc(1, sizeof(vdj_shm_publisher_t))) == NULL || (pub->name = strdup(name)) == NULL ) {
+        free(pub);
+        munmap(shm, sizeof(vdj_shm_t));
+        shm_unlink(name);
+        return CDJ_ERROR;
+    }
+    pub->v = v;
+    pub->shm = shm;
+
+    vdj_shm_running = 1;
+    if ( vdj_thread_create(v, VDJ_THREAD_SHM, vdj_shm_loop, pub) ) {
+        vdj_shm_running = 0;
+        free(pub->name);
+        free(pub);
+        munmap(shm, sizeof(vdj_shm_t));
+        shm_unlink(name);
+        return CDJ_ERROR;
+    }
+    return CDJ_OK;
+}
+
+void
+vdj_stop_shm_thread(vdj_t* v)
+{
+    vdj_shm_running = 0;
+}
+
+// readers
+
+vdj_shm_t*
+vdj_shm_open(const char* name)
+{
+    vdj_shm_t* shm;
+    struct stat st;
+    int fd;
+
+    if ( (fd = shm_open(name, O_RDONLY, 0)) < 0 ) return NULL;
+    if ( fstat(fd, &st) || st.st_size < sizeof(vdj_shm_t) ) {
+        close(fd);
+        return NULL;
+    }
+    shm = mmap(NULL, sizeof(vdj_shm_t), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (shm == MAP_FAILED) return NULL;
+
+    if (shm->magic != VDJ_SHM_MAGIC || shm->version != VDJ_SHM_VERSION || shm->size != sizeof(vdj_shm_t)) {
+        munmap(shm, sizeof(vdj_shm_t));
+        return NULL;
+    }
+    return shm;
+}
+
+void
+vdj_shm_close(vdj_shm_t* shm)
+{
+    if (shm) munmap(shm, sizeof(vdj_shm_t));
+}
+
+/**
+ * Copy length bytes at offset in the segment to dest, all from one publish
+ */
+static int
+vdj_shm_copy(vdj_shm_t* shm, void* dest, size_t offset, size_t length)
+{
+    uint32_t seq;
+    int i;
+
+    for (i = 0; i < VDJ_SHM_RETRIES; i++) {
+        seq = atomic_load_explicit(&shm->seq, memory_order_acquire);
+        if (seq & 1) {
+            sched_yield();
+            continue;
+        }
+        memcpy(dest, (uint8_t*) shm + offset, length);
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&shm->seq, memory_order_relaxed) == seq) {
+            return shm->pid ? CDJ_OK : CDJ_ERROR;
+        }
+    }
+    return CDJ_ERROR;
+}
+
+int
+vdj_shm_read(vdj_shm_t* shm, vdj_shm_t* snapshot)
+{
+    return vdj_shm_copy(shm, snapshot, 0, sizeof(vdj_shm_t));
+}
+
+int
+vdj_shm_read_player(vdj_shm_t* shm, uint8_t player_id, vdj_shm_player_t* player)
+{
+    if (player_id > VDJ_MAX_BACKLINE) return CDJ_ERROR;
+    if ( vdj_shm_copy(shm, player, offsetof(vdj_shm_t, players[player_id]), sizeof(vdj_shm_player_t)) ) {
+        return CDJ_ERROR;
+    }
+    return player->player_id ? CDJ_OK : CDJ_ERROR;
+}
+
+cdj_nanos_t
+vdj_shm_now(vdj_shm_t* shm)
+{
+    struct timespec ts;
+    clock_gettime(shm->clock, &ts);
+    return cdj_timespec_to_nanos(&ts);
+}
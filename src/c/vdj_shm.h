@@ -0,0 +1,87 @@
+#ifndef _VDJ_SHM_H_INCLUDED_
+#define _VDJ_SHM_H_INCLUDED_
+
+#include <stdatomic.h>
+#include <time.h>
+
+#include "cdj.h"
+#include "vdj.h"
+
+/**
+ * Backline state published in POSIX shared memory, so local processes (adj, a lighting controller) can read
+ * tempo, phase, master and members without joining the link themselves.
+ *
+ * One publisher thread copies the vdj_t into the segment every VDJ_SHM_PERIOD_NANOS.  The segment is versioned
+ * with a seqlock, seq is odd while the publisher writes, readers copy what they need and retry if seq moved, so
+ * any number of readers never block the publisher or each other.  Beat times are in the publisher's cdj_now()
+ * clock, which is a monotonic clock shared by every process on the host, vdj_shm_now() reads it.
+ *
+ *    vdj_init_shm_thread(v, VDJ_SHM_NAME);
+ *
+ *    vdj_shm_t* shm = vdj_shm_open(VDJ_SHM_NAME);
+ *    vdj_shm_t snap;
+ *    if (vdj_shm_read(shm, &snap) == CDJ_OK) ... snap.master_bpm ...
+ */
+
+#define VDJ_SHM_NAME            "/vdj"
+#define VDJ_SHM_MAGIC           0x534a4456  // "VDJS"
+#define VDJ_SHM_VERSION         1
+#define VDJ_SHM_PERIOD_NANOS    2000000     // publish every 2ms
+#define VDJ_SHM_RETRIES         1000        // reads that overlap a publish before giving up
+
+// one player, us or a link member
+typedef struct {
+    int64_t         last_beat;      // cdj_now() time of the last beat, 0 if none
+    int64_t         last_keepalive;
+    int64_t         grid_anchor;    // smoothed beat grid, see vdj_phase.h
+    int64_t         grid_period;    // nanos per beat, 0 if no grid yet
+    int64_t         srtt;           // smoothed round trip, 0 if not measured
+    float           bpm;
+    int32_t         pitch;
+    uint32_t        ip;             // network byte order, 0 for us
+    uint32_t        grid_beats;
+    uint8_t         player_id;      // 0 if the slot is empty
+    uint8_t         bar_pos;        // 1 - 4
+    uint8_t         grid_bar_pos;
+    uint8_t         active;
+    uint8_t         master_state;
+    uint8_t         play_state;
+    uint8_t         gone;
+    uint8_t         pad;
+} vdj_shm_player_t;
+
+typedef struct {
+    uint32_t        magic;
+    uint32_t        version;
+    uint32_t        size;           // sizeof(vdj_shm_t) of the publisher
+    int32_t         pid;            // publisher, 0 once it has stopped
+    _Atomic uint32_t seq;           // odd while publishing
+    int32_t         clock;          // clockid_t of the timestamps
+    int64_t         published;      // cdj_now() of the last publish
+    uint32_t        sync_counter;
+    float           master_bpm;
+    uint8_t         master_id;      // 0 if no master, may be self.player_id
+    uint8_t         members;        // link members excluding us
+    uint8_t         pad[6];
+    vdj_shm_player_t self;
+    vdj_shm_player_t players[VDJ_MAX_BACKLINE + 1];  // indexed by player_id, excludes us
+} vdj_shm_t;
+
+// publisher
+
+int vdj_init_shm_thread(vdj_t* v, const char* name);
+void vdj_stop_shm_thread(vdj_t* v);
+
+// readers, do not need a vdj_t
+
+// map a published segment read only, NULL if there is none or its layout differs
+vdj_shm_t* vdj_shm_open(const char* name);
+void vdj_shm_close(vdj_shm_t* shm);
+// consistent copy of the whole segment, CDJ_ERROR if the publisher stopped or never let go
+int vdj_shm_read(vdj_shm_t* shm, vdj_shm_t* snapshot);
+// consistent copy of one player, CDJ_ERROR as above or if the slot is empty
+int vdj_shm_read_player(vdj_shm_t* shm, uint8_t player_id, vdj_shm_player_t* player);
+// now in the publisher's clock, to compare with beat times
+cdj_nanos_t vdj_shm_now(vdj_shm_t* shm);
+
+#endif // _VDJ_SHM_H_INCLUDED_
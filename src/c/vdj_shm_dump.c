@@ -0,0 +1,110 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+
+#include "cdj.h"
+#include "vdj.h"
+#include "vdj_phase.h"
+#include "vdj_shm.h"
+
+/**
+ * Prints the backline a vdj publishes in shared memory, without touching the network.
+ *
+ * @author teknopaul
+ */
+
+static void
+usage()
+{
+    printf("Print the backline state published by vdj -P\n");
+    printf("options:\n");
+    printf("    -n - shared memory name, default %s\n", VDJ_SHM_NAME);
+    printf("    -f - keep printing, every this many millis\n");
+    printf("    -h - display this text\n");
+    exit(0);
+}
+
+static void
+print_player(vdj_shm_player_t* p, uint8_t master_id, cdj_nanos_t now)
+{
+    char ip_s[INET_ADDRSTRLEN] = "self";
+    vdj_phase_grid_t g = { p->grid_anchor, p->grid_period, p->bpm, p->grid_bar_pos, p->grid_beats };
+
+    if (p->ip) inet_ntop(AF_INET, &p->ip, ip_s, INET_ADDRSTRLEN);
+    printf("%02i %-15s %c %7.2f bar %i", p->player_id, ip_s, p->player_id == master_id ? 'M' : ' ', p->bpm, p->bar_pos);
+    if (p->last_beat) printf("  beat %6.3fs ago", (now - p->last_beat) / 1e9);
+    else printf("  %17s", "");
+    if (p->grid_beats) printf("  pos %5.3f", vdj_phase_position(&g, now));
+    if (p->srtt) printf("  rtt %.3fms", (double) p->srtt / CDJ_NANOS_PER_MILLI);
+    if (p->gone) printf("  gone");
+    printf("\n");
+}
+
+static int
+dump(vdj_shm_t* shm)
+{
+    vdj_shm_t snap;
+    cdj_nanos_t now;
+    int i;
+
+    if ( vdj_shm_read(shm, &snap) ) {
+        fprintf(stderr, "error: publisher has stopped\n");
+        return CDJ_ERROR;
+    }
+    // a publisher that was killed leaves the segment behind
+    if ( kill(snap.pid, 0) && errno == ESRCH ) {
+        fprintf(stderr, "error: publisher pid %i has died\n", snap.pid);
+        return CDJ_ERROR;
+    }
+    now = vdj_shm_now(shm);
+
+    printf("pid %i published %.3fms ago, seq %u, master %02i %.2f bpm, %i members\n",
+        snap.pid, (double) (now - snap.published) / CDJ_NANOS_PER_MILLI, snap.seq,
+        snap.master_id, snap.master_bpm, snap.members);
+    print_player(&snap.self, snap.master_id, now);
+    for (i = 1; i <= VDJ_MAX_BACKLINE; i++) {
+        if (snap.players[i].player_id) print_player(&snap.players[i], snap.master_id, now);
+    }
+    return CDJ_OK;
+}
+
+int main(int argc, char *argv[])
+{
+    char* name = VDJ_SHM_NAME;
+    int follow = 0;
+    int rc;
+    vdj_shm_t* shm;
+
+    int c;
+    while ( ( c = getopt(argc, argv, "n:f:h") ) != EOF) {
+        switch (c) {
+            case 'h':
+                usage();
+                break;
+            case 'n':
+                name = optarg;
+                break;
+            case 'f':
+                follow = atoi(optarg);
+                break;
+        }
+    }
+
+    if ( (shm = vdj_shm_open(name)) == NULL ) {
+        fprintf(stderr, "error: nothing published at '%s'\n", name);
+        return 1;
+    }
+
+    while ( (rc = dump(shm)) == CDJ_OK && follow > 0 ) {
+        printf("\n");
+        fflush(stdout);
+        usleep(follow * 1000);
+    }
+
+    vdj_shm_close(shm);
+    return rc;
+}
@@ -0,0 +1,307 @@
+/**
+ * Passive ProLink sniffer.
+ *
+ * cdj-mon with vdj_open_broadcast_sockets() can only see broadcast traffic, status packets are unicast
+ * to port 50002 of each link member.  On a mirrored switch port all the traffic arrives at our NIC, this code
+ * reads it from a TPACKET_V3 memory mapped ring so there is no syscall per packet, the kernel fills whole blocks
+ * and we only poll() when we have read everything.
+ *
+ * A classic BPF filter runs in the kernel so only IPv4 UDP datagrams to 50000, 50001 and 50002 are copied into the ring.
+ *
+ * @author teknopaul
+ */
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <net/ethernet.h>
+#include <netinet/in.h>
+#include <linux/if_packet.h>
+#include <linux/filter.h>
+
+#include "cdj.h"
+#include "vdj.h"
+#include "vdj_sniff.h"
+
+#define VDJ_SNIFF_ETH_HDR_LEN   14
+#define VDJ_SNIFF_UDP_HDR_LEN   8
+
+typedef struct {
+    vdj_sniff_t*  s;
+    vdj_sniff_ph  sniff_ph;
+} vdj_sniff_thread_info;
+
+/**
+ * tcpdump -dd 'ip and udp and not ip[6:2] & 0x1fff != 0 and dst portrange 50000-50002'
+ * more or less, offsets are from the start of the ethernet frame.
+ */
+static struct sock_filter vdj_sniff_bpf[] = {
+    BPF_STMT(BPF_LD  | BPF_H | BPF_ABS, 12),                    // ethertype
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ETHERTYPE_IP, 0, 9),
+    BPF_STMT(BPF_LD  | BPF_B | BPF_ABS, 23),                    // ip protocol
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, IPPROTO_UDP, 0, 7),
+    BPF_STMT(BPF_LD  | BPF_H | BPF_ABS, 20),                    // fragment offset
+    BPF_JUMP(BPF_JMP | BPF_JSET | BPF_K, 0x1fff, 5, 0),
+    BPF_STMT(BPF_LDX | BPF_B | BPF_MSH, 14),                    // x = ip header length
+    BPF_STMT(BPF_LD  | BPF_H | BPF_IND, 16),                    // udp dst port
+    BPF_JUMP(BPF_JMP | BPF_JGE | BPF_K, CDJ_DISCOVERY_PORT, 0, 2),
+    BPF_JUMP(BPF_JMP | BPF_JGT | BPF_K, CDJ_UPDATE_PORT, 1, 0),
+    BPF_STMT(BPF_RET | BPF_K, 0xffff),                          // accept
+    BPF_STMT(BPF_RET | BPF_K, 0),                               // drop
+};
+
+static int
+vdj_sniff_attach_filter(int socket_fd)
+{
+    struct sock_fprog prog;
+    prog.len = sizeof(vdj_sniff_bpf) / sizeof(vdj_sniff_bpf[0]);
+    prog.filter = vdj_sniff_bpf;
+
+    if ( setsockopt(socket_fd, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog)) ) {
+        fprintf(stderr, "error: sniff attach filter '%s'\n", strerror(errno));
+        return CDJ_ERROR;
+    }
+    return CDJ_OK;
+}
+
+static int
+vdj_sniff_setup_ring(vdj_sniff_t* s)
+{
+    int version = TPACKET_V3;
+    struct tpacket_req3 req;
+
+    if ( setsockopt(s->socket_fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) ) {
+        fprintf(stderr, "error: sniff TPACKET_V3 '%s'\n", strerror(errno));
+        return CDJ_ERROR;
+    }
+
+    memset(&req, 0, sizeof(req));
+    req.tp_block_size = VDJ_SNIFF_BLOCK_SIZE;
+    req.tp_block_nr = VDJ_SNIFF_BLOCK_COUNT;
+    req.tp_frame_size = VDJ_SNIFF_FRAME_SIZE;
+    req.tp_frame_nr = (VDJ_SNIFF_BLOCK_SIZE * VDJ_SNIFF_BLOCK_COUNT) / VDJ_SNIFF_FRAME_SIZE;
+    req.tp_retire_blk_tov = VDJ_SNIFF_BLOCK_TIMEOUT;
+
+    if ( setsockopt(s->socket_fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) ) {
+        fprintf(stderr, "error: sniff PACKET_RX_RING '%s'\n", strerror(errno));
+        return CDJ_ERROR;
+    }
+
+    s->block_size = req.tp_block_size;
+    s->block_count = req.tp_block_nr;
+    s->ring_len = (size_t) s->block_size * s->block_count;
+    s->ring = mmap(NULL, s->ring_len, PROT_READ | PROT_WRITE, MAP_SHARED, s->socket_fd, 0);
+    if (s->ring == MAP_FAILED) {
+        fprintf(stderr, "error: sniff mmap '%s'\n", strerror(errno));
+        s->ring = NULL;
+        return CDJ_ERROR;
+    }
+
+    return CDJ_OK;
+}
+
+/**
+ * Open a capture socket on iface, we see packets sent to any host, not just us.
+ *
+ * @return mallocd space or NULL;
+ */
+vdj_sniff_t*
+vdj_sniff_open(const char* iface)
+{
+    struct sockaddr_ll ll;
+    struct packet_mreq mr;
+
+    vdj_sniff_t* s = (vdj_sniff_t*) calloc(1, sizeof(vdj_sniff_t));
+    if (s == NULL) return NULL;
+    s->socket_fd = -1;
+
+    s->ifindex = if_nametoindex(iface);
+    if (s->ifindex == 0) {
+        fprintf(stderr, "error: sniff unknown interface '%s'\n", iface);
+        free(s);
+        return NULL;
+    }
+
+    // protocol 0, nothing is queued until bind() by which time the filter is in place
+    s->socket_fd = socket(AF_PACKET, SOCK_RAW, 0);
+    if (s->socket_fd == -1) {
+        fprintf(stderr, "error: sniff socket '%s' (needs CAP_NET_RAW)\n", strerror(errno));
+        free(s);
+        return NULL;
+    }
+
+    if ( vdj_sniff_attach_filter(s->socket_fd) || vdj_sniff_setup_ring(s) ) {
+        vdj_sniff_close(s);
+        return NULL;
+    }
+
+    memset(&ll, 0, sizeof(ll));
+    ll.sll_family = AF_PACKET;
+    ll.sll_protocol = htons(ETH_P_IP);
+    ll.sll_ifindex = s->ifindex;
+    if ( bind(s->socket_fd, (struct sockaddr*) &ll, sizeof(ll)) ) {
+        fprintf(stderr, "error: sniff bind %s '%s'\n", iface, strerror(errno));
+        vdj_sniff_close(s);
+        return NULL;
+    }
+
+    // on a mirrored port the traffic is not addressed to us, removed automatically on close()
+    memset(&mr, 0, sizeof(mr));
+    mr.mr_ifindex = s->ifindex;
+    mr.mr_type = PACKET_MR_PROMISC;
+    if ( setsockopt(s->socket_fd, SOL_PACKET, PACKET_ADD_MEMBERSHIP, &mr, sizeof(mr)) ) {
+        fprintf(stderr, "warn: sniff promiscuous mode '%s'\n", strerror(errno));
+    }
+
+    s->running = 1;
+    return s;
+}
+
+void
+vdj_sniff_close(vdj_sniff_t* s)
+{
+    if (s) {
+        if (s->ring) munmap(s->ring, s->ring_len);
+        if (s->socket_fd >= 0) close(s->socket_fd);
+        free(s);
+    }
+}
+
+/**
+ * strip the ethernet, ip and udp headers, the bpf filter has already checked protocols,
+ * but we still bounds check against the captured length.
+ */
+static int
+vdj_sniff_parse(struct tpacket3_hdr* ppd, vdj_sniff_packet_t* pkt)
+{
+    uint8_t* frame = (uint8_t*) ppd + ppd->tp_mac;
+    uint32_t caplen = ppd->tp_snaplen;
+    uint8_t* ip;
+    uint8_t* udp;
+    uint16_t ihl, udp_len;
+    struct timespec ts;
+
+    if (caplen < VDJ_SNIFF_ETH_HDR_LEN + 20 + VDJ_SNIFF_UDP_HDR_LEN) return CDJ_ERROR;
+
+    ip = frame + VDJ_SNIFF_ETH_HDR_LEN;
+    ihl = (ip[0] & 0x0f) * 4;
+    if (caplen < VDJ_SNIFF_ETH_HDR_LEN + ihl + VDJ_SNIFF_UDP_HDR_LEN) return CDJ_ERROR;
+
+    udp = ip + ihl;
+    udp_len = (udp[4] << 8) | udp[5];
+    if (udp_len < VDJ_SNIFF_UDP_HDR_LEN) return CDJ_ERROR;
+
+    pkt->src_ip = (ip[12] << 24) | (ip[13] << 16) | (ip[14] << 8) | ip[15];
+    pkt->dst_ip = (ip[16] << 24) | (ip[17] << 16) | (ip[18] << 8) | ip[19];
+    pkt->src_port = (udp[0] << 8) | udp[1];
+    pkt->dst_port = (udp[2] << 8) | udp[3];
+    pkt->data = udp + VDJ_SNIFF_UDP_HDR_LEN;
+    pkt->len = udp_len - VDJ_SNIFF_UDP_HDR_LEN;
+    if (pkt->len > caplen - (VDJ_SNIFF_ETH_HDR_LEN + ihl + VDJ_SNIFF_UDP_HDR_LEN)) {
+        pkt->len = caplen - (VDJ_SNIFF_ETH_HDR_LEN + ihl + VDJ_SNIFF_UDP_HDR_LEN);
+    }
+    ts.tv_sec = ppd->tp_sec;
+    ts.tv_nsec = ppd->tp_nsec;
+    pkt->timestamp = cdj_realtime_to_nanos(&ts);
+
+    return CDJ_OK;
+}
+
+static void
+vdj_sniff_walk_block(vdj_sniff_t* s, struct tpacket_block_desc* bd, vdj_sniff_ph sniff_ph)
+{
+    uint32_t i;
+    vdj_sniff_packet_t pkt;
+    struct tpacket3_hdr* ppd = (struct tpacket3_hdr*) ((uint8_t*) bd + bd->hdr.bh1.offset_to_first_pkt);
+
+    for (i = 0; i < bd->hdr.bh1.num_pkts; i++) {
+        if ( vdj_sniff_parse(ppd, &pkt) == CDJ_OK && cdj_validate_header(pkt.data, pkt.len) == CDJ_OK ) {
+            s->packets++;
+            if (sniff_ph) sniff_ph(s, &pkt);
+        }
+        ppd = (struct tpacket3_hdr*) ((uint8_t*) ppd + ppd->tp_next_offset);
+    }
+}
+
+int
+vdj_sniff_loop(vdj_sniff_t* s, vdj_sniff_ph sniff_ph)
+{
+    struct tpacket_block_desc* bd;
+    struct pollfd pfd;
+
+    pfd.fd = s->socket_fd;
+    pfd.events = POLLIN | POLLERR;
+    pfd.revents = 0;
+
+    while (s->running) {
+        bd = (struct tpacket_block_desc*) (s->ring + (size_t) s->block_idx * s->block_size);
+
+        if ( (__atomic_load_n(&bd->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER) == 0 ) {
+            // ring is empty, this is the only time we make a syscall
+            if (poll(&pfd, 1, 1000) == -1 && errno != EINTR) {
+                fprintf(stderr, "error: sniff poll '%s'\n", strerror(errno));
+                return CDJ_ERROR;
+            }
+            continue;
+        }
+
+        vdj_sniff_walk_block(s, bd, sniff_ph);
+
+        // hand the block back to the kernel
+        __atomic_store_n(&bd->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+        s->block_idx = (s->block_idx + 1) % s->block_count;
+    }
+
+    return CDJ_OK;
+}
+
+void
+vdj_sniff_stop(vdj_sniff_t* s)
+{
+    s->running = 0;
+}
+
+static void*
+vdj_sniff_thread_loop(void* arg)
+{
+    vdj_sniff_thread_info* tinfo = arg;
+    vdj_sniff_loop(tinfo->s, tinfo->sniff_ph);
+    free(tinfo);
+    return NULL;
+}
+
+int
+vdj_init_sniff_thread(vdj_sniff_t* s, vdj_sniff_ph sniff_ph)
+{
+    if ( ! s->running ) return CDJ_ERROR;
+
+    pthread_t thread_id;
+    vdj_sniff_thread_info* tinfo = (vdj_sniff_thread_info*) calloc(1, sizeof(vdj_sniff_thread_info));
+    if (tinfo == NULL) return CDJ_ERROR;
+    tinfo->s = s;
+    tinfo->sniff_ph = sniff_ph;
+    return pthread_create(&thread_id, NULL, &vdj_sniff_thread_loop, tinfo);
+}
+
+uint32_t
+vdj_sniff_drops(vdj_sniff_t* s)
+{
+    struct tpacket_stats_v3 stats;
+    socklen_t len = sizeof(stats);
+
+    // counters reset each time they are read
+    if ( getsockopt(s->socket_fd, SOL_PACKET, PACKET_STATISTICS, &stats, &len) ) {
+        return 0;
+    }
+    s->drops += stats.tp_drops;
+    return stats.tp_drops;
+}
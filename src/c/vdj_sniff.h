@@ -0,0 +1,65 @@
+#ifndef _VDJ_SNIFF_H_INCLUDED_
+#define _VDJ_SNIFF_H_INCLUDED_
+
+#include <stdatomic.h>
+#include <time.h>
+
+#include "cdj.h"
+
+/**
+ * Passive capture of all ProLink traffic on an interface.
+ *
+ * Uses an AF_PACKET socket with a TPACKET_V3 mmap ring and a BPF filter that only accepts UDP to
+ * ports 50000 - 50002, so unicast traffic between other devices is visible when the NIC is on a mirrored
+ * switch port.  Requires CAP_NET_RAW.
+ */
+
+#define VDJ_SNIFF_BLOCK_SIZE    (1 << 16)   // 64k, must be a multiple of the page size
+#define VDJ_SNIFF_BLOCK_COUNT   64
+#define VDJ_SNIFF_FRAME_SIZE    2048        // largest ProLink packet is well under the ethernet MTU
+#define VDJ_SNIFF_BLOCK_TIMEOUT 10          // millis before the kernel hands over a part filled block
+
+typedef struct {
+    uint8_t*            data;       // udp payload, i.e. the ProLink packet, points into the ring
+    uint16_t            len;        // udp payload length
+    uint16_t            src_port;
+    uint16_t            dst_port;   // CDJ_DISCOVERY_PORT, CDJ_BEAT_PORT or CDJ_UPDATE_PORT
+    uint32_t            src_ip;     // in the format used in CDJ packets, e.g. cdj_discovery_ip()
+    uint32_t            dst_ip;
+    cdj_nanos_t         timestamp;  // kernel receive timestamp, converted to cdj_now() time
+} vdj_sniff_packet_t;
+
+typedef struct vdj_sniff_s vdj_sniff_t;
+
+typedef void (*vdj_sniff_ph)(vdj_sniff_t* s, vdj_sniff_packet_t* pkt);
+
+struct vdj_sniff_s {
+    int                 socket_fd;
+    int                 ifindex;
+    uint8_t*            ring;           // mmapped TPACKET_V3 ring
+    size_t              ring_len;
+    unsigned int        block_count;
+    unsigned int        block_size;
+    unsigned int        block_idx;      // next block we expect the kernel to hand us
+    uint64_t            packets;        // packets passed to the handler
+    uint64_t            drops;          // from PACKET_STATISTICS
+    void*               client;         // if anyone wants to hook to our callbacks
+    _Atomic unsigned    running;        // set by vdj_sniff_open(), cleared by vdj_sniff_stop()
+};
+
+// allocs, opens the capture socket and puts the nic in promiscuous mode
+vdj_sniff_t* vdj_sniff_open(const char* iface);
+void vdj_sniff_close(vdj_sniff_t* s);
+
+// read the ring until vdj_sniff_stop() is called, only calls poll() when the ring is empty,
+// returns at once if it was stopped before the loop started
+int vdj_sniff_loop(vdj_sniff_t* s, vdj_sniff_ph sniff_ph);
+void vdj_sniff_stop(vdj_sniff_t* s);
+
+// runs vdj_sniff_loop() on its own thread
+int vdj_init_sniff_thread(vdj_sniff_t* s, vdj_sniff_ph sniff_ph);
+
+// kernel ring buffer drops since the last call
+uint32_t vdj_sniff_drops(vdj_sniff_t* s);
+
+#endif // _VDJ_SNIFF_H_INCLUDED_
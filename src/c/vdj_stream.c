@@ -0,0 +1,430 @@
+/**
+ * Headless event stream, see vdj_stream.h
+ *
+ * Each record is formatted into a buffer on the caller's stack and copied to a queue under a short lock, a writer
+ * thread does the write() so a slow or stopped reader never holds up the discovery, beat and update threads.
+ * When the queue is full the record is dropped and counted.  Only the update thread touches the per player
+ * status that is used to find changes.
+ *
+ * @author teknopaul
+ */
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "cdj.h"
+#include "vdj_stream.h"
+
+#define VDJ_STREAM_MODEL_LEN    20
+
+typedef struct {
+    uint8_t             seen;
+    uint8_t             flags;
+    uint16_t            bpm;
+    uint32_t            track_id;
+} vdj_stream_last_t;
+
+struct vdj_stream_s {
+    int                 fd;
+    int                 own_fd;     // connected here so close it
+    vdj_stream_format   format;
+    vdj_stream_sink     sink;
+    void*               sink_arg;
+    uint64_t _Atomic    dropped;
+    unsigned _Atomic    resend;
+    vdj_stream_last_t   last[VDJ_STREAM_PLAYERS];
+    // queue for the writer thread, not used with a sink
+    pthread_t           writer;
+    pthread_mutex_t     lock;
+    pthread_cond_t      cond;
+    unsigned int        running:1;
+    uint32_t            head;       // queued records are head to tail
+    uint32_t            tail;
+    uint16_t            len[VDJ_STREAM_QUEUE];
+    uint8_t             records[VDJ_STREAM_QUEUE][VDJ_STREAM_RECORD_MAX];
+};
+
+/**
+ * Write all of a record, a stream socket or a tty may take part of it
+ */
+static int
+vdj_stream_write_all(vdj_stream_t* s, const uint8_t* record, int len)
+{
+    ssize_t rv;
+
+    while (len > 0) {
+        // a reader that went away is a dropped record, not a SIGPIPE
+        if (s->own_fd) rv = send(s->fd, record, len, MSG_NOSIGNAL);
+        else rv = write(s->fd, record, len);
+        if (rv < 0 && errno == EINTR) continue;
+        if (rv <= 0) return CDJ_ERROR;
+        record += rv;
+        len -= rv;
+    }
+    return CDJ_OK;
+}
+
+/**
+ * Writes queued records until the stream is destroyed, then what is left in the queue
+ */
+static void*
+vdj_stream_writer(void* arg)
+{
+    vdj_stream_t* s = arg;
+    uint8_t record[VDJ_STREAM_RECORD_MAX];
+    int len;
+
+    pthread_mutex_lock(&s->lock);
+    for (;;) {
+        while (s->running && s->head == s->tail) pthread_cond_wait(&s->cond, &s->lock);
+        if (s->head == s->tail) break;
+
+        len = s->len[s->head % VDJ_STREAM_QUEUE];
+        memcpy(record, s->records[s->head % VDJ_STREAM_QUEUE], len);
+        s->head++;
+        pthread_mutex_unlock(&s->lock);
+
+        if ( vdj_stream_write_all(s, record, len) ) s->dropped++;
+
+        pthread_mutex_lock(&s->lock);
+    }
+    pthread_mutex_unlock(&s->lock);
+    return NULL;
+}
+
+static vdj_stream_t*
+vdj_stream_alloc(int fd, vdj_stream_format format)
+{
+    vdj_stream_t* s = calloc(1, sizeof(vdj_stream_t));
+    if (s == NULL) return NULL;
+
+    s->fd = fd;
+    s->format = format;
+    return s;
+}
+
+vdj_stream_t*
+vdj_stream_new(int fd, vdj_stream_format format)
+{
+    vdj_stream_t* s = vdj_stream_alloc(fd, format);
+    int rv;
+
+    if (s == NULL) return NULL;
+
+    pthread_mutex_init(&s->lock, NULL);
+    pthread_cond_init(&s->cond, NULL);
+    s->running = 1;
+    if ( (rv = pthread_create(&s->writer, NULL, vdj_stream_writer, s)) ) {
+        fprintf(stderr, "error: stream writer thread '%s'\n", strerror(rv));
+        pthread_cond_destroy(&s->cond);
+        pthread_mutex_destroy(&s->lock);
+        free(s);
+        return NULL;
+    }
+    return s;
+}
+
+vdj_stream_t*
+vdj_stream_sink_new(vdj_stream_format format, vdj_stream_sink sink, void* arg)
+{
+    vdj_stream_t* s = vdj_stream_alloc(-1, format);
+    if (s == NULL) return NULL;
+
+    s->sink = sink;
+    s->sink_arg = arg;
+    return s;
+}
+
+vdj_stream_t*
+vdj_stream_connect(const char* path, vdj_stream_format format)
+{
+    struct sockaddr_un addr;
+    vdj_stream_t* s;
+    int fd;
+
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "error: socket path too long '%s'\n", path);
+        return NULL;
+    }
+    if ( (fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0 ) {
+        fprintf(stderr, "error: unix socket '%s'\n", strerror(errno));
+        return NULL;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    if ( connect(fd, (struct sockaddr*) &addr, sizeof(addr)) ) {
+        fprintf(stderr, "error: connect '%s' '%s'\n", path, strerror(errno));
+        close(fd);
+        return NULL;
+    }
+
+    if ( (s = vdj_stream_new(fd, format)) == NULL ) {
+        close(fd);
+        return NULL;
+    }
+    s->own_fd = 1;
+    return s;
+}
+
+/**
+ * Waits for the writer thread to write what is queued
+ */
+void
+vdj_stream_destroy(vdj_stream_t* s)
+{
+    if ( ! s->sink ) {
+        pthread_mutex_lock(&s->lock);
+        s->running = 0;
+        pthread_cond_signal(&s->cond);
+        pthread_mutex_unlock(&s->lock);
+        pthread_join(s->writer, NULL);
+        pthread_cond_destroy(&s->cond);
+        pthread_mutex_destroy(&s->lock);
+    }
+    if (s->own_fd) close(s->fd);
+    free(s);
+}
+
+uint64_t
+vdj_stream_dropped(vdj_stream_t* s)
+{
+    return s->dropped;
+}
+
+void
+vdj_stream_resend(vdj_stream_t* s)
+{
+    s->resend = 1;
+}
+
+static void
+vdj_stream_write(vdj_stream_t* s, const void* record, int len)
+{
+    int full;
+
+    if (len <= 0 || len > VDJ_STREAM_RECORD_MAX) {
+        s->dropped++;
+        return;
+    }
+    if (s->sink) {
+        s->sink(s->sink_arg, record, len);
+        return;
+    }
+
+    pthread_mutex_lock(&s->lock);
+    full = s->tail - s->head == VDJ_STREAM_QUEUE;
+    if ( ! full ) {
+        memcpy(s->records[s->tail % VDJ_STREAM_QUEUE], record, len);
+        s->len[s->tail % VDJ_STREAM_QUEUE] = len;
+        if (s->tail++ == s->head) pthread_cond_signal(&s->cond);
+    }
+    pthread_mutex_unlock(&s->lock);
+    if (full) s->dropped++;
+}
+
+static int64_t
+vdj_stream_ts(cdj_nanos_t timestamp)
+{
+    struct timespec ts = cdj_nanos_to_realtime(timestamp ? timestamp : cdj_now());
+    return (int64_t) ts.tv_sec * CDJ_NANOS_PER_SEC + ts.tv_nsec;
+}
+
+static void
+vdj_stream_header(vdj_stream_header_t* hdr, uint16_t len, vdj_stream_event event, uint8_t player_id, int64_t ts)
+{
+    hdr->len = len;
+    hdr->event = event;
+    hdr->player_id = player_id;
+    hdr->ts = ts;
+}
+
+/**
+ * Model names are \0 padded ascii, anything that would need escaping in json is replaced.
+ */
+static void
+vdj_stream_model(char* model, const uint8_t* data)
+{
+    int i;
+    for (i = 0; i < VDJ_STREAM_MODEL_LEN; i++) {
+        if (data[i] == 0) break;
+        model[i] = (data[i] < 0x20 || data[i] > 0x7e || data[i] == '"' || data[i] == '\\') ? '?' : data[i];
+    }
+    model[i] = '\0';
+}
+
+void
+vdj_stream_discovery(vdj_stream_t* s, uint8_t* packet, uint16_t len, cdj_nanos_t timestamp)
+{
+    char record[VDJ_STREAM_RECORD_MAX];
+    char model[VDJ_STREAM_MODEL_LEN + 1];
+    vdj_stream_keepalive_t* r = (vdj_stream_keepalive_t*) record;
+    cdj_discovery_packet_t d_pkt;
+    uint8_t* mac;
+    int n;
+
+    if (cdj_validate_header(packet, len) != CDJ_OK || cdj_packet_type(packet, len) != CDJ_KEEP_ALIVE) return;
+    if (len < CDJ_PACKET_TYPE_OFFSET + 2 + VDJ_STREAM_MODEL_LEN) return;
+
+    memset(&d_pkt, 0, sizeof(d_pkt));
+    d_pkt.data = packet;
+    d_pkt.len = len;
+    d_pkt.type = CDJ_KEEP_ALIVE;
+    d_pkt.sub_type = cdj_discovery_sub_type(&d_pkt);
+    d_pkt.player_id = cdj_discovery_player_id(&d_pkt);
+    d_pkt.ip = cdj_discovery_ip(&d_pkt);
+    if ( (mac = cdj_discovery_mac(&d_pkt)) ) memcpy(d_pkt.mac, mac, 6);
+    vdj_stream_model(model, (uint8_t*) cdj_discovery_model(&d_pkt));
+
+    if (s->format == VDJ_STREAM_BINARY) {
+        memset(r, 0, sizeof(*r));
+        vdj_stream_header(&r->hdr, sizeof(*r), VDJ_STREAM_KEEPALIVE, d_pkt.player_id, vdj_stream_ts(timestamp));
+        memcpy(r->model, model, strlen(model));
+        r->ip = d_pkt.ip;
+        memcpy(r->mac, d_pkt.mac, 6);
+        vdj_stream_write(s, r, sizeof(*r));
+        return;
+    }
+
+    n = snprintf(record, sizeof(record),
+        "{\"event\":\"keepalive\",\"ts\":%lld,\"player\":%u,\"model\":\"%s\",\"ip\":\"%u.%u.%u.%u\","
+        "\"mac\":\"%02x:%02x:%02x:%02x:%02x:%02x\"}\n",
+        (long long) vdj_stream_ts(timestamp), d_pkt.player_id, model,
+        d_pkt.ip >> 24 & 0xff, d_pkt.ip >> 16 & 0xff, d_pkt.ip >> 8 & 0xff, d_pkt.ip & 0xff,
+        d_pkt.mac[0], d_pkt.mac[1], d_pkt.mac[2], d_pkt.mac[3], d_pkt.mac[4], d_pkt.mac[5]);
+    vdj_stream_write(s, record, n);
+}
+
+void
+vdj_stream_beat(vdj_stream_t* s, uint8_t* packet, uint16_t len, cdj_nanos_t timestamp)
+{
+    char record[VDJ_STREAM_RECORD_MAX];
+    vdj_stream_beat_t* r = (vdj_stream_beat_t*) record;
+    cdj_beat_packet_t b_pkt;
+    uint32_t pitch, next;
+    int n;
+
+    if (cdj_validate_header(packet, len) != CDJ_OK || cdj_packet_type(packet, len) != CDJ_BEAT) return;
+    if (len < 0x5d) return;
+
+    memset(&b_pkt, 0, sizeof(b_pkt));
+    b_pkt.data = packet;
+    b_pkt.len = len;
+    b_pkt.type = CDJ_BEAT;
+    b_pkt.player_id = cdj_beat_player_id(&b_pkt);
+    b_pkt.bar_pos = cdj_beat_bar_pos(&b_pkt);
+    b_pkt.bpm = cdj_beat_calculated_bpm(&b_pkt);
+    pitch = cdj_beat_pitch(&b_pkt);
+    next = cdj_beat_next(&b_pkt);
+
+    if (s->format == VDJ_STREAM_BINARY) {
+        memset(r, 0, sizeof(*r));
+        vdj_stream_header(&r->hdr, sizeof(*r), VDJ_STREAM_BEAT, b_pkt.player_id, vdj_stream_ts(timestamp));
+        r->bpm = cdj_bpm_to_int(b_pkt.bpm);
+        r->bar_pos = b_pkt.bar_pos;
+        r->pitch = pitch;
+        r->next_beat = next;
+        vdj_stream_write(s, r, sizeof(*r));
+        return;
+    }
+
+    n = snprintf(record, sizeof(record),
+        "{\"event\":\"beat\",\"ts\":%lld,\"player\":%u,\"bar\":%u,\"bpm\":%.2f,\"pitch\":%.2f,\"next_beat_ms\":%u}\n",
+        (long long) vdj_stream_ts(timestamp), b_pkt.player_id, b_pkt.bar_pos, b_pkt.bpm,
+        cdj_pitch_to_percentage(pitch), next);
+    vdj_stream_write(s, record, n);
+}
+
+void
+vdj_stream_update(vdj_stream_t* s, uint8_t* packet, uint16_t len, cdj_nanos_t timestamp)
+{
+    char record[VDJ_STREAM_RECORD_MAX];
+    vdj_stream_status_t* r = (vdj_stream_status_t*) record;
+    cdj_cdj_status_packet_t cs_pkt;
+    vdj_stream_last_t* last;
+    uint8_t changed = 0;
+    uint16_t bpm;
+    uint32_t track_id;
+    int n;
+
+    if (cdj_validate_header(packet, len) != CDJ_OK || cdj_packet_type(packet, len) != CDJ_STATUS) return;
+
+    memset(&cs_pkt, 0, sizeof(cs_pkt));
+    cs_pkt.data = packet;
+    cs_pkt.len = len;
+    cs_pkt.type = CDJ_STATUS;
+    cs_pkt.player_id = cdj_status_player_id(&cs_pkt);
+    cs_pkt.bpm = cdj_status_calculated_bpm(&cs_pkt);
+    cs_pkt.flags = cdj_status_flags(&cs_pkt);
+    if (cs_pkt.player_id >= VDJ_STREAM_PLAYERS) return;
+
+    // set by another thread, cleared here so that only this thread touches last
+    if ( atomic_exchange(&s->resend, 0) ) memset(s->last, 0, sizeof(s->last));
+
+    bpm = cdj_bpm_to_int(cs_pkt.bpm);
+    track_id = cdj_status_track_id(&cs_pkt);
+    last = &s->last[cs_pkt.player_id];
+    if ( ! last->seen || last->flags != cs_pkt.flags) changed |= VDJ_STREAM_CHANGED_FLAGS;
+    if ( ! last->seen || last->bpm != bpm) changed |= VDJ_STREAM_CHANGED_BPM;
+    if ( ! last->seen || last->track_id != track_id) changed |= VDJ_STREAM_CHANGED_TRACK;
+    if ( ! changed ) return;
+    last->seen = 1;
+    last->flags = cs_pkt.flags;
+    last->bpm = bpm;
+    last->track_id = track_id;
+
+    if (s->format == VDJ_STREAM_BINARY) {
+        memset(r, 0, sizeof(*r));
+        vdj_stream_header(&r->hdr, sizeof(*r), VDJ_STREAM_STATUS, cs_pkt.player_id, vdj_stream_ts(timestamp));
+        r->bpm = bpm;
+        r->flags = cs_pkt.flags;
+        r->changed = changed;
+        r->pitch = cdj_status_pitch(&cs_pkt);
+        r->track_id = track_id;
+        r->source_player = cdj_status_playing_from(&cs_pkt);
+        r->slot = cdj_status_playing_from_slot(&cs_pkt);
+        vdj_stream_write(s, r, sizeof(*r));
+        return;
+    }
+
+    n = snprintf(record, sizeof(record),
+        "{\"event\":\"status\",\"ts\":%lld,\"player\":%u,\"bpm\":%.2f,\"pitch\":%.2f,"
+        "\"playing\":%s,\"sync\":%s,\"master\":%s,\"on_air\":%s,"
+        "\"track\":%u,\"source_player\":%u,\"slot\":%u,\"changed\":[%s%s%s]}\n",
+        (long long) vdj_stream_ts(timestamp), cs_pkt.player_id, cs_pkt.bpm,
+        cdj_pitch_to_percentage(cdj_status_pitch(&cs_pkt)),
+        cs_pkt.flags & CDJ_STAT_FLAG_PLAY ? "true" : "false",
+        cs_pkt.flags & CDJ_STAT_FLAG_SYNC ? "true" : "false",
+        cs_pkt.flags & CDJ_STAT_FLAG_MASTER ? "true" : "false",
+        cs_pkt.flags & CDJ_STAT_FLAG_ONAIR ? "true" : "false",
+        track_id, cdj_status_playing_from(&cs_pkt), cdj_status_playing_from_slot(&cs_pkt),
+        changed & VDJ_STREAM_CHANGED_FLAGS ? "\"flags\"" : "",
+        (changed & VDJ_STREAM_CHANGED_BPM) ? (changed & VDJ_STREAM_CHANGED_FLAGS ? ",\"bpm\"" : "\"bpm\"") : "",
+        (changed & VDJ_STREAM_CHANGED_TRACK) ? (changed & (VDJ_STREAM_CHANGED_FLAGS | VDJ_STREAM_CHANGED_BPM) ? ",\"track\"" : "\"track\"") : "");
+    vdj_stream_write(s, record, n);
+}
+
+void
+vdj_stream_gone(vdj_stream_t* s, uint8_t player_id, cdj_nanos_t timestamp)
+{
+    char record[VDJ_STREAM_RECORD_MAX];
+    vdj_stream_header_t* r = (vdj_stream_header_t*) record;
+    int n;
+
+    if (s->format == VDJ_STREAM_BINARY) {
+        vdj_stream_header(r, sizeof(*r), VDJ_STREAM_GONE, player_id, vdj_stream_ts(timestamp));
+        vdj_stream_write(s, r, sizeof(*r));
+        return;
+    }
+
+    n = snprintf(record, sizeof(record), "{\"event\":\"gone\",\"ts\":%lld,\"player\":%u}\n",
+        (long long) vdj_stream_ts(timestamp), player_id);
+    vdj_stream_write(s, record, n);
+}
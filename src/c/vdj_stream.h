@@ -0,0 +1,103 @@
+#ifndef _VDJ_STREAM_H_INCLUDED_
+#define _VDJ_STREAM_H_INCLUDED_
+
+#include "cdj.h"
+
+/**
+ * Machine readable event stream for headless monitors, one record per decoded keepalive, beat and status change.
+ *
+ * Records are newline delimited JSON or the fixed layout binary records below, written to stdout or a connected
+ * unix socket.  Packets are decoded in place and each record is formatted on the caller's stack and queued for a
+ * writer thread, so receive threads can share a stream, never wait for the reader and nothing is allocated per
+ * packet.  Records are dropped and counted when a reader falls VDJ_STREAM_QUEUE records behind.
+ * Status packets repeat every 200ms, a status record is only written when something in it changed.
+ * Timestamps are CLOCK_REALTIME nanos so they line up with other logs.
+ */
+
+#define VDJ_STREAM_RECORD_MAX   512
+#define VDJ_STREAM_PLAYERS      128
+#define VDJ_STREAM_QUEUE        256     // records waiting for the writer thread before they are dropped
+
+typedef enum {
+    VDJ_STREAM_NDJSON = 0,
+    VDJ_STREAM_BINARY
+} vdj_stream_format;
+
+typedef enum {
+    VDJ_STREAM_KEEPALIVE = 1,
+    VDJ_STREAM_BEAT,
+    VDJ_STREAM_STATUS,
+    VDJ_STREAM_GONE                 // header only, no keepalive for 7 seconds
+} vdj_stream_event;
+
+// bits of vdj_stream_status_t.changed
+#define VDJ_STREAM_CHANGED_FLAGS    0x01
+#define VDJ_STREAM_CHANGED_BPM      0x02
+#define VDJ_STREAM_CHANGED_TRACK    0x04
+
+/*
+ * Binary records, host byte order, each starts with the header and len is the whole record.
+ */
+
+typedef struct __attribute__((packed)) {
+    uint16_t        len;
+    uint8_t         event;          // vdj_stream_event
+    uint8_t         player_id;
+    int64_t         ts;
+} vdj_stream_header_t;
+
+typedef struct __attribute__((packed)) {
+    vdj_stream_header_t hdr;
+    char            model[20];      // \0 padded
+    uint32_t        ip;
+    uint8_t         mac[6];
+    uint8_t         pad[2];
+} vdj_stream_keepalive_t;
+
+typedef struct __attribute__((packed)) {
+    vdj_stream_header_t hdr;
+    uint16_t        bpm;            // x 100, after pitch
+    uint8_t         bar_pos;        // 1 - 4
+    uint8_t         pad;
+    uint32_t        pitch;          // raw, 0x100000 is no change
+    uint32_t        next_beat;      // millis to the next beat
+} vdj_stream_beat_t;
+
+typedef struct __attribute__((packed)) {
+    vdj_stream_header_t hdr;
+    uint16_t        bpm;            // x 100, after pitch
+    uint8_t         flags;          // CDJ_STAT_FLAG_*
+    uint8_t         changed;        // VDJ_STREAM_CHANGED_*
+    uint32_t        pitch;
+    uint32_t        track_id;
+    uint8_t         source_player;  // the track was loaded from
+    uint8_t         slot;
+    uint8_t         pad[2];
+} vdj_stream_status_t;
+
+typedef struct vdj_stream_s vdj_stream_t;
+
+// takes each record instead of it being written, e.g. to queue it for many readers
+typedef void (*vdj_stream_sink)(void* arg, const void* record, int len);
+
+// fd is usually 1, not closed by vdj_stream_destroy(), which waits for queued records to be written
+vdj_stream_t* vdj_stream_new(int fd, vdj_stream_format format);
+// connect to a listening SOCK_STREAM unix socket, e.g. a log shipper's input
+vdj_stream_t* vdj_stream_connect(const char* path, vdj_stream_format format);
+// records go to sink, dropped records are the sink's to count
+vdj_stream_t* vdj_stream_sink_new(vdj_stream_format format, vdj_stream_sink sink, void* arg);
+void vdj_stream_destroy(vdj_stream_t* s);
+
+// packets as received, timestamp 0 for now
+void vdj_stream_discovery(vdj_stream_t* s, uint8_t* packet, uint16_t len, cdj_nanos_t timestamp);
+void vdj_stream_beat(vdj_stream_t* s, uint8_t* packet, uint16_t len, cdj_nanos_t timestamp);
+void vdj_stream_update(vdj_stream_t* s, uint8_t* packet, uint16_t len, cdj_nanos_t timestamp);
+void vdj_stream_gone(vdj_stream_t* s, uint8_t player_id, cdj_nanos_t timestamp);
+
+// the next status from each player is written whether or not it changed, e.g. when a reader joins late
+void vdj_stream_resend(vdj_stream_t* s);
+
+// records that could not be written
+uint64_t vdj_stream_dropped(vdj_stream_t* s);
+
+#endif // _VDJ_STREAM_H_INCLUDED_
@@ -0,0 +1,224 @@
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "cdj.h"
+#include "vdj.h"
+#include "vdj_thread.h"
+
+/**
+ * Thread creation with realtime attributes.
+ *
+ * Threads are started via a small trampoline that names the thread and prefaults its stack before
+ * calling the real loop, so the first beat sent does not pay for page faults.
+ *
+ * @author teknopaul
+ */
+
+static const char* vdj_thread_names[VDJ_THREAD_ROLES] = {
+    "vdj-discovery",
+    "vdj-keepalive",
+    "vdj-beat",
+    "vdj-update",
+    "vdj-status",
+    "vdj-beatout",
+    "vdj-pselect",
+    "vdj-sched",
+    "vdj-midi",
+    "vdj-rtt",
+    "vdj-metrics",
+    "vdj-shm",
+    "vdj-daemon"
+};
+
+typedef struct {
+    vdj_thread_role     role;
+    size_t              prefault;
+    void*               (*start_routine)(void*);
+    void*               arg;
+} vdj_thread_start_info;
+
+const char*
+vdj_thread_name(vdj_thread_role role)
+{
+    if (role < 0 || role >= VDJ_THREAD_ROLES) return "vdj";
+    return vdj_thread_names[role];
+}
+
+int
+vdj_thread_set_priority(vdj_t* v, vdj_thread_role role, int priority)
+{
+    if (role < 0 || role >= VDJ_THREAD_ROLES) return CDJ_ERROR;
+    if (priority < 0 || priority > VDJ_THREAD_PRIORITY_MAX) return CDJ_ERROR;
+    v->thread_conf[role].priority = priority;
+    return CDJ_OK;
+}
+
+int
+vdj_thread_set_cpu(vdj_t* v, vdj_thread_role role, int cpu)
+{
+    if (role < 0 || role >= VDJ_THREAD_ROLES) return CDJ_ERROR;
+    if (cpu >= CPU_SETSIZE) return CDJ_ERROR;
+    v->thread_conf[role].cpu = cpu < 0 ? -1 : cpu;
+    return CDJ_OK;
+}
+
+int
+vdj_thread_set_prefault(vdj_t* v, vdj_thread_role role, size_t bytes)
+{
+    if (role < 0 || role >= VDJ_THREAD_ROLES) return CDJ_ERROR;
+    v->thread_conf[role].prefault = bytes;
+    return CDJ_OK;
+}
+
+void
+vdj_thread_set_all(vdj_t* v, int priority, int cpu)
+{
+    int role;
+    for (role = 0; role < VDJ_THREAD_ROLES; role++) {
+        vdj_thread_set_priority(v, role, priority);
+        vdj_thread_set_cpu(v, role, cpu);
+    }
+}
+
+int
+vdj_lock_memory()
+{
+    if ( mlockall(MCL_CURRENT | MCL_FUTURE) ) {
+        fprintf(stderr, "error: mlockall '%s'\n", strerror(errno));
+        return CDJ_ERROR;
+    }
+    return CDJ_OK;
+}
+
+/**
+ * Touch one byte per page of the stack we expect to use, with mlockall(MCL_FUTURE) they then stay resident.
+ */
+static void
+vdj_thread_prefault(size_t bytes)
+{
+    size_t i;
+    long page = sysconf(_SC_PAGESIZE);
+    volatile uint8_t* stack = alloca(bytes);
+
+    for (i = 0; i < bytes; i += page) {
+        stack[i] = 0;
+    }
+}
+
+static void*
+vdj_thread_trampoline(void* arg)
+{
+    vdj_thread_start_info info = *(vdj_thread_start_info*) arg;
+    free(arg);
+
+    pthread_setname_np(pthread_self(), vdj_thread_name(info.role));
+    if (info.prefault) vdj_thread_prefault(info.prefault);
+
+    return info.start_routine(info.arg);
+}
+
+static int
+vdj_thread_init_attr(pthread_attr_t* attr, vdj_thread_conf_t* conf, int realtime)
+{
+    struct sched_param param;
+    cpu_set_t cpus;
+
+    pthread_attr_init(attr);
+
+    if (conf->cpu >= 0) {
+        CPU_ZERO(&cpus);
+        CPU_SET(conf->cpu, &cpus);
+        if ( pthread_attr_setaffinity_np(attr, sizeof(cpus), &cpus) ) return CDJ_ERROR;
+    }
+
+    if (realtime && conf->priority > 0) {
+        memset(&param, 0, sizeof(param));
+        param.sched_priority = conf->priority;
+        if ( pthread_attr_setinheritsched(attr, PTHREAD_EXPLICIT_SCHED) ||
+             pthread_attr_setschedpolicy(attr, SCHED_FIFO) ||
+             pthread_attr_setschedparam(attr, &param) ) {
+            return CDJ_ERROR;
+        }
+    }
+    return CDJ_OK;
+}
+
+int
+vdj_thread_create(vdj_t* v, vdj_thread_role role, void* (*start_routine)(void*), void* arg)
+{
+    pthread_attr_t attr;
+    vdj_thread_conf_t* conf;
+    vdj_thread_start_info* info;
+    int s;
+
+    if (role < 0 || role >= VDJ_THREAD_ROLES) return CDJ_ERROR;
+    conf = &v->thread_conf[role];
+
+    // one handle per role, a second thread would lose the first one's and it could never be joined
+    if (v->threads_joinable & (1 << role)) {
+        fprintf(stderr, "error: %s thread already started, stop and join it first\n", vdj_thread_name(role));
+        return CDJ_ERROR;
+    }
+
+    info = (vdj_thread_start_info*) calloc(1, sizeof(vdj_thread_start_info));
+    if (info == NULL) return CDJ_ERROR;
+    info->role = role;
+    info->prefault = conf->prefault;
+    info->start_routine = start_routine;
+    info->arg = arg;
+
+    if ( vdj_thread_init_attr(&attr, conf, 1) ) {
+        fprintf(stderr, "error: %s thread attributes\n", vdj_thread_name(role));
+        pthread_attr_destroy(&attr);
+        free(info);
+        return CDJ_ERROR;
+    }
+
+    s = pthread_create(&v->threads[role], &attr, vdj_thread_trampoline, info);
+    pthread_attr_destroy(&attr);
+
+    if (s == EPERM && conf->priority > 0) {
+        // no rtprio allowed, better to run late than not at all
+        fprintf(stderr, "warn: %s SCHED_FIFO %d not permitted, using default scheduler\n", vdj_thread_name(role), conf->priority);
+        vdj_thread_init_attr(&attr, conf, 0);
+        s = pthread_create(&v->threads[role], &attr, vdj_thread_trampoline, info);
+        pthread_attr_destroy(&attr);
+    }
+
+    if (s != 0) {
+        fprintf(stderr, "error: %s thread create '%s'\n", vdj_thread_name(role), strerror(s));
+        free(info);
+        return CDJ_ERROR;
+    }
+
+    v->threads_joinable |= 1 << role;
+    return CDJ_OK;
+}
+
+int
+vdj_thread_join(vdj_t* v, vdj_thread_role role)
+{
+    if (role < 0 || role >= VDJ_THREAD_ROLES) return CDJ_ERROR;
+    if ( ! (v->threads_joinable & (1 << role)) ) return CDJ_OK;
+
+    v->threads_joinable &= ~(1 << role);
+    if ( pthread_join(v->threads[role], NULL) ) return CDJ_ERROR;
+    return CDJ_OK;
+}
+
+void
+vdj_join_threads(vdj_t* v)
+{
+    int role;
+    for (role = 0; role < VDJ_THREAD_ROLES; role++) {
+        vdj_thread_join(v, role);
+    }
+}
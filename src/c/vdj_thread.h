@@ -0,0 +1,45 @@
+#ifndef _VDJ_THREAD_H_INCLUDED_
+#define _VDJ_THREAD_H_INCLUDED_
+
+#include "vdj.h"
+
+/**
+ * Realtime configuration of the library's threads.
+ *
+ * Set a role's priority and cpu before calling the matching vdj_init_*_thread(), the thread is created
+ * with those attributes and its pthread_t kept in the vdj_t so it can be joined.
+ * SCHED_FIFO needs CAP_SYS_NICE or an rtprio limit, without it we warn and fall back to the default scheduler.
+ *
+ * e.g. on a Pi that also runs audio the beatout thread should preempt everything else
+ *
+ *    vdj_lock_memory();
+ *    vdj_thread_set_priority(v, VDJ_THREAD_BEATOUT, 90);
+ *    vdj_thread_set_cpu(v, VDJ_THREAD_BEATOUT, 3);
+ *    vdj_thread_set_prefault(v, VDJ_THREAD_BEATOUT, 64 * 1024);
+ *    vdj_init_beatout_thread(v);
+ */
+
+#define VDJ_THREAD_PRIORITY_MAX  99
+
+// per role configuration, takes effect when the thread is next started
+int vdj_thread_set_priority(vdj_t* v, vdj_thread_role role, int priority);
+int vdj_thread_set_cpu(vdj_t* v, vdj_thread_role role, int cpu);
+int vdj_thread_set_prefault(vdj_t* v, vdj_thread_role role, size_t bytes);
+// same configuration for every role
+void vdj_thread_set_all(vdj_t* v, int priority, int cpu);
+
+// lock current and future pages into RAM so a realtime thread never waits on a page fault
+int vdj_lock_memory();
+
+// pthread_create() with the role's attributes, used by all the vdj_init_*_thread() functions,
+// CDJ_ERROR if the role already has a thread that has not been joined
+int vdj_thread_create(vdj_t* v, vdj_thread_role role, void* (*start_routine)(void*), void* arg);
+
+// join threads after vdj_stop_*_thread(), threads blocked in recv() only exit when the next packet arrives
+int vdj_thread_join(vdj_t* v, vdj_thread_role role);
+void vdj_join_threads(vdj_t* v);
+
+// short name, also set as the thread name so it shows in top -H and ps -L
+const char* vdj_thread_name(vdj_thread_role role);
+
+#endif // _VDJ_THREAD_H_INCLUDED_
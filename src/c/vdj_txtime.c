@@ -0,0 +1,160 @@
+/**
+ * SO_TXTIME beat transmission.
+ *
+ * Each beat is sent with an SCM_TXTIME control message carrying its launch time, the fq or etf qdisc
+ * releases it at that time.  With SOF_TXTIME_REPORT_ERRORS the qdisc queues an error on the socket for
+ * every packet it drops because the launch time had already passed, we read these back from MSG_ERRQUEUE.
+ * TX timestamps come back on the same queue, converted to cdj_now() time so they compare with last_beat.
+ *
+ * @author teknopaul
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <linux/errqueue.h>
+#include <linux/net_tstamp.h>
+
+#include "cdj.h"
+#include "vdj.h"
+#include "vdj_metrics.h"
+#include "vdj_flight.h"
+#include "vdj_txtime.h"
+
+#ifndef SO_TXTIME
+#define SO_TXTIME 61
+#define SCM_TXTIME SO_TXTIME
+#endif
+
+int
+vdj_txtime_enable(vdj_t* v, clockid_t clock)
+{
+    struct sock_txtime txtime;
+
+    if (v->beat_socket_fd <= 0) {
+        fprintf(stderr, "error: socket not open\n");
+        return CDJ_ERROR;
+    }
+
+    txtime.clockid = clock;
+    txtime.flags = SOF_TXTIME_REPORT_ERRORS;
+    if ( setsockopt(v->beat_socket_fd, SOL_SOCKET, SO_TXTIME, &txtime, sizeof(txtime)) ) {
+        fprintf(stderr, "error: SO_TXTIME '%s'\n", strerror(errno));
+        return CDJ_ERROR;
+    }
+    v->txtime_clock = clock;
+    v->txtime = 1;
+    return CDJ_OK;
+}
+
+uint64_t
+vdj_txtime_now(vdj_t* v)
+{
+    struct timespec ts;
+    clock_gettime(v->txtime ? v->txtime_clock : CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+int
+vdj_sendto_beat_at(vdj_t* v, uint8_t* packet, uint16_t packet_length, uint64_t launch)
+{
+    char control[CMSG_SPACE(sizeof(uint64_t))];
+    struct sockaddr_in dest;
+    struct iovec iov = { packet, packet_length };
+    struct msghdr msg;
+    struct cmsghdr* cmsg;
+    ssize_t res;
+
+    if ( ! v->txtime ) return vdj_sendto_beat(v, packet, packet_length);
+
+    memcpy(&dest, v->broadcast_addr, sizeof(struct sockaddr_in));
+    dest.sin_port = (in_port_t)htons(CDJ_BEAT_PORT);
+
+    memset(&msg, 0, sizeof(msg));
+    memset(control, 0, sizeof(control));
+    msg.msg_name = &dest;
+    msg.msg_namelen = sizeof(dest);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_TXTIME;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(uint64_t));
+    memcpy(CMSG_DATA(cmsg), &launch, sizeof(uint64_t));
+
+    res = sendmsg(v->beat_socket_fd, &msg, 0);
+    vdj_metrics_tx(CDJ_BEAT_PORT, packet, packet_length, res == -1);
+    vdj_flight_tx(CDJ_BEAT_PORT, packet, packet_length, res == -1);
+    if (res == -1) {
+        fprintf(stderr, "error: broadcast:50001 txtime '%s'\n", strerror(errno));
+        return CDJ_ERROR;
+    }
+    return CDJ_OK;
+}
+
+int
+vdj_tx_timestamps_enable(vdj_t* v)
+{
+    // OPT_ID tags each timestamp with a per socket send counter, OPT_TSONLY means the packet is not looped back
+    int flags = SOF_TIMESTAMPING_TX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE |
+                SOF_TIMESTAMPING_OPT_ID | SOF_TIMESTAMPING_OPT_TSONLY;
+
+    if ( setsockopt(v->beat_socket_fd, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags)) ) {
+        fprintf(stderr, "error: SO_TIMESTAMPING '%s'\n", strerror(errno));
+        return CDJ_ERROR;
+    }
+    v->tx_id = 0;
+    v->tx_timestamps = 1;
+    return CDJ_OK;
+}
+
+int
+vdj_txtime_errors(vdj_t* v)
+{
+    char control[256];
+    uint8_t data[1500];
+    struct iovec iov = { data, sizeof(data) };
+    struct msghdr msg;
+    struct cmsghdr* cmsg;
+    struct sock_extended_err* err;
+    struct scm_timestamping* stamps;
+    cdj_nanos_t tx = 0;
+    int found = 0;
+
+    if ( ! v->txtime && ! v->tx_timestamps ) return 0;
+
+    for (;;) {
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        if ( recvmsg(v->beat_socket_fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) == -1 ) break;
+
+        // a timestamp arrives as SCM_TIMESTAMPING followed by the extended err that carries its id
+        for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPING) {
+                stamps = (struct scm_timestamping*) CMSG_DATA(cmsg);
+                tx = cdj_realtime_to_nanos(&stamps->ts[0]);
+                continue;
+            }
+            err = (struct sock_extended_err*) CMSG_DATA(cmsg);
+            if (err->ee_origin == SO_EE_ORIGIN_TXTIME) {
+                found++;
+                v->txtime_errors++;
+            }
+            else if (err->ee_origin == SO_EE_ORIGIN_TIMESTAMPING && tx) {
+                v->beat_tx = tx;
+                v->tx_latency = tx - v->tx_sent[err->ee_data % VDJ_TX_SENT_RING];
+                tx = 0;
+            }
+        }
+    }
+    return found;
+}
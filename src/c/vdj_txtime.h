@@ -0,0 +1,38 @@
+#ifndef _VDJ_TXTIME_H_INCLUDED_
+#define _VDJ_TXTIME_H_INCLUDED_
+
+#include <time.h>
+
+#include "vdj.h"
+
+/**
+ * Scheduled beat transmission with SO_TXTIME.
+ *
+ * Beat packets are handed to the kernel ahead of time stamped with their launch time, the qdisc holds them
+ * until then, so jitter in our own thread no longer reaches the wire.  The interface needs a qdisc that honours
+ * launch times, otherwise packets go out immediately.
+ *
+ *   tc qdisc replace dev eth0 root fq                       # use CLOCK_MONOTONIC
+ *   tc qdisc replace dev eth0 root etf clockid CLOCK_TAI delta 200000   # use CLOCK_TAI, can offload to the nic
+ */
+
+#define VDJ_TXTIME_LEAD_NANOS   2000000   // how long before the launch time beatout hands a beat to the kernel
+
+// set SO_TXTIME on the beat socket, call after the sockets are opened
+int vdj_txtime_enable(vdj_t* v, clockid_t clock);
+
+// current time in v->txtime_clock
+uint64_t vdj_txtime_now(vdj_t* v);
+
+// send a packet to broadcast:50001 that leaves the nic at launch (nanos in v->txtime_clock)
+int vdj_sendto_beat_at(vdj_t* v, uint8_t* packet, uint16_t packet_length, uint64_t launch);
+
+// kernel software tx timestamps on the beat socket, v->tx_latency is then how late each beat left
+// compared to when vdj_broadcast_beat() was called, or to its launch time if it was scheduled
+int vdj_tx_timestamps_enable(vdj_t* v);
+
+// drain the socket error queue, records tx timestamps and counts errors the qdisc reported for late or
+// invalid launch times, returns how many errors were found
+int vdj_txtime_errors(vdj_t* v);
+
+#endif // _VDJ_TXTIME_H_INCLUDED_
@@ -0,0 +1,542 @@
+/**
+ * AF_XDP receive path for ProLink beat and update packets.
+ *
+ * No libbpf, the XDP program is a dozen hand assembled eBPF instructions loaded with the bpf() syscall.
+ * It checks for IPv4/UDP to 50001 or 50002 and calls bpf_redirect_map() on an XSKMAP keyed by rx queue,
+ * everything else, and anything on a queue we are not bound to, gets XDP_PASS.
+ *
+ * Redirected frames are copied into our UMEM and described on the rx ring, we parse the headers in place
+ * and hand the UDP payload to the managed handlers in vdj.c, then give the frame back on the fill ring.
+ * The program is attached with a bpf_link so it goes away when we close the link fd, or if the process dies.
+ *
+ * @author teknopaul
+ */
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <net/ethernet.h>
+#include <netinet/in.h>
+#include <linux/bpf.h>
+#include <linux/if_link.h>
+#include <linux/if_xdp.h>
+
+#include "cdj.h"
+#include "vdj.h"
+#include "vdj_thread.h"
+#include "vdj_flight.h"
+#include "vdj_xdp.h"
+
+#ifndef AF_XDP
+#define AF_XDP 44
+#endif
+#ifndef SOL_XDP
+#define SOL_XDP 283
+#endif
+
+#define VDJ_XDP_ETH_HDR_LEN  14
+#define VDJ_XDP_IP_HDR_LEN   20
+#define VDJ_XDP_UDP_HDR_LEN  8
+
+#define VDJ_XDP_PROG_LEN     32
+#define VDJ_XDP_LOG_SIZE     4096
+
+// producer/consumer ring as mapped from the socket
+typedef struct {
+    uint32_t*           producer;
+    uint32_t*           consumer;
+    void*               ring;
+    void*               map;
+    size_t              map_len;
+    uint32_t            mask;
+} vdj_xdp_ring_t;
+
+struct vdj_xdp_s {
+    vdj_t*              v;
+    int                 ifindex;
+    uint32_t            queue_id;
+    int                 map_fd;         // XSKMAP
+    int                 prog_fd;
+    int                 link_fd;        // bpf_link attaching prog_fd to ifindex
+    int                 xsk_fd;         // AF_XDP socket
+    uint8_t*            umem;
+    size_t              umem_len;
+    vdj_xdp_ring_t      fill;
+    vdj_xdp_ring_t      comp;           // never used for rx, but the kernel insists it exists
+    vdj_xdp_ring_t      rx;
+    uint64_t            packets;
+    _Atomic unsigned    running;        // set by vdj_xdp_open(), cleared by vdj_xdp_stop()
+};
+
+typedef struct {
+    vdj_xdp_t*          x;
+    vdj_beat_ph         beat_ph;
+    vdj_beat_unicast_ph beat_unicast_ph;
+    vdj_update_ph       update_ph;
+} vdj_xdp_thread_info;
+
+
+static int
+vdj_xdp_bpf(int cmd, union bpf_attr* attr)
+{
+    return syscall(__NR_bpf, cmd, attr, sizeof(*attr));
+}
+
+// eBPF instruction encoding, the kernel's filter.h macros are not exported to userspace
+
+static struct bpf_insn
+vdj_xdp_insn(uint8_t code, uint8_t dst, uint8_t src, int16_t off, int32_t imm)
+{
+    struct bpf_insn insn;
+    memset(&insn, 0, sizeof(insn));
+    insn.code = code;
+    insn.dst_reg = dst;
+    insn.src_reg = src;
+    insn.off = off;
+    insn.imm = imm;
+    return insn;
+}
+
+#define XI_MOV_REG(dst, src)          vdj_xdp_insn(BPF_ALU64 | BPF_MOV | BPF_X, dst, src, 0, 0)
+#define XI_MOV_IMM(dst, imm)          vdj_xdp_insn(BPF_ALU64 | BPF_MOV | BPF_K, dst, 0, 0, imm)
+#define XI_ADD_IMM(dst, imm)          vdj_xdp_insn(BPF_ALU64 | BPF_ADD | BPF_K, dst, 0, 0, imm)
+#define XI_LDX(size, dst, src, off)   vdj_xdp_insn(BPF_LDX | BPF_MEM | size, dst, src, off, 0)
+#define XI_JMP_REG(op, dst, src, off) vdj_xdp_insn(BPF_JMP | op | BPF_X, dst, src, off, 0)
+#define XI_JMP_IMM(op, dst, imm, off) vdj_xdp_insn(BPF_JMP | op | BPF_K, dst, 0, off, imm)
+#define XI_CALL(func)                 vdj_xdp_insn(BPF_JMP | BPF_CALL, 0, 0, 0, func)
+#define XI_EXIT()                     vdj_xdp_insn(BPF_JMP | BPF_EXIT, 0, 0, 0, 0)
+
+/**
+ * Build the redirect program, returns the instruction count.
+ *
+ *    r6 = ctx
+ *    r2 = ctx->data ; r3 = ctx->data_end
+ *    if data + 42 > data_end goto pass
+ *    if eth type != IP || ip[0] != 0x45 || ip proto != UDP || fragment goto pass
+ *    if udp dst port == 50001 || udp dst port == 50002 goto redirect
+ *  pass:
+ *    return XDP_PASS
+ *  redirect:
+ *    return bpf_redirect_map(xskmap, ctx->rx_queue_index, XDP_PASS)
+ *
+ * Packet loads are in network byte order so we compare against htons() constants.
+ * The flags arg to bpf_redirect_map() is the action if the queue has no socket in the map.
+ */
+static int
+vdj_xdp_build(struct bpf_insn* prog, int map_fd)
+{
+    int i = 0, j;
+    int pass_jumps[8];
+    int pass_count = 0;
+    int redirect_jumps[2];
+
+    prog[i++] = XI_MOV_REG(BPF_REG_6, BPF_REG_1);
+    prog[i++] = XI_LDX(BPF_W, BPF_REG_2, BPF_REG_1, offsetof(struct xdp_md, data));
+    prog[i++] = XI_LDX(BPF_W, BPF_REG_3, BPF_REG_1, offsetof(struct xdp_md, data_end));
+    prog[i++] = XI_MOV_REG(BPF_REG_4, BPF_REG_2);
+    prog[i++] = XI_ADD_IMM(BPF_REG_4, VDJ_XDP_ETH_HDR_LEN + VDJ_XDP_IP_HDR_LEN + VDJ_XDP_UDP_HDR_LEN);
+    pass_jumps[pass_count++] = i;
+    prog[i++] = XI_JMP_REG(BPF_JGT, BPF_REG_4, BPF_REG_3, 0);
+
+    prog[i++] = XI_LDX(BPF_H, BPF_REG_5, BPF_REG_2, 12);
+    pass_jumps[pass_count++] = i;
+    prog[i++] = XI_JMP_IMM(BPF_JNE, BPF_REG_5, htons(ETHERTYPE_IP), 0);
+
+    // no ip options, ProLink devices never send them
+    prog[i++] = XI_LDX(BPF_B, BPF_REG_5, BPF_REG_2, VDJ_XDP_ETH_HDR_LEN);
+    pass_jumps[pass_count++] = i;
+    prog[i++] = XI_JMP_IMM(BPF_JNE, BPF_REG_5, 0x45, 0);
+
+    prog[i++] = XI_LDX(BPF_B, BPF_REG_5, BPF_REG_2, VDJ_XDP_ETH_HDR_LEN + 9);
+    pass_jumps[pass_count++] = i;
+    prog[i++] = XI_JMP_IMM(BPF_JNE, BPF_REG_5, IPPROTO_UDP, 0);
+
+    // more fragments flag or fragment offset
+    prog[i++] = XI_LDX(BPF_H, BPF_REG_5, BPF_REG_2, VDJ_XDP_ETH_HDR_LEN + 6);
+    pass_jumps[pass_count++] = i;
+    prog[i++] = XI_JMP_IMM(BPF_JSET, BPF_REG_5, htons(0x3fff), 0);
+
+    prog[i++] = XI_LDX(BPF_H, BPF_REG_5, BPF_REG_2, VDJ_XDP_ETH_HDR_LEN + VDJ_XDP_IP_HDR_LEN + 2);
+    redirect_jumps[0] = i;
+    prog[i++] = XI_JMP_IMM(BPF_JEQ, BPF_REG_5, htons(CDJ_BEAT_PORT), 0);
+    redirect_jumps[1] = i;
+    prog[i++] = XI_JMP_IMM(BPF_JEQ, BPF_REG_5, htons(CDJ_UPDATE_PORT), 0);
+
+    // pass:
+    for (j = 0; j < pass_count; j++) prog[pass_jumps[j]].off = i - pass_jumps[j] - 1;
+    prog[i++] = XI_MOV_IMM(BPF_REG_0, XDP_PASS);
+    prog[i++] = XI_EXIT();
+
+    // redirect:
+    for (j = 0; j < 2; j++) prog[redirect_jumps[j]].off = i - redirect_jumps[j] - 1;
+    prog[i++] = XI_LDX(BPF_W, BPF_REG_2, BPF_REG_6, offsetof(struct xdp_md, rx_queue_index));
+    // 16 byte load of the map fd, the verifier swaps it for the map pointer
+    prog[i++] = vdj_xdp_insn(BPF_LD | BPF_DW | BPF_IMM, BPF_REG_1, BPF_PSEUDO_MAP_FD, 0, map_fd);
+    prog[i++] = vdj_xdp_insn(0, 0, 0, 0, 0);
+    prog[i++] = XI_MOV_IMM(BPF_REG_3, XDP_PASS);
+    prog[i++] = XI_CALL(BPF_FUNC_redirect_map);
+    prog[i++] = XI_EXIT();
+
+    return i;
+}
+
+static int
+vdj_xdp_load_prog(vdj_xdp_t* x)
+{
+    union bpf_attr attr;
+    struct bpf_insn prog[VDJ_XDP_PROG_LEN];
+    int prog_len = vdj_xdp_build(prog, x->map_fd);
+    char* log;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.prog_type = BPF_PROG_TYPE_XDP;
+    attr.insns = (uint64_t) (unsigned long) prog;
+    attr.insn_cnt = prog_len;
+    attr.license = (uint64_t) (unsigned long) "GPL";
+    x->prog_fd = vdj_xdp_bpf(BPF_PROG_LOAD, &attr);
+    if (x->prog_fd >= 0) return CDJ_OK;
+
+    // load again with the verifier log so there is something to go on
+    fprintf(stderr, "error: xdp prog load '%s'\n", strerror(errno));
+    if ( (log = calloc(1, VDJ_XDP_LOG_SIZE)) ) {
+        attr.log_buf = (uint64_t) (unsigned long) log;
+        attr.log_size = VDJ_XDP_LOG_SIZE;
+        attr.log_level = 1;
+        if (vdj_xdp_bpf(BPF_PROG_LOAD, &attr) < 0 && log[0]) fprintf(stderr, "%s\n", log);
+        free(log);
+    }
+    return CDJ_ERROR;
+}
+
+static int
+vdj_xdp_create_map(vdj_xdp_t* x)
+{
+    union bpf_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.map_type = BPF_MAP_TYPE_XSKMAP;
+    attr.key_size = sizeof(uint32_t);
+    attr.value_size = sizeof(uint32_t);
+    attr.max_entries = VDJ_XDP_MAX_QUEUES;
+    x->map_fd = vdj_xdp_bpf(BPF_MAP_CREATE, &attr);
+    if (x->map_fd < 0) {
+        fprintf(stderr, "error: xdp map create '%s' (needs CAP_BPF)\n", strerror(errno));
+        return CDJ_ERROR;
+    }
+    return CDJ_OK;
+}
+
+static int
+vdj_xdp_map_socket(vdj_xdp_t* x)
+{
+    union bpf_attr attr;
+    uint32_t key = x->queue_id;
+    uint32_t value = x->xsk_fd;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.map_fd = x->map_fd;
+    attr.key = (uint64_t) (unsigned long) &key;
+    attr.value = (uint64_t) (unsigned long) &value;
+    attr.flags = BPF_ANY;
+    if ( vdj_xdp_bpf(BPF_MAP_UPDATE_ELEM, &attr) ) {
+        fprintf(stderr, "error: xdp map update '%s'\n", strerror(errno));
+        return CDJ_ERROR;
+    }
+    return CDJ_OK;
+}
+
+static int
+vdj_xdp_attach(vdj_xdp_t* x)
+{
+    union bpf_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.link_create.prog_fd = x->prog_fd;
+    attr.link_create.target_ifindex = x->ifindex;
+    attr.link_create.attach_type = BPF_XDP;
+    attr.link_create.flags = XDP_FLAGS_SKB_MODE;
+    x->link_fd = vdj_xdp_bpf(BPF_LINK_CREATE, &attr);
+    if (x->link_fd < 0) {
+        fprintf(stderr, "error: xdp attach '%s' (is another XDP program loaded?)\n", strerror(errno));
+        return CDJ_ERROR;
+    }
+    return CDJ_OK;
+}
+
+static int
+vdj_xdp_map_ring(vdj_xdp_t* x, vdj_xdp_ring_t* r, struct xdp_ring_offset* off, size_t desc_size, off_t pgoff)
+{
+    r->map_len = off->desc + VDJ_XDP_FRAME_COUNT * desc_size;
+    r->map = mmap(NULL, r->map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, x->xsk_fd, pgoff);
+    if (r->map == MAP_FAILED) {
+        fprintf(stderr, "error: xdp mmap ring '%s'\n", strerror(errno));
+        r->map = NULL;
+        return CDJ_ERROR;
+    }
+    r->producer = (uint32_t*) ((uint8_t*) r->map + off->producer);
+    r->consumer = (uint32_t*) ((uint8_t*) r->map + off->consumer);
+    r->ring = (uint8_t*) r->map + off->desc;
+    r->mask = VDJ_XDP_FRAME_COUNT - 1;
+    return CDJ_OK;
+}
+
+static int
+vdj_xdp_setup_socket(vdj_xdp_t* x)
+{
+    struct xdp_umem_reg mr;
+    struct xdp_mmap_offsets off;
+    struct sockaddr_xdp sxdp;
+    socklen_t optlen;
+    int ring_size = VDJ_XDP_FRAME_COUNT;
+    uint64_t* fill;
+    uint32_t i;
+
+    x->xsk_fd = socket(AF_XDP, SOCK_RAW, 0);
+    if (x->xsk_fd < 0) {
+        fprintf(stderr, "error: xdp socket '%s'\n", strerror(errno));
+        return CDJ_ERROR;
+    }
+
+    x->umem_len = (size_t) VDJ_XDP_FRAME_COUNT * VDJ_XDP_FRAME_SIZE;
+    x->umem = mmap(NULL, x->umem_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+    if (x->umem == MAP_FAILED) {
+        x->umem = NULL;
+        fprintf(stderr, "error: xdp umem '%s'\n", strerror(errno));
+        return CDJ_ERROR;
+    }
+
+    memset(&mr, 0, sizeof(mr));
+    mr.addr = (uint64_t) (unsigned long) x->umem;
+    mr.len = x->umem_len;
+    mr.chunk_size = VDJ_XDP_FRAME_SIZE;
+    mr.headroom = 0;
+    if ( setsockopt(x->xsk_fd, SOL_XDP, XDP_UMEM_REG, &mr, sizeof(mr)) ||
+         setsockopt(x->xsk_fd, SOL_XDP, XDP_UMEM_FILL_RING, &ring_size, sizeof(ring_size)) ||
+         setsockopt(x->xsk_fd, SOL_XDP, XDP_UMEM_COMPLETION_RING, &ring_size, sizeof(ring_size)) ||
+         setsockopt(x->xsk_fd, SOL_XDP, XDP_RX_RING, &ring_size, sizeof(ring_size)) ) {
+        fprintf(stderr, "error: xdp umem setup '%s'\n", strerror(errno));
+        return CDJ_ERROR;
+    }
+
+    optlen = sizeof(off);
+    if ( getsockopt(x->xsk_fd, SOL_XDP, XDP_MMAP_OFFSETS, &off, &optlen) ) {
+        fprintf(stderr, "error: xdp mmap offsets '%s'\n", strerror(errno));
+        return CDJ_ERROR;
+    }
+
+    if ( vdj_xdp_map_ring(x, &x->fill, &off.fr, sizeof(uint64_t), XDP_UMEM_PGOFF_FILL_RING) ||
+         vdj_xdp_map_ring(x, &x->comp, &off.cr, sizeof(uint64_t), XDP_UMEM_PGOFF_COMPLETION_RING) ||
+         vdj_xdp_map_ring(x, &x->rx, &off.rx, sizeof(struct xdp_desc), XDP_PGOFF_RX_RING) ) {
+        return CDJ_ERROR;
+    }
+
+    // hand every frame to the kernel, we only ever give back what the rx ring gave us so the fill ring cannot overflow
+    fill = x->fill.ring;
+    for (i = 0; i < VDJ_XDP_FRAME_COUNT; i++) {
+        fill[i] = (uint64_t) i * VDJ_XDP_FRAME_SIZE;
+    }
+    __atomic_store_n(x->fill.producer, VDJ_XDP_FRAME_COUNT, __ATOMIC_RELEASE);
+
+    memset(&sxdp, 0, sizeof(sxdp));
+    sxdp.sxdp_family = AF_XDP;
+    sxdp.sxdp_ifindex = x->ifindex;
+    sxdp.sxdp_queue_id = x->queue_id;
+    sxdp.sxdp_flags = XDP_COPY;
+    if ( bind(x->xsk_fd, (struct sockaddr*) &sxdp, sizeof(sxdp)) ) {
+        fprintf(stderr, "error: xdp bind queue %u '%s'\n", x->queue_id, strerror(errno));
+        return CDJ_ERROR;
+    }
+
+    return CDJ_OK;
+}
+
+/**
+ * Set up the socket first and attach the program last, so redirection starts only when there is somewhere
+ * for the packets to go.
+ *
+ * @return mallocd space or NULL;
+ */
+vdj_xdp_t*
+vdj_xdp_open(vdj_t* v, const char* iface, uint32_t queue_id)
+{
+    if (queue_id >= VDJ_XDP_MAX_QUEUES) return NULL;
+
+    vdj_xdp_t* x = (vdj_xdp_t*) calloc(1, sizeof(vdj_xdp_t));
+    if (x == NULL) return NULL;
+    x->v = v;
+    x->queue_id = queue_id;
+    x->map_fd = x->prog_fd = x->link_fd = x->xsk_fd = -1;
+
+    x->ifindex = if_nametoindex(iface);
+    if (x->ifindex == 0) {
+        fprintf(stderr, "error: xdp unknown interface '%s'\n", iface);
+        free(x);
+        return NULL;
+    }
+
+    if ( vdj_xdp_create_map(x) ||
+         vdj_xdp_load_prog(x) ||
+         vdj_xdp_setup_socket(x) ||
+         vdj_xdp_map_socket(x) ||
+         vdj_xdp_attach(x) ) {
+        vdj_xdp_close(x);
+        return NULL;
+    }
+
+    x->running = 1;
+    return x;
+}
+
+void
+vdj_xdp_close(vdj_xdp_t* x)
+{
+    if (x) {
+        if (x->link_fd >= 0) close(x->link_fd);
+        if (x->rx.map) munmap(x->rx.map, x->rx.map_len);
+        if (x->comp.map) munmap(x->comp.map, x->comp.map_len);
+        if (x->fill.map) munmap(x->fill.map, x->fill.map_len);
+        if (x->xsk_fd >= 0) close(x->xsk_fd);
+        if (x->umem) munmap(x->umem, x->umem_len);
+        if (x->prog_fd >= 0) close(x->prog_fd);
+        if (x->map_fd >= 0) close(x->map_fd);
+        free(x);
+    }
+}
+
+/**
+ * The XDP program has checked IPv4, no options, UDP and the port, we still bounds check the lengths.
+ */
+static void
+vdj_xdp_dispatch(vdj_xdp_t* x, uint8_t* frame, uint32_t frame_len,
+    vdj_beat_ph beat_ph, vdj_beat_unicast_ph beat_unicast_ph, vdj_update_ph update_ph)
+{
+    vdj_t* v = x->v;
+    uint8_t* ip = frame + VDJ_XDP_ETH_HDR_LEN;
+    uint8_t* udp = ip + VDJ_XDP_IP_HDR_LEN;
+    uint8_t* packet = udp + VDJ_XDP_UDP_HDR_LEN;
+    uint16_t dst_port, udp_len;
+    uint32_t len;
+
+    if (frame_len < VDJ_XDP_ETH_HDR_LEN + VDJ_XDP_IP_HDR_LEN + VDJ_XDP_UDP_HDR_LEN) return;
+
+    dst_port = (udp[2] << 8) | udp[3];
+    udp_len = (udp[4] << 8) | udp[5];
+    if (udp_len < VDJ_XDP_UDP_HDR_LEN) return;
+    len = udp_len - VDJ_XDP_UDP_HDR_LEN;
+    if (len > frame_len - (VDJ_XDP_ETH_HDR_LEN + VDJ_XDP_IP_HDR_LEN + VDJ_XDP_UDP_HDR_LEN)) return;
+
+    if ( cdj_validate_header(packet, len) ) return;
+
+    x->packets++;
+    vdj_flight_rx(dst_port, packet, len);
+    if (dst_port == CDJ_BEAT_PORT) {
+        // the kernel path has two sockets on 50001, the broadcast addr and our own ip
+        if ( memcmp(ip + 16, &v->ip_addr->sin_addr.s_addr, 4) == 0 ) {
+            vdj_handle_managed_beat_unicast_datagram(v, beat_unicast_ph, packet, len);
+        } else {
+            vdj_handle_managed_beat_datagram(v, beat_ph, packet, len);
+        }
+    } else if (dst_port == CDJ_UPDATE_PORT) {
+        if (v->backline) vdj_handle_managed_update_datagram(v, update_ph, packet, len);
+    }
+}
+
+int
+vdj_xdp_loop(vdj_xdp_t* x, vdj_beat_ph beat_ph, vdj_beat_unicast_ph beat_unicast_ph, vdj_update_ph update_ph)
+{
+    struct xdp_desc* descs = x->rx.ring;
+    uint64_t* fill = x->fill.ring;
+    uint32_t rx_prod, rx_cons, fill_prod;
+    struct xdp_desc* d;
+    struct pollfd pfd;
+
+    pfd.fd = x->xsk_fd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+
+    while (x->running) {
+        rx_prod = __atomic_load_n(x->rx.producer, __ATOMIC_ACQUIRE);
+        rx_cons = *x->rx.consumer;
+
+        if (rx_prod == rx_cons) {
+            // ring is empty, this is the only time we make a syscall
+            if (poll(&pfd, 1, 1000) == -1 && errno != EINTR) {
+                fprintf(stderr, "error: xdp poll '%s'\n", strerror(errno));
+                return CDJ_ERROR;
+            }
+            continue;
+        }
+
+        fill_prod = *x->fill.producer;
+        for ( ; rx_cons != rx_prod; rx_cons++) {
+            d = &descs[rx_cons & x->rx.mask];
+            vdj_xdp_dispatch(x, x->umem + d->addr, d->len, beat_ph, beat_unicast_ph, update_ph);
+            // back to the start of the chunk, then back to the kernel
+            fill[fill_prod++ & x->fill.mask] = d->addr - (d->addr % VDJ_XDP_FRAME_SIZE);
+        }
+        __atomic_store_n(x->rx.consumer, rx_cons, __ATOMIC_RELEASE);
+        __atomic_store_n(x->fill.producer, fill_prod, __ATOMIC_RELEASE);
+    }
+
+    return CDJ_OK;
+}
+
+void
+vdj_xdp_stop(vdj_xdp_t* x)
+{
+    x->running = 0;
+}
+
+static void*
+vdj_xdp_thread_loop(void* arg)
+{
+    vdj_xdp_thread_info* tinfo = arg;
+    vdj_xdp_loop(tinfo->x, tinfo->beat_ph, tinfo->beat_unicast_ph, tinfo->update_ph);
+    free(tinfo);
+    return NULL;
+}
+
+int
+vdj_init_xdp_thread(vdj_xdp_t* x, vdj_beat_ph beat_ph, vdj_beat_unicast_ph beat_unicast_ph, vdj_update_ph update_ph)
+{
+    if ( ! x->running ) return CDJ_ERROR;
+
+    vdj_xdp_thread_info* tinfo = (vdj_xdp_thread_info*) calloc(1, sizeof(vdj_xdp_thread_info));
+    if (tinfo == NULL) return CDJ_ERROR;
+    tinfo->x = x;
+    tinfo->beat_ph = beat_ph;
+    tinfo->beat_unicast_ph = beat_unicast_ph;
+    tinfo->update_ph = update_ph;
+    return vdj_thread_create(x->v, VDJ_THREAD_BEAT, &vdj_xdp_thread_loop, tinfo);
+}
+
+uint64_t
+vdj_xdp_packets(vdj_xdp_t* x)
+{
+    return x->packets;
+}
+
+uint64_t
+vdj_xdp_drops(vdj_xdp_t* x)
+{
+    struct xdp_statistics stats;
+    socklen_t len = sizeof(stats);
+
+    memset(&stats, 0, sizeof(stats));
+    if ( getsockopt(x->xsk_fd, SOL_XDP, XDP_STATISTICS, &stats, &len) ) {
+        return 0;
+    }
+    // older kernels return a shorter struct, the fields they do not know stay 0
+    return stats.rx_dropped + stats.rx_ring_full;
+}
@@ -0,0 +1,43 @@
+#ifndef _VDJ_XDP_H_INCLUDED_
+#define _VDJ_XDP_H_INCLUDED_
+
+#include "vdj.h"
+
+/**
+ * AF_XDP receive backend for the beat and update ports.
+ *
+ * A small XDP program redirects IPv4 UDP to 50001 and 50002 into an AF_XDP socket, the frames land in a
+ * memory mapped UMEM and are passed to vdj_handle_managed_beat_datagram(), vdj_handle_managed_beat_unicast_datagram()
+ * and vdj_handle_managed_update_datagram() without going through the kernel UDP stack.
+ * Copy mode and generic (skb) XDP are used so it works on veth and any NIC driver.
+ *
+ * Only one rx queue is redirected, on a multiqueue NIC either use ethtool to steer ProLink traffic to that
+ * queue or set the queue count to 1. Traffic on other queues falls through to the normal sockets.
+ * Use this instead of vdj_init_managed_beat_thread() and vdj_init_managed_update_thread(), not as well.
+ * Requires CAP_NET_ADMIN, CAP_NET_RAW and CAP_BPF (i.e. root).
+ */
+
+#define VDJ_XDP_FRAME_SIZE   2048    // one UMEM chunk per frame, ProLink packets are well under the MTU
+#define VDJ_XDP_FRAME_COUNT  1024    // also the size of the fill and rx rings, must be a power of 2
+#define VDJ_XDP_MAX_QUEUES   64      // size of the XSKMAP
+
+typedef struct vdj_xdp_s vdj_xdp_t;
+
+// allocs, loads and attaches the XDP program and binds an AF_XDP socket to queue_id of iface
+vdj_xdp_t* vdj_xdp_open(vdj_t* v, const char* iface, uint32_t queue_id);
+// detaches the XDP program, the kernel stack gets the ports back
+void vdj_xdp_close(vdj_xdp_t* x);
+
+// read the rx ring until vdj_xdp_stop() is called, only calls poll() when the ring is empty,
+// returns at once if it was stopped before the loop started
+int vdj_xdp_loop(vdj_xdp_t* x, vdj_beat_ph beat_ph, vdj_beat_unicast_ph beat_unicast_ph, vdj_update_ph update_ph);
+void vdj_xdp_stop(vdj_xdp_t* x);
+
+// runs vdj_xdp_loop() on its own thread, update_ph needs a managed discovery thread like vdj_init_managed_update_thread()
+int vdj_init_xdp_thread(vdj_xdp_t* x, vdj_beat_ph beat_ph, vdj_beat_unicast_ph beat_unicast_ph, vdj_update_ph update_ph);
+
+// packets passed to the handlers and frames the kernel dropped because the rx ring was full
+uint64_t vdj_xdp_packets(vdj_xdp_t* x);
+uint64_t vdj_xdp_drops(vdj_xdp_t* x);
+
+#endif // _VDJ_XDP_H_INCLUDED_
@@ -0,0 +1,202 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <stdatomic.h>
+
+#include "cdj.h"
+#include "vdj.h"
+#include "vdj_xdp.h"
+#include "vdj_busypoll.h"
+
+/**
+ * Arrival to callback latency of beat packets, recv() in vdj_managed_beat_loop(), busy polling or AF_XDP.
+ *
+ * The sender writes cdj_now() into the 0xff padding of each beat packet, the receiver takes the
+ * difference when the beat_ph callback fires.  Both ends must share a clock, so run them on the same host
+ * either side of a veth pair, see tools/xdp-bench.sh.
+ *
+ * @author teknopaul
+ */
+
+#define BENCH_STAMP_OFFSET  0x3c
+
+static int64_t* samples;
+static uint32_t sample_max;
+static uint32_t _Atomic sample_count = ATOMIC_VAR_INIT(0);
+
+static void
+usage()
+{
+    printf("Measure beat packet arrival to callback latency\n");
+    printf("options:\n");
+    printf("    -i - network interface to use\n");
+    printf("    -s - send beats, otherwise receive and report\n");
+    printf("    -x - receive with AF_XDP, default is the recv() managed beat thread\n");
+    printf("    -q - rx queue for AF_XDP, default 0\n");
+    printf("    -B - busy poll the beat socket, spinning for this many micros before blocking\n");
+    printf("    -n - number of packets, default 10000\n");
+    printf("    -u - send interval in micros, default 1000\n");
+    printf("    -t - receive timeout in seconds, default 30\n");
+    printf("    -h - display this text\n");
+    exit(0);
+}
+
+static void
+bench_beat_ph(vdj_t* v, cdj_beat_packet_t* b_pkt)
+{
+    int64_t now = cdj_now();
+    int64_t sent;
+    uint32_t n;
+
+    if (b_pkt->len < BENCH_STAMP_OFFSET + sizeof(int64_t)) return;
+    memcpy(&sent, b_pkt->data + BENCH_STAMP_OFFSET, sizeof(int64_t));
+
+    n = sample_count;
+    if (n < sample_max) {
+        samples[n] = now - sent;
+        sample_count = n + 1;
+    }
+}
+
+static int
+bench_cmp(const void* a, const void* b)
+{
+    int64_t d = *(int64_t*) a - *(int64_t*) b;
+    return d < 0 ? -1 : d > 0;
+}
+
+static void
+bench_report(const char* mode)
+{
+    uint32_t i, n = sample_count;
+    int64_t sum = 0;
+
+    if (n == 0) {
+        printf("%s: no packets received\n", mode);
+        return;
+    }
+    qsort(samples, n, sizeof(int64_t), bench_cmp);
+    for (i = 0; i < n; i++) sum += samples[i];
+
+    printf("%-5s packets=%u min=%.1fus avg=%.1fus p50=%.1fus p99=%.1fus p999=%.1fus max=%.1fus\n",
+        mode, n,
+        samples[0] / 1000.0,
+        (sum / n) / 1000.0,
+        samples[n / 2] / 1000.0,
+        samples[(n * 99) / 100] / 1000.0,
+        samples[(n * 999) / 1000] / 1000.0,
+        samples[n - 1] / 1000.0);
+}
+
+static int
+bench_send(vdj_t* v, uint32_t count, uint32_t interval_us)
+{
+    uint16_t length;
+    uint32_t i;
+    int64_t now;
+    uint8_t* packet = cdj_create_beat_packet(&length, v->model, v->player_id, 120.0, 1);
+    if (packet == NULL) return 1;
+
+    for (i = 0; i < count; i++) {
+        packet[0x5c] = (i % 4) + 1;
+        now = cdj_now();
+        memcpy(packet + BENCH_STAMP_OFFSET, &now, sizeof(int64_t));
+        vdj_sendto_beat(v, packet, length);
+        usleep(interval_us);
+    }
+    free(packet);
+    return 0;
+}
+
+static int
+bench_receive(vdj_t* v, const char* iface, int xdp, uint32_t queue_id, uint32_t spin_us, int timeout)
+{
+    vdj_xdp_t* x = NULL;
+    time_t start = time(NULL);
+
+    if (xdp) {
+        if ( (x = vdj_xdp_open(v, iface, queue_id)) == NULL ) return 1;
+        if ( vdj_init_xdp_thread(x, bench_beat_ph, NULL, NULL) ) return 1;
+    } else {
+        if (spin_us) vdj_busy_poll_enable(v, spin_us);
+        vdj_rx_stats_enable(v);
+        if ( vdj_init_managed_beat_thread(v, bench_beat_ph) ) return 1;
+    }
+
+    while (sample_count < sample_max && time(NULL) - start < timeout) {
+        usleep(100000);
+    }
+
+    if (xdp) {
+        vdj_xdp_stop(x);
+        printf("xdp drops=%llu\n", (unsigned long long) vdj_xdp_drops(x));
+    } else {
+        vdj_rx_stats_fprint(stdout, v);
+        vdj_stop_managed_beat_thread(v);
+    }
+
+    bench_report(xdp ? "xdp" : spin_us ? "busy" : "recv");
+    // threads may still be blocked in poll() or recv(), exit without tidying up
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    char* iface = NULL;
+    int send = 0, xdp = 0, timeout = 30;
+    uint32_t count = 10000, interval_us = 1000, queue_id = 0, spin_us = 0;
+
+    int c;
+    while ( ( c = getopt(argc, argv, "i:sxq:B:n:u:t:h") ) != EOF) {
+        switch (c) {
+            case 'h':
+                usage();
+                break;
+            case 'i':
+                iface = optarg;
+                break;
+            case 's':
+                send = 1;
+                break;
+            case 'x':
+                xdp = 1;
+                break;
+            case 'q':
+                queue_id = atoi(optarg);
+                break;
+            case 'B':
+                spin_us = atoi(optarg);
+                break;
+            case 'n':
+                count = atoi(optarg);
+                break;
+            case 'u':
+                interval_us = atoi(optarg);
+                break;
+            case 't':
+                timeout = atoi(optarg);
+                break;
+        }
+    }
+
+    if (iface == NULL || count == 0) usage();
+
+    vdj_t* v = vdj_init_iface(iface, VDJ_FLAG_DEV_XDJ | 5);
+    if (v == NULL) {
+        fprintf(stderr, "error: creating virtual cdj\n");
+        return 1;
+    }
+    if (vdj_open_broadcast_sockets(v) != CDJ_OK) {
+        fprintf(stderr, "error: opening sockets\n");
+        return 1;
+    }
+
+    if (send) return bench_send(v, count, interval_us);
+
+    sample_max = count;
+    samples = (int64_t*) calloc(count, sizeof(int64_t));
+    if (samples == NULL) return 1;
+    return bench_receive(v, iface, xdp, queue_id, spin_us, timeout);
+}
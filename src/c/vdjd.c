@@ -0,0 +1,177 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include "cdj.h"
+#include "vdj.h"
+#include "vdj_net.h"
+#include "vdj_discovery.h"
+#include "vdj_beatout.h"
+#include "vdj_thread.h"
+#include "vdj_daemon.h"
+#include "vdj_flight.h"
+#include "vdj_series.h"
+
+/**
+ * Daemon that is the only ProLink participant on the box, local processes get its beats, status changes and
+ * members coming and going from a SOCK_SEQPACKET unix socket and send it tempo, play and master commands.
+ * See vdj_daemon.h for the protocol.
+ *
+ * @author teknopaul
+ */
+
+static volatile sig_atomic_t running = 1;
+
+static void
+signal_exit(int sig)
+{
+    running = 0;
+}
+
+static void
+usage()
+{
+    printf("Join the link once and share it with local processes over a unix socket\n");
+    printf("options:\n");
+    printf("    -i - network interface to use, required if pc has more than one\n");
+    printf("    -p - player id, default is auto assign\n");
+    printf("    -s - socket path, default %s\n", VDJ_DAEMON_PATH);
+    printf("    -b - bpm, start sending beats at this tempo, clients can also send 'play'\n");
+    printf("    -M - start as master\n");
+    printf("    -f - record every packet to this flight recorder file, see vdj-flight-dump\n");
+    printf("    -w - record beats, tempo and master changes to this time series file, see vdj-series\n");
+    printf("    -h - display this text\n");
+    exit(0);
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned int flags = 0;
+    uint8_t player_id = 0;
+    char* iface = NULL;
+    char* path = VDJ_DAEMON_PATH;
+    float bpm = 0.0;
+    char master = 0;
+    char* flight = NULL;
+    char* series = NULL;
+    int seconds = 0;
+    vdj_t* v;
+
+    int c;
+    while ( ( c = getopt(argc, argv, "i:p:s:b:f:w:Mh") ) != EOF) {
+        switch (c) {
+            case 'h':
+                usage();
+                break;
+            case 'i':
+                iface = optarg;
+                break;
+            case 'p':
+                player_id = atoi(optarg);
+                if (player_id < 0xf) flags |= player_id;
+                break;
+            case 's':
+                path = optarg;
+                break;
+            case 'b':
+                bpm = strtof(optarg, NULL);
+                break;
+            case 'M':
+                master = 1;
+                break;
+            case 'f':
+                flight = optarg;
+                break;
+            case 'w':
+                series = optarg;
+                break;
+        }
+    }
+
+    if (player_id == 0) flags |= VDJ_FLAG_AUTO_ID;
+    if ( flight && vdj_flight_open(flight, 0) != CDJ_OK ) {
+        fprintf(stderr, "error: opening flight recorder\n");
+        return 1;
+    }
+    if ( series && vdj_series_open(series) != CDJ_OK ) {
+        fprintf(stderr, "error: opening time series\n");
+        return 1;
+    }
+    if ( ! (v = vdj_init_iface(iface, flags)) ) {
+        fprintf(stderr, "error: creating virtual cdj\n");
+        return 1;
+    }
+    v->bpm = bpm > 0.0 ? bpm : 120.0;
+    if (master) v->master = 1;
+
+    if ( vdj_open_sockets(v) != CDJ_OK ) {
+        fprintf(stderr, "error: failed to open sockets\n");
+        vdj_destroy(v);
+        return 1;
+    }
+
+    if ( vdj_exec_discovery(v) != CDJ_OK ) {
+        fprintf(stderr, "error: cdj initialization\n");
+        vdj_destroy(v);
+        return 1;
+    }
+
+    // clients may connect before the link threads start, they get nothing until then
+    if ( vdj_init_daemon_thread(v, path) != CDJ_OK ) {
+        fprintf(stderr, "error: init daemon thread\n");
+        vdj_destroy(v);
+        return 1;
+    }
+
+    if ( vdj_init_managed_discovery_thread(v, vdj_daemon_discovery_ph) != CDJ_OK ) {
+        fprintf(stderr, "error: init managed discovery thread\n");
+        vdj_destroy(v);
+        return 1;
+    }
+    if ( vdj_init_managed_update_thread(v, vdj_daemon_update_ph) != CDJ_OK ) {
+        fprintf(stderr, "error: init managed update thread\n");
+        vdj_destroy(v);
+        return 1;
+    }
+    if ( vdj_init_managed_beat_thread(v, vdj_daemon_beat_ph) != CDJ_OK ) {
+        fprintf(stderr, "error: init managed beat thread\n");
+        vdj_destroy(v);
+        return 1;
+    }
+    if ( vdj_init_status_thread(v) != CDJ_OK ) {
+        fprintf(stderr, "error: init status thread\n");
+        vdj_destroy(v);
+        return 1;
+    }
+
+    // paused until -b or a client says play
+    if ( vdj_init_beatout_thread(v) != CDJ_OK ) {
+        fprintf(stderr, "error: init beatout thread\n");
+        vdj_destroy(v);
+        return 1;
+    }
+    if (bpm > 0.0) vdj_start_beatout_thread(v);
+
+    signal(SIGINT, signal_exit);
+    signal(SIGTERM, signal_exit);
+    printf("vdjd: player %02i listening on %s\n", v->player_id, path);
+    fflush(stdout);
+
+    while (running) {
+        sleep(1);
+        if (++seconds % 60 == 0) {
+            printf("vdjd: %d clients, %llu dropped for falling behind\n",
+                vdj_daemon_clients(), (unsigned long long) vdj_daemon_dropped());
+            fflush(stdout);
+        }
+    }
+
+    // removes the socket
+    vdj_stop_daemon_thread(v);
+    vdj_thread_join(v, VDJ_THREAD_DAEMON);
+    vdj_series_close();
+    // still mapped by the link threads, the kernel writes the pages back when we exit
+    return 0;
+}
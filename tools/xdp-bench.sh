@@ -0,0 +1,41 @@
+#!/bin/bash
+#
+# Compare beat packet arrival to callback latency, recv() vs busy polling vs AF_XDP, across a veth pair.
+# The sender runs in its own network namespace so packets really cross the veth.
+#
+# usage: sudo tools/xdp-bench.sh [count] [interval_us]
+#
+cd $(dirname $0)/..
+
+count=${1:-10000}
+interval=${2:-1000}
+ns=vdjbench
+bench=target/vdj-xdp-bench
+
+test -x $bench || make $bench || exit 1
+
+cleanup() {
+    ip link del vdjb0 2>/dev/null
+    ip netns del $ns 2>/dev/null
+}
+trap cleanup EXIT
+cleanup
+
+ip netns add $ns
+ip link add vdjb0 type veth peer name vdjb1
+ip link set vdjb1 netns $ns
+ip addr add 10.77.0.1/24 brd 10.77.0.255 dev vdjb0
+ip link set vdjb0 up
+ip netns exec $ns ip addr add 10.77.0.2/24 brd 10.77.0.255 dev vdjb1
+ip netns exec $ns ip link set vdjb1 up
+ip netns exec $ns ip link set lo up
+# let both links come up
+sleep 1
+
+for mode in "" "-B 1000000" "-x"; do
+    $bench -i vdjb0 $mode -n $count -t $(( count * interval / 1000000 + 10 )) &
+    receiver=$!
+    sleep 1
+    ip netns exec $ns $bench -i vdjb1 -s -n $count -u $interval
+    wait $receiver
+done